@@ -10,9 +10,12 @@
 //
 // -----------------------------------------------------------------------------
 
+#include <algorithm>
+#include <cmath>
 #include <ctime>
 #include <iostream>
 #include <numeric>
+#include <string>
 #include <vector>
 
 #include "TCanvas.h"
@@ -25,6 +28,8 @@
 #include "biodynamo.h"
 #include "core/util/log.h"
 #include "person.h"
+#include "plot-timeseries.h"
+#include "population-statistics.h"
 #include "sim-param.h"
 
 namespace bdm {
@@ -33,10 +38,549 @@ namespace hiv_malawi {
 using experimental::Counter;
 using experimental::GenericReducer;
 
+// Collectors are executed after all agents got one year older. This returns
+// the age of the person at that point, i.e. in the year following the current
+// simulation step.
+static int GetAgeAfterStep(Person* person) {
+  auto* sim = Simulation::GetActive();
+  int year = static_cast<int>(sim->GetParam()->Get<SimParam>()->start_year +
+                              sim->GetScheduler()->GetSimulatedSteps());
+  return person->GetAge(year + 1);
+}
+
+// Ids of the collectors registered by DefineAndRegisterCollectors
+static std::vector<std::string> collector_ids;
+
+// Collectors that are functions (nullptr otherwise), their sampling fractions
+// and the errors of their estimates in each collection, in the order of
+// collector_ids (see sampled_statistics)
+using CollectorFunction = double (*)(Simulation*);
+static std::vector<CollectorFunction> collector_functions;
+static std::vector<double> collector_fractions;
+static std::vector<std::vector<double>> collector_errors;
+
+// Series computed from the collected series when the time series are output
+struct DerivedSeries {
+  // Positions of the operands in collector_ids
+  std::vector<size_t> operands;
+  double (*evaluate)(const double* operands);
+};
+static std::vector<std::string> derived_ids;
+static std::vector<DerivedSeries> derived_series;
+
+// Adds collectors to a TimeSeries and records their ids in collector_ids
+class CollectorRegistry {
+ public:
+  explicit CollectorRegistry(experimental::TimeSeries* ts) : ts_(ts) {}
+
+  template <typename... TCollectors>
+  void AddCollector(const std::string& id, TCollectors... collectors) {
+    collector_ids.push_back(id);
+    collector_functions.push_back(nullptr);
+    ts_->AddCollector(id, collectors...);
+  }
+
+  void AddCollector(const std::string& id, CollectorFunction collector,
+                    CollectorFunction get_year) {
+    collector_ids.push_back(id);
+    collector_functions.push_back(collector);
+    ts_->AddCollector(id, collector, get_year);
+  }
+
+  // Adds a series that evaluate computes from the values of the collectors
+  // with the given ids. The ids are resolved once, here.
+  void AddDerived(const std::string& id,
+                  const std::vector<std::string>& operand_ids,
+                  double (*evaluate)(const double* operands)) {
+    DerivedSeries series;
+    series.evaluate = evaluate;
+    for (const auto& operand_id : operand_ids) {
+      auto it =
+          std::find(collector_ids.begin(), collector_ids.end(), operand_id);
+      if (it == collector_ids.end()) {
+        Log::Fatal("CollectorRegistry::AddDerived", "Series ", id,
+                   " depends on the unknown collector ", operand_id);
+      }
+      series.operands.push_back(it - collector_ids.begin());
+    }
+    derived_ids.push_back(id);
+    derived_series.push_back(series);
+  }
+
+ private:
+  experimental::TimeSeries* ts_;
+};
+
+const std::vector<std::string>& GetCollectorIds() { return collector_ids; }
+
+const std::vector<std::string>& GetDerivedSeriesIds() { return derived_ids; }
+
+void EvaluateDerivedSeries(const std::vector<double>& values,
+                           std::vector<double>* derived) {
+  derived->resize(derived_series.size());
+  std::vector<double> operands;
+  for (size_t d = 0; d < derived_series.size(); d++) {
+    const auto& series = derived_series[d];
+    operands.clear();
+    for (auto operand : series.operands) {
+      operands.push_back(values[operand]);
+    }
+    (*derived)[d] = series.evaluate(operands.data());
+  }
+}
+
+void AddDerivedSeries(experimental::TimeSeries* ts) {
+  if (collector_ids.empty()) {
+    return;
+  }
+  const auto x_values = ts->GetXValues(collector_ids[0]);
+  std::vector<std::vector<double>> y_values(derived_series.size());
+  std::vector<double> values(collector_ids.size());
+  std::vector<double> derived;
+  for (size_t i = 0; i < x_values.size(); i++) {
+    for (size_t c = 0; c < collector_ids.size(); c++) {
+      values[c] = ts->GetYValues(collector_ids[c])[i];
+    }
+    EvaluateDerivedSeries(values, &derived);
+    for (size_t d = 0; d < derived.size(); d++) {
+      y_values[d].push_back(derived[d]);
+    }
+  }
+  for (size_t d = 0; d < derived_series.size(); d++) {
+    ts->Add(derived_ids[d], x_values, y_values[d]);
+  }
+}
+
+bool IsCollectionIteration(const SimParam* sparam, uint64_t iteration,
+                           int year) {
+  const auto& years = sparam->collection_years;
+  if (!years.empty()) {
+    return std::find(years.begin(), years.end(), year) != years.end();
+  }
+  return iteration % std::max<uint64_t>(sparam->collection_interval, 1) == 0;
+}
+
+// Selection of the population histogram as a type, such that the collectors
+// derived from the histogram are plain functions
+using Bins = PopulationHistogram::Bins;
+static constexpr Bins kAllBins = PopulationHistogram::kAll;
+
+template <Bins kStates = kAllBins, Bins kSexes = kAllBins,
+          Bins kAgeBands = kAllBins, Bins kSociobehaviours = kAllBins,
+          Bins kTransmissionTypes = kAllBins>
+struct Select {
+  static PopulationHistogram::Selection Get() {
+    PopulationHistogram::Selection selection;
+    selection.states = kStates;
+    selection.sexes = kSexes;
+    selection.age_bands = kAgeBands;
+    selection.sociobehaviours = kSociobehaviours;
+    selection.transmission_types = kTransmissionTypes;
+    return selection;
+  }
+};
+
+// Estimates the value of a collector from the sample of its sampling
+// fraction, and records the error of the estimate
+template <typename TEstimator>
+static double EstimateCollector(CollectorFunction collector,
+                                TEstimator estimator) {
+  for (size_t i = 0; i < collector_functions.size(); i++) {
+    if (collector_functions[i] == collector) {
+      auto estimate = estimator(SampledStatistics::GetInstance(),
+                                collector_fractions[i]);
+      collector_errors[i].push_back(estimate.error);
+      return estimate.value;
+    }
+  }
+  Log::Fatal("EstimateCollector", "The collector is not registered");
+  return 0;
+}
+
+// Number of persons in the selection
+template <typename TSelection>
+static double CountPersons(Simulation* sim) {
+  if (SampledStatistics::IsEnabled()) {
+    return EstimateCollector(
+        CountPersons<TSelection>,
+        [](SampledStatistics* sampled, double fraction) {
+          return sampled->Count(TSelection::Get(), fraction);
+        });
+  }
+  return GetPopulationHistogram().Count(TSelection::Get());
+}
+
+// Sum of the casual partners of the persons in the selection
+template <typename TSelection>
+static double SumCasualPartners(Simulation* sim) {
+  if (SampledStatistics::IsEnabled()) {
+    return EstimateCollector(
+        SumCasualPartners<TSelection>,
+        [](SampledStatistics* sampled, double fraction) {
+          return sampled->SumCasualPartners(TSelection::Get(), fraction);
+        });
+  }
+  return GetPopulationHistogram().SumCasualPartners(TSelection::Get());
+}
+
+// Number of acute persons by the state and the sociobehaviour of the person
+// who infected them (-1: any)
+template <int kOriginState, int kOriginSociobehaviour>
+static double CountAcuteByOrigin(Simulation* sim) {
+  if (SampledStatistics::IsEnabled()) {
+    return EstimateCollector(
+        CountAcuteByOrigin<kOriginState, kOriginSociobehaviour>,
+        [](SampledStatistics* sampled, double fraction) {
+          return sampled->CountAcuteByOrigin(
+              kOriginState, kOriginSociobehaviour, fraction);
+        });
+  }
+  return GetPopulationHistogram().CountAcuteByOrigin(kOriginState,
+                                                     kOriginSociobehaviour);
+}
+
+// Attaches the errors of the estimated collectors to their series, such that
+// data.json holds the confidence intervals
+static void AddEstimateErrors(experimental::TimeSeries* ts) {
+  bool estimated = false;
+  for (const auto& errors : collector_errors) {
+    estimated = estimated || !errors.empty();
+  }
+  if (!estimated) {
+    return;
+  }
+  experimental::TimeSeries with_errors;
+  for (size_t i = 0; i < collector_ids.size(); i++) {
+    const auto& id = collector_ids[i];
+    const auto& x_values = ts->GetXValues(id);
+    const auto& y_values = ts->GetYValues(id);
+    if (collector_errors[i].empty()) {
+      with_errors.Add(id, x_values, y_values);
+      continue;
+    }
+    // Values restored from a checkpoint have no errors
+    std::vector<double> errors(x_values.size() - collector_errors[i].size(),
+                               0.0);
+    errors.insert(errors.end(), collector_errors[i].begin(),
+                  collector_errors[i].end());
+    with_errors.Add(id, x_values, y_values, errors, errors);
+  }
+  *ts = std::move(with_errors);
+}
+
+// Registers the collectors of DefineAndRegisterCollectors, with the same ids
+// and in the same order, but derived from the population histogram
+static void DefineFusedCollectors(CollectorRegistry* ts,
+                                  double (*get_year)(Simulation*)) {
+  constexpr Bins kHealthyState = PopulationHistogram::Bin(GemsState::kHealthy);
+  constexpr Bins kInfectedStates = kAllBins & ~kHealthyState;
+  constexpr Bins kAcuteState = PopulationHistogram::Bin(GemsState::kAcute);
+  constexpr Bins kMale = PopulationHistogram::Bin(Sex::kMale);
+  constexpr Bins kFemale = PopulationHistogram::Bin(Sex::kFemale);
+  constexpr Bins k15To49 =
+      PopulationHistogram::Bin(PopulationHistogram::k15To49);
+  constexpr Bins kAdult =
+      k15To49 | PopulationHistogram::Bin(PopulationHistogram::k50AndOlder);
+  constexpr Bins kLowSb = PopulationHistogram::Bin(0);
+  constexpr Bins kHighSb = PopulationHistogram::Bin(1);
+  constexpr Bins kMtct =
+      PopulationHistogram::Bin(TransmissionType::kMotherToChild);
+  constexpr Bins kCasual =
+      PopulationHistogram::Bin(TransmissionType::kCasualPartner);
+  constexpr Bins kRegular =
+      PopulationHistogram::Bin(TransmissionType::kRegularPartner);
+
+  using Healthy = Select<kHealthyState>;
+  using Infected = Select<kInfectedStates>;
+  using Acute = Select<kAcuteState>;
+
+  ts->AddCollector("healthy_agents", CountPersons<Healthy>, get_year);
+  ts->AddCollector("infected_agents", CountPersons<Infected>, get_year);
+  ts->AddCollector("acute_agents", CountPersons<Acute>, get_year);
+  ts->AddCollector("acute_male_agents",
+                   CountPersons<Select<kAcuteState, kMale>>, get_year);
+  ts->AddCollector(
+      "acute_male_low_sb_agents",
+      CountPersons<Select<kAcuteState, kMale, kAllBins, kLowSb>>, get_year);
+  ts->AddCollector(
+      "acute_male_high_sb_agents",
+      CountPersons<Select<kAcuteState, kMale, kAllBins, kHighSb>>, get_year);
+  ts->AddCollector("acute_female_agents",
+                   CountPersons<Select<kAcuteState, kFemale>>, get_year);
+  ts->AddCollector(
+      "acute_female_low_sb_agents",
+      CountPersons<Select<kAcuteState, kFemale, kAllBins, kLowSb>>, get_year);
+  ts->AddCollector(
+      "acute_female_high_sb_agents",
+      CountPersons<Select<kAcuteState, kFemale, kAllBins, kHighSb>>,
+      get_year);
+  ts->AddCollector(
+      "chronic_agents",
+      CountPersons<Select<PopulationHistogram::Bin(GemsState::kChronic)>>,
+      get_year);
+  ts->AddCollector(
+      "treated_agents",
+      CountPersons<Select<PopulationHistogram::Bin(GemsState::kTreated)>>,
+      get_year);
+  ts->AddCollector(
+      "failing_agents",
+      CountPersons<Select<PopulationHistogram::Bin(GemsState::kFailing)>>,
+      get_year);
+
+  // Acute persons by transmission type
+  using Mtct = Select<kAcuteState, kAllBins, kAllBins, kAllBins, kMtct>;
+  using MtctMale = Select<kAcuteState, kMale, kAllBins, kAllBins, kMtct>;
+  using MtctFemale = Select<kAcuteState, kFemale, kAllBins, kAllBins, kMtct>;
+  using Casual = Select<kAcuteState, kAllBins, kAllBins, kAllBins, kCasual>;
+  using CasualMale = Select<kAcuteState, kMale, kAllBins, kAllBins, kCasual>;
+  using CasualFemale =
+      Select<kAcuteState, kFemale, kAllBins, kAllBins, kCasual>;
+  using Regular = Select<kAcuteState, kAllBins, kAllBins, kAllBins, kRegular>;
+  using RegularMale = Select<kAcuteState, kMale, kAllBins, kAllBins, kRegular>;
+  using RegularFemale =
+      Select<kAcuteState, kFemale, kAllBins, kAllBins, kRegular>;
+  ts->AddCollector("mtct_agents", CountPersons<Mtct>, get_year);
+  ts->AddCollector("mtct_transmission_to_male", CountPersons<MtctMale>,
+                   get_year);
+  ts->AddCollector("mtct_transmission_to_female", CountPersons<MtctFemale>,
+                   get_year);
+  ts->AddCollector("casual_transmission_agents", CountPersons<Casual>,
+                   get_year);
+  ts->AddCollector("casual_transmission_to_male", CountPersons<CasualMale>,
+                   get_year);
+  ts->AddCollector("casual_transmission_to_female",
+                   CountPersons<CasualFemale>, get_year);
+  ts->AddCollector("regular_transmission_agents", CountPersons<Regular>,
+                   get_year);
+  ts->AddCollector("regular_transmission_to_male", CountPersons<RegularMale>,
+                   get_year);
+  ts->AddCollector("regular_transmission_to_female",
+                   CountPersons<RegularFemale>, get_year);
+
+  // Acute persons by the state and the sociobehaviour of their origin
+  ts->AddCollector("acute_transmission",
+                   CountAcuteByOrigin<GemsState::kAcute, -1>, get_year);
+  ts->AddCollector("chronic_transmission",
+                   CountAcuteByOrigin<GemsState::kChronic, -1>, get_year);
+  ts->AddCollector("treated_transmission",
+                   CountAcuteByOrigin<GemsState::kTreated, -1>, get_year);
+  ts->AddCollector("failing_transmission",
+                   CountAcuteByOrigin<GemsState::kFailing, -1>, get_year);
+  ts->AddCollector("low_sb_transmission", CountAcuteByOrigin<-1, 0>,
+                   get_year);
+  ts->AddCollector("high_sb_transmission", CountAcuteByOrigin<-1, 1>,
+                   get_year);
+
+  // Casual partners of persons aged 15 to 49
+  using MenLowSb = Select<kAllBins, kMale, k15To49, kLowSb>;
+  using MenHighSb = Select<kAllBins, kMale, k15To49, kHighSb>;
+  using WomenLowSb = Select<kAllBins, kFemale, k15To49, kLowSb>;
+  using WomenHighSb = Select<kAllBins, kFemale, k15To49, kHighSb>;
+  using HivWomenHighSb = Select<kInfectedStates, kFemale, k15To49, kHighSb>;
+  using HivWomenLowSb = Select<kInfectedStates, kFemale, k15To49, kLowSb>;
+  using HivMenHighSb = Select<kInfectedStates, kMale, k15To49, kHighSb>;
+  using HivMenLowSb = Select<kInfectedStates, kMale, k15To49, kLowSb>;
+  ts->AddCollector("adult_male_age_lt50_low_sb", CountPersons<MenLowSb>,
+                   get_year);
+  ts->AddCollector("total_nocas_men_low_sb", SumCasualPartners<MenLowSb>,
+                   get_year);
+  ts->AddCollector("adult_male_age_lt50_high_sb", CountPersons<MenHighSb>,
+                   get_year);
+  ts->AddCollector("total_nocas_men_high_sb", SumCasualPartners<MenHighSb>,
+                   get_year);
+  ts->AddCollector("adult_female_age_lt50_low_sb", CountPersons<WomenLowSb>,
+                   get_year);
+  ts->AddCollector("total_nocas_women_low_sb", SumCasualPartners<WomenLowSb>,
+                   get_year);
+  ts->AddCollector("adult_female_age_lt50_high_sb",
+                   CountPersons<WomenHighSb>, get_year);
+  ts->AddCollector("total_nocas_women_high_sb",
+                   SumCasualPartners<WomenHighSb>, get_year);
+  ts->AddCollector("adult_hiv_female_age_lt50_high_sb",
+                   CountPersons<HivWomenHighSb>, get_year);
+  ts->AddCollector("total_nocas_hiv_women_high_sb",
+                   SumCasualPartners<HivWomenHighSb>, get_year);
+  ts->AddCollector("adult_hiv_female_age_lt50_low_sb",
+                   CountPersons<HivWomenLowSb>, get_year);
+  ts->AddCollector("total_nocas_hiv_women_low_sb",
+                   SumCasualPartners<HivWomenLowSb>, get_year);
+  ts->AddCollector("adult_hiv_male_age_lt50_high_sb",
+                   CountPersons<HivMenHighSb>, get_year);
+  ts->AddCollector("total_nocas_hiv_men_high_sb",
+                   SumCasualPartners<HivMenHighSb>, get_year);
+  ts->AddCollector("adult_hiv_male_age_lt50_low_sb",
+                   CountPersons<HivMenLowSb>, get_year);
+  ts->AddCollector("total_nocas_hiv_men_low_sb",
+                   SumCasualPartners<HivMenLowSb>, get_year);
+
+  // Prevalence and incidence
+  using Infected15To49 = Select<kInfectedStates, kAllBins, k15To49>;
+  using All15To49 = Select<kAllBins, kAllBins, k15To49>;
+  using InfectedFemales = Select<kInfectedStates, kFemale>;
+  using Females = Select<kAllBins, kFemale>;
+  using InfectedWomen15To49 = Select<kInfectedStates, kFemale, k15To49>;
+  using Women15To49 = Select<kAllBins, kFemale, k15To49>;
+  using InfectedMales = Select<kInfectedStates, kMale>;
+  using Males = Select<kAllBins, kMale>;
+  using InfectedMen15To49 = Select<kInfectedStates, kMale, k15To49>;
+  using Men15To49 = Select<kAllBins, kMale, k15To49>;
+  ts->AddCollector("infected_15_49", CountPersons<Infected15To49>, get_year);
+  ts->AddCollector("all_15_49", CountPersons<All15To49>, get_year);
+  ts->AddCollector("infected_females", CountPersons<InfectedFemales>,
+                   get_year);
+  ts->AddCollector("females", CountPersons<Females>, get_year);
+  ts->AddCollector("infected_women_15_49", CountPersons<InfectedWomen15To49>,
+                   get_year);
+  ts->AddCollector("women_15_49", CountPersons<Women15To49>, get_year);
+  ts->AddCollector("infected_males", CountPersons<InfectedMales>, get_year);
+  ts->AddCollector("males", CountPersons<Males>, get_year);
+  ts->AddCollector("infected_men_15_49", CountPersons<InfectedMen15To49>,
+                   get_year);
+  ts->AddCollector("men_15_49", CountPersons<Men15To49>, get_year);
+
+  // Sociobehaviours of infected and healthy persons
+  using HighRiskHiv = Select<kInfectedStates, kAllBins, kAllBins, kHighSb>;
+  using LowRiskHiv = Select<kInfectedStates, kAllBins, kAllBins, kLowSb>;
+  using HighRiskHealthy = Select<kHealthyState, kAllBins, kAllBins, kHighSb>;
+  using LowRiskHealthy = Select<kHealthyState, kAllBins, kAllBins, kLowSb>;
+  ts->AddCollector("high_risk_hiv", CountPersons<HighRiskHiv>, get_year);
+  ts->AddCollector("low_risk_hiv", CountPersons<LowRiskHiv>, get_year);
+  ts->AddCollector("high_risk_healthy", CountPersons<HighRiskHealthy>,
+                   get_year);
+  ts->AddCollector("low_risk_healthy", CountPersons<LowRiskHealthy>,
+                   get_year);
+
+  // Sociobehaviours of infected and healthy adults by sex
+  using HighRiskHivWomen = Select<kInfectedStates, kFemale, kAdult, kHighSb>;
+  using LowRiskHivWomen = Select<kInfectedStates, kFemale, kAdult, kLowSb>;
+  using HivWomen = Select<kInfectedStates, kFemale, kAdult>;
+  using HighRiskHivMen = Select<kInfectedStates, kMale, kAdult, kHighSb>;
+  using LowRiskHivMen = Select<kInfectedStates, kMale, kAdult, kLowSb>;
+  using HivMen = Select<kInfectedStates, kMale, kAdult>;
+  using HighRiskHealthyWomen = Select<kHealthyState, kFemale, kAdult, kHighSb>;
+  using LowRiskHealthyWomen = Select<kHealthyState, kFemale, kAdult, kLowSb>;
+  using HealthyWomen = Select<kHealthyState, kFemale, kAdult>;
+  using HighRiskHealthyMen = Select<kHealthyState, kMale, kAdult, kHighSb>;
+  using LowRiskHealthyMen = Select<kHealthyState, kMale, kAdult, kLowSb>;
+  using HealthyMen = Select<kHealthyState, kMale, kAdult>;
+  ts->AddCollector("high_risk_hiv_women", CountPersons<HighRiskHivWomen>,
+                   get_year);
+  ts->AddCollector("hiv_women", CountPersons<HivWomen>, get_year);
+  ts->AddCollector("low_risk_hiv_women", CountPersons<LowRiskHivWomen>,
+                   get_year);
+  ts->AddCollector("high_risk_hiv_men", CountPersons<HighRiskHivMen>,
+                   get_year);
+  ts->AddCollector("hiv_men", CountPersons<HivMen>, get_year);
+  ts->AddCollector("low_risk_hiv_men", CountPersons<LowRiskHivMen>, get_year);
+  ts->AddCollector("high_risk_healthy_women",
+                   CountPersons<HighRiskHealthyWomen>, get_year);
+  ts->AddCollector("healthy_women", CountPersons<HealthyWomen>, get_year);
+  ts->AddCollector("low_risk_healthy_women",
+                   CountPersons<LowRiskHealthyWomen>, get_year);
+  ts->AddCollector("high_risk_healthy_men", CountPersons<HighRiskHealthyMen>,
+                   get_year);
+  ts->AddCollector("healthy_men", CountPersons<HealthyMen>, get_year);
+  ts->AddCollector("low_risk_healthy_men", CountPersons<LowRiskHealthyMen>,
+                   get_year);
+}
+
+// Evaluation of derived series from their operands
+static double Ratio(const double* operands) {
+  return operands[0] / operands[1];
+}
+static double RatioToSum(const double* operands) {
+  return operands[0] / (operands[1] + operands[2]);
+}
+
+// Registers the series that are derived from the collectors, which are the
+// same for the individual and the fused collectors
+static void DefineDerivedSeries(CollectorRegistry* ts) {
+  // Mean number of casual partners of persons aged 15 to 49
+  ts->AddDerived("mean_nocas_men_low_sb",
+                 {"total_nocas_men_low_sb", "adult_male_age_lt50_low_sb"},
+                 Ratio);
+  ts->AddDerived("mean_nocas_men_high_sb",
+                 {"total_nocas_men_high_sb", "adult_male_age_lt50_high_sb"},
+                 Ratio);
+  ts->AddDerived("mean_nocas_women_low_sb",
+                 {"total_nocas_women_low_sb", "adult_female_age_lt50_low_sb"},
+                 Ratio);
+  ts->AddDerived(
+      "mean_nocas_women_high_sb",
+      {"total_nocas_women_high_sb", "adult_female_age_lt50_high_sb"}, Ratio);
+  ts->AddDerived(
+      "mean_nocas_hiv_women_high_sb",
+      {"total_nocas_hiv_women_high_sb", "adult_hiv_female_age_lt50_high_sb"},
+      Ratio);
+  ts->AddDerived(
+      "mean_nocas_hiv_women_low_sb",
+      {"total_nocas_hiv_women_low_sb", "adult_hiv_female_age_lt50_low_sb"},
+      Ratio);
+  ts->AddDerived(
+      "mean_nocas_hiv_men_high_sb",
+      {"total_nocas_hiv_men_high_sb", "adult_hiv_male_age_lt50_high_sb"},
+      Ratio);
+  ts->AddDerived(
+      "mean_nocas_hiv_men_low_sb",
+      {"total_nocas_hiv_men_low_sb", "adult_hiv_male_age_lt50_low_sb"},
+      Ratio);
+
+  // Prevalence and incidence. Every agent is either healthy or infected, such
+  // that their sum is the number of agents.
+  ts->AddDerived("prevalence",
+                 {"infected_agents", "healthy_agents", "infected_agents"},
+                 RatioToSum);
+  ts->AddDerived("prevalence_15_49", {"infected_15_49", "all_15_49"}, Ratio);
+  ts->AddDerived("prevalence_females", {"infected_females", "females"},
+                 Ratio);
+  ts->AddDerived("prevalence_women_15_49",
+                 {"infected_women_15_49", "women_15_49"}, Ratio);
+  ts->AddDerived("prevalence_males", {"infected_males", "males"}, Ratio);
+  ts->AddDerived("prevalence_men_15_49", {"infected_men_15_49", "men_15_49"},
+                 Ratio);
+  ts->AddDerived("incidence",
+                 {"acute_agents", "healthy_agents", "infected_agents"},
+                 RatioToSum);
+
+  // Sociobehaviours of infected and healthy persons
+  ts->AddDerived("high_risk_sb_hiv", {"high_risk_hiv", "infected_agents"},
+                 Ratio);
+  ts->AddDerived("low_risk_sb_hiv", {"low_risk_hiv", "infected_agents"},
+                 Ratio);
+  ts->AddDerived("high_risk_sb_healthy",
+                 {"high_risk_healthy", "healthy_agents"}, Ratio);
+  ts->AddDerived("low_risk_sb_healthy", {"low_risk_healthy", "healthy_agents"},
+                 Ratio);
+
+  // Sociobehaviours of infected and healthy adults by sex
+  ts->AddDerived("high_risk_sb_hiv_women",
+                 {"high_risk_hiv_women", "hiv_women"}, Ratio);
+  ts->AddDerived("low_risk_sb_hiv_women", {"low_risk_hiv_women", "hiv_women"},
+                 Ratio);
+  ts->AddDerived("high_risk_sb_hiv_men", {"high_risk_hiv_men", "hiv_men"},
+                 Ratio);
+  ts->AddDerived("low_risk_sb_hiv_men", {"low_risk_hiv_men", "hiv_men"},
+                 Ratio);
+  ts->AddDerived("high_risk_sb_healthy_women",
+                 {"high_risk_healthy_women", "healthy_women"}, Ratio);
+  ts->AddDerived("low_risk_sb_healthy_women",
+                 {"low_risk_healthy_women", "healthy_women"}, Ratio);
+  ts->AddDerived("high_risk_sb_healthy_men",
+                 {"high_risk_healthy_men", "healthy_men"}, Ratio);
+  ts->AddDerived("low_risk_sb_healthy_men",
+                 {"low_risk_healthy_men", "healthy_men"}, Ratio);
+}
+
 void DefineAndRegisterCollectors() {
   // Get population statistics, i.e. extract data from simulation
-  // Get the pointer to the TimeSeries
-  auto* ts = Simulation::GetActive()->GetTimeSeries();
+  // Get the pointer to the TimeSeries, through which the ids of the
+  // collectors are recorded
+  collector_ids.clear();
+  collector_functions.clear();
+  derived_ids.clear();
+  derived_series.clear();
+  CollectorRegistry registry(Simulation::GetActive()->GetTimeSeries());
+  auto* ts = &registry;
 
   // Define how to get the time values of the TimeSeries
   auto get_year = [](Simulation* sim) {
@@ -47,6 +591,31 @@ void DefineAndRegisterCollectors() {
                                sim->GetScheduler()->GetSimulatedSteps());
   };
 
+  // Derive all series from one sweep over the population per iteration, or
+  // from the events of the iteration
+  const auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
+  IncrementalStatistics::GetInstance()->Reset(sparam->incremental_statistics);
+  bool sampled = sparam->sampled_statistics;
+  if (sparam->fused_statistics || sparam->incremental_statistics || sampled) {
+    DefineFusedCollectors(&registry, get_year);
+    DefineDerivedSeries(&registry);
+
+    // Sampling fraction of each collector, or the default
+    collector_fractions.clear();
+    for (const auto& id : collector_ids) {
+      auto it = sparam->collector_sampling_fractions.find(id);
+      collector_fractions.push_back(
+          it != sparam->collector_sampling_fractions.end()
+              ? it->second
+              : sparam->sampling_fraction);
+    }
+    collector_errors.assign(collector_ids.size(), {});
+    SampledStatistics::GetInstance()->Reset(sampled, collector_fractions);
+    return;
+  }
+  SampledStatistics::GetInstance()->Reset(false, {});
+  collector_errors.clear();
+
   // Define how to count the healthy individuals
   auto healthy = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
@@ -279,7 +848,8 @@ void DefineAndRegisterCollectors() {
   // behavior
   auto adult_male_age_lt50_low_sb = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return (person->IsMale() && person->IsAdult() && person->age_ < 50 &&
+    int age = GetAgeAfterStep(person);
+    return (person->IsMale() && age >= 15 && age < 50 &&
             person->HasLowRiskSocioBehav());
   };
   ts->AddCollector("adult_male_age_lt50_low_sb",
@@ -302,14 +872,6 @@ void DefineAndRegisterCollectors() {
                                            adult_male_age_lt50_low_sb),
       get_year);
 
-  auto mean_nocas_men_low_sb = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto num_casual = ts->GetYValues("total_nocas_men_low_sb").back();
-    auto agents = ts->GetYValues("adult_male_age_lt50_low_sb").back();
-    return num_casual / agents;
-  };
-  ts->AddCollector("mean_nocas_men_low_sb", mean_nocas_men_low_sb, get_year);
-
   // Define how to compute mean number of casual partners for males with
   // high-risk sociobehaviours
   //
@@ -317,7 +879,8 @@ void DefineAndRegisterCollectors() {
   // behavior
   auto adult_male_age_lt50_high_sb = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return (person->IsMale() && person->IsAdult() && person->age_ < 50 &&
+    int age = GetAgeAfterStep(person);
+    return (person->IsMale() && age >= 15 && age < 50 &&
             person->HasHighRiskSocioBehav());
   };
   ts->AddCollector("adult_male_age_lt50_high_sb",
@@ -330,14 +893,6 @@ void DefineAndRegisterCollectors() {
                                            adult_male_age_lt50_high_sb),
       get_year);
 
-  auto mean_nocas_men_high_sb = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto num_casual = ts->GetYValues("total_nocas_men_high_sb").back();
-    auto agents = ts->GetYValues("adult_male_age_lt50_high_sb").back();
-    return num_casual / agents;
-  };
-  ts->AddCollector("mean_nocas_men_high_sb", mean_nocas_men_high_sb, get_year);
-
   // Define how to compute mean number of casual partners for females with
   // low-risk sociobehaviours
   //
@@ -345,7 +900,8 @@ void DefineAndRegisterCollectors() {
   // behavior
   auto adult_female_age_lt50_low_sb = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return (person->IsFemale() && person->IsAdult() && person->age_ < 50 &&
+    int age = GetAgeAfterStep(person);
+    return (person->IsFemale() && age >= 15 && age < 50 &&
             person->HasLowRiskSocioBehav());
   };
   ts->AddCollector("adult_female_age_lt50_low_sb",
@@ -358,15 +914,6 @@ void DefineAndRegisterCollectors() {
                                            adult_female_age_lt50_low_sb),
       get_year);
 
-  auto mean_nocas_women_low_sb = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto num_casual = ts->GetYValues("total_nocas_women_low_sb").back();
-    auto agents = ts->GetYValues("adult_female_age_lt50_low_sb").back();
-    return num_casual / agents;
-  };
-  ts->AddCollector("mean_nocas_women_low_sb", mean_nocas_women_low_sb,
-                   get_year);
-
   // Define how to compute mean number of casual partners for females with
   // high-risk sociobehaviours
   //
@@ -374,7 +921,8 @@ void DefineAndRegisterCollectors() {
   // behavior
   auto adult_female_age_lt50_high_sb = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return (person->IsFemale() && person->IsAdult() && person->age_ < 50 &&
+    int age = GetAgeAfterStep(person);
+    return (person->IsFemale() && age >= 15 && age < 50 &&
             person->HasHighRiskSocioBehav());
   };
   ts->AddCollector("adult_female_age_lt50_high_sb",
@@ -388,15 +936,6 @@ void DefineAndRegisterCollectors() {
                                            adult_female_age_lt50_high_sb),
       get_year);
 
-  auto mean_nocas_women_high_sb = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto num_casual = ts->GetYValues("total_nocas_women_high_sb").back();
-    auto agents = ts->GetYValues("adult_female_age_lt50_high_sb").back();
-    return num_casual / agents;
-  };
-  ts->AddCollector("mean_nocas_women_high_sb", mean_nocas_women_high_sb,
-                   get_year);
-
   // AM: Define how to compute mean number of casual partners for HIV infected
   // females with high-risk sociobehaviours
   //
@@ -404,8 +943,9 @@ void DefineAndRegisterCollectors() {
   // risk social behavior
   auto adult_hiv_female_age_lt50_high_sb = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return (!person->IsHealthy() && person->IsFemale() && person->IsAdult() &&
-            person->age_ < 50 && person->HasHighRiskSocioBehav());
+    int age = GetAgeAfterStep(person);
+    return (!person->IsHealthy() && person->IsFemale() && age >= 15 &&
+            age < 50 && person->HasHighRiskSocioBehav());
   };
   ts->AddCollector("adult_hiv_female_age_lt50_high_sb",
                    new Counter<double>(adult_hiv_female_age_lt50_high_sb),
@@ -418,15 +958,6 @@ void DefineAndRegisterCollectors() {
                                            adult_hiv_female_age_lt50_high_sb),
       get_year);
 
-  auto mean_nocas_hiv_women_high_sb = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto num_casual = ts->GetYValues("total_nocas_hiv_women_high_sb").back();
-    auto agents = ts->GetYValues("adult_hiv_female_age_lt50_high_sb").back();
-    return num_casual / agents;
-  };
-  ts->AddCollector("mean_nocas_hiv_women_high_sb", mean_nocas_hiv_women_high_sb,
-                   get_year);
-
   // AM: Define how to compute mean number of casual partners for HIV infected
   // females with high-risk sociobehaviours
   //
@@ -434,8 +965,9 @@ void DefineAndRegisterCollectors() {
   // risk social behavior
   auto adult_hiv_female_age_lt50_low_sb = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return (!person->IsHealthy() && person->IsFemale() && person->IsAdult() &&
-            person->age_ < 50 && person->HasLowRiskSocioBehav());
+    int age = GetAgeAfterStep(person);
+    return (!person->IsHealthy() && person->IsFemale() && age >= 15 &&
+            age < 50 && person->HasLowRiskSocioBehav());
   };
   ts->AddCollector("adult_hiv_female_age_lt50_low_sb",
                    new Counter<double>(adult_hiv_female_age_lt50_low_sb),
@@ -448,15 +980,6 @@ void DefineAndRegisterCollectors() {
                                            adult_hiv_female_age_lt50_low_sb),
       get_year);
 
-  auto mean_nocas_hiv_women_low_sb = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto num_casual = ts->GetYValues("total_nocas_hiv_women_low_sb").back();
-    auto agents = ts->GetYValues("adult_hiv_female_age_lt50_low_sb").back();
-    return num_casual / agents;
-  };
-  ts->AddCollector("mean_nocas_hiv_women_low_sb", mean_nocas_hiv_women_low_sb,
-                   get_year);
-
   // AM: Define how to compute mean number of casual partners for HIV infected
   // males with high-risk sociobehaviours
   //
@@ -464,8 +987,9 @@ void DefineAndRegisterCollectors() {
   // social behavior
   auto adult_hiv_male_age_lt50_high_sb = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return (!person->IsHealthy() && person->IsMale() && person->IsAdult() &&
-            person->age_ < 50 && person->HasHighRiskSocioBehav());
+    int age = GetAgeAfterStep(person);
+    return (!person->IsHealthy() && person->IsMale() && age >= 15 && age < 50 &&
+            person->HasHighRiskSocioBehav());
   };
   ts->AddCollector("adult_hiv_male_age_lt50_high_sb",
                    new Counter<double>(adult_hiv_male_age_lt50_high_sb),
@@ -478,15 +1002,6 @@ void DefineAndRegisterCollectors() {
                                            adult_hiv_male_age_lt50_high_sb),
       get_year);
 
-  auto mean_nocas_hiv_men_high_sb = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto num_casual = ts->GetYValues("total_nocas_hiv_men_high_sb").back();
-    auto agents = ts->GetYValues("adult_hiv_male_age_lt50_high_sb").back();
-    return num_casual / agents;
-  };
-  ts->AddCollector("mean_nocas_hiv_men_high_sb", mean_nocas_hiv_men_high_sb,
-                   get_year);
-
   // AM: Define how to compute mean number of casual partners for HIV infected
   // males with low-risk sociobehaviours
   //
@@ -494,8 +1009,9 @@ void DefineAndRegisterCollectors() {
   // social behavior
   auto adult_hiv_male_age_lt50_low_sb = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return (!person->IsHealthy() && person->IsMale() && person->IsAdult() &&
-            person->age_ < 50 && person->HasLowRiskSocioBehav());
+    int age = GetAgeAfterStep(person);
+    return (!person->IsHealthy() && person->IsMale() && age >= 15 && age < 50 &&
+            person->HasLowRiskSocioBehav());
   };
   ts->AddCollector("adult_hiv_male_age_lt50_low_sb",
                    new Counter<double>(adult_hiv_male_age_lt50_low_sb),
@@ -508,45 +1024,22 @@ void DefineAndRegisterCollectors() {
                                            adult_hiv_male_age_lt50_low_sb),
       get_year);
 
-  auto mean_nocas_hiv_men_low_sb = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto num_casual = ts->GetYValues("total_nocas_hiv_men_low_sb").back();
-    auto agents = ts->GetYValues("adult_hiv_male_age_lt50_low_sb").back();
-    return num_casual / agents;
-  };
-  ts->AddCollector("mean_nocas_hiv_men_low_sb", mean_nocas_hiv_men_low_sb,
-                   get_year);
-
-  // AM: Define how to compute general prevalence
-  auto pct_prevalence = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto infected = ts->GetYValues("infected_agents").back();
-    return infected / sim->GetResourceManager()->GetNumAgents();
-  };
-  ts->AddCollector("prevalence", pct_prevalence, get_year);
-
   // AM: Define how to compute prevalence between 15 and 49 year olds
   auto infected_15_49 = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return !(person->IsHealthy()) && person->age_ >= 15 && person->age_ < 50;
+    int age = GetAgeAfterStep(person);
+    return !(person->IsHealthy()) && age >= 15 && age < 50;
   };
   ts->AddCollector("infected_15_49", new Counter<double>(infected_15_49),
                    get_year);
 
   auto all_15_49 = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return person->age_ >= 15 && person->age_ < 50;
+    int age = GetAgeAfterStep(person);
+    return age >= 15 && age < 50;
   };
   ts->AddCollector("all_15_49", new Counter<double>(all_15_49), get_year);
 
-  auto pct_prevalence_15_49 = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto infected = ts->GetYValues("infected_15_49").back();
-    auto all = ts->GetYValues("all_15_49").back();
-    return infected / all;
-  };
-  ts->AddCollector("prevalence_15_49", pct_prevalence_15_49, get_year);
-
   // AM: Define how to compute prevalence among women
   auto infected_females = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
@@ -561,38 +1054,23 @@ void DefineAndRegisterCollectors() {
   };
   ts->AddCollector("females", new Counter<double>(females), get_year);
 
-  auto pct_prevalence_females = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto infected = ts->GetYValues("infected_females").back();
-    auto all = ts->GetYValues("females").back();
-    return infected / all;
-  };
-  ts->AddCollector("prevalence_females", pct_prevalence_females, get_year);
-
   // AM: Define how to compute prevalence among women between 15 and 49
   auto infected_women_15_49 = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return !(person->IsHealthy()) && person->IsFemale() && person->age_ >= 15 &&
-           person->age_ < 50;
+    int age = GetAgeAfterStep(person);
+    return !(person->IsHealthy()) && person->IsFemale() && age >= 15 &&
+           age < 50;
   };
   ts->AddCollector("infected_women_15_49",
                    new Counter<double>(infected_women_15_49), get_year);
 
   auto women_15_49 = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return person->IsFemale() && person->age_ >= 15 && person->age_ < 50;
+    int age = GetAgeAfterStep(person);
+    return person->IsFemale() && age >= 15 && age < 50;
   };
   ts->AddCollector("women_15_49", new Counter<double>(women_15_49), get_year);
 
-  auto pct_prevalence_women_15_49 = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto infected = ts->GetYValues("infected_women_15_49").back();
-    auto all = ts->GetYValues("women_15_49").back();
-    return infected / all;
-  };
-  ts->AddCollector("prevalence_women_15_49", pct_prevalence_women_15_49,
-                   get_year);
-
   // AM: Define how to compute prevalence among men
   auto infected_males = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
@@ -607,45 +1085,22 @@ void DefineAndRegisterCollectors() {
   };
   ts->AddCollector("males", new Counter<double>(males), get_year);
 
-  auto pct_prevalence_males = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto infected = ts->GetYValues("infected_males").back();
-    auto all = ts->GetYValues("males").back();
-    return infected / all;
-  };
-  ts->AddCollector("prevalence_males", pct_prevalence_males, get_year);
-
   // AM: Define how to compute prevalence among men between 15 and 49
   auto infected_men_15_49 = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return !(person->IsHealthy()) && person->IsMale() && person->age_ >= 15 &&
-           person->age_ < 50;
+    int age = GetAgeAfterStep(person);
+    return !(person->IsHealthy()) && person->IsMale() && age >= 15 && age < 50;
   };
   ts->AddCollector("infected_men_15_49",
                    new Counter<double>(infected_men_15_49), get_year);
 
   auto men_15_49 = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return person->IsMale() && person->age_ >= 15 && person->age_ < 50;
+    int age = GetAgeAfterStep(person);
+    return person->IsMale() && age >= 15 && age < 50;
   };
   ts->AddCollector("men_15_49", new Counter<double>(men_15_49), get_year);
 
-  auto pct_prevalence_men_15_49 = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto infected = ts->GetYValues("infected_men_15_49").back();
-    auto all = ts->GetYValues("men_15_49").back();
-    return infected / all;
-  };
-  ts->AddCollector("prevalence_men_15_49", pct_prevalence_men_15_49, get_year);
-
-  // AM: Define how to compute general incidence
-  auto pct_incidence = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto acute = ts->GetYValues("acute_agents").back();
-    return acute / sim->GetResourceManager()->GetNumAgents();
-  };
-  ts->AddCollector("incidence", pct_incidence, get_year);
-
   // AM: Define how to compute proportion of people with high-risk
   // socio-beahviours among hiv+
   auto high_risk_hiv = [](Agent* a) {
@@ -655,14 +1110,6 @@ void DefineAndRegisterCollectors() {
   ts->AddCollector("high_risk_hiv", new Counter<double>(high_risk_hiv),
                    get_year);
 
-  auto pct_high_risk_hiv = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto high_risk_hiv = ts->GetYValues("high_risk_hiv").back();
-    auto infected = ts->GetYValues("infected_agents").back();
-    return high_risk_hiv / infected;
-  };
-  ts->AddCollector("high_risk_sb_hiv", pct_high_risk_hiv, get_year);
-
   // AM: Define how to compute proportion of people with low-risk
   // socio-beahviours among hiv+
   auto low_risk_hiv = [](Agent* a) {
@@ -671,14 +1118,6 @@ void DefineAndRegisterCollectors() {
   };
   ts->AddCollector("low_risk_hiv", new Counter<double>(low_risk_hiv), get_year);
 
-  auto pct_low_risk_hiv = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto low_risk_hiv = ts->GetYValues("low_risk_hiv").back();
-    auto infected = ts->GetYValues("infected_agents").back();
-    return low_risk_hiv / infected;
-  };
-  ts->AddCollector("low_risk_sb_hiv", pct_low_risk_hiv, get_year);
-
   // AM: Define how to compute proportion of people with high-risk
   // socio-beahviours among healthy
   auto high_risk_healthy = [](Agent* a) {
@@ -688,14 +1127,6 @@ void DefineAndRegisterCollectors() {
   ts->AddCollector("high_risk_healthy", new Counter<double>(high_risk_healthy),
                    get_year);
 
-  auto pct_high_risk_healthy = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto high_risk_healthy = ts->GetYValues("high_risk_healthy").back();
-    auto healthy = ts->GetYValues("healthy_agents").back();
-    return high_risk_healthy / healthy;
-  };
-  ts->AddCollector("high_risk_sb_healthy", pct_high_risk_healthy, get_year);
-
   // AM: Define how to compute proportion of people with low-risk
   // socio-beahviours among healthy
   auto low_risk_healthy = [](Agent* a) {
@@ -705,178 +1136,164 @@ void DefineAndRegisterCollectors() {
   ts->AddCollector("low_risk_healthy", new Counter<double>(low_risk_healthy),
                    get_year);
 
-  auto pct_low_risk_healthy = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    auto low_risk_healthy = ts->GetYValues("low_risk_healthy").back();
-    auto healthy = ts->GetYValues("healthy_agents").back();
-    return low_risk_healthy / healthy;
-  };
-  ts->AddCollector("low_risk_sb_healthy", pct_low_risk_healthy, get_year);
-
   // AM: Define how to compute proportion of high-risk socio-beahviours among
   // hiv adult women
   auto high_risk_hiv_women = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
+    int age = GetAgeAfterStep(person);
     return person->HasHighRiskSocioBehav() and !(person->IsHealthy()) and
-           person->IsAdult() and person->IsFemale();
+           age >= 15 and person->IsFemale();
   };
   ts->AddCollector("high_risk_hiv_women",
                    new Counter<double>(high_risk_hiv_women), get_year);
 
   auto hiv_women = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return !(person->IsHealthy()) and person->IsAdult() and person->IsFemale();
+    int age = GetAgeAfterStep(person);
+    return !(person->IsHealthy()) and age >= 15 and person->IsFemale();
   };
   ts->AddCollector("hiv_women", new Counter<double>(hiv_women), get_year);
 
-  auto pct_high_risk_hiv_women = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    return ts->GetYValues("high_risk_hiv_women").back() /
-           ts->GetYValues("hiv_women").back();
-  };
-  ts->AddCollector("high_risk_sb_hiv_women", pct_high_risk_hiv_women, get_year);
-
   // AM: Define how to compute proportion of low-risk socio-beahviours among hiv
   // adult women
   auto low_risk_hiv_women = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
+    int age = GetAgeAfterStep(person);
     return person->HasLowRiskSocioBehav() and !(person->IsHealthy()) and
-           person->IsAdult() and person->IsFemale();
+           age >= 15 and person->IsFemale();
   };
   ts->AddCollector("low_risk_hiv_women",
                    new Counter<double>(low_risk_hiv_women), get_year);
 
-  auto pct_low_risk_hiv_women = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    return ts->GetYValues("low_risk_hiv_women").back() /
-           ts->GetYValues("hiv_women").back();
-  };
-  ts->AddCollector("low_risk_sb_hiv_women", pct_low_risk_hiv_women, get_year);
-
   // AM: Define how to compute proportion of high-risk socio-beahviours among
   // hiv adult men
   auto high_risk_hiv_men = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
+    int age = GetAgeAfterStep(person);
     return person->HasHighRiskSocioBehav() and !(person->IsHealthy()) and
-           person->IsAdult() and person->IsMale();
+           age >= 15 and person->IsMale();
   };
   ts->AddCollector("high_risk_hiv_men", new Counter<double>(high_risk_hiv_men),
                    get_year);
 
   auto hiv_men = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return !(person->IsHealthy()) and person->IsAdult() and person->IsMale();
+    int age = GetAgeAfterStep(person);
+    return !(person->IsHealthy()) and age >= 15 and person->IsMale();
   };
   ts->AddCollector("hiv_men", new Counter<double>(hiv_men), get_year);
 
-  auto pct_high_risk_hiv_men = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    return ts->GetYValues("high_risk_hiv_men").back() /
-           ts->GetYValues("hiv_men").back();
-  };
-  ts->AddCollector("high_risk_sb_hiv_men", pct_high_risk_hiv_men, get_year);
-
   // AM: Define how to compute proportion of low-risk socio-beahviours among hiv
   // adult men
   auto low_risk_hiv_men = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
+    int age = GetAgeAfterStep(person);
     return person->HasLowRiskSocioBehav() and !(person->IsHealthy()) and
-           person->IsAdult() and person->IsMale();
+           age >= 15 and person->IsMale();
   };
   ts->AddCollector("low_risk_hiv_men", new Counter<double>(low_risk_hiv_men),
                    get_year);
 
-  auto pct_low_risk_hiv_men = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    return ts->GetYValues("low_risk_hiv_men").back() /
-           ts->GetYValues("hiv_men").back();
-  };
-  ts->AddCollector("low_risk_sb_hiv_men", pct_low_risk_hiv_men, get_year);
-
   // AM: Define how to compute proportion of high-risk socio-beahviours among
   // healthy adult women
   auto high_risk_healthy_women = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
+    int age = GetAgeAfterStep(person);
     return person->HasHighRiskSocioBehav() and person->IsHealthy() and
-           person->IsAdult() and person->IsFemale();
+           age >= 15 and person->IsFemale();
   };
   ts->AddCollector("high_risk_healthy_women",
                    new Counter<double>(high_risk_healthy_women), get_year);
 
   auto healthy_women = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return person->IsHealthy() and person->IsAdult() and person->IsFemale();
+    int age = GetAgeAfterStep(person);
+    return person->IsHealthy() and age >= 15 and person->IsFemale();
   };
   ts->AddCollector("healthy_women", new Counter<double>(healthy_women),
                    get_year);
 
-  auto pct_high_risk_healthy_women = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    return ts->GetYValues("high_risk_healthy_women").back() /
-           ts->GetYValues("healthy_women").back();
-  };
-  ts->AddCollector("high_risk_sb_healthy_women", pct_high_risk_healthy_women,
-                   get_year);
-
   // AM: Define how to compute proportion of low-risk socio-beahviours among
   // healthy adult women
   auto low_risk_healthy_women = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
+    int age = GetAgeAfterStep(person);
     return person->HasLowRiskSocioBehav() and person->IsHealthy() and
-           person->IsAdult() and person->IsFemale();
+           age >= 15 and person->IsFemale();
   };
   ts->AddCollector("low_risk_healthy_women",
                    new Counter<double>(low_risk_healthy_women), get_year);
 
-  auto pct_low_risk_healthy_women = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    return ts->GetYValues("low_risk_healthy_women").back() /
-           ts->GetYValues("healthy_women").back();
-  };
-  ts->AddCollector("low_risk_sb_healthy_women", pct_low_risk_healthy_women,
-                   get_year);
-
   // AM: Define how to compute proportion of high-risk socio-beahviours among
   // healthy adult men
   auto high_risk_healthy_men = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
+    int age = GetAgeAfterStep(person);
     return person->HasHighRiskSocioBehav() and person->IsHealthy() and
-           person->IsAdult() and person->IsMale();
+           age >= 15 and person->IsMale();
   };
   ts->AddCollector("high_risk_healthy_men",
                    new Counter<double>(high_risk_healthy_men), get_year);
 
   auto healthy_men = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
-    return person->IsHealthy() and person->IsAdult() and person->IsMale();
+    int age = GetAgeAfterStep(person);
+    return person->IsHealthy() and age >= 15 and person->IsMale();
   };
   ts->AddCollector("healthy_men", new Counter<double>(healthy_men), get_year);
 
-  auto pct_high_risk_healthy_men = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    return ts->GetYValues("high_risk_healthy_men").back() /
-           ts->GetYValues("healthy_men").back();
-  };
-  ts->AddCollector("high_risk_sb_healthy_men", pct_high_risk_healthy_men,
-                   get_year);
-
   // AM: Define how to compute proportion of low-risk socio-beahviours among
   // healthy adult men
   auto low_risk_healthy_men = [](Agent* a) {
     auto* person = bdm_static_cast<Person*>(a);
+    int age = GetAgeAfterStep(person);
     return person->HasLowRiskSocioBehav() and person->IsHealthy() and
-           person->IsAdult() and person->IsMale();
+           age >= 15 and person->IsMale();
   };
   ts->AddCollector("low_risk_healthy_men",
                    new Counter<double>(low_risk_healthy_men), get_year);
 
-  auto pct_low_risk_healthy_men = [](Simulation* sim) {
-    auto* ts = sim->GetTimeSeries();
-    return ts->GetYValues("low_risk_healthy_men").back() /
-           ts->GetYValues("healthy_men").back();
-  };
-  ts->AddCollector("low_risk_sb_healthy_men", pct_low_risk_healthy_men,
-                   get_year);
+  DefineDerivedSeries(&registry);
+}
+
+// -----------------------------------------------------------------------------
+void ComputeEnsembleBand(std::vector<double> values, double band, double* mean,
+                         double* low, double* high) {
+  values.erase(std::remove_if(values.begin(), values.end(),
+                              [](double v) { return !std::isfinite(v); }),
+               values.end());
+  if (values.empty()) {
+    *mean = *low = *high = std::nan("");
+    return;
+  }
+  std::sort(values.begin(), values.end());
+  *mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+  // Quantile q, interpolated linearly between the sorted values
+  auto quantile = [&](double q) {
+    double position = std::min(std::max(q, 0.0), 1.0) * (values.size() - 1);
+    size_t below = static_cast<size_t>(position);
+    size_t above = std::min(below + 1, values.size() - 1);
+    return values[below] + (position - below) * (values[above] - values[below]);
+  };
+  *low = quantile((1 - band) / 2);
+  *high = quantile((1 + band) / 2);
+}
+
+// -----------------------------------------------------------------------------
+void SaveEnsembleTimeSeries(
+    const std::vector<experimental::TimeSeries>& replicates, double band,
+    const std::string& filename) {
+  experimental::TimeSeries ensemble;
+  experimental::TimeSeries::Merge(
+      &ensemble, replicates,
+      [band](const std::vector<double>& values, double* y, double* error_high,
+             double* error_low) {
+        double low, high;
+        ComputeEnsembleBand(values, band, y, &low, &high);
+        *error_low = *y - low;
+        *error_high = high - *y;
+      });
+  ensemble.SaveJson(filename);
 }
 
 // -----------------------------------------------------------------------------
@@ -885,199 +1302,18 @@ int PlotAndSaveTimeseries() {
   auto sim = Simulation::GetActive();
   auto* ts = sim->GetTimeSeries();
 
+  // Compute the derived series from the collected ones, which are estimates
+  // with errors if sampled_statistics is set
+  AddEstimateErrors(ts);
+  AddDerivedSeries(ts);
+
   // Save the TimeSeries Data as JSON to the folder <date_time>
   ts->SaveJson(Concat(sim->GetOutputDir(), "/data.json"));
 
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g(ts, "Population - Healthy/Infected", "Time",
-                                 "Number of agents", true);
-  g.Add("healthy_agents", "Healthy", "L", kBlue, 1.0);
-  g.Add("infected_agents", "HIV", "L", kRed, 1.0);
-  g.Draw();
-  g.SaveAs(Concat(sim->GetOutputDir(), "/simulation_hiv"), {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g2(ts, "HIV stages", "Time", "Number of agents",
-                                  true);
-  // g2.Add("healthy_agents", "Healthy", "L", kBlue, 1.0, 1);
-  g2.Add("infected_agents", "HIV", "L", kOrange, 1.0, 1);
-  g2.Add("acute_agents", "Acute", "L", kRed, 1.0, 10);
-  g2.Add("chronic_agents", "Chronic", "L", kMagenta, 1.0, 10);
-  g2.Add("treated_agents", "Treated", "L", kGreen, 1.0, 10);
-  g2.Add("failing_agents", "Failing", "L", kGray, 1.0, 10);
-  g2.Draw();
-  g2.SaveAs(Concat(sim->GetOutputDir(), "/simulation_hiv_with_states"),
-            {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g2_1(ts, "Acute HIV by sex", "Time",
-                                    "Number of agents", true);
-  g2_1.Add("acute_male_agents", "Male Acute", "L", kBlue, 1.0, 1);
-  g2_1.Add("acute_female_agents", "Female Acute", "L", kMagenta, 1.0, 1);
-  g2_1.Draw();
-  g2_1.SaveAs(Concat(sim->GetOutputDir(), "/simulation_hiv_acute_sex"),
-              {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g2_1_1(ts, "Acute HIV by sex and risk", "Time",
-                                      "Number of agents", true);
-  g2_1_1.Add("acute_male_low_sb_agents", "Male Acute - Low risk", "L", kBlue,
-             1.0, 2);
-  g2_1_1.Add("acute_male_high_sb_agents", "Male Acute - High risk", "L", kBlue,
-             1.0, 1);
-  g2_1_1.Add("acute_female_low_sb_agents", "Female Acute - Low risk", "L",
-             kMagenta, 1.0, 2);
-  g2_1_1.Add("acute_female_high_sb_agents", "Female Acute - High risk", "L",
-             kMagenta, 1.0, 1);
-
-  g2_1_1.Draw();
-  g2_1_1.SaveAs(Concat(sim->GetOutputDir(), "/simulation_hiv_acute_sex_sb"),
-                {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g2_2(ts, "Transmission", "Time",
-                                    "Number of agents", true);
-  g2_2.Add("mtct_agents", "MTCT", "L", kGreen, 1.0, 3);
-  g2_2.Add("casual_transmission_agents", "Casual Transmission", "L", kRed, 1.0,
-           3);
-  g2_2.Add("regular_transmission_agents", "Regular Transmission", "L", kBlue,
-           1.0, 3);
-  g2_2.Draw();
-  g2_2.SaveAs(Concat(sim->GetOutputDir(), "/simulation_transmission_types"),
-              {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g2_2_1(ts, "Transmission", "Time",
-                                      "Number of agents", true);
-  g2_2_1.Add("casual_transmission_to_male", "Casual Transmission - to Male",
-             "L", kBlue, 1.0, 1);
-  g2_2_1.Add("casual_transmission_to_female", "Casual Transmission - to Female",
-             "L", kMagenta, 1.0, 1);
-  g2_2_1.Add("regular_transmission_to_male", "Regular Transmission - to Male",
-             "L", kBlue, 1.0, 2);
-  g2_2_1.Add("regular_transmission_to_male", "Regular Transmission - to Female",
-             "L", kMagenta, 1.0, 2);
-  g2_2_1.Add("mtct_transmission_to_male", "MTCT - to Male", "L", kBlue, 1.0, 3);
-  g2_2_1.Add("mtct_transmission_to_female", "MTCT Transmission - to Female",
-             "L", kMagenta, 1.0, 3);
-  g2_2_1.Draw();
-  g2_2_1.SaveAs(
-      Concat(sim->GetOutputDir(), "/simulation_transmission_types_by_sex"),
-      {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g2_3(ts, "Source of infection - HIV stage",
-                                    "Time", "Number of agents", true);
-  g2_3.Add("acute_transmission", "Infected by Acute", "L", kRed, 1.0, 10);
-  g2_3.Add("chronic_transmission", "Infected by Chronic", "L", kMagenta, 1.0,
-           10);
-  g2_3.Add("treated_transmission", "Infected by Treated", "L", kGreen, 1.0, 10);
-  g2_3.Add("failing_transmission", "Infected by Failing", "L", kGray, 1.0, 10);
-  g2_3.Draw();
-  g2_3.SaveAs(
-      Concat(sim->GetOutputDir(), "/simulation_transmission_sources_state"),
-      {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g2_4(ts, "Source of infection - Risk level",
-                                    "Time", "Number of agents", true);
-  g2_4.Add("low_sb_transmission", "Infected by Low Risk", "L", kRed, 1.0, 10);
-  g2_4.Add("high_sb_transmission", "Infected by High Risk", "L", kMagenta, 1.0,
-           10);
-  g2_4.Draw();
-  g2_4.SaveAs(
-      Concat(sim->GetOutputDir(), "/simulation_transmission_sources_sb"),
-      {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g3(ts, "HIV", "Time", "", true);
-  g3.Add("prevalence", "Prevalence", "L", kOrange, 1.0, 3, 1, kOrange, 1.0, 5);
-  g3.Add("prevalence_females", "Prevalence - Females", "L", kRed, 1.0, 3, 1,
-         kRed, 1.0, 10);
-  g3.Add("prevalence_males", "Prevalence - Males", "L", kBlue, 1.0, 3, 1, kBlue,
-         1.0, 10);
-
-  g3.Add("prevalence_15_49", "Prevalence (15-49)", "L", kOrange, 1.0, 1, 1);
-  g3.Add("prevalence_women_15_49", "Prevalence - Women (15-49)", "L", kRed, 1.0,
-         1, 1);
-  g3.Add("prevalence_men_15_49", "Prevalence - Men (15-49)", "L", kBlue, 1.0, 1,
-         1);
-
-  g3.Add("incidence", "Incidence", "L", kRed, 1.0, 3, 1, kRed, 1.0, 5);
-
-  g3.Draw();
-  g3.SaveAs(Concat(sim->GetOutputDir(), "/simulation_hiv_prevalence_incidence"),
-            {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g4(ts, "my result", "Time", "Proportion", true);
-  g4.Add("high_risk_sb_hiv", "High Risk SB - HIV", "L", kRed, 1.0, 1);
-  g4.Add("low_risk_sb_hiv", "Low Risk SB - HIV", "L", kBlue, 1.0, 1);
-  g4.Add("high_risk_sb_healthy", "High Risk SB - Healthy", "L", kOrange, 1.0,
-         1);
-  g4.Add("low_risk_sb_healthy", "Low Risk SB - Healthy", "L", kGreen, 1.0, 1);
-  g4.Add("high_risk_sb_hiv_women", "High Risk SB - HIV Women", "L", kRed, 1.0,
-         10);
-  g4.Add("low_risk_sb_hiv_women", "Low Risk SB - HIV Women", "L", kBlue, 1.0,
-         10);
-
-  g4.Add("high_risk_sb_hiv_men", "High Risk SB - HIV Men", "L", kRed, 1.0, 2);
-  g4.Add("low_risk_sb_hiv_men", "Low Risk SB - HIV Men", "L", kBlue, 1.0, 2);
-
-  g4.Add("high_risk_sb_healthy_women", "High Risk SB - Healthy Women", "L",
-         kOrange, 1.0, 10);
-  g4.Add("low_risk_sb_healthy_women", "Low Risk SB - Healthy Women", "L",
-         kGreen, 1.0, 10);
-
-  g4.Add("high_risk_sb_healthy_men", "High Risk SB - Healthy Men", "L", kOrange,
-         1.0, 5);
-  g4.Add("low_risk_sb_healthy_men", "Low Risk SB - Healthy Men", "L", kGreen,
-         1.0, 5);
-  g4.Draw();
-  g4.SaveAs(Concat(sim->GetOutputDir(), "/simulation_sociobehaviours"),
-            {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g5(ts, "Casual sex partners", "Time", "Number",
-                                  true);
-
-  g5.Add("mean_nocas_men_low_sb", "Mean - Men w/ Low Risk SB", "L", kGreen, 1.0,
-         2);
-  g5.Add("mean_nocas_men_high_sb", "Mean - Men w/ High Risk SB", "L", kGreen,
-         1.0, 1);
-  g5.Add("mean_nocas_women_low_sb", "Mean - Women w/ Low Risk SB", "L", kRed,
-         1.0, 2);
-  g5.Add("mean_nocas_women_high_sb", "Mean - Women w/ High Risk SB", "L", kRed,
-         1.0, 1);
-  g5.Add("mean_nocas_hiv_men_low_sb", "Mean - Men w/ HIV & Low Risk SB", "L",
-         kBlue, 1.0, 2);
-  g5.Add("mean_nocas_hiv_men_high_sb", "Mean - Men w/ HIV & High Risk SB", "L",
-         kBlue, 1.0, 1);
-  g5.Add("mean_nocas_hiv_women_low_sb", "Mean - Women w/ HIV & Low Risk SB",
-         "L", kMagenta, 1.0, 2);
-  g5.Add("mean_nocas_hiv_women_high_sb", "Mean - Women w/ HIV & High Risk SB",
-         "L", kMagenta, 1.0, 1);
-
-  g5.Draw();
-  g5.SaveAs(Concat(sim->GetOutputDir(), "/simulation_casual_mating_mean"),
-            {".svg", ".png"});
-
-  // Create a bdm LineGraph that visualizes the TimeSeries data
-  bdm::experimental::LineGraph g6(ts, "Casual sex partners", "Time", "Number",
-                                  true);
-
-  g6.Add("total_nocas_men_low_sb", "Total - Men w/ Low Risk SB", "L", kGreen,
-         1.0, 2);
-  g6.Add("total_nocas_men_high_sb", "Total - Men w/ High Risk SB", "L", kRed,
-         1.0, 2);
-  g6.Add("total_nocas_women_low_sb", "Total - Women w/ Low Risk SB", "L",
-         kGreen, 1.0, 1);
-  g6.Add("total_nocas_women_high_sb", "Total - Women w/ High Risk SB", "L",
-         kRed, 1.0, 1);
-
-  g6.Draw();
-  g6.SaveAs(Concat(sim->GetOutputDir(), "/simulation_casual_mating_total"),
-            {".svg", ".png"});
+  // Render the plots, unless they are rendered later from data.json
+  if (sim->GetParam()->Get<SimParam>()->plot_time_series) {
+    PlotTimeseries(ts, sim->GetOutputDir());
+  }
 
   // Print info for user to let him/her know where to find simulation results
   std::string info =
@@ -13,16 +13,60 @@
 #ifndef VISUALIZE_H_
 #define VISUALIZE_H_
 
+#include <cstdint>
+#include <string>
 #include <vector>
 #include "datatypes.h"
 
 namespace bdm {
+
+namespace experimental {
+class TimeSeries;
+}  // namespace experimental
+
 namespace hiv_malawi {
 
+class SimParam;
+
 // This functions defines which data should be extracted from the simulation
 // and collected for each time step using the `TimeSeries` object.
 void DefineAndRegisterCollectors();
 
+// Returns the ids of the collectors registered by DefineAndRegisterCollectors
+const std::vector<std::string>& GetCollectorIds();
+
+// Returns the ids of the series that are derived from the collectors when the
+// time series are output, instead of being collected in each iteration
+const std::vector<std::string>& GetDerivedSeriesIds();
+
+// Computes the values of the derived series (in the order of
+// GetDerivedSeriesIds) from the values of the collectors in one iteration (in
+// the order of GetCollectorIds)
+void EvaluateDerivedSeries(const std::vector<double>& values,
+                           std::vector<double>* derived);
+
+// Adds the derived series to ts, computed from the collected series
+void AddDerivedSeries(experimental::TimeSeries* ts);
+
+// Returns true if the collectors are evaluated in the given iteration, whose
+// x-value is year (see collection_interval and collection_years)
+bool IsCollectionIteration(const SimParam* sparam, uint64_t iteration,
+                           int year);
+
+// Computes the mean of the values of a series in one iteration over the
+// replicates of an ensemble, and the bounds of the central band of the values
+// that covers the fraction band (e.g. 0.9: the 5% and 95% quantiles). Values
+// that are not finite (e.g. ratios of zero counts) are ignored.
+void ComputeEnsembleBand(std::vector<double> values, double band, double* mean,
+                         double* low, double* high);
+
+// Saves the mean of each series over the replicates of an ensemble, with the
+// distances to the bounds of the band as errors, to filename (JSON). All
+// replicates must have the same series and x-values.
+void SaveEnsembleTimeSeries(
+    const std::vector<experimental::TimeSeries>& replicates, double band,
+    const std::string& filename);
+
 // This functions retrieves the collected time series from the active
 // simulation, saves the results as a JSON file, and plots the results.
 int PlotAndSaveTimeseries();
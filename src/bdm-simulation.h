@@ -13,17 +13,29 @@
 #ifndef BDM_SIMULAION_H_
 #define BDM_SIMULAION_H_
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "core/operation/operation_registry.h"
 #include "core/operation/reduction_op.h"
 
 #include "analyze.h"
+#include "calibration.h"
 #include "categorical-environment.h"
+#include "checkpoint.h"
 #include "custom-operations.h"
+#include "district-ranks.h"
+#include "population-import.h"
 #include "population-initialization.h"
+#include "population-snapshot.h"
 #include "sim-param.h"
+#include "transmission-log.h"
 
 namespace bdm {
 namespace hiv_malawi {
@@ -31,23 +43,47 @@ namespace hiv_malawi {
 ////////////////////////////////////////////////////////////////////////////////
 // BioDynaMo's main simulation
 ////////////////////////////////////////////////////////////////////////////////
-inline int Simulate(int argc, const char** argv) {
-  // Register the Siulation parameter
-  Param::RegisterParamGroup(new SimParam());
 
-  // Initialize the Simulation
-  gAgentPointerMode = AgentPointerMode::kDirect;
-  auto set_param = [&](Param* param) {
-    param->show_simulation_step = 1;
-    param->remove_output_dir_contents = false;
-    param->statistics = true;
-  };
-  Simulation simulation(argc, argv, set_param);
+// Assign the districts to the ranks in proportion to their initial population
+inline void PartitionDistricts(const SimParam* sparam) {
+  auto* ranks = DistrictRanks::GetInstance();
+  if (sparam->skip_non_transmissive_casual_contacts) {
+    Log::Fatal("Simulate()",
+               "skip_non_transmissive_casual_contacts is not supported in "
+               "distributed simulations.");
+  }
+  std::vector<float> location_weights(sparam->location_distribution.size());
+  for (size_t l = 0; l < location_weights.size(); l++) {
+    location_weights[l] = sparam->location_distribution[l] -
+                          (l > 0 ? sparam->location_distribution[l - 1] : 0);
+  }
+  ranks->Partition(location_weights);
+}
+
+// Returns the random seed of replicate i of an ensemble (see ensemble_size)
+inline uint64_t DeriveReplicateSeed(uint64_t random_seed, uint64_t i) {
+  std::seed_seq seed_sequence{static_cast<uint32_t>(random_seed),
+                              static_cast<uint32_t>(random_seed >> 32),
+                              static_cast<uint32_t>(i),
+                              static_cast<uint32_t>(i >> 32)};
+  uint32_t seed[2];
+  seed_sequence.generate(seed, seed + 2);
+  return (static_cast<uint64_t>(seed[1]) << 32) | seed[0];
+}
+
+// Construct the environment, create the population and schedule the
+// operations of the simulation. The population is restored from fork_state
+// (see WriteCheckpointData) if it is not nullptr. Returns the operation
+// executing the behaviours with a cost-aware schedule, or nullptr.
+inline Operation* SetUpSimulation(Simulation* simulation,
+                                  const std::string* fork_state) {
+  auto* sparam = simulation->GetParam()->Get<SimParam>();
+  auto* ranks = DistrictRanks::GetInstance();
 
-  // Get a pointer to the param object
-  auto* param = simulation.GetParam();
-  // Get a pointer to an instance of SimParam
-  auto* sparam = param->Get<SimParam>();
+  // Discard the fast Bernoulli integers left over from a previous simulation
+  // in this process (e.g. the previous replicate of an ensemble), such that
+  // the random numbers only depend on the random seed of this simulation
+  UniformBuffer::ResetAll();
 
   // AM: Construct Environment with numbers of age and socio-behavioral
   // categories.
@@ -55,23 +91,56 @@ inline int Simulate(int argc, const char** argv) {
       sparam->min_age, sparam->max_age, sparam->nb_age_categories,
       sparam->nb_locations, sparam->nb_sociobehav_categories);
 
-  simulation.SetEnvironment(env);
+  simulation->SetEnvironment(env);
 
-  // Randomly initialize a population
+  // Randomly initialize a population, load it from a snapshot, import a
+  // synthetic population, or resume the simulation from a checkpoint or from
+  // the state at the fork
   {
     Timing timer_init("RUNTIME POPULATION INITIALIZATION: ");
-    InitializePopulation();
+    if (fork_state != nullptr) {
+      uint64_t completed_steps = RestoreCheckpointData(
+          fork_state->data(), fork_state->size(), "the fork state");
+      ReseedRandomNumberGenerators(completed_steps);
+    } else if (!sparam->restart_from_checkpoint.empty()) {
+      uint64_t completed_steps = LoadCheckpoint(
+          ranks->GetRankFilename(sparam->restart_from_checkpoint));
+      ReseedRandomNumberGenerators(completed_steps);
+      std::cout << "Resume the simulation after " << completed_steps
+                << " iterations in " << sparam->start_year << std::endl;
+    } else if (!sparam->load_population_snapshot.empty()) {
+      LoadPopulationSnapshot(
+          ranks->GetRankFilename(sparam->load_population_snapshot),
+          sparam->start_year);
+    } else if (!sparam->import_population.empty()) {
+      ImportSyntheticPopulation(sparam->import_population,
+                                sparam->start_year);
+    } else {
+      InitializePopulation();
+    }
   }
 
   DefineAndRegisterCollectors();
 
   // Unschedule some default operations
-  auto* scheduler = simulation.GetScheduler();
+  auto* scheduler = simulation->GetScheduler();
   // Don't compute forces
   scheduler->UnscheduleOp(scheduler->GetOps("mechanical forces")[0]);
-  // Don't run load balancing, not working with custom environment.
+  // Don't run BioDynaMo's load balancing, it does not update the agent
+  // pointers between persons (see SortAgents).
   scheduler->UnscheduleOp(scheduler->GetOps("load balancing")[0]);
 
+  // Add an operation that writes the initial population to a snapshot, after
+  // the environment assigned the mothers to the children in the first
+  // iteration
+  if (!sparam->save_population_snapshot.empty() && GetRestoredSteps() == 0) {
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "WritePopulationSnapshot", OpComputeTarget::kCpu,
+        new WritePopulationSnapshot());
+    auto* write_snapshot = NewOperation("WritePopulationSnapshot");
+    scheduler->ScheduleOp(write_snapshot, OpType::kPreSchedule);
+  }
+
   // Add a operation that resets the number of casual partners at the beginning
   // of each iteration
   OperationRegistry::GetInstance()->AddOperationImpl(
@@ -79,15 +148,174 @@ inline int Simulate(int argc, const char** argv) {
   auto* reset_casual_partners = NewOperation("ResetCasualPartners");
   scheduler->ScheduleOp(reset_casual_partners, OpType::kPreSchedule);
 
-  // Run simulation for <number_of_iterations> timesteps
-  {
-    Timing timer_sim("RUNTIME");
-    scheduler->Simulate(sparam->number_of_iterations);
+  // Add an operation that re-attaches the behaviours of agents that entered or
+  // left the age window of a behaviour in the previous iteration
+  OperationRegistry::GetInstance()->AddOperationImpl(
+      "UpdateBehaviourActivation", OpComputeTarget::kCpu,
+      new UpdateBehaviourActivation());
+  auto* update_behaviour_activation = NewOperation("UpdateBehaviourActivation");
+  scheduler->ScheduleOp(update_behaviour_activation, OpType::kPreSchedule);
+
+  // Replace BioDynaMo's behaviour operation by one that executes the agents
+  // district by district, or by one with a cost-aware schedule
+  Operation* cost_aware_behaviours = nullptr;
+  if (sparam->district_partitioned_execution) {
+    if (sparam->cost_aware_scheduling) {
+      Log::Warning("SetUpSimulation",
+                   "cost_aware_scheduling is ignored with "
+                   "district_partitioned_execution");
+    }
+    auto* behaviour_op = scheduler->GetOps("behavior")[0];
+    scheduler->UnscheduleOp(behaviour_op);
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "DistrictPartitionedBehaviourExecution", OpComputeTarget::kCpu,
+        new DistrictPartitionedBehaviourExecution());
+    auto* district_behaviours =
+        NewOperation("DistrictPartitionedBehaviourExecution");
+    scheduler->ScheduleOp(district_behaviours, OpType::kSchedule);
+  } else if (sparam->cost_aware_scheduling) {
+    auto* behaviour_op = scheduler->GetOps("behavior")[0];
+    scheduler->UnscheduleOp(behaviour_op);
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "CostAwareBehaviourExecution", OpComputeTarget::kCpu,
+        new CostAwareBehaviourExecution(behaviour_op));
+    cost_aware_behaviours = NewOperation("CostAwareBehaviourExecution");
+    scheduler->ScheduleOp(cost_aware_behaviours, OpType::kSchedule);
+  }
+
+  // Add an operation that attributes the skipped casual contacts to healthy
+  // women. It is executed after all behaviours, before the time series are
+  // updated.
+  if (sparam->skip_non_transmissive_casual_contacts) {
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "DistributeSkippedCasualContacts", OpComputeTarget::kCpu,
+        new DistributeSkippedCasualContacts());
+    auto* distribute_skipped_contacts =
+        NewOperation("DistributeSkippedCasualContacts");
+    scheduler->ScheduleOp(distribute_skipped_contacts, OpType::kSchedule);
+  }
+
+  // Replace BioDynaMo's time series update by an operation that evaluates the
+  // collectors only in the selected iterations, before all other
+  // post-scheduled operations
+  if (sparam->collection_interval > 1 || !sparam->collection_years.empty()) {
+    auto time_series_ops = scheduler->GetOps("update time series");
+    if (time_series_ops.empty()) {
+      Log::Fatal("SetUpSimulation", "The time series update was not found");
+    }
+    scheduler->UnscheduleOp(time_series_ops[0]);
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "CollectTimeSeries", OpComputeTarget::kCpu, new CollectTimeSeries());
+    auto* collect_time_series = NewOperation("CollectTimeSeries");
+    scheduler->ScheduleOp(collect_time_series, OpType::kPostSchedule);
+  }
+
+  // In distributed simulations, exchange the casual contacts with women of
+  // other ranks after all behaviours, and move the agents that migrated to a
+  // district of another rank at the end of the iteration.
+  if (ranks->IsDistributed()) {
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "ExchangeRankCasualContacts", OpComputeTarget::kCpu,
+        new ExchangeRankCasualContacts());
+    auto* exchange_contacts = NewOperation("ExchangeRankCasualContacts");
+    scheduler->ScheduleOp(exchange_contacts, OpType::kSchedule);
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "ExchangeRankMigrants", OpComputeTarget::kCpu,
+        new ExchangeRankMigrants());
+    auto* exchange_migrants = NewOperation("ExchangeRankMigrants");
+    scheduler->ScheduleOp(exchange_migrants, OpType::kPostSchedule);
+  }
+
+  // Add an operation that periodically reorders the agents by compound
+  // category, at the end of the iteration. It replaces BioDynaMo's load
+  // balancing, which does not update the agent pointers between persons.
+  if (sparam->sort_agents_frequency > 0) {
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "SortAgents", OpComputeTarget::kCpu, new SortAgents());
+    auto* sort_agents = NewOperation("SortAgents");
+    sort_agents->frequency_ = sparam->sort_agents_frequency;
+    scheduler->ScheduleOp(sort_agents, OpType::kPostSchedule);
+  }
+
+  // Log the transmissions of this simulation
+  if (sparam->transmission_log) {
+    TransmissionLog::GetInstance()->Open(ranks->GetRankFilename(
+        Concat(simulation->GetOutputDir(), "/transmissions.bin")));
+  }
+
+  // Add an operation that appends the district pyramid counted by the
+  // environment to a file
+  if (sparam->district_pyramid) {
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "WriteDistrictPyramid", OpComputeTarget::kCpu,
+        new WriteDistrictPyramid());
+    auto* write_district_pyramid = NewOperation("WriteDistrictPyramid");
+    scheduler->ScheduleOp(write_district_pyramid, OpType::kPostSchedule);
+  }
+
+  // Add an operation that appends the values of the collectors to a stream
+  // after the time series update
+  if (sparam->stream_time_series) {
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "StreamTimeSeries", OpComputeTarget::kCpu, new StreamTimeSeries());
+    auto* stream_time_series = NewOperation("StreamTimeSeries");
+    scheduler->ScheduleOp(stream_time_series, OpType::kPostSchedule);
+  }
+
+  // Add an operation that compares the trajectory with the calibration targets
+  // after the time series update
+  if (CalibrationMonitor::IsEnabled()) {
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "CheckCalibrationTargets", OpComputeTarget::kCpu,
+        new CheckCalibrationTargets());
+    auto* check_calibration_targets = NewOperation("CheckCalibrationTargets");
+    scheduler->ScheduleOp(check_calibration_targets, OpType::kPostSchedule);
+  }
+
+  // Add an operation that periodically writes a checkpoint at the end of the
+  // iteration, after all other operations. The agents of a restarted
+  // simulation must be sorted in the same iterations as those of the
+  // uninterrupted one.
+  if (sparam->checkpoint_frequency > 0) {
+    if (sparam->sort_agents_frequency > 0 &&
+        sparam->checkpoint_frequency % sparam->sort_agents_frequency != 0) {
+      Log::Fatal("SetUpSimulation", "checkpoint_frequency (",
+                 sparam->checkpoint_frequency,
+                 ") must be a multiple of sort_agents_frequency (",
+                 sparam->sort_agents_frequency, ")");
+    }
+    OperationRegistry::GetInstance()->AddOperationImpl(
+        "WriteCheckpoint", OpComputeTarget::kCpu, new WriteCheckpoint());
+    auto* write_checkpoint = NewOperation("WriteCheckpoint");
+    scheduler->ScheduleOp(write_checkpoint, OpType::kPostSchedule);
+  }
+
+  return cost_aware_behaviours;
+}
+
+// Report the busy time of the threads, and save and plot the time series
+inline void FinishSimulation(Operation* cost_aware_behaviours) {
+  if (cost_aware_behaviours != nullptr) {
+    cost_aware_behaviours->GetImplementation<CostAwareBehaviourExecution>()
+        ->PrintBusyTimeReport();
   }
 
   {
     Timing timer_post("RUNTIME POSTPROCESSING:            ");
 
+    // Write the transmissions that are still buffered
+    TransmissionLog::GetInstance()->Close();
+
+    // Write the iterations of the time series stream that are still buffered
+    auto* scheduler = Simulation::GetActive()->GetScheduler();
+    for (auto* op : scheduler->GetOps("StreamTimeSeries")) {
+      op->GetImplementation<StreamTimeSeries>()->Close();
+    }
+
+    // Prepend the values collected before the checkpoint the simulation was
+    // restarted from
+    MergeRestoredTimeSeries();
+
     // Generate ROOT plot to visualize the number of healthy and infected
     // individuals over time.
     PlotAndSaveTimeseries();
@@ -96,7 +324,291 @@ inline int Simulate(int argc, const char** argv) {
   // DEBUG - AM - TO DO: Works only when selection depended soloely on locations
   /*env->NormalizeMateLocationFrequencies();
   env->PrintMateLocationFrequencies();*/
+}
+
+// Calibrate the parameters with the settings of cparam (see
+// calibration_targets). Each candidate parameter set is simulated in its own
+// simulation, which is aborted once the trajectory leaves the band of the
+// calibration method. The random numbers of the search are drawn from seed.
+// All candidates use the same random_seed, and SetUpSimulation resets the
+// random numbers left over from the previous candidate, such that candidates
+// are compared with common random numbers (exactly so if they are simulated
+// with a single thread). Candidates simulated with a smaller population than
+// the last of calibration_population_sizes are compared with the targets
+// after scaling their counts.
+inline void SimulateCalibration(
+    int argc, const char** argv,
+    const std::function<void(Param*)>& set_param, const SimParam* cparam,
+    uint64_t seed) {
+  auto targets = ReadCalibrationTargets(cparam->calibration_targets);
+  for (const auto& target : targets) {
+    int iteration = target.year - cparam->start_year;
+    if (iteration < 0 ||
+        !IsCollectionIteration(cparam, iteration, target.year)) {
+      Log::Fatal("SimulateCalibration()", "The target of ", target.series,
+                 " in ", target.year,
+                 " is not collected (see collection_interval and "
+                 "collection_years)");
+    }
+  }
+  std::vector<std::string> names;
+  std::vector<double> lower, upper;
+  for (const auto& el : cparam->calibration_parameters) {
+    if (el.second.size() != 2 || !(el.second[0] < el.second[1])) {
+      Log::Fatal("SimulateCalibration()", "The bounds of ", el.first,
+                 " must be {lower, upper} with lower < upper");
+    }
+    names.push_back(el.first);
+    lower.push_back(el.second[0]);
+    upper.push_back(el.second[1]);
+  }
+  if (names.empty()) {
+    Log::Fatal("SimulateCalibration()", "calibration_parameters is empty");
+  }
+  bool multi_fidelity = cparam->calibration_method == "successive_halving";
+  if (multi_fidelity && (!cparam->load_population_snapshot.empty() ||
+                         !cparam->import_population.empty())) {
+    Log::Fatal("SimulateCalibration()",
+               "successive_halving requires randomly initialized populations");
+  }
+
+  auto* monitor = CalibrationMonitor::GetInstance();
+  std::string calibration_dir;
+  uint64_t no_runs = 0;
+  auto simulate = [&](CalibrationRun* run) {
+    uint64_t i = no_runs++;
+    auto set_candidate_param = [&](Param* param) {
+      set_param(param);
+      calibration_dir = param->output_dir + "/calibration";
+      param->output_dir = calibration_dir + "/run_" + std::to_string(i);
+      auto* sparam = param->Get<SimParam>();
+      for (size_t k = 0; k < names.size(); k++) {
+        SetCalibrationParameter(sparam, names[k], run->parameters[k]);
+      }
+      if (run->population_size > 0) {
+        sparam->initial_population_size = run->population_size;
+      }
+    };
+    auto start = std::chrono::steady_clock::now();
+    Simulation simulation(argc, argv, set_candidate_param);
+    auto* sparam = simulation.GetParam()->Get<SimParam>();
+    double count_scale = 1;
+    if (multi_fidelity && run->population_size > 0) {
+      count_scale =
+          static_cast<double>(cparam->calibration_population_sizes.back()) /
+          run->population_size;
+    }
+    monitor->Reset(true, targets, run->band, count_scale);
+    auto* cost_aware_behaviours = SetUpSimulation(&simulation, nullptr);
+    auto* scheduler = simulation.GetScheduler();
+    {
+      Timing timer_sim("RUNTIME CALIBRATION RUN");
+      scheduler->SimulateUntil([&]() {
+        return monitor->IsRejected() ||
+               scheduler->GetSimulatedSteps() >= sparam->number_of_iterations;
+      });
+    }
+    FinishSimulation(cost_aware_behaviours);
+    run->objective = monitor->GetObjective();
+    run->max_deviation = monitor->GetMaxDeviation();
+    run->accepted = monitor->IsAccepted();
+    run->steps = scheduler->GetSimulatedSteps();
+    run->runtime = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    std::cout << "Calibration run " << i << ": "
+              << (run->accepted ? "accepted" : "not accepted")
+              << ", objective " << run->objective << " after " << run->steps
+              << " iterations" << std::endl;
+  };
+
+  std::vector<CalibrationLevel> levels;
+  auto runs = Calibrate(cparam, seed, lower, upper, simulate, &levels);
+  monitor->Reset(false, {}, 1);
+  if (!runs.empty()) {
+    auto filename = calibration_dir + "/runs.csv";
+    SaveCalibrationRuns(runs, names, filename);
+    std::cout << "Info: <SimulateCalibration> The calibration runs were saved "
+              << "to " << filename << std::endl;
+  }
+  if (!levels.empty()) {
+    SaveCalibrationLevels(levels, calibration_dir + "/levels.csv");
+  }
+}
+
+inline int Simulate(int argc, const char** argv) {
+  // Register the Siulation parameter
+  Param::RegisterParamGroup(new SimParam());
+
+  // Start MPI if the simulation was launched with mpirun. Each rank simulates
+  // a subset of the districts.
+  auto* ranks = DistrictRanks::GetInstance();
+  ranks->Init();
+
+  // Initialize the Simulation
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  auto set_param = [&](Param* param) {
+    param->show_simulation_step = 1;
+    param->remove_output_dir_contents = false;
+    param->statistics = true;
+    // Each rank draws different random numbers and writes its own output
+    if (ranks->IsDistributed()) {
+      param->random_seed += ranks->GetRank();
+      param->output_dir += "/rank_" + std::to_string(ranks->GetRank());
+    }
+  };
+
+  // State of the simulation at the fork year, and parameter patches of the
+  // scenarios simulated from it (see fork_year)
+  std::string fork_state;
+  std::vector<std::string> fork_scenarios;
+  // Number of replicates of the ensemble (see ensemble_size)
+  uint64_t ensemble_size = 0;
+  // Parameters of the calibration (see calibration_targets)
+  std::unique_ptr<SimParam> calibration_param;
+  uint64_t calibration_seed = 0;
+  {
+    Simulation simulation(argc, argv, set_param);
+
+    // Get a pointer to the param object
+    auto* param = simulation.GetParam();
+    // Get a pointer to an instance of SimParam
+    auto* sparam = param->Get<SimParam>();
+
+    if (ranks->IsDistributed()) {
+      PartitionDistricts(sparam);
+    }
+
+    if (!sparam->calibration_targets.empty()) {
+      // The candidates are simulated below, each in its own simulation
+      if (sparam->fork_year != 0 || sparam->ensemble_size > 0 ||
+          ranks->IsDistributed()) {
+        Log::Fatal("Simulate()",
+                   "calibration_targets cannot be combined with fork_year, ",
+                   "ensemble_size or distributed simulations");
+      }
+      calibration_param.reset(new SimParam(*sparam));
+      calibration_seed = param->random_seed;
+    } else if (sparam->ensemble_size > 0) {
+      // The replicates are simulated below, each in its own simulation
+      if (sparam->fork_year != 0) {
+        Log::Fatal("Simulate()",
+                   "ensemble_size cannot be combined with fork_year");
+      }
+      ensemble_size = sparam->ensemble_size;
+    } else {
+      auto* cost_aware_behaviours = SetUpSimulation(&simulation, nullptr);
+      auto* scheduler = simulation.GetScheduler();
+
+      if (sparam->fork_year == 0) {
+        // Run simulation for <number_of_iterations> timesteps
+        {
+          Timing timer_sim("RUNTIME");
+          scheduler->Simulate(sparam->number_of_iterations);
+        }
+        FinishSimulation(cost_aware_behaviours);
+      } else {
+        // Simulate the common history until the fork year once, and keep the
+        // state of the simulation in memory
+        uint64_t burn_in_steps = sparam->fork_year - sparam->start_year;
+        if (sparam->fork_year <= sparam->start_year ||
+            burn_in_steps > sparam->number_of_iterations ||
+            sparam->fork_scenarios.empty()) {
+          Log::Fatal("Simulate()", "fork_year must be in the simulated years ",
+                     "and fork_scenarios must not be empty");
+        }
+        {
+          Timing timer_sim("RUNTIME BURN-IN");
+          scheduler->Simulate(burn_in_steps);
+        }
+        std::ostringstream state;
+        WriteCheckpointData(&state, burn_in_steps);
+        fork_state = state.str();
+        fork_scenarios = sparam->fork_scenarios;
+        // Also save the state, e.g. to simulate the scenarios in separate
+        // processes with restart_from_checkpoint
+        auto filename = ranks->GetRankFilename(sparam->checkpoint_file);
+        if (!SaveCheckpoint(filename, burn_in_steps)) {
+          Log::Warning("Simulate()", "Could not write ", filename);
+        }
+      }
+    }
+  }
+
+  // Simulate each scenario from the state at the fork, with the same random
+  // numbers. Each scenario writes its output to its own directory.
+  for (size_t i = 0; i < fork_scenarios.size(); i++) {
+    auto set_scenario_param = [&](Param* param) {
+      set_param(param);
+      param->MergeJsonPatch(fork_scenarios[i]);
+      param->output_dir += "/scenario_" + std::to_string(i);
+      auto* sparam = param->Get<SimParam>();
+      sparam->checkpoint_file += ".scenario_" + std::to_string(i);
+    };
+    Simulation simulation(argc, argv, set_scenario_param);
+    auto* sparam = simulation.GetParam()->Get<SimParam>();
+    std::cout << "Simulate scenario " << i << " from " << sparam->fork_year
+              << std::endl;
+    auto* cost_aware_behaviours = SetUpSimulation(&simulation, &fork_state);
+    {
+      Timing timer_sim("RUNTIME SCENARIO");
+      simulation.GetScheduler()->Simulate(sparam->number_of_iterations);
+    }
+    FinishSimulation(cost_aware_behaviours);
+  }
+
+  // Simulate the replicates of the ensemble one after the other. The
+  // parameters, including the tables computed by SimParam::Initialize, are
+  // copied from the registered SimParam instead of being recomputed. Each
+  // replicate writes its output to its own directory, and keeps its time
+  // series for the statistics of the ensemble.
+  std::vector<experimental::TimeSeries> replicates;
+  std::string ensemble_dir;
+  double ensemble_band = 0;
+  // Initial population of the first replicate, if it is shared
+  std::string initial_state;
+  for (uint64_t i = 0; i < ensemble_size; i++) {
+    auto set_replicate_param = [&](Param* param) {
+      set_param(param);
+      ensemble_dir = param->output_dir;
+      param->random_seed = DeriveReplicateSeed(param->random_seed, i);
+      param->output_dir += "/replicate_" + std::to_string(i);
+      auto* sparam = param->Get<SimParam>();
+      sparam->checkpoint_file += ".replicate_" + std::to_string(i);
+    };
+    Simulation simulation(argc, argv, set_replicate_param);
+    auto* sparam = simulation.GetParam()->Get<SimParam>();
+    std::cout << "Simulate replicate " << i << " of " << ensemble_size
+              << std::endl;
+    ensemble_band = sparam->ensemble_band;
+    bool restore = sparam->ensemble_share_population && i > 0;
+    auto* cost_aware_behaviours =
+        SetUpSimulation(&simulation, restore ? &initial_state : nullptr);
+    if (sparam->ensemble_share_population && i == 0) {
+      std::ostringstream state;
+      WriteCheckpointData(&state, 0);
+      initial_state = state.str();
+    }
+    {
+      Timing timer_sim("RUNTIME REPLICATE");
+      simulation.GetScheduler()->Simulate(sparam->number_of_iterations);
+    }
+    FinishSimulation(cost_aware_behaviours);
+    replicates.push_back(*simulation.GetTimeSeries());
+  }
+  if (ensemble_size > 0) {
+    auto filename = ensemble_dir + "/ensemble.json";
+    SaveEnsembleTimeSeries(replicates, ensemble_band, filename);
+    std::cout << "Info: <Simulate> Statistics of the ensemble were saved to "
+              << filename << std::endl;
+  }
+
+  if (calibration_param != nullptr) {
+    SimulateCalibration(argc, argv, set_param, calibration_param.get(),
+                        calibration_seed);
+  }
 
+  ranks->Finalize();
   return 0;
 }
 
@@ -0,0 +1,587 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "calibration.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+#include "biodynamo.h"
+#include "sim-param.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+bool CalibrationMonitor::enabled_ = false;
+
+std::vector<CalibrationTarget> ReadCalibrationTargets(
+    const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    Log::Fatal("ReadCalibrationTargets()", "Cannot open ", filename);
+  }
+  std::vector<CalibrationTarget> targets;
+  std::string line;
+  // Skip the header line
+  std::getline(file, line);
+  while (std::getline(file, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream stream(line);
+    CalibrationTarget target;
+    std::string year, value, tolerance;
+    if (!std::getline(stream, target.series, ',') ||
+        !std::getline(stream, year, ',') ||
+        !std::getline(stream, value, ',') ||
+        !std::getline(stream, tolerance, ',')) {
+      Log::Fatal("ReadCalibrationTargets()", "Malformed line '", line, "' in ",
+                 filename);
+    }
+    target.year = std::stoi(year);
+    target.value = std::stod(value);
+    target.tolerance = std::stod(tolerance);
+    if (!(target.tolerance > 0)) {
+      Log::Fatal("ReadCalibrationTargets()", "The tolerance of ",
+                 target.series, " in ", target.year, " must be positive");
+    }
+    targets.push_back(target);
+  }
+  return targets;
+}
+
+void SetCalibrationParameter(SimParam* sparam, const std::string& name,
+                             double value) {
+  if (name == "coef_infection_probability") {
+    // The infection probabilities were computed from the previous coefficient
+    float scale =
+        static_cast<float>(value) / sparam->coef_infection_probability;
+    for (auto* probability : {&sparam->infection_probability_acute_mf,
+                              &sparam->infection_probability_chronic_mf,
+                              &sparam->infection_probability_treated_mf,
+                              &sparam->infection_probability_failing_mf,
+                              &sparam->infection_probability_acute_fm,
+                              &sparam->infection_probability_chronic_fm,
+                              &sparam->infection_probability_treated_fm,
+                              &sparam->infection_probability_failing_fm,
+                              &sparam->infection_probability_acute_mm,
+                              &sparam->infection_probability_chronic_mm,
+                              &sparam->infection_probability_treated_mm,
+                              &sparam->infection_probability_failing_mm}) {
+      *probability *= scale;
+    }
+    sparam->coef_infection_probability = static_cast<float>(value);
+  } else if (name == "give_birth_probability") {
+    sparam->give_birth_probability = static_cast<float>(value);
+  } else if (name == "no_mates_mean_scale") {
+    for (auto& year_means : sparam->no_mates_mean) {
+      for (auto& mean : year_means) {
+        mean *= static_cast<float>(value);
+      }
+    }
+  } else if (name == "sociobehav_mixing_weight") {
+    for (auto& row : sparam->sociobehav_mixing_matrix) {
+      for (size_t sb = 1; sb < row.size(); sb++) {
+        row[sb] = static_cast<float>(value) * row[0];
+      }
+    }
+  } else {
+    Log::Fatal("SetCalibrationParameter()", "The parameter ", name,
+               " cannot be calibrated");
+  }
+}
+
+void CalibrationMonitor::Reset(bool enabled,
+                               const std::vector<CalibrationTarget>& targets,
+                               double band, double count_scale) {
+  enabled_ = enabled;
+  targets_ = targets;
+  band_ = band;
+  count_scale_ = count_scale;
+  rejected_ = false;
+  no_checked_ = 0;
+  sum_squared_deviations_ = 0;
+  max_deviation_ = 0;
+}
+
+void CalibrationMonitor::Check(const std::vector<std::string>& ids,
+                               double year,
+                               const std::vector<double>& values) {
+  for (const auto& target : targets_) {
+    if (target.year != static_cast<int>(std::lround(year))) {
+      continue;
+    }
+    auto it = std::find(ids.begin(), ids.end(), target.series);
+    if (it == ids.end()) {
+      Log::Fatal("CalibrationMonitor::Check()", "There is no series ",
+                 target.series);
+    }
+    double value = values[it - ids.begin()];
+    double deviation = std::abs(value - target.value) / target.tolerance;
+    // Values that are not finite (e.g. ratios of zero counts) are rejected
+    if (!std::isfinite(deviation)) {
+      deviation = band_;
+      rejected_ = true;
+    } else if (deviation > band_) {
+      rejected_ = true;
+    }
+    no_checked_++;
+    sum_squared_deviations_ += deviation * deviation;
+    max_deviation_ = std::max(max_deviation_, deviation);
+  }
+}
+
+double CalibrationMonitor::GetObjective() const {
+  return sum_squared_deviations_ +
+         (targets_.size() - no_checked_) * band_ * band_;
+}
+
+// Returns the parameters at the position x of the unit cube in the bounds
+static std::vector<double> Scale(const std::vector<double>& x,
+                                 const std::vector<double>& lower,
+                                 const std::vector<double>& upper) {
+  std::vector<double> parameters(x.size());
+  for (size_t k = 0; k < x.size(); k++) {
+    double position = std::min(std::max(x[k], 0.0), 1.0);
+    parameters[k] = lower[k] + position * (upper[k] - lower[k]);
+  }
+  return parameters;
+}
+
+std::vector<CalibrationRun> CalibrateAbcRejection(
+    const CalibrationSimulator& simulate, const std::vector<double>& lower,
+    const std::vector<double>& upper, uint64_t runs, uint64_t seed) {
+  std::mt19937_64 generator(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<CalibrationRun> results(runs);
+  for (auto& run : results) {
+    std::vector<double> x(lower.size());
+    for (auto& x_k : x) {
+      x_k = uniform(generator);
+    }
+    run.parameters = Scale(x, lower, upper);
+    run.band = 1;
+    simulate(&run);
+  }
+  return results;
+}
+
+// Returns the cumulative distribution function of the standard normal
+// distribution at x
+static double NormalDistribution(double x) {
+  return 0.5 * std::erfc(-x / std::sqrt(2.0));
+}
+
+std::vector<CalibrationRun> CalibrateAbcSmc(
+    const CalibrationSimulator& simulate, const std::vector<double>& lower,
+    const std::vector<double>& upper, uint64_t runs, uint64_t rounds,
+    double initial_band, uint64_t seed) {
+  std::mt19937_64 generator(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::normal_distribution<double> normal(0, 1);
+  size_t d = lower.size();
+  std::vector<CalibrationRun> results;
+  // Accepted parameter sets of the previous round, and their weights
+  std::vector<std::vector<double>> particles;
+  std::vector<double> weights;
+
+  for (uint64_t round = 0; round < rounds; round++) {
+    double exponent =
+        rounds > 1 ? static_cast<double>(rounds - 1 - round) / (rounds - 1) : 0;
+    double band = std::pow(initial_band, exponent);
+    // Gaussian perturbation kernel with twice the weighted variance of the
+    // previous particles
+    std::vector<double> sigma(d);
+    for (size_t k = 0; round > 0 && k < d; k++) {
+      double mean = 0, variance = 0;
+      for (size_t j = 0; j < particles.size(); j++) {
+        mean += weights[j] * particles[j][k];
+      }
+      for (size_t j = 0; j < particles.size(); j++) {
+        variance += weights[j] * std::pow(particles[j][k] - mean, 2);
+      }
+      sigma[k] =
+          std::max(std::sqrt(2 * variance), 1e-6 * (upper[k] - lower[k]));
+    }
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    // Probability that the kernel around each particle lies within the
+    // bounds, which normalizes the kernel truncated to the bounds
+    std::vector<double> kernel_mass(particles.size(), 1);
+    for (size_t j = 0; j < particles.size(); j++) {
+      for (size_t k = 0; k < d; k++) {
+        kernel_mass[j] *=
+            NormalDistribution((upper[k] - particles[j][k]) / sigma[k]) -
+            NormalDistribution((lower[k] - particles[j][k]) / sigma[k]);
+      }
+    }
+
+    std::vector<std::vector<double>> accepted;
+    std::vector<double> accepted_weights;
+    for (uint64_t i = 0; i < runs; i++) {
+      CalibrationRun run;
+      if (round == 0) {
+        std::vector<double> x(d);
+        for (auto& x_k : x) {
+          x_k = uniform(generator);
+        }
+        run.parameters = Scale(x, lower, upper);
+      } else {
+        // Perturb a previous particle until it lies within the bounds
+        const auto& particle = particles[pick(generator)];
+        run.parameters.resize(d);
+        for (size_t k = 0; k < d; k++) {
+          double value;
+          do {
+            value = particle[k] + sigma[k] * normal(generator);
+          } while (value < lower[k] || value > upper[k]);
+          run.parameters[k] = value;
+        }
+      }
+      run.round = round;
+      run.band = band;
+      simulate(&run);
+      results.push_back(run);
+      if (!run.accepted) {
+        continue;
+      }
+      // Importance weight for the uniform prior: the inverse density of the
+      // proposal (up to a constant), whose kernels are truncated to the bounds
+      double weight = 1;
+      if (round > 0) {
+        double density = 0;
+        for (size_t j = 0; j < particles.size(); j++) {
+          double squared_distance = 0;
+          for (size_t k = 0; k < d; k++) {
+            squared_distance += std::pow(
+                (run.parameters[k] - particles[j][k]) / sigma[k], 2);
+          }
+          if (kernel_mass[j] > 0) {
+            density += weights[j] * std::exp(-0.5 * squared_distance) /
+                       kernel_mass[j];
+          }
+        }
+        weight = density > 0 ? 1 / density : 0;
+      }
+      accepted.push_back(run.parameters);
+      accepted_weights.push_back(weight);
+    }
+
+    double sum =
+        std::accumulate(accepted_weights.begin(), accepted_weights.end(), 0.0);
+    if (accepted.empty() || !(sum > 0)) {
+      Log::Warning("CalibrateAbcSmc()", "No parameter set was accepted in ",
+                   "round ", round, " (band ", band, ")");
+      break;
+    }
+    for (auto& weight : accepted_weights) {
+      weight /= sum;
+    }
+    particles = std::move(accepted);
+    weights = std::move(accepted_weights);
+  }
+  return results;
+}
+
+std::vector<CalibrationRun> CalibrateNelderMead(
+    const CalibrationSimulator& simulate, const std::vector<double>& lower,
+    const std::vector<double>& upper, uint64_t runs, double abort_band) {
+  size_t d = lower.size();
+  std::vector<CalibrationRun> results;
+  // Simulates the parameters at x in the unit cube, unless no runs are left
+  auto evaluate = [&](const std::vector<double>& x) {
+    if (results.size() >= runs) {
+      return std::numeric_limits<double>::infinity();
+    }
+    CalibrationRun run;
+    run.parameters = Scale(x, lower, upper);
+    run.band = abort_band;
+    simulate(&run);
+    results.push_back(run);
+    return run.objective;
+  };
+  // Returns a + factor * (b - a)
+  auto step = [&](const std::vector<double>& a, const std::vector<double>& b,
+                  double factor) {
+    std::vector<double> x(d);
+    for (size_t k = 0; k < d; k++) {
+      x[k] = std::min(std::max(a[k] + factor * (b[k] - a[k]), 0.0), 1.0);
+    }
+    return x;
+  };
+
+  // Initial simplex around the center of the bounds
+  std::vector<std::vector<double>> simplex(d + 1, std::vector<double>(d, 0.5));
+  std::vector<double> values(d + 1);
+  for (size_t i = 0; i <= d; i++) {
+    if (i > 0) {
+      simplex[i][i - 1] += 0.25;
+    }
+    values[i] = evaluate(simplex[i]);
+  }
+
+  while (results.size() < runs) {
+    // Order the vertices from the best to the worst
+    std::vector<size_t> order(d + 1);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return values[a] < values[b]; });
+    std::vector<std::vector<double>> sorted_simplex;
+    std::vector<double> sorted_values;
+    for (auto i : order) {
+      sorted_simplex.push_back(simplex[i]);
+      sorted_values.push_back(values[i]);
+    }
+    simplex = std::move(sorted_simplex);
+    values = std::move(sorted_values);
+
+    // Stop if the simplex collapsed
+    double size = 0;
+    for (size_t i = 1; i <= d; i++) {
+      for (size_t k = 0; k < d; k++) {
+        size = std::max(size, std::abs(simplex[i][k] - simplex[0][k]));
+      }
+    }
+    if (size < 1e-6) {
+      break;
+    }
+
+    std::vector<double> centroid(d, 0);
+    for (size_t i = 0; i < d; i++) {
+      for (size_t k = 0; k < d; k++) {
+        centroid[k] += simplex[i][k] / d;
+      }
+    }
+    auto& worst = simplex[d];
+    auto reflected = step(centroid, worst, -1);
+    double reflected_value = evaluate(reflected);
+    if (reflected_value < values[0]) {
+      auto expanded = step(centroid, worst, -2);
+      double expanded_value = evaluate(expanded);
+      if (expanded_value < reflected_value) {
+        worst = expanded;
+        values[d] = expanded_value;
+      } else {
+        worst = reflected;
+        values[d] = reflected_value;
+      }
+    } else if (reflected_value < values[d - 1]) {
+      worst = reflected;
+      values[d] = reflected_value;
+    } else {
+      // Contract towards the better of the reflected and the worst vertex
+      bool outside = reflected_value < values[d];
+      auto contracted = step(centroid, outside ? reflected : worst, 0.5);
+      double contracted_value = evaluate(contracted);
+      if (contracted_value < std::min(reflected_value, values[d])) {
+        worst = contracted;
+        values[d] = contracted_value;
+      } else {
+        // Shrink towards the best vertex
+        for (size_t i = 1; i <= d; i++) {
+          simplex[i] = step(simplex[0], simplex[i], 0.5);
+          values[i] = evaluate(simplex[i]);
+        }
+      }
+    }
+  }
+  return results;
+}
+
+// Returns the ranks of values (starting at 0), with the mean rank for ties
+static std::vector<double> Ranks(const std::vector<double>& values) {
+  std::vector<size_t> order(values.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return values[a] < values[b]; });
+  std::vector<double> ranks(values.size());
+  for (size_t i = 0; i < order.size();) {
+    size_t j = i;
+    while (j + 1 < order.size() && values[order[j + 1]] == values[order[i]]) {
+      j++;
+    }
+    for (size_t k = i; k <= j; k++) {
+      ranks[order[k]] = 0.5 * (i + j);
+    }
+    i = j + 1;
+  }
+  return ranks;
+}
+
+double RankCorrelation(const std::vector<double>& a,
+                       const std::vector<double>& b) {
+  auto rank_a = Ranks(a);
+  auto rank_b = Ranks(b);
+  size_t n = a.size();
+  double mean = n > 0 ? 0.5 * (n - 1) : 0;
+  double covariance = 0, variance_a = 0, variance_b = 0;
+  for (size_t i = 0; i < n; i++) {
+    covariance += (rank_a[i] - mean) * (rank_b[i] - mean);
+    variance_a += std::pow(rank_a[i] - mean, 2);
+    variance_b += std::pow(rank_b[i] - mean, 2);
+  }
+  if (!(variance_a > 0) || !(variance_b > 0)) {
+    return std::nan("");
+  }
+  return covariance / std::sqrt(variance_a * variance_b);
+}
+
+std::vector<CalibrationRun> CalibrateSuccessiveHalving(
+    const CalibrationSimulator& simulate, const std::vector<double>& lower,
+    const std::vector<double>& upper, uint64_t runs,
+    const std::vector<uint64_t>& population_sizes, double promotion_fraction,
+    double abort_band, uint64_t seed, std::vector<CalibrationLevel>* levels) {
+  if (population_sizes.empty()) {
+    Log::Fatal("CalibrateSuccessiveHalving()",
+               "calibration_population_sizes is empty");
+  }
+  std::mt19937_64 generator(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<std::vector<double>> candidates(runs);
+  for (auto& candidate : candidates) {
+    std::vector<double> x(lower.size());
+    for (auto& x_k : x) {
+      x_k = uniform(generator);
+    }
+    candidate = Scale(x, lower, upper);
+  }
+
+  std::vector<CalibrationRun> results;
+  // Candidates of the current level, and their objectives in the previous one
+  std::vector<size_t> alive(runs);
+  std::iota(alive.begin(), alive.end(), 0);
+  std::vector<double> previous_objectives;
+  for (size_t l = 0; l < population_sizes.size() && !alive.empty(); l++) {
+    CalibrationLevel level;
+    level.population_size = population_sizes[l];
+    level.candidates = alive.size();
+    std::vector<double> objectives(alive.size());
+    for (size_t i = 0; i < alive.size(); i++) {
+      CalibrationRun run;
+      run.parameters = candidates[alive[i]];
+      run.round = l;
+      run.band = abort_band;
+      run.population_size = population_sizes[l];
+      simulate(&run);
+      results.push_back(run);
+      objectives[i] = run.objective;
+      level.runtime += run.runtime;
+      level.steps += run.steps;
+    }
+    level.rank_correlation = l > 0 ? RankCorrelation(previous_objectives,
+                                                     objectives)
+                                   : std::nan("");
+
+    // Promote the best candidates to the next level
+    if (l + 1 < population_sizes.size()) {
+      std::vector<size_t> order(alive.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return objectives[a] < objectives[b];
+      });
+      auto no_promoted = static_cast<size_t>(
+          std::ceil(promotion_fraction * alive.size()));
+      no_promoted = std::min(std::max(no_promoted, size_t{1}), alive.size());
+      std::vector<size_t> promoted;
+      previous_objectives.clear();
+      for (size_t i = 0; i < no_promoted; i++) {
+        promoted.push_back(alive[order[i]]);
+        previous_objectives.push_back(objectives[order[i]]);
+      }
+      alive = std::move(promoted);
+      level.promoted = no_promoted;
+    }
+    if (levels != nullptr) {
+      levels->push_back(level);
+    }
+  }
+  return results;
+}
+
+std::vector<CalibrationRun> Calibrate(const SimParam* sparam, uint64_t seed,
+                                      const std::vector<double>& lower,
+                                      const std::vector<double>& upper,
+                                      const CalibrationSimulator& simulate,
+                                      std::vector<CalibrationLevel>* levels) {
+  const auto& method = sparam->calibration_method;
+  if (method == "abc_rejection") {
+    return CalibrateAbcRejection(simulate, lower, upper,
+                                 sparam->calibration_runs,
+                                 seed);
+  } else if (method == "abc_smc") {
+    return CalibrateAbcSmc(simulate, lower, upper, sparam->calibration_runs,
+                           sparam->calibration_rounds,
+                           sparam->calibration_initial_band,
+                           seed);
+  } else if (method == "nelder_mead") {
+    return CalibrateNelderMead(simulate, lower, upper,
+                               sparam->calibration_runs,
+                               sparam->calibration_abort_band);
+  } else if (method == "successive_halving") {
+    return CalibrateSuccessiveHalving(
+        simulate, lower, upper, sparam->calibration_runs,
+        sparam->calibration_population_sizes,
+        sparam->calibration_promotion_fraction,
+        sparam->calibration_abort_band, seed, levels);
+  }
+  Log::Fatal("Calibrate()", "Unknown calibration_method ", method);
+  return {};
+}
+
+void SaveCalibrationRuns(const std::vector<CalibrationRun>& runs,
+                         const std::vector<std::string>& parameter_names,
+                         const std::string& filename) {
+  std::ofstream file(filename, std::ios::trunc);
+  if (!file.is_open()) {
+    Log::Fatal("SaveCalibrationRuns()", "Cannot create ", filename);
+  }
+  file << "run,round,band,population_size";
+  for (const auto& name : parameter_names) {
+    file << "," << name;
+  }
+  file << ",objective,max_deviation,accepted,steps,runtime\n";
+  file << std::setprecision(std::numeric_limits<double>::max_digits10);
+  for (size_t i = 0; i < runs.size(); i++) {
+    const auto& run = runs[i];
+    file << i << "," << run.round << "," << run.band << ","
+         << run.population_size;
+    for (auto parameter : run.parameters) {
+      file << "," << parameter;
+    }
+    file << "," << run.objective << "," << run.max_deviation << ","
+         << run.accepted << "," << run.steps << "," << run.runtime << "\n";
+  }
+}
+
+void SaveCalibrationLevels(const std::vector<CalibrationLevel>& levels,
+                           const std::string& filename) {
+  std::ofstream file(filename, std::ios::trunc);
+  if (!file.is_open()) {
+    Log::Fatal("SaveCalibrationLevels()", "Cannot create ", filename);
+  }
+  file << "level,population_size,candidates,promoted,runtime,steps,"
+       << "rank_correlation\n";
+  file << std::setprecision(std::numeric_limits<double>::max_digits10);
+  for (size_t l = 0; l < levels.size(); l++) {
+    const auto& level = levels[l];
+    file << l << "," << level.population_size << "," << level.candidates
+         << "," << level.promoted << "," << level.runtime << "," << level.steps
+         << "," << level.rank_correlation << "\n";
+  }
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,213 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bdm {
+namespace hiv_malawi {
+
+class SimParam;
+
+////////////////////////////////////////////////////////////////////////////////
+// Calibration of parameters against observed series (see calibration_method).
+// Each candidate parameter set is simulated, and its trajectory is compared
+// with the targets whenever the collectors are evaluated in a target year. The
+// deviation from a target is measured in units of its tolerance. A simulation
+// whose deviation from any target exceeds the band of the search is aborted,
+// since the remaining years cannot make it acceptable.
+////////////////////////////////////////////////////////////////////////////////
+
+// Observed value of a series (an id of the TimeSeries, e.g. prevalence) in a
+// year, with the tolerated deviation of the simulated value
+struct CalibrationTarget {
+  std::string series;
+  int year;
+  double value;
+  double tolerance;
+};
+
+// Reads targets from a CSV file with a header line and one target per line:
+// series,year,value,tolerance
+std::vector<CalibrationTarget> ReadCalibrationTargets(
+    const std::string& filename);
+
+// Sets the calibrated parameter name to value, together with the parameters
+// derived from it. Supported are coef_infection_probability (which scales the
+// infection probabilities), give_birth_probability, no_mates_mean_scale (a
+// factor of all no_mates_mean) and sociobehav_mixing_weight (the weight of
+// high-risk casual partners in sociobehav_mixing_matrix, relative to
+// low-risk ones).
+void SetCalibrationParameter(SimParam* sparam, const std::string& name,
+                             double value);
+
+// Compares the trajectory of the active simulation with the targets
+class CalibrationMonitor {
+ public:
+  static CalibrationMonitor* GetInstance() {
+    static CalibrationMonitor instance;
+    return &instance;
+  }
+
+  // Returns true if the trajectory is compared with targets
+  static bool IsEnabled() { return enabled_; }
+
+  // Forgets the previous trajectory, e.g. at the beginning of a simulation.
+  // The trajectory is rejected once its deviation from a target exceeds band.
+  // The collectors, which count persons, are multiplied by count_scale before
+  // the comparison, e.g. to compare a smaller population with the targets.
+  void Reset(bool enabled, const std::vector<CalibrationTarget>& targets,
+             double band, double count_scale = 1);
+
+  // Returns the factor of the collectors
+  double GetCountScale() const { return count_scale_; }
+
+  // Compares the values of the series ids collected in year with the targets
+  // of this year
+  void Check(const std::vector<std::string>& ids, double year,
+             const std::vector<double>& values);
+
+  // Returns true if the trajectory left the band
+  bool IsRejected() const { return rejected_; }
+
+  // Returns true if the trajectory was compared with all targets and never
+  // left the band
+  bool IsAccepted() const {
+    return !rejected_ && no_checked_ == targets_.size();
+  }
+
+  // Returns the sum of the squared deviations. Targets that were not reached
+  // (e.g. after a rejection) count as deviations of band.
+  double GetObjective() const;
+
+  // Returns the largest deviation from the targets compared so far
+  double GetMaxDeviation() const { return max_deviation_; }
+
+ private:
+  CalibrationMonitor() {}
+
+  static bool enabled_;
+  std::vector<CalibrationTarget> targets_;
+  double band_ = 1;
+  double count_scale_ = 1;
+  bool rejected_ = false;
+  uint64_t no_checked_ = 0;
+  double sum_squared_deviations_ = 0;
+  double max_deviation_ = 0;
+};
+
+// Simulation of a candidate parameter set during the calibration
+struct CalibrationRun {
+  // Values of the calibrated parameters
+  std::vector<double> parameters;
+  // Round of abc_smc or level of successive_halving (0 for the other
+  // methods), and the band in which the trajectory had to stay
+  uint64_t round = 0;
+  double band = 1;
+  // Initial population size of the simulation (0: initial_population_size)
+  uint64_t population_size = 0;
+  // Results of the simulation, see CalibrationMonitor
+  double objective = 0;
+  double max_deviation = 0;
+  bool accepted = false;
+  // Number of simulated iterations, and runtime of the simulation in seconds
+  uint64_t steps = 0;
+  double runtime = 0;
+};
+
+// Population size of a level of successive_halving, with the cost of its
+// simulations and the agreement of its ranking with the previous level
+struct CalibrationLevel {
+  uint64_t population_size = 0;
+  // Number of simulated and of promoted parameter sets
+  uint64_t candidates = 0;
+  uint64_t promoted = 0;
+  // Summed runtime (seconds) and iterations of the simulations
+  double runtime = 0;
+  uint64_t steps = 0;
+  // Rank correlation between the objectives of the candidates in this level
+  // and in the previous one (NaN in the first level)
+  double rank_correlation = 0;
+};
+
+// Simulates run->parameters and sets the results of run
+using CalibrationSimulator = std::function<void(CalibrationRun* run)>;
+
+// Samples calibration_runs parameter sets uniformly from the bounds, and
+// accepts those whose trajectory stays within the tolerances (band 1)
+std::vector<CalibrationRun> CalibrateAbcRejection(
+    const CalibrationSimulator& simulate, const std::vector<double>& lower,
+    const std::vector<double>& upper, uint64_t runs, uint64_t seed);
+
+// Sequential Monte Carlo ABC: the first round samples from the bounds, the
+// following ones perturb the parameter sets accepted in the previous round
+// with a Gaussian kernel truncated to the bounds, and weight them by the
+// inverse density of this proposal. The band shrinks geometrically from
+// initial_band in the first round to 1 in the last one. Each round simulates
+// runs parameter sets.
+std::vector<CalibrationRun> CalibrateAbcSmc(
+    const CalibrationSimulator& simulate, const std::vector<double>& lower,
+    const std::vector<double>& upper, uint64_t runs, uint64_t rounds,
+    double initial_band, uint64_t seed);
+
+// Minimizes the objective with the Nelder-Mead simplex method within the
+// bounds, with at most runs simulations. Simulations are aborted outside of
+// abort_band.
+std::vector<CalibrationRun> CalibrateNelderMead(
+    const CalibrationSimulator& simulate, const std::vector<double>& lower,
+    const std::vector<double>& upper, uint64_t runs, double abort_band);
+
+// Multi-fidelity search by successive halving: samples runs parameter sets
+// uniformly from the bounds and simulates them with the first population
+// size. Only the fraction promotion_fraction with the smallest objectives is
+// simulated again with the next population size, and so on. Simulations are
+// aborted outside of abort_band. The cost and the ranking agreement of each
+// population size are appended to levels.
+std::vector<CalibrationRun> CalibrateSuccessiveHalving(
+    const CalibrationSimulator& simulate, const std::vector<double>& lower,
+    const std::vector<double>& upper, uint64_t runs,
+    const std::vector<uint64_t>& population_sizes, double promotion_fraction,
+    double abort_band, uint64_t seed, std::vector<CalibrationLevel>* levels);
+
+// Returns the Spearman rank correlation of a and b (NaN if a or b is
+// constant)
+double RankCorrelation(const std::vector<double>& a,
+                       const std::vector<double>& b);
+
+// Calibrates with the method and the settings of sparam. The random numbers
+// of the search are drawn from seed. The levels of successive_halving are
+// appended to levels.
+std::vector<CalibrationRun> Calibrate(const SimParam* sparam, uint64_t seed,
+                                      const std::vector<double>& lower,
+                                      const std::vector<double>& upper,
+                                      const CalibrationSimulator& simulate,
+                                      std::vector<CalibrationLevel>* levels);
+
+// Writes the runs to a CSV file with one line per run
+void SaveCalibrationRuns(const std::vector<CalibrationRun>& runs,
+                         const std::vector<std::string>& parameter_names,
+                         const std::string& filename);
+
+// Writes the levels of successive_halving to a CSV file with one line per
+// level
+void SaveCalibrationLevels(const std::vector<CalibrationLevel>& levels,
+                           const std::string& filename);
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // CALIBRATION_H_
@@ -13,6 +13,7 @@
 #include "categorical-environment.h"
 #include "biodynamo.h"
 #include "core/algorithm.h"
+#include "district-ranks.h"
 
 namespace bdm {
 namespace hiv_malawi {
@@ -95,6 +96,63 @@ void AgentVector::UpdateOffsets() {
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// CompoundCategoryLoadBalanceInfo
+////////////////////////////////////////////////////////////////////////////////
+
+// Iterates over a range of sorted agent handles
+struct SortedHandleIterator : public Iterator<AgentHandle> {
+  const AgentHandle* current_;
+  const AgentHandle* end_;
+
+  SortedHandleIterator(const AgentHandle* begin, const AgentHandle* end)
+      : current_(begin), end_(end) {}
+
+  bool HasNext() const override { return current_ < end_; }
+
+  AgentHandle Next() override { return *current_++; }
+};
+
+void CompoundCategoryLoadBalanceInfo::Update(CategoricalEnvironment* env) {
+  auto* sim = Simulation::GetActive();
+  auto* rm = sim->GetResourceManager();
+  int year = static_cast<int>(sim->GetParam()->Get<SimParam>()->start_year +
+                              sim->GetScheduler()->GetSimulatedSteps());
+
+  // Sort key: compound category, then sex. Children are sorted into the
+  // first age category of their location.
+  std::vector<std::pair<size_t, AgentHandle>> keys;
+  keys.reserve(rm->GetNumAgents());
+  rm->ForEachAgent([&](Agent* agent, AgentHandle ah) {
+    auto* person = bdm_static_cast<Person*>(agent);
+    int age_category = std::max(
+        0, person->GetAgeCategory(year, env->GetMinAge(),
+                                  env->GetNoAgeCategories()));
+    size_t compound_index = env->ComputeCompoundIndex(
+        person->location_, age_category, person->social_behaviour_factor_);
+    keys.emplace_back(compound_index * 2 + person->sex_, ah);
+  });
+  // Keep the current order within each category
+  std::stable_sort(keys.begin(), keys.end(),
+                   [](const auto& lhs, const auto& rhs) {
+                     return lhs.first < rhs.first;
+                   });
+
+  sorted_handles_.resize(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    sorted_handles_[i] = keys[i].second;
+  }
+}
+
+void CompoundCategoryLoadBalanceInfo::CallHandleIteratorConsumer(
+    uint64_t start, uint64_t end,
+    Functor<void, Iterator<AgentHandle>*>& f) const {
+  assert(start <= end && end <= sorted_handles_.size());
+  SortedHandleIterator it(sorted_handles_.data() + start,
+                          sorted_handles_.data() + end);
+  f(&it);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // CategoricalEnvironment
 ////////////////////////////////////////////////////////////////////////////////
@@ -117,7 +175,23 @@ CategoricalEnvironment::CategoricalEnvironment(
                            no_sociobehavioural_categories),
       mothers_(no_locations),
       adults_(no_locations),
-      mothers_are_assiged_(false) {}
+      mothers_are_assiged_(false) {
+  skipped_casual_contacts_.resize(ThreadInfo::GetInstance()->GetMaxThreads());
+  for (auto& el : skipped_casual_contacts_) {
+    el.resize(
+        no_age_categories * no_locations * no_sociobehavioural_categories, 0);
+  }
+  executing_district_.resize(ThreadInfo::GetInstance()->GetMaxThreads(), -1);
+  remote_casual_contacts_.resize(ThreadInfo::GetInstance()->GetMaxThreads());
+  for (auto& el : remote_casual_contacts_) {
+    el.resize(no_locations);
+  }
+  remote_family_links_.resize(ThreadInfo::GetInstance()->GetMaxThreads());
+  rank_casual_contacts_.resize(ThreadInfo::GetInstance()->GetMaxThreads());
+  for (auto& el : rank_casual_contacts_) {
+    el.resize(DistrictRanks::GetInstance()->GetNoRanks());
+  }
+}
 
 // AM : Update probability to select a female mate from each location x age x sb
 // compound category. Depends on static mixing matrices and updated number of
@@ -137,6 +211,34 @@ void CategoricalEnvironment::UpdateImplementation() {
   casual_female_agents_.resize(no_age_categories_ * no_locations_ *
                                no_sociobehavioural_categories_);
 
+  for (auto& el : casual_healthy_female_agents_) {
+    el.Clear();
+  }
+  casual_healthy_female_agents_.resize(no_age_categories_ * no_locations_ *
+                                       no_sociobehavioural_categories_);
+
+  for (auto& el : casual_infected_female_agents_) {
+    el.Clear();
+  }
+  casual_infected_female_agents_.resize(no_age_categories_ * no_locations_ *
+                                        no_sociobehavioural_categories_);
+
+  for (auto& el : casual_female_state_agents_) {
+    el.Clear();
+  }
+  // Whether casual female partners are also indexed by HIV state, for the
+  // casual contacts with other ranks or with other districts
+  bool index_by_hiv_state = DistrictRanks::GetInstance()->IsDistributed() ||
+                            Simulation::GetActive()
+                                ->GetParam()
+                                ->Get<SimParam>()
+                                ->district_partitioned_execution;
+  casual_female_state_agents_.resize(
+      index_by_hiv_state ? no_age_categories_ * no_locations_ *
+                               no_sociobehavioural_categories_ *
+                               GemsState::kGemsLast
+                         : 0);
+
   for (auto& el : regular_female_agents_) {
     el.Clear();
   }
@@ -167,7 +269,23 @@ void CategoricalEnvironment::UpdateImplementation() {
   // Index females (by location x age x sociobehaviour for casual and regular
   // partnerships), and adults (by location for location attractivity)
   auto* rm = Simulation::GetActive()->GetResourceManager();
-  auto assign_to_indices = L2F([](Agent* agent) {
+  // Current year, from which the age of the agents is derived
+  int year = static_cast<int>(
+      Simulation::GetActive()->GetParam()->Get<SimParam>()->start_year +
+      Simulation::GetActive()->GetScheduler()->GetSimulatedSteps());
+  // Whether casual female partners are also indexed by HIV state
+  bool index_by_state = Simulation::GetActive()
+                            ->GetParam()
+                            ->Get<SimParam>()
+                            ->skip_non_transmissive_casual_contacts;
+  // Whether the persons are counted by district, sex, age band and HIV state
+  bool count_pyramid =
+      Simulation::GetActive()->GetParam()->Get<SimParam>()->district_pyramid;
+  if (count_pyramid) {
+    ClearDistrictPyramid();
+  }
+  auto assign_to_indices = L2F([year, index_by_state, index_by_hiv_state,
+                                count_pyramid](Agent* agent) {
     auto* env = bdm_static_cast<CategoricalEnvironment*>(
         Simulation::GetActive()->GetEnvironment());
     auto* person = bdm_static_cast<Person*>(agent);
@@ -180,17 +298,21 @@ void CategoricalEnvironment::UpdateImplementation() {
     // person->no_casual_partners_ = 0;
 
     // Adults
-    if (person->age_ >= env->GetMinAge()) {
+    int age = person->GetAge(year);
+    if (count_pyramid) {
+      env->AddToDistrictPyramid(person, age);
+    }
+    if (age >= env->GetMinAge()) {
       AgentPointer<Person> person_ptr = person->GetAgentPtr<Person>();
       if (person_ptr == nullptr) {
         Log::Fatal("CategoricalEnvironment::UpdateImplementation()",
                    "person_ptr is nullptr");
       }
       // Under max_age_
-      if (person->age_ <= env->GetMaxAge()) {
+      if (age < env->GetMaxAge()) {
         // Compute age category of agent
-        size_t age_category =
-            person->GetAgeCategory(env->GetMinAge(), env->GetNoAgeCategories());
+        size_t age_category = person->GetAgeCategory(
+            year, env->GetMinAge(), env->GetNoAgeCategories());
         // Adult women under max_age_ are potential casual partners
         if (person->sex_ == Sex::kFemale) {
           // Add female agent to the right index, based on her location, age
@@ -198,6 +320,18 @@ void CategoricalEnvironment::UpdateImplementation() {
           env->AddCasualFemaleToIndex(person_ptr, person->location_,
                                       age_category,
                                       person->social_behaviour_factor_);
+          if (index_by_state) {
+            env->AddCasualFemaleToStateIndex(person_ptr, person->location_,
+                                             age_category,
+                                             person->social_behaviour_factor_);
+          }
+          if (index_by_hiv_state) {
+            env->AddCasualFemaleToHivStateIndex(
+                person_ptr,
+                env->ComputeCompoundIndex(person->location_, age_category,
+                                          person->social_behaviour_factor_),
+                person->state_);
+          }
         } else {
           // Adult male under max_age_ are potential casual partners
           // Add male agent to the right index, based on his location, age
@@ -209,8 +343,8 @@ void CategoricalEnvironment::UpdateImplementation() {
       // Adult single women are potential regular partners
       if (person->sex_ == Sex::kFemale && person->hasPartner() == false) {
         // Compute age category of female agent
-        size_t age_category =
-            person->GetAgeCategory(env->GetMinAge(), env->GetNoAgeCategories());
+        size_t age_category = person->GetAgeCategory(
+            year, env->GetMinAge(), env->GetNoAgeCategories());
         // Add female agent to the right index, based on her location, age
         // category and socio-behavioural category
         env->AddRegularFemaleToIndex(person_ptr, person->location_,
@@ -245,6 +379,12 @@ void CategoricalEnvironment::UpdateImplementation() {
       }*/
   });
   rm->ForEachAgentParallel(assign_to_indices);
+  if (index_by_hiv_state) {
+    UpdateGlobalCounts();
+  }
+  if (count_pyramid) {
+    MergeDistrictPyramid();
+  }
 
   // During first iteration, assign mothers to children
   // Note: Ignore for parallelization because it is only executed once at the
@@ -260,7 +400,7 @@ void CategoricalEnvironment::UpdateImplementation() {
     mothers_.clear();
     mothers_.resize(no_locations_);
 
-    rm->ForEachAgent([](Agent* agent) {
+    rm->ForEachAgent([year](Agent* agent) {
       auto* env = bdm_static_cast<CategoricalEnvironment*>(
           Simulation::GetActive()->GetEnvironment());
       auto* person = bdm_static_cast<Person*>(agent);
@@ -270,8 +410,9 @@ void CategoricalEnvironment::UpdateImplementation() {
       }
 
       // TO DO AM: Change to MaxAgeBirth
-      if (person->sex_ == Sex::kFemale && person->age_ >= env->GetMinAge() &&
-          person->age_ <= env->GetMaxAge()) {
+      if (person->sex_ == Sex::kFemale &&
+          person->GetAge(year) >= env->GetMinAge() &&
+          person->GetAge(year) < env->GetMaxAge()) {
         AgentPointer<Person> person_ptr = person->GetAgentPtr<Person>();
         if (person_ptr == nullptr) {
           Log::Fatal("CategoricalEnvironment::UpdateImplementation()",
@@ -294,9 +435,9 @@ void CategoricalEnvironment::UpdateImplementation() {
                    "person is nullptr");
       }
 
-      if (person->age_ < env->GetMinAge()) {
-        // std::cout << "I am a child (" << person->age_ << ") looking for a
-        // mother at location " << person->location_ << std::endl;
+      if (person->GetAge(year) < env->GetMinAge()) {
+        // std::cout << "I am a child (" << person->GetAge(year) << ") looking
+        // for a mother at location " << person->location_ << std::endl;
         // Select a mother, at same location as child
         // TO DO AM: ideally, mother is at least 15 and at most 40 years older
         // than child
@@ -354,6 +495,10 @@ void CategoricalEnvironment::UpdateImplementation() {
       sim->GetParam()->Get<SimParam>();  // AM : Needed to get mixing matrices
   auto* random = sim->GetRandom();       // : Needed for sampling
 
+  if (sparam->fast_bernoulli) {
+    bernoulli_thresholds_.Update(sparam);
+  }
+
   // Regular Partnership Updates
   // AM : Update probability matrix to select regular female partner
   // given location, age and socio-behaviour of male agent
@@ -369,12 +514,12 @@ void CategoricalEnvironment::UpdateImplementation() {
       Log::Fatal("CategoricalEnvironment::UpdateImplementation()",
                  "person is nullptr");
     }
-    if (person->sex_ == Sex::kMale && person->IsAdult() &&
+    if (person->sex_ == Sex::kMale && person->IsAdult(year) &&
         !person->hasPartner() && person->seek_regular_partnership_ == true) {
       AgentPointer<Person> person_ptr = person->GetAgentPtr<Person>();
       // Compute man's compound category
-      size_t age_category =
-          person->GetAgeCategory(env->GetMinAge(), env->GetNoAgeCategories());
+      size_t age_category = person->GetAgeCategory(year, env->GetMinAge(),
+                                                   env->GetNoAgeCategories());
       size_t man_compound_index = ComputeCompoundIndex(
           person->location_, age_category, person->social_behaviour_factor_);
       // Get man's partner category distribution
@@ -416,8 +561,7 @@ void CategoricalEnvironment::UpdateImplementation() {
         std::vector<int> v(no_females);
         std::iota(std::begin(v), std::end(v), 0);
         // Shuffle female indexes
-        std::random_device rd;
-        std::mt19937 g(rd());
+        std::mt19937 g(DrawSeed(sim->GetRandom()));
         std::shuffle(v.begin(), v.end(), g);
         // Male select Females
         for (size_t i = 0; i < no_males; i++) {
@@ -437,8 +581,7 @@ void CategoricalEnvironment::UpdateImplementation() {
         std::vector<int> v(no_males);
         std::iota(std::begin(v), std::end(v), 0);
         // Shuffle male indexes
-        std::random_device rd;
-        std::mt19937 g(rd());
+        std::mt19937 g(DrawSeed(sim->GetRandom()));
         std::shuffle(v.begin(), v.end(), g);
         // Females select Males
         for (size_t i = 0; i < no_females; i++) {
@@ -459,9 +602,6 @@ void CategoricalEnvironment::UpdateImplementation() {
   }
 
   // AM: Probability of migration location depends on the current year
-  int year = static_cast<int>(
-      sparam->start_year +
-      sim->GetScheduler()->GetSimulatedSteps());  // Current year
   // If no transition year is higher than current year, then use last
   // transition year
   int year_index = sparam->migration_year_transition.size() - 1;
@@ -480,8 +620,43 @@ void CategoricalEnvironment::UpdateImplementation() {
   UpdateCasualPartnerCategoryDistribution(sparam->location_mixing_matrix,
                                           sparam->age_mixing_matrix,
                                           sparam->sociobehav_mixing_matrix);
+  if (sparam->skip_non_transmissive_casual_contacts) {
+    UpdateInfectedCasualPartnerCategoryDistribution();
+  }
 };
 
+void CategoricalEnvironment::UpdateInfectedCasualPartnerCategoryDistribution() {
+  size_t no_compound_categories =
+      no_locations_ * no_age_categories_ * no_sociobehavioural_categories_;
+  mate_infected_compound_category_distribution_.resize(no_compound_categories);
+
+  // Share of infected women per compound category
+  std::vector<float> infected_share(no_compound_categories, 0.0);
+  for (size_t j = 0; j < no_compound_categories; j++) {
+    size_t no_females = casual_female_agents_[j].GetNumAgents();
+    if (no_females > 0) {
+      infected_share[j] =
+          static_cast<float>(casual_infected_female_agents_[j].GetNumAgents()) /
+          no_females;
+    }
+  }
+
+#pragma omp parallel for
+  for (size_t i = 0; i < no_compound_categories;
+       i++) {  // Loop over male agent compound categories
+    const auto& distribution = mate_compound_category_distribution_[i];
+    auto& infected_distribution =
+        mate_infected_compound_category_distribution_[i];
+    infected_distribution.resize(no_compound_categories);
+    float cumulative = 0.0;
+    for (size_t j = 0; j < no_compound_categories; j++) {
+      float probability = distribution[j] - (j > 0 ? distribution[j - 1] : 0);
+      cumulative += probability * infected_share[j];
+      infected_distribution[j] = cumulative;
+    }
+  }
+}
+
 void CategoricalEnvironment::UpdateCasualPartnerCategoryDistribution(
     const std::vector<std::vector<float>>& location_mixing_matrix,
     const std::vector<std::vector<float>>& age_mixing_matrix,
@@ -493,6 +668,18 @@ void CategoricalEnvironment::UpdateCasualPartnerCategoryDistribution(
   mate_compound_category_distribution_.resize(
       no_locations_ * no_age_categories_ * no_sociobehavioural_categories_);
 
+  // Whether to keep the factorised probabilities for bulk partner allocation
+  bool store_factors = Simulation::GetActive()
+                           ->GetParam()
+                           ->Get<SimParam>()
+                           ->bulk_casual_partner_allocation;
+  if (store_factors) {
+    mate_location_probability_.resize(
+        no_locations_ * no_age_categories_ * no_sociobehavioural_categories_);
+    mate_age_probability_.resize(mate_location_probability_.size());
+    mate_sociobehaviour_probability_.resize(mate_location_probability_.size());
+  }
+
   //#pragma omp for
   for (size_t i = 0;
        i < no_locations_ * no_age_categories_ * no_sociobehavioural_categories_;
@@ -576,6 +763,25 @@ void CategoricalEnvironment::UpdateCasualPartnerCategoryDistribution(
       }
     }
 
+    // Store the factorised probabilities for bulk partner allocation
+    if (store_factors) {
+      mate_location_probability_[i] = proba_locations;
+      mate_age_probability_[i].resize(no_locations_ * no_age_categories_);
+      mate_sociobehaviour_probability_[i].resize(
+          no_locations_ * no_age_categories_ * no_sociobehavioural_categories_);
+      for (size_t l_j = 0; l_j < no_locations_; l_j++) {
+        for (size_t a_j = 0; a_j < no_age_categories_; a_j++) {
+          size_t la_j = l_j * no_age_categories_ + a_j;
+          mate_age_probability_[i][la_j] = proba_ages_given_location[l_j][a_j];
+          for (size_t s_j = 0; s_j < no_sociobehavioural_categories_; s_j++) {
+            size_t las_j = la_j * no_sociobehavioural_categories_ + s_j;
+            mate_sociobehaviour_probability_[i][las_j] =
+                proba_socio_given_location_age[l_j][a_j][s_j];
+          }
+        }
+      }
+    }
+
     // Compute the final probability that a male agent of compound category i,
     // selects a female mate of compound category j.
     for (size_t j = 0; j < no_locations_ * no_age_categories_ *
@@ -843,6 +1049,27 @@ void CategoricalEnvironment::AddCasualFemaleToIndex(AgentPointer<Person> agent,
   casual_female_agents_[compound_index].AddAgent(agent);
 };
 
+void CategoricalEnvironment::AddCasualFemaleToStateIndex(
+    AgentPointer<Person> agent, size_t location, size_t age, size_t sb) {
+  assert(location >= 0 and location < no_locations_);
+  assert(age >= 0 and age < no_age_categories_);
+  assert(sb >= 0 and sb < no_sociobehavioural_categories_);
+
+  size_t compound_index = ComputeCompoundIndex(location, age, sb);
+  if (compound_index >= casual_infected_female_agents_.size()) {
+    Log::Fatal("CategoricalEnvironment::AddCasualFemaleToStateIndex()",
+               "Location index is out of bounds. Received compound index: ",
+               compound_index, " (loc ", location, ", age ", age, ", sb ", sb,
+               ") casual_infected_female_agents_.size(): ",
+               casual_infected_female_agents_.size());
+  }
+  if (agent->IsHealthy()) {
+    casual_healthy_female_agents_[compound_index].AddAgent(agent);
+  } else {
+    casual_infected_female_agents_[compound_index].AddAgent(agent);
+  }
+};
+
 void CategoricalEnvironment::AddRegularFemaleToIndex(AgentPointer<Person> agent,
                                                      size_t location,
                                                      size_t age, size_t sb) {
@@ -895,6 +1122,10 @@ void CategoricalEnvironment::AddMotherToLocation(AgentPointer<Person> agent,
   mothers_[location].AddAgent(agent);
 }
 
+void CategoricalEnvironment::AddBehaviourUpdate(AgentPointer<Person> agent) {
+  behaviour_updates_.AddAgent(agent);
+}
+
 AgentPointer<Person> CategoricalEnvironment::GetRandomCasualFemaleFromIndex(
     size_t location, size_t age, size_t sb) {
   size_t compound_index = ComputeCompoundIndex(location, age, sb);
@@ -954,7 +1185,7 @@ size_t CategoricalEnvironment::GetNumCasualFemalesAtIndex(size_t location,
                                                           size_t sb) {
   size_t compound_index = ComputeCompoundIndex(location, age, sb);
   assert(compound_index < casual_female_agents_.size());
-  return casual_female_agents_[compound_index].GetNumAgents();
+  return GetNumCasualFemales(compound_index);
 }
 
 size_t CategoricalEnvironment::GetNumRegularFemalesAtIndex(size_t location,
@@ -967,6 +1198,9 @@ size_t CategoricalEnvironment::GetNumRegularFemalesAtIndex(size_t location,
 
 size_t CategoricalEnvironment::GetNumAdultsAtLocation(size_t location) {
   assert(location < adults_.size());
+  if (DistrictRanks::GetInstance()->IsDistributed()) {
+    return global_adult_counts_[location];
+  }
   return adults_[location].GetNumAgents();
 }
 
@@ -976,7 +1210,7 @@ size_t CategoricalEnvironment::GetNumCasualFemalesAtLocationAge(size_t location,
   for (size_t sb = 0; sb < no_sociobehavioural_categories_; sb++) {
     size_t compound_index = ComputeCompoundIndex(location, age, sb);
     assert(compound_index < casual_female_agents_.size());
-    sum += casual_female_agents_[compound_index].GetNumAgents();
+    sum += GetNumCasualFemales(compound_index);
   }
   return sum;
 }
@@ -998,7 +1232,7 @@ size_t CategoricalEnvironment::GetNumCasualFemalesAtLocation(size_t location) {
     for (size_t age = 0; age < no_age_categories_; age++) {
       size_t compound_index = ComputeCompoundIndex(location, age, sb);
       assert(compound_index < casual_female_agents_.size());
-      sum += casual_female_agents_[compound_index].GetNumAgents();
+      sum += GetNumCasualFemales(compound_index);
     }
   }
   return sum;
@@ -1016,6 +1250,406 @@ size_t CategoricalEnvironment::GetNumRegularFemalesAtLocation(size_t location) {
   return sum;
 }
 
+AgentPointer<Person>
+CategoricalEnvironment::GetRandomCasualInfectedFemaleFromIndex(
+    size_t compound_index) {
+  return casual_infected_female_agents_[compound_index].GetRandomAgent();
+}
+
+const std::vector<std::pair<size_t, uint64_t>>&
+CategoricalEnvironment::SampleCasualPartnerCounts(size_t male_compound_index,
+                                                  uint64_t no_mates,
+                                                  Random* random) {
+  thread_local std::vector<std::pair<size_t, uint64_t>> partner_counts;
+  thread_local std::vector<uint64_t> location_counts;
+  thread_local std::vector<uint64_t> age_counts;
+  thread_local std::vector<uint64_t> sociobehaviour_counts;
+  partner_counts.clear();
+
+  const auto& location_probability =
+      mate_location_probability_[male_compound_index];
+  const auto& age_probability = mate_age_probability_[male_compound_index];
+  const auto& sociobehaviour_probability =
+      mate_sociobehaviour_probability_[male_compound_index];
+
+  SampleMultinomial(random, no_mates, location_probability, &location_counts);
+  for (size_t l = 0; l < no_locations_; l++) {
+    if (location_counts[l] == 0) {
+      continue;
+    }
+    SampleMultinomial(random, location_counts[l],
+                      &age_probability[l * no_age_categories_],
+                      no_age_categories_, &age_counts);
+    for (size_t a = 0; a < no_age_categories_; a++) {
+      if (age_counts[a] == 0) {
+        continue;
+      }
+      SampleMultinomial(random, age_counts[a],
+                        &sociobehaviour_probability
+                            [(l * no_age_categories_ + a) *
+                             no_sociobehavioural_categories_],
+                        no_sociobehavioural_categories_,
+                        &sociobehaviour_counts);
+      for (size_t s = 0; s < no_sociobehavioural_categories_; s++) {
+        if (sociobehaviour_counts[s] > 0) {
+          partner_counts.emplace_back(ComputeCompoundIndex(l, a, s),
+                                      sociobehaviour_counts[s]);
+        }
+      }
+    }
+  }
+  return partner_counts;
+}
+
+void CategoricalEnvironment::UpdateReferences(
+    const std::unordered_map<const Agent*, AgentUid>& uids) {
+  auto* rm = Simulation::GetActive()->GetResourceManager();
+  std::vector<AgentPointer<Person>> updates;
+  for (size_t i = 0; i < behaviour_updates_.GetNumAgents(); i++) {
+    auto it = uids.find(behaviour_updates_.GetAgentAtIndex(i).Get());
+    if (it == uids.end()) {
+      Log::Fatal("CategoricalEnvironment::UpdateReferences()",
+                 "Agent in behaviour_updates_ not found.");
+    }
+    auto* person = bdm_static_cast<Person*>(rm->GetAgent(it->second));
+    updates.push_back(person->GetAgentPtr<Person>());
+  }
+  behaviour_updates_.Clear();
+  for (auto& el : updates) {
+    behaviour_updates_.AddAgent(el);
+  }
+  for (auto& el : mothers_) {
+    el.Clear();
+  }
+}
+
+void CategoricalEnvironment::AddSkippedCasualContacts(
+    size_t male_compound_index, uint64_t no_contacts) {
+  auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+  skipped_casual_contacts_[tid][male_compound_index] += no_contacts;
+}
+
+void CategoricalEnvironment::DistributeSkippedCasualContacts() {
+  auto* random = Simulation::GetActive()->GetRandom();
+  size_t no_compound_categories =
+      no_locations_ * no_age_categories_ * no_sociobehavioural_categories_;
+
+  // Number of healthy women per compound category
+  std::vector<float> healthy_share(no_compound_categories, 0.0);
+  for (size_t j = 0; j < no_compound_categories; j++) {
+    size_t no_females = casual_female_agents_[j].GetNumAgents();
+    if (no_females > 0) {
+      healthy_share[j] =
+          static_cast<float>(casual_healthy_female_agents_[j].GetNumAgents()) /
+          no_females;
+    }
+  }
+
+  // Split the skipped contacts of each male compound category over the female
+  // compound categories, in proportion to the probability to select a healthy
+  // woman from each of them.
+  std::vector<uint64_t> contacts_per_category(no_compound_categories, 0);
+  std::vector<float> weights(no_compound_categories);
+  std::vector<uint64_t> counts;
+  for (size_t i = 0; i < no_compound_categories; i++) {
+    uint64_t no_contacts = 0;
+    for (auto& el : skipped_casual_contacts_) {
+      no_contacts += el[i];
+      el[i] = 0;
+    }
+    if (no_contacts == 0) {
+      continue;
+    }
+    const auto& distribution = mate_compound_category_distribution_[i];
+    for (size_t j = 0; j < no_compound_categories; j++) {
+      weights[j] = (distribution[j] - (j > 0 ? distribution[j - 1] : 0)) *
+                   healthy_share[j];
+    }
+    SampleMultinomial(random, no_contacts, weights, &counts);
+    for (size_t j = 0; j < no_compound_categories; j++) {
+      contacts_per_category[j] += counts[j];
+    }
+  }
+
+  // Assign the contacts to random healthy women. Each woman belongs to a single
+  // category, hence categories can be processed in parallel.
+#pragma omp parallel for schedule(dynamic)
+  for (size_t j = 0; j < no_compound_categories; j++) {
+    auto& healthy_females = casual_healthy_female_agents_[j];
+    size_t no_females = healthy_females.GetNumAgents();
+    uint64_t no_contacts = contacts_per_category[j];
+    if (no_females == 0 || no_contacts == 0) {
+      continue;
+    }
+    // Fewer contacts than women: draw a woman per contact
+    if (no_contacts < no_females) {
+      for (uint64_t c = 0; c < no_contacts; c++) {
+        auto mate = healthy_females.GetRandomAgent();
+        mate->no_casual_partners_ = mate->no_casual_partners_ + 1;
+        AddCasualPartnersToStatistics(mate.Get(), 1);
+      }
+      continue;
+    }
+    // Otherwise draw the number of contacts of each woman, i.e. a multinomial
+    // sample with equal weights, such that the cost is bounded by the number
+    // of women instead of the number of contacts
+    auto* thread_random = Simulation::GetActive()->GetRandom();
+    for (size_t k = 0; k < no_females && no_contacts > 0; k++) {
+      uint64_t no_mate_contacts = no_contacts;
+      if (k + 1 < no_females) {
+        no_mate_contacts = thread_random->Binomial(
+            static_cast<int>(no_contacts), 1.0 / (no_females - k));
+      }
+      if (no_mate_contacts == 0) {
+        continue;
+      }
+      auto mate = healthy_females.GetAgentAtIndex(k);
+      mate->no_casual_partners_ =
+          mate->no_casual_partners_ + static_cast<int>(no_mate_contacts);
+      AddCasualPartnersToStatistics(mate.Get(),
+                                    static_cast<int>(no_mate_contacts));
+      no_contacts -= no_mate_contacts;
+    }
+  }
+}
+
+void CategoricalEnvironment::SetExecutingDistrict(int location) {
+  auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+  executing_district_[tid] = location;
+}
+
+void CategoricalEnvironment::ClearExecutingDistricts() {
+  for (auto& el : executing_district_) {
+    el = -1;
+  }
+}
+
+bool CategoricalEnvironment::IsRemoteDistrict(size_t location) {
+  auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+  return executing_district_[tid] >= 0 &&
+         static_cast<size_t>(executing_district_[tid]) != location;
+}
+
+void CategoricalEnvironment::AddRemoteCasualContact(AgentPointer<Person> mate,
+                                                    size_t location,
+                                                    bool infection,
+                                                    int origin_state,
+                                                    int origin_sb,
+                                                    uint64_t origin) {
+  auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+  remote_casual_contacts_[tid][location].push_back(
+      {mate, infection, origin_state, origin_sb, origin});
+}
+
+void CategoricalEnvironment::UnlinkRemoteRelatives(Person* person, int year) {
+  auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+  if (executing_district_[tid] < 0) {
+    return;
+  }
+  // Children under 15 migrate with their mother, hence only adult children and
+  // the mother of an adult can live in another district.
+  auto& children = person->children_;
+  for (auto it = children.begin(); it != children.end();) {
+    if ((*it)->IsAdult(year)) {
+      remote_family_links_[tid].push_back(
+          {person->GetAgentPtr<Person>(), *it, true});
+      it = children.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (person->mother_ != nullptr && person->IsAdult(year)) {
+    remote_family_links_[tid].push_back(
+        {person->mother_, person->GetAgentPtr<Person>(), false});
+    person->mother_ = nullptr;
+  }
+}
+
+void CategoricalEnvironment::ApplyRemoteDistrictUpdates() {
+  // Each woman is recorded in the district she had at the beginning of the
+  // iteration, hence districts can be processed in parallel.
+#pragma omp parallel for schedule(dynamic)
+  for (size_t l = 0; l < no_locations_; l++) {
+    for (auto& thread_contacts : remote_casual_contacts_) {
+      for (auto& el : thread_contacts[l]) {
+        auto& mate = el.mate;
+        mate->no_casual_partners_ = mate->no_casual_partners_ + 1;
+        AddCasualPartnersToStatistics(mate.Get(), 1);
+        if (el.infection && mate->IsHealthy()) {
+          mate->state_ = GemsState::kAcute;
+          mate->transmission_type_ = TransmissionType::kCasualPartner;
+          mate->infection_origin_state_ = el.origin_state;
+          mate->infection_origin_sb_ = el.origin_sb;
+          LogTransmission(mate.Get(), el.origin, el.origin_state,
+                          el.origin_sb);
+          UpdateStatistics(mate.Get());
+        }
+      }
+      thread_contacts[l].clear();
+    }
+  }
+
+  // Deaths are rare, the family links are removed serially. Both the mother
+  // and the child may have died in this iteration.
+  for (auto& thread_links : remote_family_links_) {
+    for (auto& el : thread_links) {
+      if (el.mother_died) {
+        el.child->mother_ = nullptr;
+      } else if (el.mother->IsParentOf(el.child)) {
+        el.mother->RemoveChild(el.child);
+      }
+    }
+    thread_links.clear();
+  }
+}
+
+void CategoricalEnvironment::UpdateGlobalCounts() {
+  size_t no_compound_categories =
+      no_locations_ * no_age_categories_ * no_sociobehavioural_categories_;
+  global_casual_female_counts_.resize(no_compound_categories *
+                                      GemsState::kGemsLast);
+  for (size_t i = 0; i < global_casual_female_counts_.size(); i++) {
+    global_casual_female_counts_[i] =
+        casual_female_state_agents_[i].GetNumAgents();
+  }
+  global_adult_counts_.resize(no_locations_);
+  for (size_t l = 0; l < no_locations_; l++) {
+    global_adult_counts_[l] = adults_[l].GetNumAgents();
+  }
+  auto* ranks = DistrictRanks::GetInstance();
+  ranks->AllreduceSum(&global_casual_female_counts_);
+  ranks->AllreduceSum(&global_adult_counts_);
+}
+
+void CategoricalEnvironment::ClearDistrictPyramid() {
+  size_t size = ComputePyramidIndex(no_locations_, 0, 0, 0);
+  thread_district_pyramids_.resize(ThreadInfo::GetInstance()->GetMaxThreads());
+  for (auto& el : thread_district_pyramids_) {
+    el.assign(size, 0);
+  }
+}
+
+void CategoricalEnvironment::AddToDistrictPyramid(Person* person, int age) {
+  if (person->location_ < 0 ||
+      static_cast<size_t>(person->location_) >= no_locations_ ||
+      (person->sex_ != Sex::kMale && person->sex_ != Sex::kFemale) ||
+      person->state_ < 0 || person->state_ >= GemsState::kGemsLast ||
+      age < 0) {
+    return;
+  }
+  int age_band = std::min(age / 5, kNoPyramidAgeBands - 1);
+  auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+  thread_district_pyramids_[tid][ComputePyramidIndex(
+      person->location_, person->sex_, age_band, person->state_)]++;
+}
+
+void CategoricalEnvironment::MergeDistrictPyramid() {
+  district_pyramid_.assign(ComputePyramidIndex(no_locations_, 0, 0, 0), 0);
+  for (const auto& thread_pyramid : thread_district_pyramids_) {
+    for (size_t i = 0; i < thread_pyramid.size(); i++) {
+      district_pyramid_[i] += thread_pyramid[i];
+    }
+  }
+  DistrictRanks::GetInstance()->AllreduceSum(&district_pyramid_);
+}
+
+size_t CategoricalEnvironment::GetNumCasualFemales(size_t compound_index) {
+  if (DistrictRanks::GetInstance()->IsDistributed()) {
+    const uint64_t* counts =
+        &global_casual_female_counts_[compound_index * GemsState::kGemsLast];
+    return std::accumulate(counts, counts + GemsState::kGemsLast, uint64_t{0});
+  }
+  return casual_female_agents_[compound_index].GetNumAgents();
+}
+
+void CategoricalEnvironment::AddCasualFemaleToHivStateIndex(
+    AgentPointer<Person> agent, size_t compound_index, int state) {
+  assert(state >= 0 and state < GemsState::kGemsLast);
+  casual_female_state_agents_[compound_index * GemsState::kGemsLast + state]
+      .AddAgent(agent);
+}
+
+int CategoricalEnvironment::SampleCasualFemaleState(size_t compound_index,
+                                                    Random* random,
+                                                    bool infected_only) {
+  const uint64_t* counts =
+      &global_casual_female_counts_[compound_index * GemsState::kGemsLast];
+  int first_state = infected_only ? GemsState::kAcute : GemsState::kHealthy;
+  uint64_t total = 0;
+  for (int state = first_state; state < GemsState::kGemsLast; state++) {
+    total += counts[state];
+  }
+  if (total == 0) {
+    Log::Fatal("CategoricalEnvironment::SampleCasualFemaleState()",
+               "Female agents empty. Received compound index: ",
+               compound_index);
+  }
+  uint64_t rand_num = random->Integer(total);
+  for (int state = first_state; state < GemsState::kGemsLast; state++) {
+    if (rand_num < counts[state]) {
+      return state;
+    }
+    rand_num -= counts[state];
+  }
+  return first_state;
+}
+
+AgentPointer<Person>
+CategoricalEnvironment::GetRandomCasualFemaleFromHivStateIndex(
+    size_t compound_index, int state) {
+  return casual_female_state_agents_[compound_index * GemsState::kGemsLast +
+                                     state]
+      .GetRandomAgent();
+}
+
+void CategoricalEnvironment::AddRankCasualContact(size_t compound_index,
+                                                  int state, bool infection,
+                                                  int origin_state,
+                                                  int origin_sb) {
+  auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+  int rank = DistrictRanks::GetInstance()->GetOwner(
+      ComputeLocationFromCompoundIndex(compound_index));
+  rank_casual_contacts_[tid][rank].push_back(
+      {static_cast<uint32_t>(compound_index), state, origin_state, origin_sb,
+       infection});
+}
+
+void CategoricalEnvironment::ExchangeRankCasualContacts() {
+  auto* ranks = DistrictRanks::GetInstance();
+  // Merge the thread-local contacts per destination rank
+  std::vector<std::vector<RankCasualContact>> send(ranks->GetNoRanks());
+  for (auto& thread_contacts : rank_casual_contacts_) {
+    for (int r = 0; r < ranks->GetNoRanks(); r++) {
+      send[r].insert(send[r].end(), thread_contacts[r].begin(),
+                     thread_contacts[r].end());
+      thread_contacts[r].clear();
+    }
+  }
+  std::vector<RankCasualContact> received;
+  ranks->Exchange(&send, &received);
+
+  // The woman is drawn from the compound category and HIV state sampled by
+  // the sender, i.e. from the state index of the beginning of the iteration.
+  for (const auto& el : received) {
+    size_t i = el.compound_index * GemsState::kGemsLast + el.state;
+    if (casual_female_state_agents_[i].GetNumAgents() == 0) {
+      continue;
+    }
+    auto mate = casual_female_state_agents_[i].GetRandomAgent();
+    mate->no_casual_partners_ = mate->no_casual_partners_ + 1;
+    AddCasualPartnersToStatistics(mate.Get(), 1);
+    if (el.infection && mate->IsHealthy()) {
+      mate->state_ = GemsState::kAcute;
+      mate->transmission_type_ = TransmissionType::kCasualPartner;
+      mate->infection_origin_state_ = el.origin_state;
+      mate->infection_origin_sb_ = el.origin_sb;
+      LogTransmission(mate.Get(), kUnknownInfector, el.origin_state,
+                      el.origin_sb);
+      UpdateStatistics(mate.Get());
+    }
+  }
+}
+
 // AM: GET Random mother from location
 AgentPointer<Person> CategoricalEnvironment::GetRandomMotherFromLocation(
     size_t location) {
@@ -1035,6 +1669,13 @@ CategoricalEnvironment::GetMateCompoundCategoryDistribution(size_t loc,
   return mate_compound_category_distribution_[compound_index];
 };
 
+const std::vector<float>&
+CategoricalEnvironment::GetMateInfectedCompoundCategoryDistribution(
+    size_t loc, size_t age_category, size_t sociobehav) {
+  size_t compound_index = ComputeCompoundIndex(loc, age_category, sociobehav);
+  return mate_infected_compound_category_distribution_[compound_index];
+};
+
 const std::vector<float>& CategoricalEnvironment::GetMigrationLocDistribution(
     size_t loc) {
   return migration_location_distribution_[loc];
@@ -1092,10 +1733,12 @@ std::array<int32_t, 2> CategoricalEnvironment::GetDimensionThresholds() const {
 };
 
 // Code for virtual functions (ignore)
+// Agents are balanced in the order of their compound category (see
+// SortAgents). Note that the agent pointers stored by the agents must be
+// updated afterwards in AgentPointerMode::kDirect.
 LoadBalanceInfo* CategoricalEnvironment::GetLoadBalanceInfo() {
-  Log::Fatal("CategoricalEnvironment::GetLoadBalanceInfo()",
-             "LoadBalancing not supported for this environment.");
-  return nullptr;
+  load_balance_info_.Update(this);
+  return &load_balance_info_;
 };
 
 // Code for virtual functions (ignore)
@@ -1104,5 +1747,45 @@ CategoricalEnvironment::GetNeighborMutexBuilder() {
   return nullptr;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Sampling helpers
+////////////////////////////////////////////////////////////////////////////////
+
+void SampleMultinomial(Random* random, uint64_t n,
+                       const std::vector<float>& weights,
+                       std::vector<uint64_t>* counts) {
+  SampleMultinomial(random, n, weights.data(), weights.size(), counts);
+}
+
+void SampleMultinomial(Random* random, uint64_t n, const float* weights,
+                       size_t no_weights, std::vector<uint64_t>* counts) {
+  counts->assign(no_weights, 0);
+  double remaining_weight = 0.0;
+  size_t last = no_weights;
+  for (size_t j = 0; j < no_weights; j++) {
+    if (weights[j] > 0) {
+      remaining_weight += weights[j];
+      last = j;
+    }
+  }
+  // The number of draws in category j, given the draws in the previous
+  // categories, is binomial with probability w_j / (sum of w_k for k >= j).
+  // The last category with positive weight takes all remaining draws, which
+  // avoids losing draws to rounding errors.
+  for (size_t j = 0; j < no_weights && n > 0; j++) {
+    if (weights[j] <= 0) {
+      continue;
+    }
+    uint64_t n_j = n;
+    if (j != last) {
+      n_j = random->Binomial(static_cast<int>(n),
+                             std::min(1.0, weights[j] / remaining_weight));
+    }
+    (*counts)[j] = n_j;
+    n -= n_j;
+    remaining_weight -= weights[j];
+  }
+}
+
 }  // namespace hiv_malawi
 }  // namespace bdm
@@ -18,13 +18,17 @@
 #include "core/resource_manager.h"
 #include "core/util/log.h"
 
+#include "core/load_balance_info.h"
 #include "datatypes.h"
+#include "fast-bernoulli.h"
 #include "person.h"
+#include "transmission-log.h"
 #include "sim-param.h"  // AM: Added to get location_mixing_matrix to update mate_location_distribution_
 
 #include <cassert>
 #include <iostream>
 #include <random>
+#include <unordered_map>
 
 namespace bdm {
 namespace hiv_malawi {
@@ -64,6 +68,64 @@ class AgentVector {
   void Clear();
 };
 
+// Casual contact of a man with a woman of another district. It is applied to
+// the woman once the behaviours of all districts were executed (see
+// SimParam::district_partitioned_execution).
+struct RemoteCasualContact {
+  AgentPointer<Person> mate;
+  // HIV was transmitted to the woman
+  bool infection;
+  // HIV state and socio-behavioural category of the man
+  int origin_state;
+  int origin_sb;
+  // Uid of the man
+  uint64_t origin;
+};
+
+// Family link between a dead agent and a relative that may live in another
+// district. It is removed on the side of the relative once the behaviours of
+// all districts were executed.
+struct RemoteFamilyLink {
+  AgentPointer<Person> mother;
+  AgentPointer<Person> child;
+  // True if the mother died, false if the child died
+  bool mother_died;
+};
+
+// Casual contact of a man with a woman simulated by another rank (see
+// DistrictRanks). The woman is drawn by her rank from the given compound
+// category and HIV state.
+struct RankCasualContact {
+  uint32_t compound_index;
+  int32_t state;
+  // HIV state and socio-behavioural category of the man
+  int32_t origin_state;
+  int32_t origin_sb;
+  // HIV was transmitted to the woman
+  bool infection;
+};
+
+class CategoricalEnvironment;
+
+// Load balancing information of the CategoricalEnvironment. It defines the
+// order in which BioDynaMo stores the agents when balancing them: by compound
+// category (location x age category x sociobehaviours) and sex. Agents of the
+// same category, e.g. the potential mates of a man, are then contiguous in
+// memory.
+class CompoundCategoryLoadBalanceInfo : public LoadBalanceInfo {
+ private:
+  // Handles of all agents, sorted by compound category and sex
+  std::vector<AgentHandle> sorted_handles_;
+
+ public:
+  // Compute the order of the agents in the active simulation
+  void Update(CategoricalEnvironment* env);
+
+  void CallHandleIteratorConsumer(
+      uint64_t start, uint64_t end,
+      Functor<void, Iterator<AgentHandle>*>& f) const override;
+};
+
 // This is our customn BioDynaMo environment to describe the female population
 // at all locations. By knowing the all females at a location, it's easy to
 // select suitable mates during the MatingBehavior.
@@ -98,14 +160,74 @@ class CategoricalEnvironment : public Environment {
   // indexed by location. Used to estimate population size per location, and
   // attractiveness.
   std::vector<AgentVector> adults_;
+  // Vectors to store the healthy and the infected agents of
+  // casual_female_agents_ separately, indexed by location x age x
+  // sociobehaviours. Only filled if skip_non_transmissive_casual_contacts is
+  // set.
+  std::vector<AgentVector> casual_healthy_female_agents_;
+  std::vector<AgentVector> casual_infected_female_agents_;
+  // Thread-local number of casual contacts between healthy men and healthy
+  // women that were skipped, indexed by the compound category of the men.
+  SharedData<std::vector<uint64_t>> skipped_casual_contacts_;
+  // Agents that entered or left the activation window of a behaviour during
+  // the last iteration and whose behaviours must be re-attached.
+  AgentVector behaviour_updates_;
+  // Thread-local district (location) whose agents are executed by the thread
+  // in district-partitioned execution, -1 otherwise.
+  SharedData<int> executing_district_;
+  // Thread-local casual contacts with women of other districts, indexed by the
+  // district of the woman.
+  SharedData<std::vector<std::vector<RemoteCasualContact>>>
+      remote_casual_contacts_;
+  // Thread-local family links of dead agents with relatives of other districts
+  SharedData<std::vector<RemoteFamilyLink>> remote_family_links_;
+  // Vector to store the casual female partners of casual_female_agents_ by
+  // HIV state, indexed by compound category x state. Only filled in
+  // distributed simulations and in district-partitioned execution.
+  std::vector<AgentVector> casual_female_state_agents_;
+  // Number of casual female partners per compound category x HIV state, and
+  // number of adults per location, summed over all ranks. Only used in
+  // distributed simulations and in district-partitioned execution.
+  std::vector<uint64_t> global_casual_female_counts_;
+  std::vector<uint64_t> global_adult_counts_;
+  // Thread-local casual contacts with women simulated by other ranks, indexed
+  // by rank.
+  SharedData<std::vector<std::vector<RankCasualContact>>>
+      rank_casual_contacts_;
+  // Number of persons per location x sex x age band x HIV state at the
+  // beginning of the iteration, summed over all ranks (see district_pyramid),
+  // and its thread-local counts. Filled while the indexes are rebuilt.
+  std::vector<uint64_t> district_pyramid_;
+  SharedData<std::vector<uint64_t>> thread_district_pyramids_;
   // We only assign mother in the first update.
   bool mothers_are_assiged_;
+  // Order of the agents used for load balancing
+  CompoundCategoryLoadBalanceInfo load_balance_info_;
+  // Thresholds of the Bernoulli decisions of the behaviours. Only updated if
+  // fast_bernoulli is set.
+  BernoulliThresholds bernoulli_thresholds_;
 
   // AM: Matrix to store cumulative probability to select a female mate (casual
   // partner) from one compound category (location x age category x
   // sociobehaviour category) given male agent compound category
   std::vector<std::vector<float>> mate_compound_category_distribution_;
 
+  // Matrix to store the cumulative probability to select an infected female
+  // mate (casual partner) from one compound category given male agent compound
+  // category. The last element is the probability that a casual contact is
+  // with an infected woman.
+  std::vector<std::vector<float>> mate_infected_compound_category_distribution_;
+
+  // Factorised probability to select a female mate (casual partner) given
+  // male agent compound category: probability of each location, of each age
+  // category given the location (location x age category), and of each
+  // socio-behaviour given location and age category (location x age category
+  // x sociobehaviour category). Only stored if bulk_casual_partner_allocation
+  // is set.
+  std::vector<std::vector<float>> mate_location_probability_;
+  std::vector<std::vector<float>> mate_age_probability_;
+  std::vector<std::vector<float>> mate_sociobehaviour_probability_;
+
   // AM: Matrix to store cumulative probability to select a female regular
   // partner from one compound category (location x age category x
   // sociobehaviour category) given male agent compound category
@@ -143,6 +265,20 @@ class CategoricalEnvironment : public Environment {
       const std::vector<std::vector<float>>& age_mixing_matrix,
       const std::vector<std::vector<float>>& sociobehav_mixing_matrix);
 
+  // Update (at every iteration) matrix storing the probability that a male
+  // agent selects an infected casual partner from each compound category.
+  // Derived from mate_compound_category_distribution_ and the share of infected
+  // women per compound category.
+  void UpdateInfectedCasualPartnerCategoryDistribution();
+
+  // Sum the number of casual female partners per compound category and HIV
+  // state, and of adults per location, over all ranks
+  void UpdateGlobalCounts();
+
+  // Number of casual female partners in the compound category (over all ranks
+  // in distributed simulations)
+  size_t GetNumCasualFemales(size_t compound_index);
+
   void UpdateRegularPartnerCategoryDistribution(
       std::vector<std::vector<float>> reg_partner_age_mixing_matrix,
       std::vector<std::vector<float>> reg_partner_sociobehav_mixing_matrix);
@@ -197,6 +333,11 @@ class CategoricalEnvironment : public Environment {
   void AddCasualFemaleToIndex(AgentPointer<Person> agent, size_t location,
                               size_t age, size_t sb);
   // Add an agent pointer to a certain location, age group, and sb category in
+  // casual_healthy_female_agents_ or casual_infected_female_agents_ index,
+  // depending on the agent's state.
+  void AddCasualFemaleToStateIndex(AgentPointer<Person> agent, size_t location,
+                                   size_t age, size_t sb);
+  // Add an agent pointer to a certain location, age group, and sb category in
   // regular_female_agents_ index.
   void AddRegularFemaleToIndex(AgentPointer<Person> agent, size_t location,
                                size_t age, size_t sb);
@@ -215,6 +356,53 @@ class CategoricalEnvironment : public Environment {
   // Add an agent pointer to a certain location in mothers_ index
   void AddMotherToLocation(AgentPointer<Person> agent, size_t location);
 
+  // Add an agent whose behaviours must be re-attached to behaviour_updates_
+  void AddBehaviourUpdate(AgentPointer<Person> agent);
+
+  // Update the agent pointers stored across iterations after the agents were
+  // moved in memory (AgentPointerMode::kDirect). uids maps the previous address
+  // of each agent to its uid. The mothers_ index, which is only needed in the
+  // first iteration, is cleared.
+  void UpdateReferences(const std::unordered_map<const Agent*, AgentUid>& uids);
+
+  // Skip the assignment of mothers to children in the first update, e.g. if
+  // the population was restored with its mother / child links
+  void SetMothersAssigned() { mothers_are_assiged_ = true; }
+
+  // Getter of bernoulli_thresholds_
+  const BernoulliThresholds& GetBernoulliThresholds() const {
+    return bernoulli_thresholds_;
+  }
+
+  // Number of age bands of the district pyramid: 0-4, 5-9, ..., 75-79, 80+
+  static constexpr int kNoPyramidAgeBands = 17;
+
+  // Position of a bin in the district pyramid
+  size_t ComputePyramidIndex(size_t location, int sex, int age_band,
+                             int state) const {
+    return ((location * 2 + sex) * kNoPyramidAgeBands + age_band) *
+               GemsState::kGemsLast +
+           state;
+  }
+
+  // Zeroes the thread-local counts of the district pyramid
+  void ClearDistrictPyramid();
+  // Counts person, of the given age, in the district pyramid of the calling
+  // thread. Persons with attributes out of range are not counted.
+  void AddToDistrictPyramid(Person* person, int age);
+  // Sums the thread-local counts of all threads and ranks
+  void MergeDistrictPyramid();
+  // Getter of district_pyramid_
+  const std::vector<uint64_t>& GetDistrictPyramid() const {
+    return district_pyramid_;
+  }
+  // Getter of no_locations_
+  size_t GetNoLocations() const { return no_locations_; }
+
+  // Getter of behaviour_updates_. The index is not cleared by
+  // UpdateImplementation but by the operation processing it.
+  AgentVector& GetBehaviourUpdates() { return behaviour_updates_; }
+
   // Returns a random AgentPointer at a specific location, age group, and sb
   // category in casual_female_agents_
   AgentPointer<Person> GetRandomCasualFemaleFromIndex(size_t location,
@@ -228,10 +416,87 @@ class CategoricalEnvironment : public Environment {
   // age group, and sb category) in casual_female_agents_
   AgentPointer<Person> GetRandomCasualFemaleFromIndex(size_t compound_index);
 
+  // Returns a random AgentPointer at a specific compound category (location,
+  // age group, and sb category) in casual_infected_female_agents_
+  AgentPointer<Person> GetRandomCasualInfectedFemaleFromIndex(
+      size_t compound_index);
+
   // Returns a random AgentPointer at a specific compound category (location,
   // age group, and sb category) in regular_female_agents_
   AgentPointer<Person> GetRandomRegularFemaleFromIndex(size_t compound_index);
 
+  // Allocate the no_mates casual partners of a man of the given compound
+  // category to the female compound categories, with conditional binomial
+  // draws over locations, then age categories, then socio-behaviours. Returns
+  // the (female compound category, number of partners) pairs with at least
+  // one partner. The result is thread-local and valid until the next call.
+  const std::vector<std::pair<size_t, uint64_t>>& SampleCasualPartnerCounts(
+      size_t male_compound_index, uint64_t no_mates, Random* random);
+
+  // Count casual contacts of a man of the given compound category with healthy
+  // women that were not sampled individually (thread-safe).
+  void AddSkippedCasualContacts(size_t male_compound_index,
+                                uint64_t no_contacts);
+
+  // Attribute the skipped casual contacts of this iteration to healthy women.
+  // The contacts of each male compound category are split over the female
+  // compound categories with one multinomial draw, and then assigned to random
+  // healthy women of each category: one draw per contact if there are fewer
+  // contacts than women, else one binomial draw per woman.
+  void DistributeSkippedCasualContacts();
+
+  // Set the district whose agents are executed by the calling thread
+  void SetExecutingDistrict(int location);
+
+  // Reset the executing district of all threads, i.e. leave
+  // district-partitioned execution
+  void ClearExecutingDistricts();
+
+  // Returns true if the agents of the given location are executed by another
+  // district than the one of the calling thread. Always false outside of
+  // district-partitioned execution.
+  bool IsRemoteDistrict(size_t location);
+
+  // Record a casual contact with a woman of another district (thread-safe).
+  // origin is the uid of the man.
+  void AddRemoteCasualContact(AgentPointer<Person> mate, size_t location,
+                              bool infection, int origin_state, int origin_sb,
+                              uint64_t origin = kUnknownInfector);
+
+  // In district-partitioned execution, unlink a dying agent from the relatives
+  // that may live in another district (its adult children, and its mother if
+  // it is an adult), and record the links to remove on their side.
+  void UnlinkRemoteRelatives(Person* person, int year);
+
+  // Apply the casual contacts and remove the family links recorded for other
+  // districts during the behaviour pass.
+  void ApplyRemoteDistrictUpdates();
+
+  // Add a casual female partner to casual_female_state_agents_
+  void AddCasualFemaleToHivStateIndex(AgentPointer<Person> agent,
+                                      size_t compound_index, int state);
+
+  // Sample the HIV state of a casual female partner of the compound category,
+  // in proportion to the number of women in each state over all ranks at the
+  // beginning of the iteration. If infected_only, healthy women are excluded.
+  int SampleCasualFemaleState(size_t compound_index, Random* random,
+                              bool infected_only = false);
+
+  // Get a random casual female partner of the compound category that had the
+  // given HIV state at the beginning of the iteration
+  AgentPointer<Person> GetRandomCasualFemaleFromHivStateIndex(
+      size_t compound_index, int state);
+
+  // Record a casual contact with a woman simulated by another rank
+  // (thread-safe)
+  void AddRankCasualContact(size_t compound_index, int state, bool infection,
+                            int origin_state, int origin_sb);
+
+  // Send the casual contacts with women of other ranks to these ranks, and
+  // apply the received contacts to random local women of the recorded
+  // compound category and HIV state.
+  void ExchangeRankCasualContacts();
+
   // Returns a random Potential Mother (AgentPointer) at a specific location
   AgentPointer<Person> GetRandomMotherFromLocation(size_t location);
 
@@ -284,6 +549,10 @@ class CategoricalEnvironment : public Environment {
   const std::vector<float>& GetMateCompoundCategoryDistribution(
       size_t loc, size_t age_category, size_t sociobehav);
 
+  // Getter of mate_infected_compound_category_distribution_
+  const std::vector<float>& GetMateInfectedCompoundCategoryDistribution(
+      size_t loc, size_t age_category, size_t sociobehav);
+
   // AM: Getter of migration_location_distribution_
   const std::vector<float>& GetMigrationLocDistribution(size_t loc);
 
@@ -314,6 +583,16 @@ class CategoricalEnvironment : public Environment {
   Environment::NeighborMutexBuilder* GetNeighborMutexBuilder() override;
 };
 
+// Sample how n draws from a categorical distribution are allocated to its
+// categories with one pass of conditional binomial draws. The weights do not
+// need to be normalised. The result is written to counts.
+void SampleMultinomial(Random* random, uint64_t n,
+                       const std::vector<float>& weights,
+                       std::vector<uint64_t>* counts);
+// Same as above, for the no_weights consecutive weights starting at weights.
+void SampleMultinomial(Random* random, uint64_t n, const float* weights,
+                       size_t no_weights, std::vector<uint64_t>* counts);
+
 }  // namespace hiv_malawi
 }  // namespace bdm
 
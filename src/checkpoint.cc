@@ -0,0 +1,253 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "checkpoint.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include "biodynamo.h"
+
+#include "analyze.h"
+#include "district-ranks.h"
+#include "fast-bernoulli.h"
+#include "population-snapshot.h"
+#include "sim-param.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Values of a collector restored from a checkpoint
+struct RestoredSeries {
+  std::string id;
+  std::vector<double> x_values;
+  std::vector<double> y_values;
+};
+
+// Unique name of the simulation restored from a checkpoint, iterations
+// completed before the checkpoint, and values collected during these
+// iterations
+static std::string restored_simulation;
+static uint64_t restored_steps = 0;
+static std::vector<RestoredSeries> restored_series;
+
+// Returns true if the active simulation was restored from a checkpoint
+static bool IsRestored() {
+  return !restored_simulation.empty() &&
+         Simulation::GetActive()->GetUniqueName() == restored_simulation;
+}
+
+// Returns the restored values of the collector id, or nullptr
+static const RestoredSeries* FindRestoredSeries(const std::string& id) {
+  if (!IsRestored()) {
+    return nullptr;
+  }
+  for (const auto& series : restored_series) {
+    if (series.id == id) {
+      return &series;
+    }
+  }
+  return nullptr;
+}
+
+// Returns the restored values followed by the values collected since the
+// restart
+static std::vector<double> Concatenate(const std::vector<double>* restored,
+                                       const std::vector<double>& collected) {
+  std::vector<double> values;
+  if (restored != nullptr) {
+    values = *restored;
+  }
+  values.insert(values.end(), collected.begin(), collected.end());
+  return values;
+}
+
+void WriteCheckpointData(std::ostream* out, uint64_t steps) {
+  auto* sim = Simulation::GetActive();
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  auto* ts = sim->GetTimeSeries();
+  auto* ranks = DistrictRanks::GetInstance();
+  const auto& ids = GetCollectorIds();
+
+  CheckpointHeader header;
+  header.magic = CheckpointHeader::kMagic;
+  header.version = CheckpointHeader::kVersion;
+  uint64_t previous_steps = GetRestoredSteps();
+  header.start_year = static_cast<int32_t>(sparam->start_year - previous_steps);
+  header.completed_steps = previous_steps + steps;
+  header.rank = ranks->GetRank();
+  header.no_ranks = ranks->GetNoRanks();
+  header.no_series = ids.size();
+
+  out->write(reinterpret_cast<const char*>(&header), sizeof(header));
+  WritePopulation(out, sparam->start_year + steps);
+  for (const auto& id : ids) {
+    const auto* restored = FindRestoredSeries(id);
+    auto x_values = Concatenate(restored ? &restored->x_values : nullptr,
+                                ts->GetXValues(id));
+    auto y_values = Concatenate(restored ? &restored->y_values : nullptr,
+                                ts->GetYValues(id));
+    uint64_t id_length = id.size();
+    uint64_t no_values = x_values.size();
+    out->write(reinterpret_cast<const char*>(&id_length), sizeof(uint64_t));
+    out->write(id.data(), id_length);
+    out->write(reinterpret_cast<const char*>(&no_values), sizeof(uint64_t));
+    out->write(reinterpret_cast<const char*>(x_values.data()),
+               no_values * sizeof(double));
+    out->write(reinterpret_cast<const char*>(y_values.data()),
+               no_values * sizeof(double));
+  }
+}
+
+bool SaveCheckpoint(const std::string& filename, uint64_t steps) {
+  // Write to a temporary file first, such that an interruption while writing
+  // does not destroy the previous checkpoint
+  std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+    WriteCheckpointData(&file, steps);
+    if (!file.good()) {
+      return false;
+    }
+  }
+  return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+uint64_t RestoreCheckpointData(const char* data, size_t size,
+                               const std::string& source) {
+  auto* sim = Simulation::GetActive();
+  auto* sparam = sim->GetParam()->Get<SimParam>();
+  auto* ranks = DistrictRanks::GetInstance();
+  const char* end = data + size;
+
+  CheckpointHeader header;
+  if (size < sizeof(header)) {
+    Log::Fatal("RestoreCheckpointData()", source, " is not a checkpoint");
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != CheckpointHeader::kMagic ||
+      header.version != CheckpointHeader::kVersion) {
+    Log::Fatal("RestoreCheckpointData()", source,
+               " is not a checkpoint of version ", CheckpointHeader::kVersion);
+  }
+  if (header.start_year != sparam->start_year ||
+      header.no_ranks != ranks->GetNoRanks() ||
+      header.rank != ranks->GetRank()) {
+    Log::Fatal("RestoreCheckpointData()", "The checkpoint ", source,
+               " was written by a simulation starting in ", header.start_year,
+               " on rank ", header.rank, " of ", header.no_ranks, " ranks");
+  }
+  if (header.completed_steps > sparam->number_of_iterations) {
+    Log::Fatal("RestoreCheckpointData()", "The checkpoint ", source,
+               " is after ", header.completed_steps,
+               " iterations, the simulation only has ",
+               sparam->number_of_iterations);
+  }
+
+  const char* position = data + sizeof(header);
+  position += ReadPopulation(position, end - position,
+                             header.start_year + header.completed_steps,
+                             source);
+
+  // Copies the next size bytes to value and advances position
+  auto read = [&](void* value, size_t size) {
+    if (static_cast<size_t>(end - position) < size) {
+      Log::Fatal("RestoreCheckpointData()", "The checkpoint ", source,
+                 " is truncated");
+    }
+    std::memcpy(value, position, size);
+    position += size;
+  };
+  restored_series.clear();
+  restored_series.resize(header.no_series);
+  for (auto& series : restored_series) {
+    uint64_t id_length;
+    uint64_t no_values;
+    read(&id_length, sizeof(uint64_t));
+    series.id.resize(id_length);
+    read(&series.id[0], id_length);
+    read(&no_values, sizeof(uint64_t));
+    series.x_values.resize(no_values);
+    series.y_values.resize(no_values);
+    read(series.x_values.data(), no_values * sizeof(double));
+    read(series.y_values.data(), no_values * sizeof(double));
+  }
+
+  restored_simulation = sim->GetUniqueName();
+  restored_steps = header.completed_steps;
+  sparam->start_year += restored_steps;
+  sparam->number_of_iterations -= restored_steps;
+  return restored_steps;
+}
+
+uint64_t LoadCheckpoint(const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat file_status;
+  if (fd < 0 || fstat(fd, &file_status) != 0) {
+    Log::Fatal("LoadCheckpoint()", "Cannot open ", filename);
+  }
+  size_t file_size = file_status.st_size;
+  void* data = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    Log::Fatal("LoadCheckpoint()", "Cannot map ", filename);
+  }
+  auto completed_steps = RestoreCheckpointData(static_cast<const char*>(data),
+                                               file_size, filename);
+  munmap(data, file_size);
+  return completed_steps;
+}
+
+uint64_t GetRestoredSteps() { return IsRestored() ? restored_steps : 0; }
+
+void MergeRestoredTimeSeries() {
+  if (!IsRestored() || restored_series.empty()) {
+    return;
+  }
+  auto* ts = Simulation::GetActive()->GetTimeSeries();
+  experimental::TimeSeries merged;
+  for (const auto& id : GetCollectorIds()) {
+    const auto* restored = FindRestoredSeries(id);
+    merged.Add(id,
+               Concatenate(restored ? &restored->x_values : nullptr,
+                           ts->GetXValues(id)),
+               Concatenate(restored ? &restored->y_values : nullptr,
+                           ts->GetYValues(id)));
+  }
+  *ts = std::move(merged);
+  restored_series.clear();
+}
+
+void ReseedRandomNumberGenerators(uint64_t completed_steps) {
+  auto* sim = Simulation::GetActive();
+  uint64_t random_seed = sim->GetParam()->random_seed;
+  auto& randoms = sim->GetAllRandom();
+  for (size_t i = 0; i < randoms.size(); i++) {
+    std::seed_seq seed_sequence{
+        static_cast<uint32_t>(random_seed),
+        static_cast<uint32_t>(random_seed >> 32),
+        static_cast<uint32_t>(completed_steps), static_cast<uint32_t>(i)};
+    uint32_t seed;
+    seed_sequence.generate(&seed, &seed + 1);
+    randoms[i]->SetSeed(seed);
+  }
+  UniformBuffer::ResetAll();
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,95 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace bdm {
+namespace hiv_malawi {
+
+////////////////////////////////////////////////////////////////////////////////
+// Checkpoints of a running simulation, written at the end of an iteration. A
+// checkpoint file consists of a CheckpointHeader, the population (see
+// population-snapshot.h) and the values of all collectors of the TimeSeries
+// (for each collector: the length of the id, the id, the number of values, the
+// x values and the y values).
+//
+// A simulation restarted from a checkpoint continues with the next year:
+// start_year is shifted by the number of completed iterations, and the values
+// collected before the checkpoint are prepended to the TimeSeries at the end
+// (see MergeRestoredTimeSeries). The only state of the environment that is
+// kept across iterations, the assignment of the mothers, is restored with the
+// population. To make the restarted simulation reproduce the uninterrupted
+// one, the random number generators are reseeded from the random seed and the
+// number of completed iterations whenever a checkpoint is written or restored.
+// With several threads, the agents draw from the generator of the thread that
+// executes them, such that the reproduction is only statistical; it is exact
+// with a single thread.
+////////////////////////////////////////////////////////////////////////////////
+
+struct CheckpointHeader {
+  static constexpr uint64_t kMagic = 0x4b4348434d564948;  // "HIVMCHCK"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  // Original start_year of the simulation
+  int32_t start_year;
+  // Number of iterations completed before the checkpoint
+  uint64_t completed_steps;
+  int32_t rank;
+  int32_t no_ranks;
+  uint64_t no_series;
+};
+
+// Write a checkpoint of the active simulation to out, after it completed the
+// given number of iterations (e.g. GetSimulatedSteps() + 1 during the
+// post-scheduled operations of an iteration)
+void WriteCheckpointData(std::ostream* out, uint64_t steps);
+
+// Write a checkpoint (see WriteCheckpointData) to filename. Returns false if
+// the file could not be written.
+bool SaveCheckpoint(const std::string& filename, uint64_t steps);
+
+// Restore the population and the collected values of the checkpoint written
+// by WriteCheckpointData, which starts at data and spans size bytes, into the
+// active simulation, which must not contain agents yet. Shifts start_year and
+// reduces number_of_iterations by the number of completed iterations, which
+// is returned. source names the origin of data in the error messages.
+uint64_t RestoreCheckpointData(const char* data, size_t size,
+                               const std::string& source);
+
+// Restore the checkpoint in filename (see RestoreCheckpointData)
+uint64_t LoadCheckpoint(const std::string& filename);
+
+// Returns the number of iterations completed before the checkpoint from which
+// the active simulation was restarted (0 if it was not restarted)
+uint64_t GetRestoredSteps();
+
+// Prepend the values restored from the checkpoint to the TimeSeries of the
+// active simulation. Call at the end of the simulation.
+void MergeRestoredTimeSeries();
+
+// Reseed BioDynaMo's random number generators of all threads, and the
+// fast Bernoulli buffers, from the random seed and the number of completed
+// iterations
+void ReseedRandomNumberGenerators(uint64_t completed_steps);
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // CHECKPOINT_H_
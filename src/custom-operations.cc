@@ -11,10 +11,41 @@
 // -----------------------------------------------------------------------------
 
 #include "custom-operations.h"
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include "analyze.h"
+#include "calibration.h"
+#include "categorical-environment.h"
+#include "checkpoint.h"
+#include "district-ranks.h"
+#include "person-behavior.h"
+#include "population-snapshot.h"
 
 namespace bdm {
 namespace hiv_malawi {
 
+// Returns the mean number of casual partners per socio-behavioural category in
+// the current year
+static const std::vector<float>& GetCurrentNoMatesMean(Simulation* sim) {
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  int year = static_cast<int>(
+      sparam->start_year +
+      sim->GetScheduler()->GetSimulatedSteps());  // Current year
+  int year_index = sparam->no_mates_year_transition.size() - 1;
+  for (size_t y = 0; y < sparam->no_mates_year_transition.size() - 1; y++) {
+    if (year < sparam->no_mates_year_transition[y + 1]) {
+      year_index = y;
+      break;
+    }
+  }
+  return sparam->no_mates_mean[year_index];
+}
+
 void ResetCasualPartners::operator()() {
   // L2F converts a lambda call to a bdm::functor. We introduce this functor
   // because the ResourceManager::ForEachAgentParallel expects a functor.
@@ -27,6 +58,542 @@ void ResetCasualPartners::operator()() {
   auto* sim = Simulation::GetActive();
   auto* rm = sim->GetResourceManager();
   rm->ForEachAgentParallel(reset_functor);
+  if (IncrementalStatistics::IsEnabled()) {
+    IncrementalStatistics::GetInstance()->ResetCasualPartners();
+  }
+}
+
+void UpdateBehaviourActivation::operator()() {
+  auto* sim = Simulation::GetActive();
+  auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  int year = static_cast<int>(
+      sparam->start_year +
+      sim->GetScheduler()->GetSimulatedSteps());  // Current year
+
+  // Only the agents that crossed a window boundary are visited, i.e. the cost
+  // scales with the number of birthdays at min_age, max_age, max_age_birth.
+  auto& updates = env->GetBehaviourUpdates();
+  const size_t no_updates = updates.GetNumAgents();
+#pragma omp parallel for
+  for (size_t i = 0; i < no_updates; i++) {
+    auto* person = updates.GetAgentAtIndex(i).Get();
+    AttachBehaviours(person, GetBehaviourWindows(person, year, sparam));
+  }
+  updates.Clear();
+}
+
+void DistributeSkippedCasualContacts::operator()() {
+  auto* env = bdm_static_cast<CategoricalEnvironment*>(
+      Simulation::GetActive()->GetEnvironment());
+  env->DistributeSkippedCasualContacts();
+}
+
+void SortAgents::operator()() {
+  auto* sim = Simulation::GetActive();
+  auto* rm = sim->GetResourceManager();
+  auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
+
+  // With AgentPointerMode::kDirect, agent pointers store the address of the
+  // agent, which changes when agents are reordered. Remember the uid behind
+  // each address to restore the pointers afterwards.
+  std::unordered_map<const Agent*, AgentUid> uids;
+  bool direct = gAgentPointerMode == AgentPointerMode::kDirect;
+  if (direct) {
+    uids.reserve(rm->GetNumAgents());
+    rm->ForEachAgent([&](Agent* agent) { uids[agent] = agent->GetUid(); });
+  }
+
+  // Agents are stored in the order given by the environment's load balancing
+  // information (see CompoundCategoryLoadBalanceInfo)
+  rm->LoadBalance();
+
+  if (!direct) {
+    return;
+  }
+  auto update_reference = [&](AgentPointer<Person>* ptr) {
+    if (*ptr == nullptr) {
+      return;
+    }
+    auto it = uids.find(ptr->Get());
+    if (it == uids.end()) {
+      Log::Fatal("SortAgents", "Agent pointer to unknown agent.");
+    }
+    *ptr = bdm_static_cast<Person*>(rm->GetAgent(it->second))
+               ->GetAgentPtr<Person>();
+  };
+  auto update_references = L2F([&](Agent* agent) {
+    auto* person = bdm_static_cast<Person*>(agent);
+    update_reference(&person->partner_);
+    update_reference(&person->mother_);
+    for (auto& child : person->children_) {
+      update_reference(&child);
+    }
+  });
+  rm->ForEachAgentParallel(update_references);
+  env->UpdateReferences(uids);
+}
+
+void CostAwareBehaviourExecution::operator()() {
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+
+  auto* sim = Simulation::GetActive();
+  auto* rm = sim->GetResourceManager();
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  int no_threads = ThreadInfo::GetInstance()->GetMaxThreads();
+  busy_time_.resize(no_threads, 0);
+
+  // Expected number of casual partners in the current year
+  const auto& no_mates_mean = GetCurrentNoMatesMean(sim);
+
+  // Estimate the cost of each agent, in storage order
+  uint64_t no_numa_nodes = rm->GetNumNumaNodes();
+  std::vector<std::vector<float>> costs(no_numa_nodes);
+  double total_cost = 0;
+  for (uint64_t n = 0; n < no_numa_nodes; n++) {
+    uint64_t no_agents = rm->GetNumAgents(n);
+    costs[n].resize(no_agents);
+    double numa_cost = 0;
+#pragma omp parallel for reduction(+ : numa_cost)
+    for (uint64_t i = 0; i < no_agents; i++) {
+      auto* person = bdm_static_cast<Person*>(rm->GetAgent(AgentHandle(n, i)));
+      costs[n][i] = EstimateBehaviourCost(person, no_mates_mean);
+      numa_cost += costs[n][i];
+    }
+    total_cost += numa_cost;
+  }
+
+  // Cut the agents into chunks of similar cost, several per thread such that
+  // the work can be rebalanced at the end of the iteration
+  struct Chunk {
+    uint64_t numa_node;
+    uint64_t begin;
+    uint64_t end;
+  };
+  const int kChunksPerThread = 16;
+  double chunk_cost = total_cost / (no_threads * kChunksPerThread);
+  std::vector<Chunk> chunks;
+  for (uint64_t n = 0; n < no_numa_nodes; n++) {
+    uint64_t begin = 0;
+    double cost = 0;
+    for (uint64_t i = 0; i < costs[n].size(); i++) {
+      cost += costs[n][i];
+      if (cost >= chunk_cost) {
+        chunks.push_back({n, begin, i + 1});
+        begin = i + 1;
+        cost = 0;
+      }
+    }
+    if (begin < costs[n].size()) {
+      chunks.push_back({n, begin, costs[n].size()});
+    }
+  }
+
+  // Each thread owns a contiguous range of chunks. Chunks are claimed with an
+  // atomic counter, by the owner as well as by stealing threads.
+  struct alignas(64) ChunkQueue {
+    std::atomic<uint64_t> next;
+    uint64_t end;
+  };
+  std::vector<ChunkQueue> queues(no_threads);
+  for (int t = 0; t < no_threads; t++) {
+    queues[t].next = t * chunks.size() / no_threads;
+    queues[t].end = (t + 1) * chunks.size() / no_threads;
+  }
+
+  std::vector<Operation*> ops{behaviour_op_};
+#pragma omp parallel
+  {
+    auto busy_start = Clock::now();
+    int tid = ThreadInfo::GetInstance()->GetMyThreadId();
+    auto* ctxt = sim->GetExecutionContext();
+    // Process the own chunks first, then steal from the other threads
+    for (int k = 0; k < no_threads; k++) {
+      auto& queue = queues[(tid + k) % no_threads];
+      uint64_t c;
+      while ((c = queue.next.fetch_add(1)) < queue.end) {
+        const auto& chunk = chunks[c];
+        for (uint64_t i = chunk.begin; i < chunk.end; i++) {
+          AgentHandle ah(chunk.numa_node, i);
+          ctxt->Execute(rm->GetAgent(ah), ah, ops);
+        }
+      }
+    }
+    busy_time_[tid] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           Clock::now() - busy_start)
+                           .count();
+  }
+
+  total_time_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     Clock::now() - start)
+                     .count();
+}
+
+void CostAwareBehaviourExecution::PrintBusyTimeReport() const {
+  std::cout << "Busy time per thread in the behaviour pass (total "
+            << total_time_ * 1e-9 << " s):" << std::endl;
+  for (size_t t = 0; t < busy_time_.size(); t++) {
+    std::cout << "  thread " << std::setw(3) << t << ": "
+              << busy_time_[t] * 1e-9 << " s (" << std::fixed
+              << std::setprecision(1)
+              << (total_time_ > 0 ? 100.0 * busy_time_[t] / total_time_ : 0)
+              << "%)" << std::defaultfloat << std::endl;
+  }
+}
+
+void DistrictPartitionedBehaviourExecution::operator()() {
+  auto* sim = Simulation::GetActive();
+  auto* rm = sim->GetResourceManager();
+  auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  size_t no_districts = sparam->nb_locations;
+
+  // Partition the agents by location
+  districts_.resize(no_districts);
+  for (auto& el : districts_) {
+    el.Clear();
+  }
+  auto partition = L2F([&](Agent* agent) {
+    auto* person = bdm_static_cast<Person*>(agent);
+    districts_[person->location_].AddAgent(person->GetAgentPtr<Person>());
+  });
+  rm->ForEachAgentParallel(partition);
+
+  // Order the districts by decreasing cost, such that the most expensive ones
+  // are started first
+  const auto& no_mates_mean = GetCurrentNoMatesMean(sim);
+  std::vector<double> costs(no_districts, 0);
+#pragma omp parallel for schedule(dynamic)
+  for (size_t l = 0; l < no_districts; l++) {
+    for (size_t i = 0; i < districts_[l].GetNumAgents(); i++) {
+      costs[l] += EstimateBehaviourCost(districts_[l].GetAgentAtIndex(i).Get(),
+                                        no_mates_mean);
+    }
+  }
+  std::vector<size_t> order(no_districts);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+  // Each district is executed by a single thread. The behaviours are run
+  // directly instead of through the execution context, which would lock the
+  // relatives of each agent.
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t k = 0; k < no_districts; k++) {
+    size_t l = order[k];
+    env->SetExecutingDistrict(l);
+    auto& district = districts_[l];
+    for (size_t i = 0; i < district.GetNumAgents(); i++) {
+      district.GetAgentAtIndex(i)->RunBehaviors();
+    }
+  }
+  env->ClearExecutingDistricts();
+
+  env->ApplyRemoteDistrictUpdates();
+}
+
+void ExchangeRankCasualContacts::operator()() {
+  auto* env = bdm_static_cast<CategoricalEnvironment*>(
+      Simulation::GetActive()->GetEnvironment());
+  env->ExchangeRankCasualContacts();
+}
+
+// Copy of a Person sent to another rank. The links to the partner and the
+// mother are given relative to the position of the record in the sent
+// records, 0 if there is no link.
+struct MigrantRecord {
+  int32_t state;
+  int32_t transmission_type;
+  int32_t infection_origin_state;
+  int32_t infection_origin_sb;
+  int32_t birth_year;
+  int32_t sex;
+  int32_t location;
+  int32_t social_behaviour_factor;
+  int32_t biomedical_factor;
+  int32_t no_casual_partners;
+  int64_t partner;
+  int64_t mother;
+  bool is_protected;
+  bool seek_regular_partnership;
+};
+
+void ExchangeRankMigrants::operator()() {
+  auto* ranks = DistrictRanks::GetInstance();
+  auto* sim = Simulation::GetActive();
+  auto* rm = sim->GetResourceManager();
+  auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+
+  // Agents living in a district of another rank, and their position in the
+  // records sent to this rank
+  std::vector<Person*> migrants;
+  rm->ForEachAgent([&](Agent* agent) {
+    auto* person = bdm_static_cast<Person*>(agent);
+    if (!ranks->IsLocal(person->location_)) {
+      migrants.push_back(person);
+    }
+  });
+  std::vector<std::vector<MigrantRecord>> send(ranks->GetNoRanks());
+  std::unordered_map<const Person*, std::pair<int, int64_t>> positions;
+  for (auto* person : migrants) {
+    int rank = ranks->GetOwner(person->location_);
+    positions[person] = {rank, send[rank].size()};
+    send[rank].push_back({person->state_, person->transmission_type_,
+                          person->infection_origin_state_,
+                          person->infection_origin_sb_, person->birth_year_,
+                          person->sex_, person->location_,
+                          person->social_behaviour_factor_,
+                          person->biomedical_factor_,
+                          person->no_casual_partners_, 0, 0,
+                          person->protected_,
+                          person->seek_regular_partnership_});
+  }
+
+  // Returns the offset from a migrant to a relative moving to the same rank,
+  // or 0 if the relative stays or moves to another rank
+  auto relative_offset = [&](const Person* person, const Person* relative) {
+    auto it = positions.find(relative);
+    const auto& position = positions[person];
+    if (it == positions.end() || it->second.first != position.first) {
+      return int64_t{0};
+    }
+    return it->second.second - position.second;
+  };
+  for (auto* person : migrants) {
+    const auto& position = positions[person];
+    auto& record = send[position.first][position.second];
+    if (person->partner_ != nullptr) {
+      record.partner = relative_offset(person, person->partner_.Get());
+      if (record.partner == 0) {
+        person->partner_->partner_ = nullptr;
+      }
+    }
+    if (person->mother_ != nullptr) {
+      record.mother = relative_offset(person, person->mother_.Get());
+      if (record.mother == 0 &&
+          positions.find(person->mother_.Get()) == positions.end()) {
+        person->mother_->RemoveChild(person->GetAgentPtr<Person>());
+      }
+    }
+    for (auto& child : person->children_) {
+      if (positions.find(child.Get()) == positions.end()) {
+        child->mother_ = nullptr;
+      }
+    }
+  }
+
+  // Remove the migrants from this rank, and from the agents whose behaviours
+  // must be re-attached
+  auto& behaviour_updates = env->GetBehaviourUpdates();
+  std::vector<AgentPointer<Person>> updates;
+  for (size_t i = 0; i < behaviour_updates.GetNumAgents(); i++) {
+    auto update = behaviour_updates.GetAgentAtIndex(i);
+    if (positions.find(update.Get()) == positions.end()) {
+      updates.push_back(update);
+    }
+  }
+  behaviour_updates.Clear();
+  for (auto& el : updates) {
+    behaviour_updates.AddAgent(el);
+  }
+  for (auto* person : migrants) {
+    RemoveFromStatistics(person);
+    rm->RemoveAgent(person->GetUid());
+  }
+
+  std::vector<MigrantRecord> received;
+  ranks->Exchange(&send, &received);
+
+  // Create the received agents, then restore the links within households. The
+  // behaviours are those of the next year.
+  int year = static_cast<int>(sparam->start_year +
+                              sim->GetScheduler()->GetSimulatedSteps());
+  std::vector<Person*> arrivals(received.size());
+  for (size_t i = 0; i < received.size(); i++) {
+    const auto& record = received[i];
+    auto* person = new Person();
+    person->state_ = record.state;
+    person->transmission_type_ = record.transmission_type;
+    person->infection_origin_state_ = record.infection_origin_state;
+    person->infection_origin_sb_ = record.infection_origin_sb;
+    person->birth_year_ = record.birth_year;
+    person->sex_ = record.sex;
+    person->location_ = record.location;
+    person->social_behaviour_factor_ = record.social_behaviour_factor;
+    person->biomedical_factor_ = record.biomedical_factor;
+    person->no_casual_partners_ = record.no_casual_partners;
+    person->protected_ = record.is_protected;
+    person->seek_regular_partnership_ = record.seek_regular_partnership;
+    AttachBehaviours(person, GetBehaviourWindows(person, year + 1, sparam));
+    rm->AddAgent(person);
+    UpdateStatistics(person);
+    arrivals[i] = person;
+  }
+  for (size_t i = 0; i < received.size(); i++) {
+    auto* person = arrivals[i];
+    if (received[i].partner > 0) {
+      person->SetPartner(
+          arrivals[i + received[i].partner]->GetAgentPtr<Person>());
+    }
+    if (received[i].mother != 0) {
+      auto* mother = arrivals[i + received[i].mother];
+      person->mother_ = mother->GetAgentPtr<Person>();
+      mother->AddChild(person->GetAgentPtr<Person>());
+    }
+  }
+}
+
+void WritePopulationSnapshot::operator()() {
+  auto* sim = Simulation::GetActive();
+  if (sim->GetScheduler()->GetSimulatedSteps() != 0) {
+    return;
+  }
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  auto filename = DistrictRanks::GetInstance()->GetRankFilename(
+      sparam->save_population_snapshot);
+  if (!SavePopulationSnapshot(filename, sparam->start_year)) {
+    Log::Warning("WritePopulationSnapshot", "Could not write ", filename);
+  } else {
+    std::cout << "Population snapshot written to " << filename << std::endl;
+  }
+}
+
+void WriteCheckpoint::operator()() {
+  auto* sim = Simulation::GetActive();
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  uint64_t steps = sim->GetScheduler()->GetSimulatedSteps() + 1;
+  uint64_t completed_steps = GetRestoredSteps() + steps;
+  if (completed_steps % sparam->checkpoint_frequency != 0) {
+    return;
+  }
+  auto filename =
+      DistrictRanks::GetInstance()->GetRankFilename(sparam->checkpoint_file);
+  if (!SaveCheckpoint(filename, steps)) {
+    Log::Warning("WriteCheckpoint", "Could not write ", filename);
+  }
+  // The restarted simulation continues with the same random numbers
+  ReseedRandomNumberGenerators(completed_steps);
+}
+
+void WriteDistrictPyramid::operator()() {
+  auto* sim = Simulation::GetActive();
+  auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
+  if (DistrictRanks::GetInstance()->GetRank() != 0) {
+    return;
+  }
+  if (file_ == nullptr) {
+    auto filename = Concat(sim->GetOutputDir(), "/district_pyramid.bin");
+    file_ = std::make_shared<std::ofstream>(filename,
+                                            std::ios::binary | std::ios::trunc);
+    if (!file_->is_open()) {
+      Log::Fatal("WriteDistrictPyramid", "Cannot create ", filename);
+    }
+    DistrictPyramidHeader header;
+    header.magic = DistrictPyramidHeader::kMagic;
+    header.version = DistrictPyramidHeader::kVersion;
+    header.no_locations = env->GetNoLocations();
+    header.no_sexes = 2;
+    header.no_age_bands = CategoricalEnvironment::kNoPyramidAgeBands;
+    header.no_states = GemsState::kGemsLast;
+    header.reserved = 0;
+    file_->write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  // The pyramid was counted with the ages of the current year
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  int64_t year = sparam->start_year + sim->GetScheduler()->GetSimulatedSteps();
+  const auto& pyramid = env->GetDistrictPyramid();
+  std::vector<uint32_t> counts(pyramid.begin(), pyramid.end());
+  file_->write(reinterpret_cast<const char*>(&year), sizeof(int64_t));
+  file_->write(reinterpret_cast<const char*>(counts.data()),
+               counts.size() * sizeof(uint32_t));
+  file_->flush();
+}
+
+void CollectTimeSeries::operator()() {
+  auto* sim = Simulation::GetActive();
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  uint64_t steps = sim->GetScheduler()->GetSimulatedSteps();
+  // The cadence continues across restarts from a checkpoint
+  int year = static_cast<int>(sparam->start_year + steps);
+  if (IsCollectionIteration(sparam, GetRestoredSteps() + steps, year)) {
+    sim->GetTimeSeries()->Update();
+  }
+}
+
+void StreamTimeSeries::operator()() {
+  auto* sim = Simulation::GetActive();
+  auto* ts = sim->GetTimeSeries();
+  const auto& ids = GetCollectorIds();
+  const auto& derived_ids = GetDerivedSeriesIds();
+  if (writer_ == nullptr) {
+    const auto* sparam = sim->GetParam()->Get<SimParam>();
+    auto* ranks = DistrictRanks::GetInstance();
+    auto filename =
+        ranks->GetRankFilename(Concat(sim->GetOutputDir(), "/timeseries.bin"));
+    std::string csv_filename;
+    if (sparam->stream_time_series_csv) {
+      csv_filename = ranks->GetRankFilename(
+          Concat(sim->GetOutputDir(), "/timeseries.csv"));
+    }
+    auto all_ids = ids;
+    all_ids.insert(all_ids.end(), derived_ids.begin(), derived_ids.end());
+    writer_ = std::make_shared<TimeSeriesStreamWriter>(
+        filename, csv_filename, all_ids, sparam->stream_time_series_block);
+  }
+
+  // Nothing to append in iterations without collection (see
+  // collection_interval)
+  if (ids.empty() || ts->GetXValues(ids[0]).size() == no_rows_) {
+    return;
+  }
+  no_rows_ = ts->GetXValues(ids[0]).size();
+
+  // All collectors share the x-values
+  double x = ts->GetXValues(ids[0]).back();
+  std::vector<double> y_values(ids.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    y_values[i] = ts->GetYValues(ids[i]).back();
+  }
+  std::vector<double> derived;
+  EvaluateDerivedSeries(y_values, &derived);
+  y_values.insert(y_values.end(), derived.begin(), derived.end());
+  writer_->Append(x, y_values);
+}
+
+void StreamTimeSeries::Close() {
+  if (writer_ != nullptr) {
+    writer_->Close();
+  }
+}
+
+void CheckCalibrationTargets::operator()() {
+  auto* ts = Simulation::GetActive()->GetTimeSeries();
+  const auto& ids = GetCollectorIds();
+  // Nothing to compare in iterations without collection (see
+  // collection_interval)
+  if (ids.empty() || ts->GetXValues(ids[0]).size() == no_rows_) {
+    return;
+  }
+  no_rows_ = ts->GetXValues(ids[0]).size();
+
+  double x = ts->GetXValues(ids[0]).back();
+  // The counts are scaled to the population of the targets; the derived
+  // series are ratios of counts and thus not affected
+  auto* monitor = CalibrationMonitor::GetInstance();
+  std::vector<double> y_values(ids.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    y_values[i] = ts->GetYValues(ids[i]).back() * monitor->GetCountScale();
+  }
+  std::vector<double> derived;
+  EvaluateDerivedSeries(y_values, &derived);
+  y_values.insert(y_values.end(), derived.begin(), derived.end());
+  auto all_ids = ids;
+  const auto& derived_ids = GetDerivedSeriesIds();
+  all_ids.insert(all_ids.end(), derived_ids.begin(), derived_ids.end());
+  monitor->Check(all_ids, x, y_values);
 }
 
 }  // namespace hiv_malawi
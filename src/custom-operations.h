@@ -13,9 +13,15 @@
 #ifndef CUSTOM_OPERATIONS_H_
 #define CUSTOM_OPERATIONS_H_
 
+#include <fstream>
+#include <memory>
+#include <vector>
+
 #include "core/operation/operation.h"
+#include "categorical-environment.h"
 #include "core/resource_manager.h"
 #include "person.h"
+#include "timeseries-stream.h"
 
 namespace bdm {
 namespace hiv_malawi {
@@ -26,6 +32,172 @@ struct ResetCasualPartners : public StandaloneOperationImpl {
   void operator()() override;
 };
 
+/// Operation to re-attach the behaviours of agents that entered or left the
+/// age window of a behaviour in the previous iteration (in parallel)
+struct UpdateBehaviourActivation : public StandaloneOperationImpl {
+  BDM_OP_HEADER(UpdateBehaviourActivation);
+  void operator()() override;
+};
+
+/// Operation to attribute the casual contacts that were skipped in the
+/// MatingBehaviour (see skip_non_transmissive_casual_contacts) to healthy women
+struct DistributeSkippedCasualContacts : public StandaloneOperationImpl {
+  BDM_OP_HEADER(DistributeSkippedCasualContacts);
+  void operator()() override;
+};
+
+/// Operation to reorder the agents in memory by compound category (location x
+/// age category x sociobehaviours) and sex, and to update the agent pointers
+/// stored by the agents and the environment accordingly
+struct SortAgents : public StandaloneOperationImpl {
+  BDM_OP_HEADER(SortAgents);
+  void operator()() override;
+};
+
+/// Operation to run the behaviours of all agents with a cost-aware schedule,
+/// replacing BioDynaMo's "behavior" operation. Agents are grouped into chunks
+/// of similar estimated cost (see EstimateBehaviourCost), each thread owns a
+/// contiguous range of chunks, and threads that run out of work steal chunks
+/// from the others. The busy time of each thread is recorded.
+struct CostAwareBehaviourExecution : public StandaloneOperationImpl {
+  BDM_OP_HEADER(CostAwareBehaviourExecution);
+
+  CostAwareBehaviourExecution() {}
+  explicit CostAwareBehaviourExecution(Operation* behaviour_op)
+      : behaviour_op_(behaviour_op) {}
+
+  void operator()() override;
+
+  /// Print the time each thread spent running behaviours, relative to the
+  /// total time spent in this operation
+  void PrintBusyTimeReport() const;
+
+ private:
+  /// BioDynaMo's "behavior" operation, executed for each agent
+  Operation* behaviour_op_ = nullptr;
+  /// Total time spent in this operation (ns)
+  uint64_t total_time_ = 0;
+  /// Time each thread spent running behaviours (ns)
+  std::vector<uint64_t> busy_time_;
+};
+
+/// Operation to run the behaviours district by district, replacing BioDynaMo's
+/// "behavior" operation (see district_partitioned_execution). Agents are
+/// partitioned by location and each district is executed by a single thread,
+/// the most expensive districts first. Since families live in a single
+/// district, agents are executed without locking their relatives. Casual
+/// contacts with women of other districts and deaths of relatives in other
+/// districts are exchanged through the environment, and applied after all
+/// districts were executed.
+struct DistrictPartitionedBehaviourExecution : public StandaloneOperationImpl {
+  BDM_OP_HEADER(DistrictPartitionedBehaviourExecution);
+  void operator()() override;
+
+ private:
+  /// Agents of each district at the beginning of the iteration
+  std::vector<AgentVector> districts_;
+};
+
+/// Operation to send the casual contacts with women simulated by other ranks
+/// to these ranks, and apply the contacts received from them (see
+/// DistrictRanks)
+struct ExchangeRankCasualContacts : public StandaloneOperationImpl {
+  BDM_OP_HEADER(ExchangeRankCasualContacts);
+  void operator()() override;
+};
+
+/// Operation to move the agents that migrated to a district of another rank
+/// to this rank. Households (partners and children) are moved together; the
+/// links to relatives staying behind are removed on both sides.
+struct ExchangeRankMigrants : public StandaloneOperationImpl {
+  BDM_OP_HEADER(ExchangeRankMigrants);
+  void operator()() override;
+};
+
+/// Operation to write the population to a snapshot file in the first
+/// iteration, after the mothers were assigned to the children (see
+/// save_population_snapshot and population-snapshot.h)
+struct WritePopulationSnapshot : public StandaloneOperationImpl {
+  BDM_OP_HEADER(WritePopulationSnapshot);
+  void operator()() override;
+};
+
+/// Operation to write a checkpoint of the simulation at the end of every
+/// checkpoint_frequency-th iteration (see checkpoint.h). Must be scheduled
+/// after all other post-scheduled operations.
+struct WriteCheckpoint : public StandaloneOperationImpl {
+  BDM_OP_HEADER(WriteCheckpoint);
+  void operator()() override;
+};
+
+/// Header of the file written by WriteDistrictPyramid. It is followed by one
+/// record per iteration: the year (int64_t) and the counts of the district
+/// pyramid as uint32_t, indexed by location x sex x age band x HIV state (see
+/// CategoricalEnvironment::ComputePyramidIndex).
+struct DistrictPyramidHeader {
+  static constexpr uint64_t kMagic = 0x415259504d564948;  // "HIVMPYRA"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t no_locations;
+  uint32_t no_sexes;
+  uint32_t no_age_bands;
+  uint32_t no_states;
+  uint32_t reserved;
+};
+
+/// Operation to append the district pyramid counted by the environment at the
+/// beginning of the iteration to district_pyramid.bin (see district_pyramid).
+/// In distributed simulations, the counts are summed over all ranks and only
+/// written by the first rank.
+struct WriteDistrictPyramid : public StandaloneOperationImpl {
+  BDM_OP_HEADER(WriteDistrictPyramid);
+  void operator()() override;
+
+ private:
+  /// Opened in the first iteration, shared with the copies of the operation
+  std::shared_ptr<std::ofstream> file_;
+};
+
+/// Operation to evaluate the collectors of the time series in the iterations
+/// selected by collection_interval and collection_years. It replaces
+/// BioDynaMo's time series update, which evaluates them in every iteration.
+struct CollectTimeSeries : public StandaloneOperationImpl {
+  BDM_OP_HEADER(CollectTimeSeries);
+  void operator()() override;
+};
+
+/// Operation to append the values the collectors recorded in this iteration to
+/// the time series stream (see stream_time_series and timeseries-stream.h),
+/// followed by the derived series. Must be scheduled after the time series
+/// update.
+struct StreamTimeSeries : public StandaloneOperationImpl {
+  BDM_OP_HEADER(StreamTimeSeries);
+  void operator()() override;
+
+  /// Write the remaining iterations and close the stream
+  void Close();
+
+ private:
+  /// Created in the first iteration, shared with the copies of the operation
+  std::shared_ptr<TimeSeriesStreamWriter> writer_;
+  /// Number of iterations appended so far
+  uint64_t no_rows_ = 0;
+};
+
+/// Operation to compare the values the collectors recorded in this iteration,
+/// and the derived series, with the calibration targets (see
+/// CalibrationMonitor). Must be scheduled after the time series update.
+struct CheckCalibrationTargets : public StandaloneOperationImpl {
+  BDM_OP_HEADER(CheckCalibrationTargets);
+  void operator()() override;
+
+ private:
+  /// Number of iterations compared so far
+  uint64_t no_rows_ = 0;
+};
+
 }  // namespace hiv_malawi
 }  // namespace bdm
 
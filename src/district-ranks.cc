@@ -0,0 +1,105 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "district-ranks.h"
+#include <algorithm>
+#include <numeric>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif  // USE_MPI
+
+namespace bdm {
+namespace hiv_malawi {
+
+DistrictRanks* DistrictRanks::GetInstance() {
+  static DistrictRanks instance;
+  return &instance;
+}
+
+void DistrictRanks::Init() {
+#ifdef USE_MPI
+  int initialized = 0;
+  MPI_Initialized(&initialized);
+  if (!initialized) {
+    MPI_Init(nullptr, nullptr);
+    initialized_mpi_ = true;
+  }
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+  MPI_Comm_size(MPI_COMM_WORLD, &no_ranks_);
+#endif  // USE_MPI
+}
+
+void DistrictRanks::Finalize() {
+#ifdef USE_MPI
+  if (initialized_mpi_) {
+    MPI_Finalize();
+    initialized_mpi_ = false;
+  }
+#endif  // USE_MPI
+}
+
+void DistrictRanks::Partition(const std::vector<float>& location_weights) {
+  size_t no_locations = location_weights.size();
+  owners_.assign(no_locations, 0);
+  double total = std::accumulate(location_weights.begin(),
+                                 location_weights.end(), 0.0);
+  // Each location goes to the rank whose share of the total weight contains
+  // the middle of the location's weight
+  double cumulative = 0;
+  for (size_t l = 0; l < no_locations; l++) {
+    double middle = total > 0 ? (cumulative + 0.5 * location_weights[l]) / total
+                              : (l + 0.5) / no_locations;
+    cumulative += location_weights[l];
+    owners_[l] = std::min(static_cast<int>(middle * no_ranks_), no_ranks_ - 1);
+  }
+}
+
+void DistrictRanks::AllreduceSum(std::vector<uint64_t>* values) {
+#ifdef USE_MPI
+  if (no_ranks_ > 1) {
+    MPI_Allreduce(MPI_IN_PLACE, values->data(), values->size(), MPI_UINT64_T,
+                  MPI_SUM, MPI_COMM_WORLD);
+  }
+#endif  // USE_MPI
+}
+
+void DistrictRanks::ExchangeBytes(const std::vector<std::vector<char>>& send,
+                                  std::vector<char>* received) {
+#ifdef USE_MPI
+  if (no_ranks_ > 1) {
+    std::vector<int> send_counts(no_ranks_), send_offsets(no_ranks_);
+    std::vector<char> send_buffer;
+    for (int r = 0; r < no_ranks_; r++) {
+      send_counts[r] = send[r].size();
+      send_offsets[r] = send_buffer.size();
+      send_buffer.insert(send_buffer.end(), send[r].begin(), send[r].end());
+    }
+    std::vector<int> receive_counts(no_ranks_), receive_offsets(no_ranks_);
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, receive_counts.data(), 1,
+                 MPI_INT, MPI_COMM_WORLD);
+    int total = 0;
+    for (int r = 0; r < no_ranks_; r++) {
+      receive_offsets[r] = total;
+      total += receive_counts[r];
+    }
+    received->resize(total);
+    MPI_Alltoallv(send_buffer.data(), send_counts.data(), send_offsets.data(),
+                  MPI_BYTE, received->data(), receive_counts.data(),
+                  receive_offsets.data(), MPI_BYTE, MPI_COMM_WORLD);
+    return;
+  }
+#endif  // USE_MPI
+  *received = send[rank_];
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,115 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef DISTRICT_RANKS_H_
+#define DISTRICT_RANKS_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Assignment of the districts (locations) to the processes of a distributed
+// simulation. Each process (MPI rank) simulates the agents living in its own
+// districts. Without MPI (i.e. if the project is not built with
+// HIV_MALAWI_MPI), or if a single process is started, all districts belong to
+// rank 0 and the exchange functions return the data sent to the own rank.
+class DistrictRanks {
+ private:
+  int rank_ = 0;
+  int no_ranks_ = 1;
+  bool initialized_mpi_ = false;
+  // Rank owning each location
+  std::vector<int> owners_;
+
+  // Send the bytes of send[r] to rank r, and concatenate the bytes received
+  // from all ranks (in rank order) into received.
+  void ExchangeBytes(const std::vector<std::vector<char>>& send,
+                     std::vector<char>* received);
+
+ public:
+  static DistrictRanks* GetInstance();
+
+  // Initialize MPI if it was not initialized yet
+  void Init();
+  // Finalize MPI if it was initialized by Init
+  void Finalize();
+
+  int GetRank() const { return rank_; }
+  int GetNoRanks() const { return no_ranks_; }
+  bool IsDistributed() const { return no_ranks_ > 1; }
+
+  // Assign contiguous blocks of locations to the ranks, such that the sum of
+  // the weights (e.g. the population share) of each block is similar.
+  void Partition(const std::vector<float>& location_weights);
+
+  // Assign all no_locations locations to rank 0, e.g. to compare a
+  // distributed simulation with a simulation on a single rank
+  void AssignToFirstRank(size_t no_locations) {
+    owners_.assign(no_locations, 0);
+  }
+
+  // Returns the rank owning the location. All locations belong to rank 0
+  // before Partition is called.
+  int GetOwner(size_t location) const {
+    return location < owners_.size() ? owners_[location] : 0;
+  }
+
+  // Returns true if the location is simulated by this rank
+  bool IsLocal(size_t location) const { return GetOwner(location) == rank_; }
+
+  // Returns the name of the file of this rank, i.e. filename with the suffix
+  // ".rank_<rank>" in distributed simulations and filename otherwise
+  std::string GetRankFilename(const std::string& filename) const {
+    if (!IsDistributed()) {
+      return filename;
+    }
+    return filename + ".rank_" + std::to_string(rank_);
+  }
+
+  // Element-wise sum of values over all ranks
+  void AllreduceSum(std::vector<uint64_t>* values);
+
+  // Send the elements of (*send)[r] to rank r, and store the elements received
+  // from all ranks in received. send is cleared. T must be trivially copyable.
+  template <typename T>
+  void Exchange(std::vector<std::vector<T>>* send, std::vector<T>* received) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "DistrictRanks::Exchange requires trivially copyable data");
+    std::vector<std::vector<char>> send_bytes(no_ranks_);
+    for (int r = 0; r < no_ranks_ && r < static_cast<int>(send->size()); r++) {
+      auto& elements = (*send)[r];
+      send_bytes[r].resize(elements.size() * sizeof(T));
+      if (!elements.empty()) {
+        std::memcpy(send_bytes[r].data(), elements.data(),
+                    send_bytes[r].size());
+      }
+      elements.clear();
+    }
+    std::vector<char> received_bytes;
+    ExchangeBytes(send_bytes, &received_bytes);
+    received->resize(received_bytes.size() / sizeof(T));
+    if (!received->empty()) {
+      std::memcpy(received->data(), received_bytes.data(),
+                  received_bytes.size());
+    }
+  }
+};
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // DISTRICT_RANKS_H_
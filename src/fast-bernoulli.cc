@@ -0,0 +1,92 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "fast-bernoulli.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+std::atomic<uint64_t> UniformBuffer::generation_{0};
+
+UniformBuffer* UniformBuffer::GetThreadLocal() {
+  thread_local UniformBuffer buffer;
+  return &buffer;
+}
+
+void UniformBuffer::Refill() {
+  auto* sim = Simulation::GetActive();
+  uint64_t generation = generation_.load(std::memory_order_relaxed);
+  if (seeded_for_ != sim || seeded_generation_ != generation) {
+    auto* random = sim->GetRandom();
+    std::vector<uint32_t> seeds(4);
+    for (auto& el : seeds) {
+      el = DrawSeed(random);
+    }
+    std::seed_seq seed_sequence(seeds.begin(), seeds.end());
+    generator_.seed(seed_sequence);
+    seeded_for_ = sim;
+    seeded_generation_ = generation;
+  }
+  for (auto& el : buffer_) {
+    el = static_cast<uint32_t>(generator_());
+  }
+  next_ = 0;
+}
+
+// Converts each element of probabilities
+static std::vector<BernoulliThreshold> ToBernoulliThresholds(
+    const std::vector<float>& probabilities) {
+  std::vector<BernoulliThreshold> thresholds(probabilities.size());
+  for (size_t i = 0; i < probabilities.size(); i++) {
+    thresholds[i] = ToBernoulliThreshold(probabilities[i]);
+  }
+  return thresholds;
+}
+
+void BernoulliThresholds::Update(const SimParam* sparam) {
+  migration = ToBernoulliThreshold(sparam->migration_probability);
+  break_up = ToBernoulliThreshold(sparam->break_up_probability);
+  regular_partnership =
+      ToBernoulliThreshold(sparam->regular_partnership_probability);
+  give_birth = ToBernoulliThreshold(sparam->give_birth_probability);
+  biomedical_risk = ToBernoulliThreshold(sparam->biomedical_risk_probability);
+  birth_infection_treated =
+      ToBernoulliThreshold(sparam->birth_infection_probability_treated);
+  birth_infection_untreated =
+      ToBernoulliThreshold(sparam->birth_infection_probability_untreated);
+  birth_infection_prophylaxis =
+      ToBernoulliThreshold(sparam->birth_infection_probability_prophylaxis);
+
+  sociobehavioural_risk.clear();
+  for (const auto& el : sparam->sociobehavioural_risk_probability) {
+    sociobehavioural_risk.push_back(ToBernoulliThresholds(el));
+  }
+  sociobehaviour_low_risk.clear();
+  for (const auto& sb : sparam->sociobehaviour_transition_matrix) {
+    sociobehaviour_low_risk.emplace_back();
+    for (const auto& sex : sb) {
+      sociobehaviour_low_risk.back().push_back(ToBernoulliThreshold(sex[0]));
+    }
+  }
+  hiv_transition.clear();
+  for (const auto& state : sparam->hiv_transition_matrix) {
+    hiv_transition.emplace_back();
+    for (const auto& category : state) {
+      hiv_transition.back().push_back(ToBernoulliThresholds(category));
+    }
+  }
+  hiv_mortality = ToBernoulliThresholds(sparam->hiv_mortality_rate);
+  age_mortality = ToBernoulliThresholds(sparam->mortality_rate_by_age);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,121 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef FAST_BERNOULLI_H_
+#define FAST_BERNOULLI_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "biodynamo.h"
+#include "sim-param.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+// A probability p expressed as a threshold on uniform 32-bit integers: an
+// integer x drawn uniformly from [0, 2^32) satisfies x < threshold with
+// probability p (rounded down to a multiple of 2^-32).
+using BernoulliThreshold = uint64_t;
+
+inline BernoulliThreshold ToBernoulliThreshold(double probability) {
+  if (probability <= 0) {
+    return 0;
+  }
+  if (probability >= 1) {
+    return BernoulliThreshold{1} << 32;
+  }
+  return static_cast<BernoulliThreshold>(probability * 4294967296.0);
+}
+
+// Draws a seed for a standard random number generator, uniformly over the
+// 32-bit integers, from BioDynaMo's random number generator random
+inline uint32_t DrawSeed(Random* random) {
+  return (random->Integer(1 << 16) << 16) | random->Integer(1 << 16);
+}
+
+// Thread-local buffer of uniform 32-bit integers, filled in bulk. Bernoulli
+// decisions compare the next integer of the buffer with a threshold, instead
+// of drawing and converting a floating point number for every decision. The
+// generator of each thread is seeded from BioDynaMo's thread-local random
+// number generator of the active simulation.
+class UniformBuffer {
+ public:
+  static constexpr size_t kSize = 4096;
+
+  // Returns the buffer of the calling thread
+  static UniformBuffer* GetThreadLocal();
+
+  // Discard the buffered integers of all threads, and reseed their generators
+  // from BioDynaMo's random number generators before the next decision, e.g.
+  // after these were reseeded (see ReseedRandomNumberGenerators) or at the
+  // beginning of a simulation (see SetUpSimulation)
+  static void ResetAll() { generation_++; }
+
+  // Returns true with the probability represented by threshold
+  bool Bernoulli(BernoulliThreshold threshold) {
+    if (next_ == kSize ||
+        seeded_generation_ != generation_.load(std::memory_order_relaxed)) {
+      Refill();
+    }
+    return buffer_[next_++] < threshold;
+  }
+
+ private:
+  // Incremented by ResetAll
+  static std::atomic<uint64_t> generation_;
+
+  std::mt19937 generator_;
+  // Simulation whose random number generator seeded generator_, and value of
+  // generation_ at that point
+  const Simulation* seeded_for_ = nullptr;
+  uint64_t seeded_generation_ = 0;
+  std::array<uint32_t, kSize> buffer_;
+  size_t next_ = kSize;
+
+  void Refill();
+};
+
+// Thresholds of the probabilities of SimParam used in the Bernoulli decisions
+// of the behaviours (see SimParam::fast_bernoulli). The layout of the
+// vectors follows the corresponding parameters.
+struct BernoulliThresholds {
+  BernoulliThreshold migration = 0;
+  BernoulliThreshold break_up = 0;
+  BernoulliThreshold regular_partnership = 0;
+  BernoulliThreshold give_birth = 0;
+  BernoulliThreshold biomedical_risk = 0;
+  BernoulliThreshold birth_infection_treated = 0;
+  BernoulliThreshold birth_infection_untreated = 0;
+  BernoulliThreshold birth_infection_prophylaxis = 0;
+  // year transition x GemsState
+  std::vector<std::vector<BernoulliThreshold>> sociobehavioural_risk;
+  // sociobehaviour x sex, probability to move to the low risk category
+  std::vector<std::vector<BernoulliThreshold>> sociobehaviour_low_risk;
+  // GemsState x year and population category x GemsState
+  std::vector<std::vector<std::vector<BernoulliThreshold>>> hiv_transition;
+  // GemsState
+  std::vector<BernoulliThreshold> hiv_mortality;
+  // Age category (see mortality_rate_age_transition)
+  std::vector<BernoulliThreshold> age_mortality;
+
+  // Recompute the thresholds from the parameters
+  void Update(const SimParam* sparam);
+};
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // FAST_BERNOULLI_H_
@@ -15,12 +15,71 @@
 
 #include "categorical-environment.h"
 #include "datatypes.h"
+#include "district-ranks.h"
 #include "person.h"
 #include "population-initialization.h"
+#include "transmission-log.h"
 
 namespace bdm {
 namespace hiv_malawi {
 
+////////////////////////////////////////////////////////////////////////////////
+// Behaviour activation windows
+////////////////////////////////////////////////////////////////////////////////
+
+// Most behaviours only act on persons of a given sex and age range. Instead of
+// invoking them every year just to exit early, they are only attached to a
+// person while the person is inside their activation window. RandomMigration
+// and GetOlder act on everybody and are always attached.
+enum BehaviourWindow {
+  // MatingBehaviour: males in [min_age, max_age)
+  kMatingWindow = 1 << 0,
+  // RegularMatingBehaviour: adult males younger than max_age
+  kRegularMatingWindow = 1 << 1,
+  // RegularPartnershipBehaviour: adult males
+  kRegularPartnershipWindow = 1 << 2,
+  // GiveBirth: females in [min_age, max_age_birth)
+  kGiveBirthWindow = 1 << 3
+};
+
+// Returns the bitmask of the behaviour windows the person is in during the
+// given year.
+inline int GetBehaviourWindows(Person* person, int year,
+                               const SimParam* sparam) {
+  int windows = 0;
+  int age = person->GetAge(year);
+  if (person->IsMale()) {
+    if (age >= sparam->min_age && age < sparam->max_age) {
+      windows |= BehaviourWindow::kMatingWindow;
+    }
+    if (person->IsAdult(year)) {
+      windows |= BehaviourWindow::kRegularPartnershipWindow;
+      if (age < sparam->max_age) {
+        windows |= BehaviourWindow::kRegularMatingWindow;
+      }
+    }
+  } else if (age >= sparam->min_age && age < sparam->max_age_birth) {
+    windows |= BehaviourWindow::kGiveBirthWindow;
+  }
+  return windows;
+}
+
+// Returns the estimated relative cost of running the behaviours of the person:
+// one unit per attached behaviour, plus the expected number of casual partners
+// (no_mates_mean of the current year) for men in the mating window.
+inline float EstimateBehaviourCost(Person* person,
+                                   const std::vector<float>& no_mates_mean) {
+  float cost = person->GetAllBehaviors().size();
+  if (person->active_behaviours_ & BehaviourWindow::kMatingWindow) {
+    cost += no_mates_mean[person->social_behaviour_factor_];
+  }
+  return cost;
+}
+
+// Replaces all behaviours of the person by the ones matching the windows. See
+// definition below the behaviours.
+inline void AttachBehaviours(Person* person, int windows);
+
 ////////////////////////////////////////////////////////////////////////////////
 // BioDynaMo's Agent / Individual Behaviors
 ////////////////////////////////////////////////////////////////////////////////
@@ -39,11 +98,21 @@ struct RandomMigration : public Behavior {
     auto* person = bdm_static_cast<Person*>(agent);
     auto* param = sim->GetParam();
     const auto* sparam = param->Get<SimParam>();
+    int year = static_cast<int>(
+        sparam->start_year +
+        sim->GetScheduler()->GetSimulatedSteps());  // Current year
 
     // Probability to migrate
-    float rand_num = static_cast<float>(random->Uniform());
+    bool migrate;
+    if (sparam->fast_bernoulli) {
+      migrate = UniformBuffer::GetThreadLocal()->Bernoulli(
+          env->GetBernoulliThresholds().migration);
+    } else {
+      float rand_num = static_cast<float>(random->Uniform());
+      migrate = rand_num <= sparam->migration_probability;
+    }
     // Adult men and adult single women can initiate migration
-    if (rand_num <= sparam->migration_probability && person->age_ >= 15 &&
+    if (migrate && person->IsAdult(year) &&
         ((person->sex_ == Sex::kMale) ||
          (person->sex_ == Sex::kFemale && !person->hasPartner()))) {
       // Randomly determine the migration location
@@ -58,7 +127,7 @@ struct RandomMigration : public Behavior {
       int new_location =
           SampleLocation(rand_num_loc, migration_location_distribution_);
 
-      person->Relocate(new_location);
+      person->Relocate(new_location, year);
     }
   }
 };
@@ -89,6 +158,19 @@ struct MatingBehaviour : public Behavior {
     return 0;
   }
 
+  // Returns the number of contacts with healthy women before the next contact
+  // with an infected woman (geometric distribution), at most max_contacts.
+  int SampleNoSkippedContacts(double rand_num, double infected_probability,
+                              int max_contacts) {
+    if (infected_probability <= 0) {
+      return max_contacts;
+    }
+    double no_skipped =
+        std::floor(std::log(rand_num) / std::log1p(-infected_probability));
+    return no_skipped < max_contacts ? static_cast<int>(no_skipped)
+                                     : max_contacts;
+  }
+
   void Run(Agent* agent) override {
     auto* sim = Simulation::GetActive();
     auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
@@ -122,21 +204,80 @@ struct MatingBehaviour : public Behavior {
 
     // This part is only executed for male persons in a certain age group, since
     // the infection goes into both directions.
-    if (no_mates > 0 && person->sex_ == Sex::kMale &&
-        person->age_ >= env->GetMinAge() && person->age_ < env->GetMaxAge()) {
+    int age = person->GetAge(year);
+    if (no_mates > 0 && person->sex_ == Sex::kMale && age >= env->GetMinAge() &&
+        age < env->GetMaxAge()) {
       // Compute male agent's age category
-      size_t age_category =
-          person->GetAgeCategory(env->GetMinAge(), env->GetNoAgeCategories());
+      size_t age_category = person->GetAgeCategory(year, env->GetMinAge(),
+                                                   env->GetNoAgeCategories());
       // Get (cumulative) probability distribution that the male agent selects a
       // female mate from each compound category
       const std::vector<float>& mate_compound_category_distribution =
           env->GetMateCompoundCategoryDistribution(
               person->location_, age_category,
               person->social_behaviour_factor_);
+      size_t compound_category = env->ComputeCompoundIndex(
+          person->location_, age_category, person->social_behaviour_factor_);
       // Reset to 0 for this year
       // person->no_casual_partners_ = 0;
 
-      for (int i = 0; i < no_mates; i++) {
+      int i = 0;
+      if (sparam->skip_non_transmissive_casual_contacts &&
+          person->IsHealthy()) {
+        // Contacts of a healthy man with healthy women cannot transmit HIV.
+        // Walk from one contact with an infected woman to the next, skipping
+        // the contacts in between, until the man gets infected.
+        const std::vector<float>& infected_distribution =
+            env->GetMateInfectedCompoundCategoryDistribution(
+                person->location_, age_category,
+                person->social_behaviour_factor_);
+        float infected_probability = infected_distribution.back();
+        while (i < no_mates && person->IsHealthy()) {
+          int no_skipped = SampleNoSkippedContacts(
+              random->Uniform(), infected_probability, no_mates - i);
+          person->no_casual_partners_ =
+              person->no_casual_partners_ + no_skipped;
+          AddCasualPartnersToStatistics(person, no_skipped);
+          env->AddSkippedCasualContacts(compound_category, no_skipped);
+          i += no_skipped;
+          if (i == no_mates) {
+            break;
+          }
+          // Select an infected mate
+          float rand_num =
+              static_cast<float>(random->Uniform()) * infected_probability;
+          size_t mate_compound_category =
+              SampleCompoundCategory(rand_num, infected_distribution);
+          int mate_state, mate_sb;
+          AgentPointer<Person> mate = SelectMate(
+              env, mate_compound_category, true, random, &mate_state, &mate_sb);
+          CasualContact(person, mate, mate_state, mate_sb,
+                        mate_compound_category, year_index, random, sparam);
+          i++;
+        }
+      }
+
+      if (sparam->bulk_casual_partner_allocation && i < no_mates) {
+        // Allocate the remaining contacts to the female compound categories at
+        // once, and pick the mates category by category. Categories are
+        // visited from a random offset, such that no category is
+        // systematically met first.
+        const auto& partner_counts = env->SampleCasualPartnerCounts(
+            compound_category, no_mates - i, random);
+        size_t no_categories = partner_counts.size();
+        size_t offset = no_categories > 0 ? random->Integer(no_categories) : 0;
+        for (size_t c = 0; c < no_categories; c++) {
+          const auto& el = partner_counts[(offset + c) % no_categories];
+          for (uint64_t k = 0; k < el.second; k++) {
+            CasualContactInCategory(person, el.first, year_index, random,
+                                    sparam);
+          }
+        }
+        i = no_mates;
+      }
+
+      // Sample the remaining contacts individually
+      for (; i < no_mates; i++) {
         // AM: select compound category of mate
         float rand_num = static_cast<float>(random->Uniform());
 
@@ -145,131 +286,241 @@ struct MatingBehaviour : public Behavior {
 
         // AM: Choose a random female mate at the selected mate compound
         // category (location, age group and sociobehavioral category
-        AgentPointer<Person> mate =
-            env->GetRandomCasualFemaleFromIndex(mate_compound_category);
+        CasualContactInCategory(person, mate_compound_category, year_index,
+                                random, sparam);
+      }
+    }
+  }
 
-        if (mate == nullptr) {
-          Log::Fatal("MatingBehaviour()",
-                     "Received nullptr as AgentPointer mate.");
-        }
+  // Returns a random woman of the compound category, among the infected ones if
+  // infected_only, and writes her HIV state and sociobehaviour to mate_state
+  // and mate_sb. In district-partitioned execution, a woman of another
+  // district may be changed by the thread that executes her district. Her
+  // state is then sampled from the index by HIV state of the beginning of the
+  // iteration, as for the women of other ranks, and her sociobehaviour is the
+  // one of the category.
+  AgentPointer<Person> SelectMate(CategoricalEnvironment* env,
+                                  size_t mate_compound_category,
+                                  bool infected_only, Random* random,
+                                  int* mate_state, int* mate_sb) {
+    size_t mate_location =
+        env->ComputeLocationFromCompoundIndex(mate_compound_category);
+    AgentPointer<Person> mate;
+    if (env->IsRemoteDistrict(mate_location)) {
+      *mate_state = env->SampleCasualFemaleState(mate_compound_category,
+                                                 random, infected_only);
+      *mate_sb =
+          env->ComputeSociobehaviourFromCompoundIndex(mate_compound_category);
+      mate = env->GetRandomCasualFemaleFromHivStateIndex(
+          mate_compound_category, *mate_state);
+    } else {
+      mate = infected_only ? env->GetRandomCasualInfectedFemaleFromIndex(
+                                 mate_compound_category)
+                           : env->GetRandomCasualFemaleFromIndex(
+                                 mate_compound_category);
+      if (mate != nullptr) {
+        *mate_state = mate->state_;
+        *mate_sb = mate->social_behaviour_factor_;
+      }
+    }
+    if (mate == nullptr) {
+      Log::Fatal("MatingBehaviour()", "Received nullptr as AgentPointer mate.");
+    }
+    return mate;
+  }
 
-        // Increment number of casual partners for both agents
-        person->no_casual_partners_ = person->no_casual_partners_ + 1;
-        mate->no_casual_partners_ = mate->no_casual_partners_ + 1;
-
-        int no_acts = static_cast<int>(random->Gaus(
-            sparam->no_acts_mean[year_index][person->social_behaviour_factor_],
-            sparam
-                ->no_acts_sigma[year_index][person->social_behaviour_factor_]));
-
-        // Scenario healthy male has intercourse with infected acute female
-        if (mate->state_ == GemsState::kAcute &&
-            person->state_ == GemsState::kHealthy &&
-            random->Uniform() <
-                (1.0 -
-                 pow(1.0 - sparam->infection_probability_acute_fm, no_acts))) {
-          person->state_ = GemsState::kAcute;
-          person->transmission_type_ = TransmissionType::kCasualPartner;
-          person->infection_origin_state_ = mate->state_;
-          person->infection_origin_sb_ = mate->social_behaviour_factor_;
-          // AM: Add MatingBehaviour only when male gets infected
-          /*person->AddBehavior(new MatingBehaviour());
-          std::cout << "This should not currently happen: AddBehavior(new
-          MatingBehaviour()) in MatingBehaviour::Run()" << std::endl;*/
-        }
-        // Scenario healthy male has intercourse with infected chronic female
-        else if (mate->state_ == GemsState::kChronic &&
-                 person->state_ == GemsState::kHealthy &&
-                 random->Uniform() <
-                     (1.0 - pow(1.0 - sparam->infection_probability_chronic_fm,
-                                no_acts))) {
-          person->state_ = GemsState::kAcute;
-          person->transmission_type_ = TransmissionType::kCasualPartner;
-          person->infection_origin_state_ = mate->state_;
-          person->infection_origin_sb_ = mate->social_behaviour_factor_;
-          // AM: Add MatingBehaviour only when male gets infected
-          /*person->AddBehavior(new MatingBehaviour());
-          std::cout << "This should not currently happen: AddBehavior(new
-          MatingBehaviour()) in MatingBehaviour::Run()" << std::endl;*/
-        }
-        // Scenario healthy male has intercourse with infected treated female
-        else if (mate->state_ == GemsState::kTreated &&
-                 person->state_ == GemsState::kHealthy &&
-                 random->Uniform() <
-                     (1.0 - pow(1.0 - sparam->infection_probability_treated_fm,
-                                no_acts))) {
-          person->state_ = GemsState::kAcute;
-          person->transmission_type_ = TransmissionType::kCasualPartner;
-          person->infection_origin_state_ = mate->state_;
-          person->infection_origin_sb_ = mate->social_behaviour_factor_;
-          // AM: Add MatingBehaviour only when male gets infected
-          /*person->AddBehavior(new MatingBehaviour());
-          std::cout << "This should not currently happen: AddBehavior(new
-          MatingBehaviour()) in MatingBehaviour::Run()" << std::endl;*/
-        }
-        // Scenario healthy male has intercourse with infected failing treatment
-        // female
-        else if (mate->state_ == GemsState::kFailing &&
-                 person->state_ == GemsState::kHealthy &&
-                 random->Uniform() <
-                     (1.0 - pow(1.0 - sparam->infection_probability_failing_fm,
-                                no_acts))) {
-          person->state_ = GemsState::kAcute;
-          person->transmission_type_ = TransmissionType::kCasualPartner;
-          person->infection_origin_state_ = mate->state_;
-          person->infection_origin_sb_ = mate->social_behaviour_factor_;
-          // AM: Add MatingBehaviour only when male gets infected
-          /*person->AddBehavior(new MatingBehaviour());
-          std::cout << "This should not currently happen: AddBehavior(new
-          MatingBehaviour()) in MatingBehaviour::Run()" << std::endl;*/
-        }
-        // Scenario infected acute male has intercourse with healthy female
-        else if (mate->state_ == GemsState::kHealthy &&
-                 person->state_ == GemsState::kAcute &&
-                 random->Uniform() <
-                     (1.0 - pow(1.0 - sparam->infection_probability_acute_mf,
-                                no_acts))) {
-          mate->state_ = GemsState::kAcute;
-          mate->transmission_type_ = TransmissionType::kCasualPartner;
-          mate->infection_origin_state_ = person->state_;
-          mate->infection_origin_sb_ = person->social_behaviour_factor_;
-        }  // Scenario infected chronic male has intercourse with healthy female
-        else if (mate->state_ == GemsState::kHealthy &&
-                 person->state_ == GemsState::kChronic &&
-                 random->Uniform() <
-                     (1.0 - pow(1.0 - sparam->infection_probability_chronic_mf,
-                                no_acts))) {
-          mate->state_ = GemsState::kAcute;
-          mate->transmission_type_ = TransmissionType::kCasualPartner;
-          mate->infection_origin_state_ = person->state_;
-          mate->infection_origin_sb_ = person->social_behaviour_factor_;
-        }  // Scenario infected treated male has intercourse with healthy female
-        else if (mate->state_ == GemsState::kHealthy &&
-                 person->state_ == GemsState::kTreated &&
-                 random->Uniform() <
-                     (1.0 - pow(1.0 - sparam->infection_probability_treated_mf,
-                                no_acts))) {
-          mate->state_ = GemsState::kAcute;
-          mate->transmission_type_ = TransmissionType::kCasualPartner;
-          mate->infection_origin_state_ = person->state_;
-          mate->infection_origin_sb_ = person->social_behaviour_factor_;
-        }  // Scenario infected failing treatment male has intercourse with
-           // healthy female
-        else if (mate->state_ == GemsState::kHealthy &&
-                 person->state_ == GemsState::kFailing &&
-                 random->Uniform() <
-                     (1.0 - pow(1.0 - sparam->infection_probability_failing_mf,
-                                no_acts))) {
-          mate->state_ = GemsState::kAcute;
-          mate->transmission_type_ = TransmissionType::kCasualPartner;
-          mate->infection_origin_state_ = person->state_;
-          mate->infection_origin_sb_ = person->social_behaviour_factor_;
-        } else {
-          ;  // if both are infected or both are healthy, do nothing
-        }
+  // Casual contact between the male agent and his mate, whose HIV state and
+  // sociobehaviour are given by SelectMate: increments the number of casual
+  // partners of both agents, and HIV may be transmitted from the infected to
+  // the healthy one. In district-partitioned execution, a mate of another
+  // district is only modified at the end of the behaviour pass.
+  void CasualContact(Person* person, AgentPointer<Person>& mate,
+                     int mate_state, int mate_sb,
+                     size_t mate_compound_category, int year_index,
+                     Random* random, const SimParam* sparam) {
+    auto* env = bdm_static_cast<CategoricalEnvironment*>(
+        Simulation::GetActive()->GetEnvironment());
+    size_t mate_location =
+        env->ComputeLocationFromCompoundIndex(mate_compound_category);
+    bool remote_mate = env->IsRemoteDistrict(mate_location);
+
+    // Increment number of casual partners for both agents
+    person->no_casual_partners_ = person->no_casual_partners_ + 1;
+    AddCasualPartnersToStatistics(person, 1);
+    if (!remote_mate) {
+      mate->no_casual_partners_ = mate->no_casual_partners_ + 1;
+      AddCasualPartnersToStatistics(mate.Get(), 1);
+    }
+
+    bool healthy = person->IsHealthy();
+    bool mate_infection = CasualTransmission(person, mate_state, mate_sb,
+                                             year_index, random, sparam);
+    if (healthy && !person->IsHealthy()) {
+      LogTransmission(person, mate->GetUid(), mate_state, mate_sb);
+      UpdateStatistics(person);
+    }
+
+    if (remote_mate) {
+      env->AddRemoteCasualContact(mate, mate_location, mate_infection,
+                                  person->state_,
+                                  person->social_behaviour_factor_,
+                                  person->GetUid());
+    } else {
+      if (mate_infection) {
+        mate->state_ = GemsState::kAcute;
+        mate->transmission_type_ = TransmissionType::kCasualPartner;
+        mate->infection_origin_state_ = person->state_;
+        mate->infection_origin_sb_ = person->social_behaviour_factor_;
+        LogTransmission(mate.Get(), person);
+        UpdateStatistics(mate.Get());
       }
     }
   }
+
+  // HIV transmission during a casual contact between the male agent and a mate
+  // with the given HIV state and socio-behavioural category. The man is
+  // infected in place; returns true if HIV is transmitted to the mate.
+  bool CasualTransmission(Person* person, int mate_state, int mate_sb,
+                          int year_index, Random* random,
+                          const SimParam* sparam) {
+    bool mate_infection = false;
+    int no_acts = static_cast<int>(random->Gaus(
+        sparam->no_acts_mean[year_index][person->social_behaviour_factor_],
+        sparam->no_acts_sigma[year_index][person->social_behaviour_factor_]));
+
+    // Scenario healthy male has intercourse with infected acute female
+    if (mate_state == GemsState::kAcute &&
+        person->state_ == GemsState::kHealthy &&
+        random->Uniform() <
+            (1.0 -
+             pow(1.0 - sparam->infection_probability_acute_fm, no_acts))) {
+      person->state_ = GemsState::kAcute;
+      person->transmission_type_ = TransmissionType::kCasualPartner;
+      person->infection_origin_state_ = mate_state;
+      person->infection_origin_sb_ = mate_sb;
+      // AM: Add MatingBehaviour only when male gets infected
+      /*person->AddBehavior(new MatingBehaviour());
+      std::cout << "This should not currently happen: AddBehavior(new
+      MatingBehaviour()) in MatingBehaviour::Run()" << std::endl;*/
+    }
+    // Scenario healthy male has intercourse with infected chronic female
+    else if (mate_state == GemsState::kChronic &&
+             person->state_ == GemsState::kHealthy &&
+             random->Uniform() <
+                 (1.0 - pow(1.0 - sparam->infection_probability_chronic_fm,
+                            no_acts))) {
+      person->state_ = GemsState::kAcute;
+      person->transmission_type_ = TransmissionType::kCasualPartner;
+      person->infection_origin_state_ = mate_state;
+      person->infection_origin_sb_ = mate_sb;
+      // AM: Add MatingBehaviour only when male gets infected
+      /*person->AddBehavior(new MatingBehaviour());
+      std::cout << "This should not currently happen: AddBehavior(new
+      MatingBehaviour()) in MatingBehaviour::Run()" << std::endl;*/
+    }
+    // Scenario healthy male has intercourse with infected treated female
+    else if (mate_state == GemsState::kTreated &&
+             person->state_ == GemsState::kHealthy &&
+             random->Uniform() <
+                 (1.0 - pow(1.0 - sparam->infection_probability_treated_fm,
+                            no_acts))) {
+      person->state_ = GemsState::kAcute;
+      person->transmission_type_ = TransmissionType::kCasualPartner;
+      person->infection_origin_state_ = mate_state;
+      person->infection_origin_sb_ = mate_sb;
+      // AM: Add MatingBehaviour only when male gets infected
+      /*person->AddBehavior(new MatingBehaviour());
+      std::cout << "This should not currently happen: AddBehavior(new
+      MatingBehaviour()) in MatingBehaviour::Run()" << std::endl;*/
+    }
+    // Scenario healthy male has intercourse with infected failing treatment
+    // female
+    else if (mate_state == GemsState::kFailing &&
+             person->state_ == GemsState::kHealthy &&
+             random->Uniform() <
+                 (1.0 - pow(1.0 - sparam->infection_probability_failing_fm,
+                            no_acts))) {
+      person->state_ = GemsState::kAcute;
+      person->transmission_type_ = TransmissionType::kCasualPartner;
+      person->infection_origin_state_ = mate_state;
+      person->infection_origin_sb_ = mate_sb;
+      // AM: Add MatingBehaviour only when male gets infected
+      /*person->AddBehavior(new MatingBehaviour());
+      std::cout << "This should not currently happen: AddBehavior(new
+      MatingBehaviour()) in MatingBehaviour::Run()" << std::endl;*/
+    }
+    // Scenario infected acute male has intercourse with healthy female
+    else if (mate_state == GemsState::kHealthy &&
+             person->state_ == GemsState::kAcute &&
+             random->Uniform() <
+                 (1.0 - pow(1.0 - sparam->infection_probability_acute_mf,
+                            no_acts))) {
+      mate_infection = true;
+    }  // Scenario infected chronic male has intercourse with healthy female
+    else if (mate_state == GemsState::kHealthy &&
+             person->state_ == GemsState::kChronic &&
+             random->Uniform() <
+                 (1.0 - pow(1.0 - sparam->infection_probability_chronic_mf,
+                            no_acts))) {
+      mate_infection = true;
+    }  // Scenario infected treated male has intercourse with healthy female
+    else if (mate_state == GemsState::kHealthy &&
+             person->state_ == GemsState::kTreated &&
+             random->Uniform() <
+                 (1.0 - pow(1.0 - sparam->infection_probability_treated_mf,
+                            no_acts))) {
+      mate_infection = true;
+    }  // Scenario infected failing treatment male has intercourse with
+       // healthy female
+    else if (mate_state == GemsState::kHealthy &&
+             person->state_ == GemsState::kFailing &&
+             random->Uniform() <
+                 (1.0 - pow(1.0 - sparam->infection_probability_failing_mf,
+                            no_acts))) {
+      mate_infection = true;
+    } else {
+      ;  // if both are infected or both are healthy, do nothing
+    }
+    return mate_infection;
+  }
+
+  // Casual contact with a random woman of the given compound category. Women
+  // simulated by another rank (see DistrictRanks) are not accessible: the HIV
+  // state of the mate is sampled from the number of women in each state of
+  // the category, and the contact is sent to the rank of the woman at the end
+  // of the behaviour pass.
+  void CasualContactInCategory(Person* person, size_t mate_compound_category,
+                               int year_index, Random* random,
+                               const SimParam* sparam) {
+    auto* env = bdm_static_cast<CategoricalEnvironment*>(
+        Simulation::GetActive()->GetEnvironment());
+    size_t mate_location =
+        env->ComputeLocationFromCompoundIndex(mate_compound_category);
+    if (DistrictRanks::GetInstance()->IsLocal(mate_location)) {
+      int mate_state, mate_sb;
+      AgentPointer<Person> mate = SelectMate(
+          env, mate_compound_category, false, random, &mate_state, &mate_sb);
+      CasualContact(person, mate, mate_state, mate_sb, mate_compound_category,
+                    year_index, random, sparam);
+      return;
+    }
+    int mate_state =
+        env->SampleCasualFemaleState(mate_compound_category, random);
+    int mate_sb =
+        env->ComputeSociobehaviourFromCompoundIndex(mate_compound_category);
+    person->no_casual_partners_ = person->no_casual_partners_ + 1;
+    AddCasualPartnersToStatistics(person, 1);
+    bool healthy = person->IsHealthy();
+    bool mate_infection = CasualTransmission(person, mate_state, mate_sb,
+                                             year_index, random, sparam);
+    if (healthy && !person->IsHealthy()) {
+      LogTransmission(person, kUnknownInfector, mate_state, mate_sb);
+      UpdateStatistics(person);
+    }
+    env->AddRankCasualContact(mate_compound_category, mate_state,
+                              mate_infection, person->state_,
+                              person->social_behaviour_factor_);
+  }
 };
 
 // This is the regular partnership behaviour. The Behavior
@@ -284,14 +535,23 @@ struct RegularPartnershipBehaviour : public Behavior {
 
   void Run(Agent* agent) override {
     auto* sim = Simulation::GetActive();
+    auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
     auto* random = sim->GetRandom();
     auto* param = sim->GetParam();
     const auto* sparam = param->Get<SimParam>();
     auto* person = bdm_static_cast<Person*>(agent);
+    int year = static_cast<int>(
+        sparam->start_year +
+        sim->GetScheduler()->GetSimulatedSteps());  // Current year
+    auto* fast = sparam->fast_bernoulli ? UniformBuffer::GetThreadLocal()
+                                        : nullptr;
+    const auto& thresholds = env->GetBernoulliThresholds();
 
     // Adult men in regular partnership can break up (symmetric for female)
-    if (person->IsAdult() && person->hasPartner() &&
-        random->Uniform() <= sparam->break_up_probability) {
+    if (person->IsAdult(year) && person->hasPartner() &&
+        (fast != nullptr
+             ? fast->Bernoulli(thresholds.break_up)
+             : random->Uniform() <= sparam->break_up_probability)) {
       // Set female partner to single
       person->partner_->partner_ = nullptr;
       // Set male agent to single
@@ -299,8 +559,10 @@ struct RegularPartnershipBehaviour : public Behavior {
     }
 
     // Adult single men can decide to engage in a regular partnership
-    if (person->IsAdult() && !person->hasPartner() &&
-        random->Uniform() <= sparam->regular_partnership_probability) {
+    if (person->IsAdult(year) && !person->hasPartner() &&
+        (fast != nullptr ? fast->Bernoulli(thresholds.regular_partnership)
+                         : random->Uniform() <=
+                               sparam->regular_partnership_probability)) {
       person->seek_regular_partnership_ = true;
     } else {
       person->seek_regular_partnership_ = false;
@@ -340,7 +602,9 @@ struct RegularMatingBehaviour : public Behavior {
       }
     }
 
-    if (person->hasPartner() && person->age_ < env->GetMaxAge()) {
+    if (person->hasPartner() && person->GetAge(year) < env->GetMaxAge()) {
+      bool healthy = person->IsHealthy();
+      bool partner_healthy = person->partner_->IsHealthy();
       // Scenario healthy male has intercourse with infected acute female
       // partner
       if (person->partner_->state_ == GemsState::kAcute &&
@@ -404,6 +668,7 @@ struct RegularMatingBehaviour : public Behavior {
         person->partner_->transmission_type_ =
             TransmissionType::kRegularPartner;
         person->partner_->infection_origin_state_ = person->state_;
+        UpdateStatistics(person->partner_.Get());
       }  // Scenario infected chronic male has intercourse with healthy female
          // partner
       else if (person->partner_->state_ == GemsState::kHealthy &&
@@ -415,6 +680,7 @@ struct RegularMatingBehaviour : public Behavior {
         person->partner_->transmission_type_ =
             TransmissionType::kRegularPartner;
         person->partner_->infection_origin_state_ = person->state_;
+        UpdateStatistics(person->partner_.Get());
       }  // Scenario infected treated male has intercourse with healthy female
          // partner
       else if (person->partner_->state_ == GemsState::kHealthy &&
@@ -426,6 +692,7 @@ struct RegularMatingBehaviour : public Behavior {
         person->partner_->transmission_type_ =
             TransmissionType::kRegularPartner;
         person->partner_->infection_origin_state_ = person->state_;
+        UpdateStatistics(person->partner_.Get());
       }  // Scenario infected failing treatment male has intercourse with
          // healthy female partner
       else if (person->partner_->state_ == GemsState::kHealthy &&
@@ -437,9 +704,17 @@ struct RegularMatingBehaviour : public Behavior {
         person->partner_->transmission_type_ =
             TransmissionType::kRegularPartner;
         person->partner_->infection_origin_state_ = person->state_;
+        UpdateStatistics(person->partner_.Get());
       } else {
         ;  // if both are infected or both are healthy, do nothing
       }
+
+      if (healthy && !person->IsHealthy()) {
+        LogTransmission(person, person->partner_.Get());
+        UpdateStatistics(person);
+      } else if (partner_healthy && !person->partner_->IsHealthy()) {
+        LogTransmission(person->partner_.Get(), person);
+      }
     }
   }
 };
@@ -453,18 +728,25 @@ struct GetOlder : public Behavior {
 
   // AM : Get mortality rate by age
   float get_mortality_rate_age(
-      float age, const std::vector<int>& mortality_rate_age_transition,
+      int age, const std::vector<int>& mortality_rate_age_transition,
       const std::vector<float>& mortality_rate_by_age) {
-    size_t age_index = mortality_rate_by_age.size() - 1;
+    size_t age_index = get_mortality_age_index(
+        age, mortality_rate_age_transition, mortality_rate_by_age.size());
+    // std::cout << "Age " << age << " => Mortality rate " <<
+    // mortality_rate_by_age[age_index] << std::endl;
+    return mortality_rate_by_age[age_index];
+  }
+
+  // Get the index of the age category in mortality_rate_by_age
+  size_t get_mortality_age_index(
+      int age, const std::vector<int>& mortality_rate_age_transition,
+      size_t no_age_categories) {
     for (size_t i = 0; i < mortality_rate_age_transition.size(); i++) {
       if (age < mortality_rate_age_transition[i]) {
-        age_index = i;
-        break;
+        return i;
       }
     }
-    // std::cout << "Age " << age << " => Mortality rate " <<
-    // mortality_rate_by_age[age_index] << std::endl;
-    return mortality_rate_by_age[age_index];
+    return no_age_categories - 1;
   }
 
   // AM: Get HIV-related mortality rate
@@ -475,19 +757,26 @@ struct GetOlder : public Behavior {
 
   void Run(Agent* agent) override {
     auto* sim = Simulation::GetActive();
+    auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
     auto* random = sim->GetRandom();
     auto* param = sim->GetParam();
     const auto* sparam = param->Get<SimParam>();
     auto* person = bdm_static_cast<Person*>(agent);
+    int year = static_cast<int>(
+        sparam->start_year +
+        sim->GetScheduler()->GetSimulatedSteps());  // Current year
+    int age = person->GetAge(year);
+    auto* fast = sparam->fast_bernoulli ? UniformBuffer::GetThreadLocal()
+                                        : nullptr;
+    const auto& thresholds = env->GetBernoulliThresholds();
+    // Attributes of the bins of the person in the statistics
+    int old_state = person->state_;
+    int old_social_behaviour_factor = person->social_behaviour_factor_;
 
     // Assign or reassign risk factors
-    if (floor(person->age_) ==
-        sparam->min_age) {  // Assign potentially high risk
-                            // factor at first year of adulthood
+    if (age == sparam->min_age) {  // Assign potentially high risk
+                                   // factor at first year of adulthood
       // Probability of being at high risk depends on year and HIV status
-      int year = static_cast<int>(
-          sparam->start_year +
-          sim->GetScheduler()->GetSimulatedSteps());  // Current year
       // Check transition year
       // If no sociobehavioural risk transition year is higher than current
       // year, then use last transition year
@@ -500,31 +789,42 @@ struct GetOlder : public Behavior {
         }
       }
 
-      if (random->Uniform() <=
-          sparam
-              ->sociobehavioural_risk_probability[year_index][person->state_]) {
+      const auto& risk_thresholds = thresholds.sociobehavioural_risk;
+      if (fast != nullptr
+              ? fast->Bernoulli(risk_thresholds[year_index][person->state_])
+              : random->Uniform() <=
+                    sparam->sociobehavioural_risk_probability[year_index]
+                                                             [person->state_]) {
         person->social_behaviour_factor_ = 1;
       } else {
         person->social_behaviour_factor_ = 0;
       }
-      if (random->Uniform() <= sparam->biomedical_risk_probability) {
+      if (fast != nullptr
+              ? fast->Bernoulli(thresholds.biomedical_risk)
+              : random->Uniform() <= sparam->biomedical_risk_probability) {
         person->biomedical_factor_ = 1;
       } else {
         person->biomedical_factor_ = 0;
       }
-    } else if (person->age_ > sparam->min_age) {
+    } else if (age > sparam->min_age) {
       // Potential change in risk factor foradults (after first year of
       // adulthood)
       // Update risk factors stochastically like in initialization
-      if (random->Uniform() <=
-          sparam->sociobehaviour_transition_matrix
-              [person->social_behaviour_factor_][person->sex_][0]) {
+      if (fast != nullptr
+              ? fast->Bernoulli(
+                    thresholds.sociobehaviour_low_risk
+                        [person->social_behaviour_factor_][person->sex_])
+              : random->Uniform() <=
+                    sparam->sociobehaviour_transition_matrix
+                        [person->social_behaviour_factor_][person->sex_][0]) {
         person->social_behaviour_factor_ = 0;
 
       } else {
         person->social_behaviour_factor_ = 1;
       }
-      if (random->Uniform() > sparam->biomedical_risk_probability) {
+      if (fast != nullptr
+              ? !fast->Bernoulli(thresholds.biomedical_risk)
+              : random->Uniform() > sparam->biomedical_risk_probability) {
         person->biomedical_factor_ = 0;
       } else {
         person->biomedical_factor_ = 1;
@@ -538,10 +838,6 @@ struct GetOlder : public Behavior {
     // category (important for transition to treatment)
     int year_population_category = -1;
 
-    int start_year = sim->GetParam()->Get<SimParam>()->start_year;
-    int year =
-        static_cast<int>(start_year + sim->GetScheduler()->GetSimulatedSteps());
-
     // TO DO AM: Replace code below with function :
     // ComputeYearPopulationCategory(int year, float age, int sex)
     // year_population_category =
@@ -551,20 +847,18 @@ struct GetOlder : public Behavior {
       year_population_category =
           0;  // All (No difference in ART between people. ART not available.)
     } else if (year < 2011) {  // Between 2003 and 2010
-      if (person->sex_ == Sex::kFemale && person->age_ >= 15 and
-          person->age_ <= 40) {
+      if (person->sex_ == Sex::kFemale && age >= 15 and age < 40) {
         year_population_category = 1;  // Female between 15 and 40
-      } else if (person->age_ < 15) {
+      } else if (age < 15) {
         year_population_category = 2;  // Child
       } else {
         year_population_category =
             3;  // Others (Male over 15 and Female over 40)
       }
     } else {  // After 2011
-      if (person->sex_ == Sex::kFemale && person->age_ >= 15 and
-          person->age_ <= 40) {
+      if (person->sex_ == Sex::kFemale && age >= 15 and age < 40) {
         year_population_category = 4;  // Female between 15 and 40
-      } else if (person->age_ < 15) {
+      } else if (age < 15) {
         year_population_category = 5;  // Child
       } else {
         year_population_category =
@@ -574,7 +868,11 @@ struct GetOlder : public Behavior {
     const auto& transition_proba =
         sparam->hiv_transition_matrix[person->state_][year_population_category];
     for (size_t i = 0; i < transition_proba.size(); i++) {
-      if (random->Uniform() < transition_proba[i]) {
+      if (fast != nullptr
+              ? fast->Bernoulli(
+                    thresholds.hiv_transition[person->state_]
+                                             [year_population_category][i])
+              : random->Uniform() < transition_proba[i]) {
         person->state_ = i;
         break;
       }
@@ -584,18 +882,32 @@ struct GetOlder : public Behavior {
     bool stay_alive{true};
 
     // AM: Mortality
-    // HIV-related mortality
-    float rand_num_hiv = static_cast<float>(random->Uniform());
-    if (rand_num_hiv <
-        get_mortality_rate_hiv(person->state_, sparam->hiv_mortality_rate)) {
-      stay_alive = false;
-    }
-    // Age-related mortality
-    float rand_num_age = static_cast<float>(random->Uniform());
-    if (rand_num_age < get_mortality_rate_age(
-                           person->age_, sparam->mortality_rate_age_transition,
-                           sparam->mortality_rate_by_age)) {
-      stay_alive = false;
+    if (fast != nullptr) {
+      // HIV-related mortality
+      if (fast->Bernoulli(thresholds.hiv_mortality[person->state_])) {
+        stay_alive = false;
+      }
+      // Age-related mortality
+      size_t age_index = get_mortality_age_index(
+          age, sparam->mortality_rate_age_transition,
+          thresholds.age_mortality.size());
+      if (fast->Bernoulli(thresholds.age_mortality[age_index])) {
+        stay_alive = false;
+      }
+    } else {
+      // HIV-related mortality
+      float rand_num_hiv = static_cast<float>(random->Uniform());
+      if (rand_num_hiv <
+          get_mortality_rate_hiv(person->state_, sparam->hiv_mortality_rate)) {
+        stay_alive = false;
+      }
+      // Age-related mortality
+      float rand_num_age = static_cast<float>(random->Uniform());
+      if (rand_num_age < get_mortality_rate_age(
+                             age, sparam->mortality_rate_age_transition,
+                             sparam->mortality_rate_by_age)) {
+        stay_alive = false;
+      }
     }
 
     // We protect mothers that just gave birth. This should not have a large
@@ -611,11 +923,31 @@ struct GetOlder : public Behavior {
     }
 
     if (!stay_alive) {
-      // Person dies, i.e. is removed from simulation.
+      // Person dies, i.e. is removed from simulation. In district-partitioned
+      // execution, the relatives that may live in another district are
+      // unlinked at the end of the behaviour pass.
+      env->UnlinkRemoteRelatives(person, year);
       person->RemoveFromSimulation();
     } else {
-      // increase age
-      person->age_ += 1;
+      // The statistics are only updated if the person changed its HIV state or
+      // its sociobehaviour, or enters another age band in the next year. The
+      // cells of the sampled statistics only depend on the HIV state.
+      if (person->state_ != old_state) {
+        UpdateStatistics(person);
+      } else if (person->social_behaviour_factor_ !=
+                     old_social_behaviour_factor ||
+                 PopulationHistogram::GetAgeBand(age) !=
+                     PopulationHistogram::GetAgeBand(age + 1)) {
+        UpdateIncrementalStatistics(person);
+      }
+      // The person gets one year older, which follows from birth_year_ and the
+      // next year. If the person enters or leaves the activation window of a
+      // behaviour, its behaviours are re-attached at the beginning of the next
+      // iteration.
+      if (GetBehaviourWindows(person, year + 1, sparam) !=
+          person->active_behaviours_) {
+        env->AddBehaviourUpdate(person->GetAgentPtr<Person>());
+      }
     }
   }
 };
@@ -629,9 +961,22 @@ struct GiveBirth : public Behavior {
 
   GiveBirth() {}
 
+  // Helper function to sample the infection of a child at birth
+  bool BirthInfection(Random* random_generator, float probability,
+                      BernoulliThreshold threshold, const SimParam* sparam) {
+    if (sparam->fast_bernoulli) {
+      return UniformBuffer::GetThreadLocal()->Bernoulli(threshold);
+    }
+    return random_generator->Uniform() < probability;
+  }
+
   // Helper function to create a single child
   Person* CreateChild(Random* random_generator, Person* mother,
                       const SimParam* sparam, size_t year) {
+    const auto& thresholds =
+        bdm_static_cast<CategoricalEnvironment*>(
+            Simulation::GetActive()->GetEnvironment())
+            ->GetBernoulliThresholds();
     // Create new child
     Person* child = new Person();
     // BioDynaMo API: Add agent (child) to simulation
@@ -640,8 +985,9 @@ struct GiveBirth : public Behavior {
     // Assign sex
     child->sex_ =
         SampleSex(random_generator->Uniform(), sparam->probability_male);
-    // Assign age - possibly -1 ?
-    child->age_ = random_generator->Uniform();
+    // Assign age. The child takes part in the simulation from next year on,
+    // with age 0.
+    child->SetAge(0, year + 1);
     // Assign location
     child->location_ = mother->location_;
     // Compute risk factors
@@ -662,8 +1008,9 @@ struct GiveBirth : public Behavior {
     // AM: birth infection probability depends on whether mother is treated and
     // current year
     else if (mother->state_ == GemsState::kTreated) {
-      if (random_generator->Uniform() <
-          sparam->birth_infection_probability_treated) {
+      if (BirthInfection(random_generator,
+                         sparam->birth_infection_probability_treated,
+                         thresholds.birth_infection_treated, sparam)) {
         child->state_ = GemsState::kAcute;
         child->transmission_type_ = TransmissionType::kMotherToChild;
         child->infection_origin_state_ = mother->state_;
@@ -674,8 +1021,9 @@ struct GiveBirth : public Behavior {
                mother->state_ ==
                    GemsState::kFailing) {  // AM: Mother is not healthy and not
                                            // treated
-      if (random_generator->Uniform() <
-          sparam->birth_infection_probability_untreated) {
+      if (BirthInfection(random_generator,
+                         sparam->birth_infection_probability_untreated,
+                         thresholds.birth_infection_untreated, sparam)) {
         child->state_ = GemsState::kAcute;
         child->transmission_type_ = TransmissionType::kMotherToChild;
         child->infection_origin_state_ = mother->state_;
@@ -683,8 +1031,9 @@ struct GiveBirth : public Behavior {
         child->state_ = GemsState::kHealthy;
       }
     } else {
-      if (random_generator->Uniform() <
-          sparam->birth_infection_probability_prophylaxis) {
+      if (BirthInfection(random_generator,
+                         sparam->birth_infection_probability_prophylaxis,
+                         thresholds.birth_infection_prophylaxis, sparam)) {
         child->state_ = GemsState::kAcute;
         child->transmission_type_ = TransmissionType::kMotherToChild;
         child->infection_origin_state_ = mother->state_;
@@ -693,6 +1042,10 @@ struct GiveBirth : public Behavior {
       }
     }
 
+    if (child->state_ == GemsState::kAcute) {
+      LogTransmission(child, mother);
+    }
+
     // Register child with mother
     mother->AddChild(child->GetAgentPtr<Person>());
 
@@ -706,18 +1059,8 @@ struct GiveBirth : public Behavior {
     // child->partner_id_ = nullptr;
 
     // BioDynaMo API: Add the behaviors to the Agent
-    child->AddBehavior(new RandomMigration());
-    if (child->sex_ == Sex::kFemale) {
-      child->AddBehavior(new GiveBirth());
-    } else {
-      child->AddBehavior(new MatingBehaviour());
-      /*if (child->state_ != GemsState::kHealthy){
-          child->AddBehavior(new MatingBehaviour());
-      }*/
-      child->AddBehavior(new RegularMatingBehaviour());
-      child->AddBehavior(new RegularPartnershipBehaviour());
-    }
-    child->AddBehavior(new GetOlder());
+    AttachBehaviours(child, GetBehaviourWindows(child, year + 1, sparam));
+    UpdateStatistics(child);
 
     return child;
   }
@@ -728,17 +1071,24 @@ struct GiveBirth : public Behavior {
     auto* param = sim->GetParam();
     const auto* sparam = param->Get<SimParam>();
     auto* mother = bdm_static_cast<Person*>(agent);
+    // The probability of the child to be infected depends on the current year
+    // (ex. prophylaxis)
+    int year = static_cast<int>(
+        sparam->start_year +
+        sim->GetScheduler()->GetSimulatedSteps());  // Current year
 
     // Each potential mother gives birth with a certain probability.
-    if (random->Uniform() < sparam->give_birth_probability &&
-        mother->age_ <= sparam->max_age_birth &&
-        mother->age_ >= sparam->min_age) {
-      // The probability of the child to be infected depends on the current year
-      // (ex. prophylaxis)
-      int year = static_cast<int>(
-          sparam->start_year +
-          sim->GetScheduler()->GetSimulatedSteps());  // Current year
-
+    bool give_birth;
+    if (sparam->fast_bernoulli) {
+      auto* env =
+          bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
+      give_birth = UniformBuffer::GetThreadLocal()->Bernoulli(
+          env->GetBernoulliThresholds().give_birth);
+    } else {
+      give_birth = random->Uniform() < sparam->give_birth_probability;
+    }
+    int age = mother->GetAge(year);
+    if (give_birth && age < sparam->max_age_birth && age >= sparam->min_age) {
       // Create a child
       auto* new_child = CreateChild(random, mother, sparam, year);
 
@@ -763,6 +1113,31 @@ struct GiveBirth : public Behavior {
   }
 };
 
+inline void AttachBehaviours(Person* person, int windows) {
+  // Copy, since RemoveBehavior modifies the container
+  auto behaviours = person->GetAllBehaviors();
+  for (auto* behaviour : behaviours) {
+    person->RemoveBehavior(behaviour);
+  }
+  // BioDynaMo API: Add the behaviors to the Agent. The order is the same for
+  // all agents, GetOlder must remain the last behaviour.
+  person->AddBehavior(new RandomMigration());
+  if (windows & BehaviourWindow::kGiveBirthWindow) {
+    person->AddBehavior(new GiveBirth());
+  }
+  if (windows & BehaviourWindow::kMatingWindow) {
+    person->AddBehavior(new MatingBehaviour());
+  }
+  if (windows & BehaviourWindow::kRegularMatingWindow) {
+    person->AddBehavior(new RegularMatingBehaviour());
+  }
+  if (windows & BehaviourWindow::kRegularPartnershipWindow) {
+    person->AddBehavior(new RegularPartnershipBehaviour());
+  }
+  person->AddBehavior(new GetOlder());
+  person->active_behaviours_ = windows;
+}
+
 }  // namespace hiv_malawi
 }  // namespace bdm
 
@@ -16,6 +16,7 @@
 #include "biodynamo.h"
 #include "core/simulation.h"
 #include "datatypes.h"
+#include "population-statistics.h"
 
 namespace bdm {
 namespace hiv_malawi {
@@ -35,7 +36,11 @@ class Person : public Agent {
     children_.clear();
     children_.reserve(3);
     protected_ = false;
+    seek_regular_partnership_ = false;
     no_casual_partners_ = 0;
+    active_behaviours_ = 0;
+    statistics_key_ = IncrementalStatistics::kUncounted;
+    sampling_cell_ = SampledStatistics::kUncounted;
   }
   virtual ~Person() {}
 
@@ -63,8 +68,10 @@ class Person : public Agent {
   int infection_origin_state_;
   // Stores the socio-behavioural risk of the agent who infected them.
   int infection_origin_sb_;
-  // Stores the age of the agent
-  float age_;
+  // Stores the year in which the agent is 0 years old. The age is not stored
+  // but derived from the current year, such that it does not need to be
+  // updated every year (see GetAge).
+  int birth_year_;
   // Stores the sex of the agent
   int sex_;
   // Stores the location as categorical variable
@@ -85,6 +92,13 @@ class Person : public Agent {
   bool seek_regular_partnership_;
   // Number of casual partners
   int no_casual_partners_;
+  // Bitmask of the age and sex windowed behaviours that are currently attached
+  // to the agent (see BehaviourWindow in person-behavior.h)
+  int active_behaviours_;
+  // Key of the bins in which the person is counted by IncrementalStatistics
+  uint64_t statistics_key_;
+  // Cell in which the person is counted by SampledStatistics
+  uint32_t sampling_cell_;
 
   ///! The aguments below are currently either not used or repetitive.
   // // Stores if an agent is infected or not
@@ -117,6 +131,7 @@ class Person : public Agent {
   }
 
   void RemoveFromSimulation() override {
+    RemoveFromStatistics(this);
     // If has regular partner, end partnership
     if (hasPartner()) {
       SeparateFromPartner();
@@ -186,24 +201,29 @@ class Person : public Agent {
   bool HasHighRiskSocioBehav() { return social_behaviour_factor_ == 1; }
   // Returns True if the agent is at low-risk socio-behaviours
   bool HasLowRiskSocioBehav() { return social_behaviour_factor_ == 0; }
+  // Returns the age of the agent (in completed years) during the given year
+  int GetAge(int year) { return year - birth_year_; }
+  // Sets birth_year_ such that the agent has the given age in the given year
+  void SetAge(int age, int year) { birth_year_ = year - age; }
   // Returns True if the agent is adult, is at least 15 years old
-  bool IsAdult() { return age_ >= 15; }
+  bool IsAdult(int year) { return GetAge(year) >= 15; }
   // Returns True if the agent is a male
   bool IsMale() { return sex_ == Sex::kMale; }
   // Returns True if the agent is a female
   bool IsFemale() { return sex_ == Sex::kFemale; }
 
   // AM - Get Age Category from 0 to no_age_categories. 5-years interval
-  // categories from min_age.
-  int GetAgeCategory(size_t min_age, size_t no_age_categories) {
+  // categories from min_age, computed with integer arithmetic only.
+  int GetAgeCategory(int year, int min_age, int no_age_categories) {
+    int age = GetAge(year);
     int age_category;
-    if (age_ >= min_age + (no_age_categories - 1) * 5) {
+    if (age >= min_age + (no_age_categories - 1) * 5) {
       age_category = no_age_categories - 1;
     } else {
-      age_category = (int)(age_ - min_age) / 5;
+      age_category = (age - min_age) / 5;
     }
     // DEBUG:
-    // std::cout << "age " << age_ << " --> age_category " << age_category << "
+    // std::cout << "age " << age << " --> age_category " << age_category << "
     // (min_age " << min_age << ",  no_age_categories " << no_age_categories <<
     // ")" << std::endl;
     return age_category;
@@ -238,9 +258,9 @@ class Person : public Agent {
     if (!found) {
       Log::Warning("Person::RemoveChild()",
                    "Child to be removed not found in mother's list of "
-                   "children. Age = ",
-                   child->age_, " Mother:", this->GetAgentPtr(),
-                   " Age mother:", this->age_,
+                   "children. Year of birth = ",
+                   child->birth_year_, " Mother:", this->GetAgentPtr(),
+                   " Year of birth mother:", this->birth_year_,
                    " Num children:", children_.size());
     }
   }
@@ -262,8 +282,9 @@ class Person : public Agent {
     }
   }
 
-  void Relocate(size_t new_location) {
+  void Relocate(size_t new_location, int year) {
     location_ = new_location;
+    UpdateStatistics(this);
 
     if (sex_ == Sex::kFemale) {
       // Children (under 15yo) migrate with their mother
@@ -271,7 +292,7 @@ class Person : public Agent {
       // std::cout << "I am a woman with "<< nb_children << " children and I
       // migrated to location " << location_<< std::endl;
       for (int c = 0; c < nb_children; c++) {
-        if (children_[c]->age_ < 15) {
+        if (children_[c]->GetAge(year) < 15) {
           /*if (old_location != children_[c]->location_){
               Log::Warning("RandomMigration::Run()", "child and mother had
           different locations BEFORE MIGRATION. Child's age = ",
@@ -283,23 +304,24 @@ class Person : public Agent {
           // children_[c]->location_ << " to " << location_ <<
           // std::endl;
           children_[c]->location_ = location_;
+          UpdateStatistics(children_[c].Get());
         }
       }
       // DEBUG : Check that all children migrated with Mother
       for (int c = 0; c < nb_children; c++) {
-        if (children_[c]->age_ < 15) {
+        if (children_[c]->GetAge(year) < 15) {
           if (children_[c]->location_ != location_) {
             Log::Warning("RandomMigration::Run()",
                          "DEBUG: child and mother have different locations "
                          "AFTER MIGRATION. Child's age = ",
-                         children_[c]->age_);
+                         children_[c]->GetAge(year));
           }
         }
       }
     } else if (hasPartner()) {
       // If a man engaged in a regular partnership relocates, his female partner
       // relocates too.
-      partner_->Relocate(new_location);
+      partner_->Relocate(new_location, year);
     }
   }
 
@@ -0,0 +1,215 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "plot-timeseries.h"
+
+#include "biodynamo.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+void PlotTimeseries(experimental::TimeSeries* ts,
+                    const std::string& output_dir) {
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g(ts, "Population - Healthy/Infected", "Time",
+                                 "Number of agents", true);
+  g.Add("healthy_agents", "Healthy", "L", kBlue, 1.0);
+  g.Add("infected_agents", "HIV", "L", kRed, 1.0);
+  g.Draw();
+  g.SaveAs(Concat(output_dir, "/simulation_hiv"), {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g2(ts, "HIV stages", "Time", "Number of agents",
+                                  true);
+  // g2.Add("healthy_agents", "Healthy", "L", kBlue, 1.0, 1);
+  g2.Add("infected_agents", "HIV", "L", kOrange, 1.0, 1);
+  g2.Add("acute_agents", "Acute", "L", kRed, 1.0, 10);
+  g2.Add("chronic_agents", "Chronic", "L", kMagenta, 1.0, 10);
+  g2.Add("treated_agents", "Treated", "L", kGreen, 1.0, 10);
+  g2.Add("failing_agents", "Failing", "L", kGray, 1.0, 10);
+  g2.Draw();
+  g2.SaveAs(Concat(output_dir, "/simulation_hiv_with_states"),
+            {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g2_1(ts, "Acute HIV by sex", "Time",
+                                    "Number of agents", true);
+  g2_1.Add("acute_male_agents", "Male Acute", "L", kBlue, 1.0, 1);
+  g2_1.Add("acute_female_agents", "Female Acute", "L", kMagenta, 1.0, 1);
+  g2_1.Draw();
+  g2_1.SaveAs(Concat(output_dir, "/simulation_hiv_acute_sex"),
+              {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g2_1_1(ts, "Acute HIV by sex and risk", "Time",
+                                      "Number of agents", true);
+  g2_1_1.Add("acute_male_low_sb_agents", "Male Acute - Low risk", "L", kBlue,
+             1.0, 2);
+  g2_1_1.Add("acute_male_high_sb_agents", "Male Acute - High risk", "L", kBlue,
+             1.0, 1);
+  g2_1_1.Add("acute_female_low_sb_agents", "Female Acute - Low risk", "L",
+             kMagenta, 1.0, 2);
+  g2_1_1.Add("acute_female_high_sb_agents", "Female Acute - High risk", "L",
+             kMagenta, 1.0, 1);
+
+  g2_1_1.Draw();
+  g2_1_1.SaveAs(Concat(output_dir, "/simulation_hiv_acute_sex_sb"),
+                {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g2_2(ts, "Transmission", "Time",
+                                    "Number of agents", true);
+  g2_2.Add("mtct_agents", "MTCT", "L", kGreen, 1.0, 3);
+  g2_2.Add("casual_transmission_agents", "Casual Transmission", "L", kRed, 1.0,
+           3);
+  g2_2.Add("regular_transmission_agents", "Regular Transmission", "L", kBlue,
+           1.0, 3);
+  g2_2.Draw();
+  g2_2.SaveAs(Concat(output_dir, "/simulation_transmission_types"),
+              {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g2_2_1(ts, "Transmission", "Time",
+                                      "Number of agents", true);
+  g2_2_1.Add("casual_transmission_to_male", "Casual Transmission - to Male",
+             "L", kBlue, 1.0, 1);
+  g2_2_1.Add("casual_transmission_to_female", "Casual Transmission - to Female",
+             "L", kMagenta, 1.0, 1);
+  g2_2_1.Add("regular_transmission_to_male", "Regular Transmission - to Male",
+             "L", kBlue, 1.0, 2);
+  g2_2_1.Add("regular_transmission_to_male", "Regular Transmission - to Female",
+             "L", kMagenta, 1.0, 2);
+  g2_2_1.Add("mtct_transmission_to_male", "MTCT - to Male", "L", kBlue, 1.0, 3);
+  g2_2_1.Add("mtct_transmission_to_female", "MTCT Transmission - to Female",
+             "L", kMagenta, 1.0, 3);
+  g2_2_1.Draw();
+  g2_2_1.SaveAs(
+      Concat(output_dir, "/simulation_transmission_types_by_sex"),
+      {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g2_3(ts, "Source of infection - HIV stage",
+                                    "Time", "Number of agents", true);
+  g2_3.Add("acute_transmission", "Infected by Acute", "L", kRed, 1.0, 10);
+  g2_3.Add("chronic_transmission", "Infected by Chronic", "L", kMagenta, 1.0,
+           10);
+  g2_3.Add("treated_transmission", "Infected by Treated", "L", kGreen, 1.0, 10);
+  g2_3.Add("failing_transmission", "Infected by Failing", "L", kGray, 1.0, 10);
+  g2_3.Draw();
+  g2_3.SaveAs(
+      Concat(output_dir, "/simulation_transmission_sources_state"),
+      {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g2_4(ts, "Source of infection - Risk level",
+                                    "Time", "Number of agents", true);
+  g2_4.Add("low_sb_transmission", "Infected by Low Risk", "L", kRed, 1.0, 10);
+  g2_4.Add("high_sb_transmission", "Infected by High Risk", "L", kMagenta, 1.0,
+           10);
+  g2_4.Draw();
+  g2_4.SaveAs(
+      Concat(output_dir, "/simulation_transmission_sources_sb"),
+      {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g3(ts, "HIV", "Time", "", true);
+  g3.Add("prevalence", "Prevalence", "L", kOrange, 1.0, 3, 1, kOrange, 1.0, 5);
+  g3.Add("prevalence_females", "Prevalence - Females", "L", kRed, 1.0, 3, 1,
+         kRed, 1.0, 10);
+  g3.Add("prevalence_males", "Prevalence - Males", "L", kBlue, 1.0, 3, 1, kBlue,
+         1.0, 10);
+
+  g3.Add("prevalence_15_49", "Prevalence (15-49)", "L", kOrange, 1.0, 1, 1);
+  g3.Add("prevalence_women_15_49", "Prevalence - Women (15-49)", "L", kRed, 1.0,
+         1, 1);
+  g3.Add("prevalence_men_15_49", "Prevalence - Men (15-49)", "L", kBlue, 1.0, 1,
+         1);
+
+  g3.Add("incidence", "Incidence", "L", kRed, 1.0, 3, 1, kRed, 1.0, 5);
+
+  g3.Draw();
+  g3.SaveAs(Concat(output_dir, "/simulation_hiv_prevalence_incidence"),
+            {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g4(ts, "my result", "Time", "Proportion", true);
+  g4.Add("high_risk_sb_hiv", "High Risk SB - HIV", "L", kRed, 1.0, 1);
+  g4.Add("low_risk_sb_hiv", "Low Risk SB - HIV", "L", kBlue, 1.0, 1);
+  g4.Add("high_risk_sb_healthy", "High Risk SB - Healthy", "L", kOrange, 1.0,
+         1);
+  g4.Add("low_risk_sb_healthy", "Low Risk SB - Healthy", "L", kGreen, 1.0, 1);
+  g4.Add("high_risk_sb_hiv_women", "High Risk SB - HIV Women", "L", kRed, 1.0,
+         10);
+  g4.Add("low_risk_sb_hiv_women", "Low Risk SB - HIV Women", "L", kBlue, 1.0,
+         10);
+
+  g4.Add("high_risk_sb_hiv_men", "High Risk SB - HIV Men", "L", kRed, 1.0, 2);
+  g4.Add("low_risk_sb_hiv_men", "Low Risk SB - HIV Men", "L", kBlue, 1.0, 2);
+
+  g4.Add("high_risk_sb_healthy_women", "High Risk SB - Healthy Women", "L",
+         kOrange, 1.0, 10);
+  g4.Add("low_risk_sb_healthy_women", "Low Risk SB - Healthy Women", "L",
+         kGreen, 1.0, 10);
+
+  g4.Add("high_risk_sb_healthy_men", "High Risk SB - Healthy Men", "L", kOrange,
+         1.0, 5);
+  g4.Add("low_risk_sb_healthy_men", "Low Risk SB - Healthy Men", "L", kGreen,
+         1.0, 5);
+  g4.Draw();
+  g4.SaveAs(Concat(output_dir, "/simulation_sociobehaviours"),
+            {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g5(ts, "Casual sex partners", "Time", "Number",
+                                  true);
+
+  g5.Add("mean_nocas_men_low_sb", "Mean - Men w/ Low Risk SB", "L", kGreen, 1.0,
+         2);
+  g5.Add("mean_nocas_men_high_sb", "Mean - Men w/ High Risk SB", "L", kGreen,
+         1.0, 1);
+  g5.Add("mean_nocas_women_low_sb", "Mean - Women w/ Low Risk SB", "L", kRed,
+         1.0, 2);
+  g5.Add("mean_nocas_women_high_sb", "Mean - Women w/ High Risk SB", "L", kRed,
+         1.0, 1);
+  g5.Add("mean_nocas_hiv_men_low_sb", "Mean - Men w/ HIV & Low Risk SB", "L",
+         kBlue, 1.0, 2);
+  g5.Add("mean_nocas_hiv_men_high_sb", "Mean - Men w/ HIV & High Risk SB", "L",
+         kBlue, 1.0, 1);
+  g5.Add("mean_nocas_hiv_women_low_sb", "Mean - Women w/ HIV & Low Risk SB",
+         "L", kMagenta, 1.0, 2);
+  g5.Add("mean_nocas_hiv_women_high_sb", "Mean - Women w/ HIV & High Risk SB",
+         "L", kMagenta, 1.0, 1);
+
+  g5.Draw();
+  g5.SaveAs(Concat(output_dir, "/simulation_casual_mating_mean"),
+            {".svg", ".png"});
+
+  // Create a bdm LineGraph that visualizes the TimeSeries data
+  bdm::experimental::LineGraph g6(ts, "Casual sex partners", "Time", "Number",
+                                  true);
+
+  g6.Add("total_nocas_men_low_sb", "Total - Men w/ Low Risk SB", "L", kGreen,
+         1.0, 2);
+  g6.Add("total_nocas_men_high_sb", "Total - Men w/ High Risk SB", "L", kRed,
+         1.0, 2);
+  g6.Add("total_nocas_women_low_sb", "Total - Women w/ Low Risk SB", "L",
+         kGreen, 1.0, 1);
+  g6.Add("total_nocas_women_high_sb", "Total - Women w/ High Risk SB", "L",
+         kRed, 1.0, 1);
+
+  g6.Draw();
+  g6.SaveAs(Concat(output_dir, "/simulation_casual_mating_total"),
+            {".svg", ".png"});
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
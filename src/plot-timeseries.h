@@ -0,0 +1,36 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef PLOT_TIMESERIES_H_
+#define PLOT_TIMESERIES_H_
+
+#include <string>
+
+namespace bdm {
+
+namespace experimental {
+class TimeSeries;
+}  // namespace experimental
+
+namespace hiv_malawi {
+
+// Renders the plots of the collected time series with ROOT, and saves each as
+// .svg and .png in output_dir. Only the series of DefineAndRegisterCollectors
+// are used, such that the plots can also be rendered from a saved data.json
+// (see hiv_malawi-plot).
+void PlotTimeseries(experimental::TimeSeries* ts,
+                    const std::string& output_dir);
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // PLOT_TIMESERIES_H_
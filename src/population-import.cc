@@ -0,0 +1,398 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "population-import.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include <unordered_map>
+
+#include "biodynamo.h"
+
+#include "categorical-environment.h"
+#include "datatypes.h"
+#include "district-ranks.h"
+#include "person-behavior.h"
+#include "person.h"
+#include "sim-param.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Fields of SyntheticPerson, in the order of the names below
+enum SyntheticField {
+  kId,
+  kSex,
+  kAge,
+  kLocation,
+  kState,
+  kSocialBehaviourFactor,
+  kBiomedicalFactor,
+  kPartnerId,
+  kMotherId,
+  kNoSyntheticFields
+};
+
+static const char* const kSyntheticFieldNames[kNoSyntheticFields] = {
+    "id",
+    "sex",
+    "age",
+    "location",
+    "state",
+    "social_behaviour_factor",
+    "biomedical_factor",
+    "partner_id",
+    "mother_id"};
+
+// Number of persons read and created at once
+static constexpr size_t kImportChunkSize = 1 << 16;
+
+// Trims spaces, tabs and carriage returns at both ends of field
+static std::string Trim(const std::string& field) {
+  size_t begin = field.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = field.find_last_not_of(" \t\r");
+  return field.substr(begin, end - begin + 1);
+}
+
+SyntheticPopulationReader::SyntheticPopulationReader(
+    const std::string& filename)
+    : filename_(filename),
+      file_(filename, std::ios::binary),
+      binary_(false),
+      line_(0),
+      remaining_(0) {
+  if (!file_.is_open()) {
+    Log::Fatal("SyntheticPopulationReader()", "Cannot open ", filename);
+  }
+  SyntheticPopulationHeader header;
+  file_.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (file_.gcount() == sizeof(header) &&
+      header.magic == SyntheticPopulationHeader::kMagic) {
+    if (header.version != SyntheticPopulationHeader::kVersion) {
+      Log::Fatal("SyntheticPopulationReader()", filename,
+                 " is not a synthetic population of version ",
+                 SyntheticPopulationHeader::kVersion);
+    }
+    binary_ = true;
+    remaining_ = header.no_persons;
+    return;
+  }
+
+  // Not a binary file: rewind and read the header line of the CSV file
+  file_.clear();
+  file_.seekg(0);
+  std::string header_line;
+  if (!std::getline(file_, header_line)) {
+    Log::Fatal("SyntheticPopulationReader()", filename, " is empty");
+  }
+  line_ = 1;
+  columns_ = GetCsvColumns(header_line, filename);
+}
+
+std::vector<int> SyntheticPopulationReader::GetCsvColumns(
+    const std::string& header, const std::string& source) {
+  std::vector<int> columns;
+  std::vector<bool> found(kNoSyntheticFields, false);
+  std::istringstream stream(header);
+  std::string name;
+  while (std::getline(stream, name, ',')) {
+    name = Trim(name);
+    int field = -1;
+    for (int f = 0; f < kNoSyntheticFields; f++) {
+      if (name == kSyntheticFieldNames[f]) {
+        field = f;
+        found[f] = true;
+      }
+    }
+    columns.push_back(field);
+  }
+  for (int f : {kId, kSex, kAge, kLocation}) {
+    if (!found[f]) {
+      Log::Fatal("SyntheticPopulationReader::GetCsvColumns()", source,
+                 " has no column ", kSyntheticFieldNames[f]);
+    }
+  }
+  return columns;
+}
+
+bool SyntheticPopulationReader::ParseCsvLine(const std::string& line,
+                                             const std::vector<int>& columns,
+                                             SyntheticPerson* person) {
+  int64_t values[kNoSyntheticFields] = {0, 0, 0, 0, 0, 0, 0, -1, -1};
+  size_t column = 0;
+  size_t begin = 0;
+  while (begin <= line.size()) {
+    size_t end = line.find(',', begin);
+    if (end == std::string::npos) {
+      end = line.size();
+    }
+    if (column >= columns.size()) {
+      return false;
+    }
+    if (columns[column] >= 0) {
+      std::string field = Trim(line.substr(begin, end - begin));
+      char* parsed_end;
+      errno = 0;
+      int64_t value = std::strtoll(field.c_str(), &parsed_end, 10);
+      if (field.empty() || *parsed_end != '\0' || errno != 0) {
+        return false;
+      }
+      values[columns[column]] = value;
+    }
+    column++;
+    begin = end + 1;
+  }
+  if (column != columns.size()) {
+    return false;
+  }
+  person->id = values[kId];
+  person->sex = static_cast<int32_t>(values[kSex]);
+  person->age = static_cast<int32_t>(values[kAge]);
+  person->location = static_cast<int32_t>(values[kLocation]);
+  person->state = static_cast<int32_t>(values[kState]);
+  person->social_behaviour_factor =
+      static_cast<int32_t>(values[kSocialBehaviourFactor]);
+  person->biomedical_factor = static_cast<int32_t>(values[kBiomedicalFactor]);
+  person->partner_id = values[kPartnerId];
+  person->mother_id = values[kMotherId];
+  return true;
+}
+
+bool SyntheticPopulationReader::ReadChunk(std::vector<SyntheticPerson>* chunk,
+                                          size_t max_size) {
+  chunk->clear();
+  if (binary_) {
+    size_t size = std::min<uint64_t>(max_size, remaining_);
+    size_t no_bytes = size * sizeof(SyntheticPerson);
+    chunk->resize(size);
+    file_.read(reinterpret_cast<char*>(chunk->data()), no_bytes);
+    if (static_cast<size_t>(file_.gcount()) != no_bytes) {
+      Log::Fatal("SyntheticPopulationReader::ReadChunk()", "The file ",
+                 filename_, " is truncated");
+    }
+    remaining_ -= size;
+    return size > 0;
+  }
+
+  std::string line;
+  while (chunk->size() < max_size && std::getline(file_, line)) {
+    line_++;
+    if (Trim(line).empty()) {
+      continue;
+    }
+    SyntheticPerson person;
+    if (!ParseCsvLine(line, columns_, &person)) {
+      Log::Fatal("SyntheticPopulationReader::ReadChunk()", "Malformed line ",
+                 line_, " in ", filename_);
+    }
+    chunk->push_back(person);
+  }
+  return !chunk->empty();
+}
+
+// Terminates the simulation if the attributes of person are out of range
+static void ValidateSyntheticPerson(const SyntheticPerson& person,
+                                    const SimParam* sparam,
+                                    const std::string& source) {
+  if ((person.sex != Sex::kMale && person.sex != Sex::kFemale) ||
+      person.age < 0 || person.location < 0 ||
+      person.location >= sparam->nb_locations || person.state < 0 ||
+      person.state >= GemsState::kGemsLast ||
+      person.social_behaviour_factor < 0 ||
+      person.social_behaviour_factor >= sparam->nb_sociobehav_categories ||
+      person.biomedical_factor < 0 || person.biomedical_factor > 1) {
+    Log::Fatal("ValidateSyntheticPerson()", "The person with id ", person.id,
+               " in ", source, " has attributes out of range");
+  }
+}
+
+// Returns true if a and b can be regular partners: adults of opposite sexes
+static bool IsValidPartnership(Person* a, Person* b, int year) {
+  return a->IsAdult(year) && b->IsAdult(year) &&
+         ((a->IsMale() && b->IsFemale()) || (a->IsFemale() && b->IsMale()));
+}
+
+// Returns true if mother can be the mother of child: a woman older than child
+static bool IsValidMother(Person* mother, Person* child, int year) {
+  return mother->IsFemale() && mother->GetAge(year) > child->GetAge(year);
+}
+
+// Create a person from the record of a synthetic population
+static Person* CreateSyntheticPerson(const SyntheticPerson& record, int year,
+                                     const SimParam* sparam) {
+  auto* person = new Person();
+  person->sex_ = record.sex;
+  person->SetAge(record.age, year);
+  person->location_ = record.location;
+  person->state_ = record.state;
+  // As in the sampled population, persons infected at the start got infected
+  // through casual partnership
+  if (person->state_ != GemsState::kHealthy) {
+    person->transmission_type_ = TransmissionType::kCasualPartner;
+  }
+  person->social_behaviour_factor_ = record.social_behaviour_factor;
+  person->biomedical_factor_ = record.biomedical_factor;
+  AttachBehaviours(person, GetBehaviourWindows(person, year, sparam));
+  return person;
+}
+
+bool SaveSyntheticPopulation(const std::vector<SyntheticPerson>& persons,
+                             const std::string& filename) {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  SyntheticPopulationHeader header;
+  header.magic = SyntheticPopulationHeader::kMagic;
+  header.version = SyntheticPopulationHeader::kVersion;
+  header.reserved = 0;
+  header.no_persons = persons.size();
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(persons.data()),
+             persons.size() * sizeof(SyntheticPerson));
+  return static_cast<bool>(file);
+}
+
+void ImportSyntheticPopulation(const std::string& filename, int year) {
+  auto* sim = Simulation::GetActive();
+  auto* rm = sim->GetResourceManager();
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  const auto* ranks = DistrictRanks::GetInstance();
+
+  // Persons by id, and persons with a partner or a mother in the file
+  struct PendingLinks {
+    Person* person;
+    int64_t partner_id;
+    int64_t mother_id;
+  };
+  std::unordered_map<int64_t, Person*> persons_by_id;
+  std::vector<PendingLinks> pending_links;
+
+  SyntheticPopulationReader reader(filename);
+  std::vector<SyntheticPerson> chunk;
+  std::vector<Person*> created;
+  chunk.reserve(kImportChunkSize);
+  while (reader.ReadChunk(&chunk, kImportChunkSize)) {
+    for (const auto& record : chunk) {
+      ValidateSyntheticPerson(record, sparam, filename);
+    }
+    created.assign(chunk.size(), nullptr);
+#pragma omp parallel for
+    for (size_t i = 0; i < chunk.size(); i++) {
+      // In distributed simulations, each rank only keeps the persons living
+      // in its own districts
+      if (ranks->IsLocal(chunk[i].location)) {
+        created[i] = CreateSyntheticPerson(chunk[i], year, sparam);
+      }
+    }
+    for (size_t i = 0; i < chunk.size(); i++) {
+      if (created[i] == nullptr) {
+        continue;
+      }
+      rm->AddAgent(created[i]);
+      if (!persons_by_id.emplace(chunk[i].id, created[i]).second) {
+        Log::Fatal("ImportSyntheticPopulation()", "The id ", chunk[i].id,
+                   " appears twice in ", filename);
+      }
+      if (chunk[i].partner_id >= 0 || chunk[i].mother_id >= 0) {
+        pending_links.push_back(
+            {created[i], chunk[i].partner_id, chunk[i].mother_id});
+      }
+    }
+  }
+
+  // Link partners, mothers and children once all persons exist
+  auto find = [&](int64_t id) -> Person* {
+    auto it = persons_by_id.find(id);
+    return it != persons_by_id.end() ? it->second : nullptr;
+  };
+  uint64_t no_mothers = 0;
+  uint64_t no_dropped_links = 0;
+  // Links between persons who cannot be partners, or mother and child
+  uint64_t no_invalid_links = 0;
+  // Children under 15 who were moved to the location of their mother
+  uint64_t no_moved_children = 0;
+  for (const auto& links : pending_links) {
+    auto* person = links.person;
+    if (links.partner_id >= 0) {
+      auto* partner = find(links.partner_id);
+      if (partner == nullptr) {
+        no_dropped_links++;
+      } else if (!IsValidPartnership(person, partner, year)) {
+        no_invalid_links++;
+      } else {
+        person->partner_ = partner->GetAgentPtr<Person>();
+      }
+    }
+    if (links.mother_id >= 0) {
+      auto* mother = find(links.mother_id);
+      if (mother == nullptr) {
+        no_dropped_links++;
+      } else if (!IsValidMother(mother, person, year)) {
+        no_invalid_links++;
+      } else {
+        // Children under 15 live with their mother. In distributed
+        // simulations, the mother of a local child is local as well.
+        if (!person->IsAdult(year) && person->location_ != mother->location_) {
+          person->location_ = mother->location_;
+          no_moved_children++;
+        }
+        person->mother_ = mother->GetAgentPtr<Person>();
+        mother->AddChild(person->GetAgentPtr<Person>());
+        no_mothers++;
+      }
+    }
+  }
+  // Partnerships are symmetric, even if only one partner names the other.
+  // Links to a person who names another partner are dropped.
+  for (const auto& links : pending_links) {
+    auto* person = links.person;
+    if (person->partner_ == nullptr) {
+      continue;
+    }
+    if (person->partner_->partner_ == nullptr) {
+      person->partner_->partner_ = person->GetAgentPtr<Person>();
+    } else if (person->partner_->partner_.Get() != person) {
+      person->partner_ = nullptr;
+      no_dropped_links++;
+    }
+  }
+
+  if (no_mothers > 0) {
+    auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
+    env->SetMothersAssigned();
+  }
+  if (no_dropped_links > 0 && ranks->GetNoRanks() == 1) {
+    Log::Warning("ImportSyntheticPopulation()", "Dropped ", no_dropped_links,
+                 " links to persons that are not in ", filename);
+  }
+  if (no_invalid_links > 0) {
+    Log::Warning("ImportSyntheticPopulation()", "Dropped ", no_invalid_links,
+                 " partner links that are not between adults of opposite ",
+                 "sexes, or mother links to a person who is not a woman ",
+                 "older than the child, in ", filename);
+  }
+  if (no_moved_children > 0) {
+    Log::Warning("ImportSyntheticPopulation()", "Moved ", no_moved_children,
+                 " children under 15 to the location of their mother, as ",
+                 "they live in another location in ", filename);
+  }
+  std::cout << "Imported " << persons_by_id.size() << " persons from "
+            << filename << std::endl;
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,116 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef POPULATION_IMPORT_H_
+#define POPULATION_IMPORT_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace bdm {
+namespace hiv_malawi {
+
+////////////////////////////////////////////////////////////////////////////////
+// Import of an external synthetic population, e.g. derived from a census with
+// households. Each person has an id, and the partner and the mother are given
+// by their ids (-1 if there is none); the children are derived from the
+// mothers. Two formats are supported:
+//  - CSV with a header line naming the columns. The columns id, sex, age and
+//    location are required; state, social_behaviour_factor,
+//    biomedical_factor, partner_id and mother_id are optional (default 0, or
+//    -1 for the ids). sex, location and state are the integer values of the
+//    enums in datatypes.h.
+//  - Binary: a SyntheticPopulationHeader followed by one SyntheticPerson per
+//    person.
+// The file is read in chunks, and the persons of a chunk are created in
+// parallel. Only the ids and the links are kept until all persons are
+// created.
+////////////////////////////////////////////////////////////////////////////////
+
+struct SyntheticPopulationHeader {
+  static constexpr uint64_t kMagic = 0x504e59534d564948;  // "HIVMSYNP"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t no_persons;
+};
+
+struct SyntheticPerson {
+  int64_t id;
+  int64_t partner_id;
+  int64_t mother_id;
+  int32_t sex;
+  int32_t age;
+  int32_t location;
+  int32_t state;
+  int32_t social_behaviour_factor;
+  int32_t biomedical_factor;
+};
+
+// Reads the persons of a synthetic population file chunk by chunk
+class SyntheticPopulationReader {
+ public:
+  // Opens filename; the format is detected from the first bytes
+  explicit SyntheticPopulationReader(const std::string& filename);
+
+  // Replaces the content of chunk by the next persons of the file, at most
+  // max_size. Returns false at the end of the file.
+  bool ReadChunk(std::vector<SyntheticPerson>* chunk, size_t max_size);
+
+  // Parses a line of a CSV file with the given columns (see
+  // GetCsvColumns). Returns false if the line is malformed.
+  static bool ParseCsvLine(const std::string& line,
+                           const std::vector<int>& columns,
+                           SyntheticPerson* person);
+
+  // Maps the column names of the header line to the fields of SyntheticPerson
+  // (-1 for unknown columns). Terminates the simulation if a required column
+  // is missing.
+  static std::vector<int> GetCsvColumns(const std::string& header,
+                                        const std::string& source);
+
+ private:
+  std::string filename_;
+  std::ifstream file_;
+  bool binary_;
+  // Columns of the CSV file, and number of the last line read
+  std::vector<int> columns_;
+  uint64_t line_;
+  // Persons left in the binary file
+  uint64_t remaining_;
+};
+
+// Writes persons to filename in the binary format. Returns false if the file
+// could not be written.
+bool SaveSyntheticPopulation(const std::vector<SyntheticPerson>& persons,
+                             const std::string& filename);
+
+// Create the persons of the synthetic population in filename, in the given
+// year, and link partners, mothers and children. In distributed simulations,
+// each rank only creates the persons of its own districts, and links to
+// persons of other ranks are dropped. Partner links that are not between
+// adults of opposite sexes, and mother links to a person who is not a woman
+// older than the child, are dropped with a warning. Children under 15 live
+// with their mother (see Person::Relocate): those whose record has another
+// location are moved to the location of their mother with a warning. If the
+// file links any child to a mother, the environment does not assign random
+// mothers.
+void ImportSyntheticPopulation(const std::string& filename, int year);
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // POPULATION_IMPORT_H_
@@ -10,12 +10,15 @@
 //
 // -----------------------------------------------------------------------------
 
+#include <algorithm>
 #include <limits>
+#include <random>
 #include <vector>
 
 #include "biodynamo.h"
 
 #include "datatypes.h"
+#include "district-ranks.h"
 #include "person-behavior.h"
 #include "population-initialization.h"
 
@@ -134,34 +137,17 @@ int ComputeBiomedical(float rand_num, int age,
   }
 }
 
-auto CreatePerson(Random* random_generator, const SimParam* sparam) {
-  // Get all random numbers for initialization
-  std::vector<float> rand_num{};
-  rand_num.resize(10);
-  for (int i = 0; i < 10; i++) {
-    rand_num[i] = static_cast<float>(random_generator->Uniform());
-  }
-
-  // Create new person
-  Person* person = new Person();
-  // Assign sex
-  person->sex_ = SampleSex(rand_num[0], sparam->probability_male);
-  // Assign age
-  if (person->sex_ == Sex::kMale) {
-    person->age_ = SampleAge(rand_num[1], rand_num[2], person->sex_,
-                             sparam->male_age_distribution);
-  } else {
-    person->age_ = SampleAge(rand_num[1], rand_num[2], person->sex_,
-                             sparam->female_age_distribution);
-  }
-  // Assign location
-  person->location_ =
-      SampleLocation(rand_num[3], sparam->location_distribution);
+// Assign the GemsState and the risk factors of a person of the given age,
+// whose location is already set
+static void AssignStateAndRiskFactors(Person* person, int age,
+                                      float rand_num_1, float rand_num_2,
+                                      float rand_num_3, float rand_num_4,
+                                      const SimParam* sparam) {
   // Assign the GemsState of the person.
   // AM: This depends on the person's age and location. HIV+ are only between
   // min_age and max_age, ans in a subset of locations.
   person->state_ =
-      ComputeState(rand_num[4], rand_num[5], person->age_, sparam->min_age,
+      ComputeState(rand_num_1, rand_num_2, age, sparam->min_age,
                    sparam->max_age, person->location_, sparam->seed_districts,
                    sparam->initial_healthy_probability,
                    sparam->initial_infection_probability);
@@ -175,10 +161,40 @@ auto CreatePerson(Random* random_generator, const SimParam* sparam) {
   // Compute risk factors.
   // AM: social_behaviour_factor_ depends on the age and health/hiv state
   person->social_behaviour_factor_ = ComputeSociobehavioural(
-      rand_num[6], person->age_,
+      rand_num_3, age,
       sparam->sociobehavioural_risk_probability[0][person->state_]);
   person->biomedical_factor_ = ComputeBiomedical(
-      rand_num[7], person->age_, sparam->biomedical_risk_probability);
+      rand_num_4, age, sparam->biomedical_risk_probability);
+}
+
+auto CreatePerson(Random* random_generator, const SimParam* sparam) {
+  // Get all random numbers for initialization
+  std::vector<float> rand_num{};
+  rand_num.resize(10);
+  for (int i = 0; i < 10; i++) {
+    rand_num[i] = static_cast<float>(random_generator->Uniform());
+  }
+
+  // Create new person
+  Person* person = new Person();
+  // Assign sex
+  person->sex_ = SampleSex(rand_num[0], sparam->probability_male);
+  // Assign age (in completed years) and derive the year of birth from it
+  int age;
+  if (person->sex_ == Sex::kMale) {
+    age = static_cast<int>(SampleAge(rand_num[1], rand_num[2], person->sex_,
+                                     sparam->male_age_distribution));
+  } else {
+    age = static_cast<int>(SampleAge(rand_num[1], rand_num[2], person->sex_,
+                                     sparam->female_age_distribution));
+  }
+  person->SetAge(age, sparam->start_year);
+  // Assign location
+  person->location_ =
+      SampleLocation(rand_num[3], sparam->location_distribution);
+  // Assign the GemsState and the risk factors
+  AssignStateAndRiskFactors(person, age, rand_num[4], rand_num[5],
+                            rand_num[6], rand_num[7], sparam);
 
   // DEBUG
   /*if (person->state_ == GemsState::kAcute){
@@ -200,30 +216,194 @@ auto CreatePerson(Random* random_generator, const SimParam* sparam) {
   // person->mother_id_ = nullptr;
   // person->partner_id_ = nullptr;
 
-  // BioDynaMo API: Add the behaviors to the Agent
-  person->AddBehavior(new RandomMigration());
-  if (person->sex_ == Sex::kFemale) {
-    person->AddBehavior(new GiveBirth());
-  } else {
-    /*if (person->state_ != GemsState::kHealthy){
-      person->AddBehavior(new MatingBehaviour());
-    }*/
-    person->AddBehavior(new MatingBehaviour());
-    person->AddBehavior(new RegularMatingBehaviour());
-    person->AddBehavior(new RegularPartnershipBehaviour());
-  }
-  person->AddBehavior(new GetOlder());
+  // BioDynaMo API: Add the behaviors to the Agent. Only the behaviours whose
+  // age and sex window contains the person are attached.
+  AttachBehaviours(person,
+                   GetBehaviourWindows(person, sparam->start_year, sparam));
   return person;
 };
 
+// Returns the probabilities of the bins of a cumulative distribution
+static std::vector<double> GetBinProbabilities(
+    const std::vector<float>& cumulative_distribution) {
+  std::vector<double> probabilities(cumulative_distribution.size());
+  double total = cumulative_distribution.back();
+  double previous = 0;
+  for (size_t i = 0; i < cumulative_distribution.size(); i++) {
+    probabilities[i] = (cumulative_distribution[i] - previous) / total;
+    previous = cumulative_distribution[i];
+  }
+  return probabilities;
+}
+
+std::vector<uint64_t> SampleCellCounts(
+    uint64_t n, const std::vector<double>& probabilities,
+    std::mt19937_64* generator) {
+  // Integer parts of the expected counts
+  std::vector<uint64_t> counts(probabilities.size());
+  std::vector<double> residuals(probabilities.size());
+  uint64_t remaining = n;
+  double residual_total = 0;
+  for (size_t i = 0; i < probabilities.size(); i++) {
+    double expected = n * probabilities[i];
+    counts[i] = std::min(static_cast<uint64_t>(expected), remaining);
+    remaining -= counts[i];
+    residuals[i] = std::max(expected - counts[i], 0.0);
+    residual_total += residuals[i];
+  }
+  // Multinomial split of the remaining persons by the fractional parts, drawn
+  // as a sequence of binomials
+  for (size_t i = 0; i < probabilities.size() && remaining > 0; i++) {
+    if (residual_total <= 0 || i + 1 == probabilities.size()) {
+      counts[i] += remaining;
+      break;
+    }
+    double probability = std::min(residuals[i] / residual_total, 1.0);
+    std::binomial_distribution<uint64_t> binomial(remaining, probability);
+    uint64_t count = binomial(*generator);
+    counts[i] += count;
+    remaining -= count;
+    residual_total -= residuals[i];
+  }
+  return counts;
+}
+
+// Create a person of the given sex, age bin and location
+static Person* CreatePersonInCell(Random* random_generator,
+                                  const SimParam* sparam, int sex,
+                                  int age_bin, int location) {
+  Person* person = new Person();
+  person->sex_ = sex;
+  // Uniform age within the bin of 5 years, as in SampleAge
+  float rand_num = static_cast<float>(random_generator->Uniform());
+  int age = static_cast<int>(5 * (age_bin + rand_num));
+  person->SetAge(age, sparam->start_year);
+  person->location_ = location;
+  float rand_num_1 = static_cast<float>(random_generator->Uniform());
+  float rand_num_2 = static_cast<float>(random_generator->Uniform());
+  float rand_num_3 = static_cast<float>(random_generator->Uniform());
+  float rand_num_4 = static_cast<float>(random_generator->Uniform());
+  AssignStateAndRiskFactors(person, age, rand_num_1, rand_num_2, rand_num_3,
+                            rand_num_4, sparam);
+  AttachBehaviours(person,
+                   GetBehaviourWindows(person, sparam->start_year, sparam));
+  return person;
+}
+
+void InitializeStratifiedPopulation() {
+  auto* sim = Simulation::GetActive();
+  auto* param = sim->GetParam();
+  const auto* sparam = param->Get<SimParam>();
+  const auto* ranks = DistrictRanks::GetInstance();
+
+  // Cells of sex, age bin and location, and their probabilities. Sex, age and
+  // location are sampled independently, as in CreatePerson.
+  struct Cell {
+    int sex;
+    int age_bin;
+    int location;
+  };
+  std::vector<Cell> cells;
+  std::vector<double> probabilities;
+  auto location_probabilities =
+      GetBinProbabilities(sparam->location_distribution);
+  for (int sex : {Sex::kMale, Sex::kFemale}) {
+    double sex_probability = sex == Sex::kMale
+                                 ? sparam->probability_male
+                                 : 1.0 - sparam->probability_male;
+    auto age_probabilities = GetBinProbabilities(
+        sex == Sex::kMale ? sparam->male_age_distribution
+                          : sparam->female_age_distribution);
+    for (size_t a = 0; a < age_probabilities.size(); a++) {
+      for (size_t l = 0; l < location_probabilities.size(); l++) {
+        cells.push_back({sex, static_cast<int>(a), static_cast<int>(l)});
+        probabilities.push_back(sex_probability * age_probabilities[a] *
+                                location_probabilities[l]);
+      }
+    }
+  }
+
+  // The counts only depend on the random seed, such that all ranks of a
+  // distributed simulation agree on them
+  std::mt19937_64 generator(param->random_seed);
+  auto counts = SampleCellCounts(sparam->initial_population_size,
+                                 probabilities, &generator);
+
+  // Split the local cells into contiguous ranges of similar numbers of
+  // persons, one per thread. A few cells (e.g. the young adults of the large
+  // districts) hold most of the persons, such that equal numbers of cells per
+  // thread leave most threads idle.
+  int no_threads = ThreadInfo::GetInstance()->GetMaxThreads();
+  uint64_t no_local_persons = 0;
+  for (size_t c = 0; c < cells.size(); c++) {
+    if (ranks->IsLocal(cells[c].location)) {
+      no_local_persons += counts[c];
+    }
+  }
+  std::vector<size_t> first_cell(no_threads + 1, cells.size());
+  first_cell[0] = 0;
+  int range = 0;
+  uint64_t cumulative = 0;
+  for (size_t c = 0; c < cells.size() && no_local_persons > 0; c++) {
+    if (!ranks->IsLocal(cells[c].location)) {
+      continue;
+    }
+    // Each cell goes to the range that contains the middle of its persons
+    uint64_t middle = cumulative + counts[c] / 2;
+    int owner = std::min(
+        static_cast<int>(middle * no_threads / no_local_persons),
+        no_threads - 1);
+    while (range < owner) {
+      first_cell[++range] = c;
+    }
+    cumulative += counts[c];
+  }
+
+  // Fill the ranges in parallel, and skip the cells of the districts of other
+  // ranks. The ranges and their assignment to the threads only depend on the
+  // counts and the number of threads, such that the population only depends
+  // on the random seed and the number of threads.
+#pragma omp parallel
+  {
+    auto* ctxt = sim->GetExecutionContext();
+    auto* random_generator = sim->GetRandom();
+
+#pragma omp for schedule(static, 1)
+    for (int r = 0; r < no_threads; r++) {
+      for (size_t c = first_cell[r]; c < first_cell[r + 1]; c++) {
+        const auto& cell = cells[c];
+        if (!ranks->IsLocal(cell.location)) {
+          continue;
+        }
+        for (uint64_t i = 0; i < counts[c]; i++) {
+          ctxt->AddAgent(CreatePersonInCell(random_generator, sparam,
+                                            cell.sex, cell.age_bin,
+                                            cell.location));
+        }
+      }
+    }
+  }
+}
+
 void InitializePopulation() {
+  const auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
+  // Sampling each person independently would sample the whole population on
+  // every rank, and discard the persons of the other ranks. The stratified
+  // initialization only creates the persons of the local districts.
+  bool distributed = DistrictRanks::GetInstance()->IsDistributed();
+  if (distributed && !sparam->stratified_initialization) {
+    Log::Warning("InitializePopulation",
+                 "Distributed simulations use the stratified initialization");
+  }
+  if (sparam->stratified_initialization || distributed) {
+    InitializeStratifiedPopulation();
+    return;
+  }
 #pragma omp parallel
   {
     auto* sim = Simulation::GetActive();
     auto* ctxt = sim->GetExecutionContext();
     auto* random_generator = sim->GetRandom();
-    auto* param = sim->GetParam();
-    const auto* sparam = param->Get<SimParam>();
 
 #pragma omp for
     for (uint64_t x = 0; x < sparam->initial_population_size; x++) {
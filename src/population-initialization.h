@@ -13,6 +13,10 @@
 #ifndef POPULATION_INITIALIZATION_H_
 #define POPULATION_INITIALIZATION_H_
 
+#include <cstdint>
+#include <random>
+#include <vector>
+
 #include "biodynamo.h"
 #include "sim-param.h"
 
@@ -52,7 +56,23 @@ int ComputeBiomedical(float rand_num, int age,
 // create a single person
 auto CreatePerson(Random* random_generator, SimParam* sparam);
 
-// Initialize an entire population for the BDM simulation
+// Split n persons into cells with the given probabilities. Each cell receives
+// the integer part of its expected count, and the remaining persons are
+// distributed by a multinomial draw weighted by the fractional parts. The
+// counts sum up to n.
+std::vector<uint64_t> SampleCellCounts(
+    uint64_t n, const std::vector<double>& probabilities,
+    std::mt19937_64* generator);
+
+// Initialize the population cell by cell: the number of persons of each sex,
+// age bin and location is drawn first (see SampleCellCounts), then the cells
+// are filled in parallel. Only the age within the bin, the GemsState and the
+// risk factors are sampled per person.
+void InitializeStratifiedPopulation();
+
+// Initialize an entire population for the BDM simulation. Uses
+// InitializeStratifiedPopulation if stratified_initialization is set, or if
+// the simulation is distributed.
 void InitializePopulation();
 
 }  // namespace hiv_malawi
@@ -0,0 +1,237 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "population-snapshot.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+#include "biodynamo.h"
+
+#include "categorical-environment.h"
+#include "person-behavior.h"
+#include "person.h"
+#include "sim-param.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+void WritePopulation(std::ostream* out, int year) {
+  auto* rm = Simulation::GetActive()->GetResourceManager();
+
+  // Number the persons in the order of the resource manager
+  std::vector<Person*> persons;
+  persons.reserve(rm->GetNumAgents());
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  std::unordered_map<const Person*, int64_t> indices;
+  indices.reserve(persons.size());
+  for (size_t i = 0; i < persons.size(); i++) {
+    indices[persons[i]] = i;
+  }
+  auto index_of = [&](const AgentPointer<Person>& relative) {
+    if (relative == nullptr) {
+      return int64_t{-1};
+    }
+    auto it = indices.find(relative.Get());
+    return it != indices.end() ? it->second : int64_t{-1};
+  };
+
+  std::vector<PersonSnapshot> records(persons.size());
+  std::vector<uint64_t> children;
+  for (size_t i = 0; i < persons.size(); i++) {
+    auto* person = persons[i];
+    auto& record = records[i];
+    record.state = person->state_;
+    record.transmission_type = person->transmission_type_;
+    record.infection_origin_state = person->infection_origin_state_;
+    record.infection_origin_sb = person->infection_origin_sb_;
+    record.birth_year = person->birth_year_;
+    record.sex = person->sex_;
+    record.location = person->location_;
+    record.social_behaviour_factor = person->social_behaviour_factor_;
+    record.biomedical_factor = person->biomedical_factor_;
+    record.no_casual_partners = person->no_casual_partners_;
+    record.partner = index_of(person->partner_);
+    record.mother = index_of(person->mother_);
+    record.first_child = children.size();
+    record.no_children = 0;
+    for (auto& child : person->children_) {
+      int64_t child_index = index_of(child);
+      if (child_index >= 0) {
+        children.push_back(child_index);
+        record.no_children++;
+      }
+    }
+    record.is_protected = person->protected_;
+    record.seek_regular_partnership = person->seek_regular_partnership_;
+  }
+
+  PopulationSnapshotHeader header;
+  header.magic = PopulationSnapshotHeader::kMagic;
+  header.version = PopulationSnapshotHeader::kVersion;
+  header.year = year;
+  header.no_persons = records.size();
+  header.no_children = children.size();
+
+  out->write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out->write(reinterpret_cast<const char*>(records.data()),
+             records.size() * sizeof(PersonSnapshot));
+  out->write(reinterpret_cast<const char*>(children.data()),
+             children.size() * sizeof(uint64_t));
+}
+
+bool SavePopulationSnapshot(const std::string& filename, int year) {
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  WritePopulation(&file, year);
+  return file.good();
+}
+
+// Terminates the simulation if the attributes of record are out of range or
+// its links refer to persons that are not in the snapshot
+static void ValidatePersonSnapshot(const PersonSnapshot& record,
+                                   const uint64_t* children,
+                                   const PopulationSnapshotHeader& header,
+                                   const SimParam* sparam,
+                                   const std::string& source) {
+  auto no_persons = static_cast<int64_t>(header.no_persons);
+  bool valid =
+      (record.sex == Sex::kMale || record.sex == Sex::kFemale) &&
+      record.state >= 0 && record.state < GemsState::kGemsLast &&
+      record.location >= 0 && record.location < sparam->nb_locations &&
+      record.partner >= -1 && record.partner < no_persons &&
+      record.mother >= -1 && record.mother < no_persons &&
+      record.first_child <= header.no_children &&
+      record.no_children <= header.no_children - record.first_child;
+  for (uint32_t c = 0; valid && c < record.no_children; c++) {
+    valid = children[record.first_child + c] < header.no_persons;
+  }
+  if (!valid) {
+    Log::Fatal("ReadPopulation()", "A person in ", source,
+               " has attributes or links out of range");
+  }
+}
+
+size_t ReadPopulation(const char* data, size_t size, int year,
+                      const std::string& source) {
+  auto* sim = Simulation::GetActive();
+  auto* rm = sim->GetResourceManager();
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+
+  if (size < sizeof(PopulationSnapshotHeader)) {
+    Log::Fatal("ReadPopulation()", source, " is not a population snapshot");
+  }
+  const auto* header = reinterpret_cast<const PopulationSnapshotHeader*>(data);
+  if (header->magic != PopulationSnapshotHeader::kMagic ||
+      header->version != PopulationSnapshotHeader::kVersion) {
+    Log::Fatal("ReadPopulation()", source,
+               " is not a population snapshot of version ",
+               PopulationSnapshotHeader::kVersion);
+  }
+  // Compare the counts with the remaining size, such that the size of the
+  // population does not overflow
+  size_t remaining = size - sizeof(PopulationSnapshotHeader);
+  if (header->no_persons > remaining / sizeof(PersonSnapshot) ||
+      header->no_children >
+          (remaining - header->no_persons * sizeof(PersonSnapshot)) /
+              sizeof(uint64_t)) {
+    Log::Fatal("ReadPopulation()", "The population of ", source,
+               " is truncated");
+  }
+  const auto* records = reinterpret_cast<const PersonSnapshot*>(header + 1);
+  const auto* children =
+      reinterpret_cast<const uint64_t*>(records + header->no_persons);
+  size_t population_size = sizeof(PopulationSnapshotHeader) +
+                           header->no_persons * sizeof(PersonSnapshot) +
+                           header->no_children * sizeof(uint64_t);
+  if (header->year != year) {
+    Log::Fatal("ReadPopulation()", "The population of ", source,
+               " was saved in ", header->year, ", the simulation is in ",
+               year);
+  }
+
+  for (uint64_t i = 0; i < header->no_persons; i++) {
+    ValidatePersonSnapshot(records[i], children, *header, sparam, source);
+  }
+
+  // Create the persons and their behaviours in parallel
+  std::vector<Person*> persons(header->no_persons);
+#pragma omp parallel for
+  for (uint64_t i = 0; i < header->no_persons; i++) {
+    const auto& record = records[i];
+    auto* person = new Person();
+    person->state_ = record.state;
+    person->transmission_type_ = record.transmission_type;
+    person->infection_origin_state_ = record.infection_origin_state;
+    person->infection_origin_sb_ = record.infection_origin_sb;
+    person->birth_year_ = record.birth_year;
+    person->sex_ = record.sex;
+    person->location_ = record.location;
+    person->social_behaviour_factor_ = record.social_behaviour_factor;
+    person->biomedical_factor_ = record.biomedical_factor;
+    person->no_casual_partners_ = record.no_casual_partners;
+    person->protected_ = record.is_protected;
+    person->seek_regular_partnership_ = record.seek_regular_partnership;
+    AttachBehaviours(person, GetBehaviourWindows(person, year, sparam));
+    persons[i] = person;
+  }
+  for (auto* person : persons) {
+    rm->AddAgent(person);
+  }
+
+  // Restore the links. Each person only writes its own links.
+#pragma omp parallel for
+  for (uint64_t i = 0; i < header->no_persons; i++) {
+    const auto& record = records[i];
+    auto* person = persons[i];
+    if (record.partner >= 0) {
+      person->partner_ = persons[record.partner]->GetAgentPtr<Person>();
+    }
+    if (record.mother >= 0) {
+      person->mother_ = persons[record.mother]->GetAgentPtr<Person>();
+    }
+    for (uint32_t c = 0; c < record.no_children; c++) {
+      person->AddChild(
+          persons[children[record.first_child + c]]->GetAgentPtr<Person>());
+    }
+  }
+
+  // The mothers were assigned before the population was saved
+  auto* env = bdm_static_cast<CategoricalEnvironment*>(sim->GetEnvironment());
+  env->SetMothersAssigned();
+  return population_size;
+}
+
+void LoadPopulationSnapshot(const std::string& filename, int year) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat file_status;
+  if (fd < 0 || fstat(fd, &file_status) != 0) {
+    Log::Fatal("LoadPopulationSnapshot()", "Cannot open ", filename);
+  }
+  size_t file_size = file_status.st_size;
+  void* data = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    Log::Fatal("LoadPopulationSnapshot()", "Cannot map ", filename);
+  }
+  madvise(data, file_size, MADV_SEQUENTIAL);
+  ReadPopulation(static_cast<const char*>(data), file_size, year, filename);
+  munmap(data, file_size);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,92 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef POPULATION_SNAPSHOT_H_
+#define POPULATION_SNAPSHOT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace bdm {
+namespace hiv_malawi {
+
+////////////////////////////////////////////////////////////////////////////////
+// Binary snapshot of the population, i.e. of the attributes of all persons and
+// of the mother / child / partner links between them. The file consists of a
+// PopulationSnapshotHeader, followed by one PersonSnapshot per person and by
+// the indices of the children of all persons. Links are stored as indices of
+// the persons in the file (-1 if there is no link).
+////////////////////////////////////////////////////////////////////////////////
+
+struct PopulationSnapshotHeader {
+  static constexpr uint64_t kMagic = 0x504f50494d564948;  // "HIVMIPOP"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  // Year in which the snapshot was taken (the behaviours of that year have not
+  // been executed yet)
+  int32_t year;
+  uint64_t no_persons;
+  uint64_t no_children;
+};
+
+struct PersonSnapshot {
+  int32_t state;
+  int32_t transmission_type;
+  int32_t infection_origin_state;
+  int32_t infection_origin_sb;
+  int32_t birth_year;
+  int32_t sex;
+  int32_t location;
+  int32_t social_behaviour_factor;
+  int32_t biomedical_factor;
+  int32_t no_casual_partners;
+  int64_t partner;
+  int64_t mother;
+  // Position of the first child in the children section, and number of
+  // children
+  uint64_t first_child;
+  uint32_t no_children;
+  uint8_t is_protected;
+  uint8_t seek_regular_partnership;
+};
+
+// Write the population of the active simulation (header, persons and
+// children) to out.
+void WritePopulation(std::ostream* out, int year);
+
+// Create the persons of the population written by WritePopulation, which
+// starts at data and spans at most size bytes, and attach the behaviours of
+// the given year. Returns the number of bytes read. Terminates the simulation
+// if data does not hold a valid population of the given year; source names
+// the origin of data in the error messages.
+size_t ReadPopulation(const char* data, size_t size, int year,
+                      const std::string& source);
+
+// Write the population of the active simulation to filename. Returns false if
+// the file could not be written.
+bool SavePopulationSnapshot(const std::string& filename, int year);
+
+// Replace the initial sampling of the population (see InitializePopulation)
+// by the population stored in filename. The file is mapped into memory and
+// the persons are created in parallel; the behaviours of the year of the
+// snapshot are attached. Terminates the simulation if the file is not a valid
+// snapshot taken in the given year.
+void LoadPopulationSnapshot(const std::string& filename, int year);
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // POPULATION_SNAPSHOT_H_
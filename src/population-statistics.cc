@@ -0,0 +1,687 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "population-statistics.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <string>
+
+#include "biodynamo.h"
+
+#include "person.h"
+#include "sim-param.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Returns value if it lies in [0, no_bins - 1), else the last bin
+static int GetBin(int value, int no_bins) {
+  return value >= 0 && value < no_bins - 1 ? value : no_bins - 1;
+}
+
+PopulationHistogram::PopulationHistogram(int no_locations)
+    : no_locations_(0) {
+  Clear(no_locations);
+}
+
+void PopulationHistogram::Clear(int no_locations) {
+  if (no_locations + 1 != no_locations_) {
+    no_locations_ = no_locations + 1;
+    size_t size = Index(kNoStates, 0, 0, 0, 0, 0);
+    counts_.resize(size);
+    casual_partners_.resize(size);
+    casual_partners_squared_.resize(size);
+    acute_origins_.resize(kNoStates * kNoSociobehaviours);
+  }
+  std::fill(counts_.begin(), counts_.end(), 0);
+  std::fill(casual_partners_.begin(), casual_partners_.end(), 0);
+  std::fill(casual_partners_squared_.begin(), casual_partners_squared_.end(),
+            0);
+  std::fill(acute_origins_.begin(), acute_origins_.end(), 0);
+}
+
+void PopulationHistogram::Add(Person* person, int year) {
+  AddKey(GetKey(person, year), 1, person->no_casual_partners_);
+}
+
+uint64_t PopulationHistogram::GetKey(Person* person, int year) const {
+  int age_band = GetAgeBand(person->GetAge(year));
+  int state = GetBin(person->state_, kNoStates);
+  uint64_t index =
+      Index(state, GetBin(person->sex_, kNoSexes), age_band,
+            GetBin(person->social_behaviour_factor_, kNoSociobehaviours),
+            GetBin(person->location_, no_locations_),
+            GetBin(person->transmission_type_, kNoTransmissionTypes));
+  uint64_t origin = kNotAcute;
+  if (state == GemsState::kAcute) {
+    origin = GetBin(person->infection_origin_state_, kNoStates) *
+                 kNoSociobehaviours +
+             GetBin(person->infection_origin_sb_, kNoSociobehaviours);
+  }
+  return index << 8 | origin;
+}
+
+void PopulationHistogram::AddKey(uint64_t key, int sign, int casual_partners) {
+  size_t index = key >> 8;
+  uint64_t origin = key & 0xff;
+  uint64_t partners = static_cast<uint64_t>(std::max(casual_partners, 0));
+  // Unsigned arithmetic, where adding -1 wraps around
+  uint64_t delta = static_cast<uint64_t>(static_cast<int64_t>(sign));
+  counts_[index] += delta;
+  casual_partners_[index] += delta * partners;
+  casual_partners_squared_[index] += delta * partners * partners;
+  if (origin != kNotAcute) {
+    acute_origins_[origin] += delta;
+  }
+}
+
+void PopulationHistogram::AddCasualPartners(uint64_t key, int old_count,
+                                            int new_count) {
+  size_t index = key >> 8;
+  uint64_t old_partners = static_cast<uint64_t>(std::max(old_count, 0));
+  uint64_t new_partners = static_cast<uint64_t>(std::max(new_count, 0));
+  // Unsigned arithmetic, where negative differences wrap around
+  casual_partners_[index] += new_partners - old_partners;
+  casual_partners_squared_[index] +=
+      new_partners * new_partners - old_partners * old_partners;
+}
+
+void PopulationHistogram::ClearCasualPartners() {
+  std::fill(casual_partners_.begin(), casual_partners_.end(), 0);
+  std::fill(casual_partners_squared_.begin(), casual_partners_squared_.end(),
+            0);
+}
+
+void PopulationHistogram::Merge(const PopulationHistogram& other) {
+  for (size_t i = 0; i < counts_.size(); i++) {
+    counts_[i] += other.counts_[i];
+    casual_partners_[i] += other.casual_partners_[i];
+    casual_partners_squared_[i] += other.casual_partners_squared_[i];
+  }
+  for (size_t i = 0; i < acute_origins_.size(); i++) {
+    acute_origins_[i] += other.acute_origins_[i];
+  }
+}
+
+double PopulationHistogram::Sum(const std::vector<uint64_t>& values,
+                                const Selection& selection) const {
+  int first_location = selection.location >= 0 ? selection.location : 0;
+  int last_location =
+      selection.location >= 0 ? selection.location : no_locations_ - 1;
+  uint64_t sum = 0;
+  for (int state = 0; state < kNoStates; state++) {
+    if (!(selection.states & Bin(state))) {
+      continue;
+    }
+    for (int sex = 0; sex < kNoSexes; sex++) {
+      if (!(selection.sexes & Bin(sex))) {
+        continue;
+      }
+      for (int band = 0; band < kNoAgeBands; band++) {
+        if (!(selection.age_bands & Bin(band))) {
+          continue;
+        }
+        for (int sb = 0; sb < kNoSociobehaviours; sb++) {
+          if (!(selection.sociobehaviours & Bin(sb))) {
+            continue;
+          }
+          for (int l = first_location; l <= last_location; l++) {
+            size_t index = Index(state, sex, band, sb, l, 0);
+            for (int tt = 0; tt < kNoTransmissionTypes; tt++) {
+              if (selection.transmission_types & Bin(tt)) {
+                sum += values[index + tt];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  return static_cast<double>(sum);
+}
+
+double PopulationHistogram::Count(const Selection& selection) const {
+  return Sum(counts_, selection);
+}
+
+double PopulationHistogram::SumCasualPartners(
+    const Selection& selection) const {
+  return Sum(casual_partners_, selection);
+}
+
+double PopulationHistogram::SumSquaredCasualPartners(
+    const Selection& selection) const {
+  return Sum(casual_partners_squared_, selection);
+}
+
+double PopulationHistogram::CountAcuteByOrigin(int origin_state,
+                                               int origin_sb) const {
+  uint64_t count = 0;
+  for (int state = 0; state < kNoStates; state++) {
+    for (int sb = 0; sb < kNoSociobehaviours; sb++) {
+      if ((origin_state < 0 || origin_state == state) &&
+          (origin_sb < 0 || origin_sb == sb)) {
+        count += acute_origins_[state * kNoSociobehaviours + sb];
+      }
+    }
+  }
+  return static_cast<double>(count);
+}
+
+// Fills histogram by a parallel sweep over the population, with the ages of
+// the given year. If set_keys is true, the key of each person is set as well
+// (see IncrementalStatistics).
+static void SweepPopulation(PopulationHistogram* histogram, int year,
+                            int no_locations, bool set_keys) {
+  static std::vector<PopulationHistogram> thread_histograms;
+  thread_histograms.resize(ThreadInfo::GetInstance()->GetMaxThreads());
+  for (auto& thread_histogram : thread_histograms) {
+    thread_histogram.Clear(no_locations);
+  }
+
+  // Each thread fills its own histogram
+  auto add_person = L2F([&](Agent* agent) {
+    auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+    auto* person = bdm_static_cast<Person*>(agent);
+    uint64_t key = thread_histograms[tid].GetKey(person, year);
+    thread_histograms[tid].AddKey(key, 1, person->no_casual_partners_);
+    if (set_keys) {
+      person->statistics_key_ = key;
+    }
+  });
+  Simulation::GetActive()->GetResourceManager()->ForEachAgentParallel(
+      add_person);
+
+  histogram->Clear(no_locations);
+  for (const auto& thread_histogram : thread_histograms) {
+    histogram->Merge(thread_histogram);
+  }
+}
+
+const PopulationHistogram& GetPopulationHistogram() {
+  // Histogram of the last sweep, and the simulation and iteration it belongs
+  // to
+  static PopulationHistogram histogram;
+  static std::string simulation_name;
+  static uint64_t step = std::numeric_limits<uint64_t>::max();
+
+  if (IncrementalStatistics::IsEnabled()) {
+    return IncrementalStatistics::GetInstance()->GetHistogram();
+  }
+
+  auto* sim = Simulation::GetActive();
+  uint64_t current_step = sim->GetScheduler()->GetSimulatedSteps();
+  if (step == current_step && simulation_name == sim->GetUniqueName()) {
+    return histogram;
+  }
+  step = current_step;
+  simulation_name = sim->GetUniqueName();
+
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  int year = static_cast<int>(sparam->start_year + current_step) + 1;
+  SweepPopulation(&histogram, year, sparam->nb_locations, false);
+  return histogram;
+}
+
+bool IncrementalStatistics::enabled_ = false;
+
+void IncrementalStatistics::Reset(bool enabled) {
+  const auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
+  enabled_ = enabled;
+  no_locations_ = sparam->nb_locations;
+  start_year_ = sparam->start_year;
+  resynchronize_ = true;
+  step_ = std::numeric_limits<uint64_t>::max();
+  histogram_.Clear(no_locations_);
+  deltas_.resize(ThreadInfo::GetInstance()->GetMaxThreads());
+  for (auto& delta : deltas_) {
+    delta.Clear(no_locations_);
+  }
+}
+
+void IncrementalStatistics::Update(Person* person) {
+  auto* sim = Simulation::GetActive();
+  int year = static_cast<int>(start_year_ +
+                              sim->GetScheduler()->GetSimulatedSteps()) +
+             1;
+  // Relatives of a person may be updated by several threads at once. Only the
+  // thread that swaps in a new key accounts for the difference. Another thread
+  // may change the person between the computation of the key and the swap, so
+  // the key is computed again after each swap until it is stable. The casual
+  // partners of the person move with it to the new bin.
+  auto& delta = deltas_[ThreadInfo::GetInstance()->GetMyThreadId()];
+  uint64_t old_key =
+      __atomic_load_n(&person->statistics_key_, __ATOMIC_RELAXED);
+  while (true) {
+    uint64_t key = histogram_.GetKey(person, year);
+    if (old_key == key || old_key == kRemoved) {
+      return;
+    }
+    if (__atomic_compare_exchange_n(&person->statistics_key_, &old_key, key,
+                                    false, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      int casual_partners = person->no_casual_partners_;
+      if (old_key != kUncounted) {
+        delta.AddKey(old_key, -1, casual_partners);
+      }
+      delta.AddKey(key, 1, casual_partners);
+      old_key = key;
+    }
+  }
+}
+
+void IncrementalStatistics::Remove(Person* person) {
+  uint64_t old_key =
+      __atomic_exchange_n(&person->statistics_key_, kRemoved, __ATOMIC_RELAXED);
+  if (old_key != kUncounted && old_key != kRemoved) {
+    deltas_[ThreadInfo::GetInstance()->GetMyThreadId()].AddKey(
+        old_key, -1, person->no_casual_partners_);
+  }
+}
+
+void IncrementalStatistics::AddCasualPartners(Person* person, int no_added) {
+  // Persons that are not counted yet are counted with all their casual
+  // partners by their first update or by the sweep
+  uint64_t key = __atomic_load_n(&person->statistics_key_, __ATOMIC_RELAXED);
+  if (key == kUncounted || key == kRemoved) {
+    return;
+  }
+  int count = person->no_casual_partners_;
+  deltas_[ThreadInfo::GetInstance()->GetMyThreadId()].AddCasualPartners(
+      key, count - no_added, count);
+}
+
+void IncrementalStatistics::ResetCasualPartners() {
+  histogram_.ClearCasualPartners();
+  for (auto& delta : deltas_) {
+    delta.ClearCasualPartners();
+  }
+}
+
+const PopulationHistogram& IncrementalStatistics::GetHistogram() {
+  auto* sim = Simulation::GetActive();
+  uint64_t current_step = sim->GetScheduler()->GetSimulatedSteps();
+  if (step_ == current_step) {
+    return histogram_;
+  }
+  step_ = current_step;
+  for (auto& delta : deltas_) {
+    histogram_.Merge(delta);
+    delta.Clear(no_locations_);
+  }
+  // Persons that were created or restored without an event, e.g. the initial
+  // population, are counted by a sweep
+  uint64_t no_counted =
+      static_cast<uint64_t>(histogram_.Count(PopulationHistogram::Selection{}));
+  if (resynchronize_ ||
+      no_counted != sim->GetResourceManager()->GetNumAgents()) {
+    Resynchronize();
+  }
+  return histogram_;
+}
+
+void IncrementalStatistics::Resynchronize() {
+  auto* sim = Simulation::GetActive();
+  int year = static_cast<int>(start_year_ +
+                              sim->GetScheduler()->GetSimulatedSteps()) +
+             1;
+  SweepPopulation(&histogram_, year, no_locations_, true);
+  resynchronize_ = false;
+}
+
+bool SampledStatistics::enabled_ = false;
+
+double SampledStatistics::GetSamplingKey(const Person* person) {
+  // Finalizer of splitmix64, which spreads consecutive uids uniformly
+  uint64_t x = static_cast<uint64_t>(person->GetUid()) + 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  x ^= x >> 31;
+  return static_cast<double>(x >> 11) * 0x1.0p-53;
+}
+
+void SampledStatistics::Reset(bool enabled,
+                              const std::vector<double>& fractions) {
+  const auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
+  enabled_ = enabled;
+  no_locations_ = sparam->nb_locations + 1;
+  start_year_ = sparam->start_year;
+  step_ = std::numeric_limits<uint64_t>::max();
+  simulation_name_.clear();
+  fractions_.clear();
+  for (double fraction : fractions) {
+    if (!(fraction > 0)) {
+      Log::Fatal("SampledStatistics::Reset", "Invalid sampling fraction ",
+                 fraction);
+    }
+    fractions_.push_back(std::min(fraction, 1.0));
+  }
+  std::sort(fractions_.begin(), fractions_.end());
+  fractions_.erase(std::unique(fractions_.begin(), fractions_.end()),
+                   fractions_.end());
+  samples_.resize(fractions_.size());
+  sample_sizes_.resize(fractions_.size());
+
+  using H = PopulationHistogram;
+  size_t no_cells =
+      static_cast<size_t>(no_locations_) * H::kNoSexes * H::kNoStates;
+  resynchronize_ = true;
+  exact_counts_.assign(no_cells, 0);
+  auto max_threads = ThreadInfo::GetInstance()->GetMaxThreads();
+  deltas_.resize(max_threads);
+  new_sampled_.resize(max_threads);
+  for (int t = 0; t < max_threads; t++) {
+    deltas_[t].assign(no_cells, 0);
+    new_sampled_[t].clear();
+  }
+  sample_index_.clear();
+}
+
+size_t SampledStatistics::GetLevel(double fraction) const {
+  fraction = std::min(fraction, 1.0);
+  auto it = std::lower_bound(fractions_.begin(), fractions_.end(), fraction);
+  if (it == fractions_.end() || *it != fraction) {
+    Log::Fatal("SampledStatistics::GetLevel", "No sample of fraction ",
+               fraction);
+  }
+  return it - fractions_.begin();
+}
+
+uint32_t SampledStatistics::GetCell(const Person* person) const {
+  using H = PopulationHistogram;
+  size_t stratum = Stratum(GetBin(person->location_, no_locations_),
+                           GetBin(person->sex_, H::kNoSexes));
+  return static_cast<uint32_t>(
+      ExactIndex(stratum, GetBin(person->state_, H::kNoStates)));
+}
+
+void SampledStatistics::Update(Person* person) {
+  // As in IncrementalStatistics::Update, only the thread that swaps in a new
+  // cell accounts for the difference, and the cell is computed again after
+  // each swap until it is stable
+  auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+  auto& delta = deltas_[tid];
+  uint32_t old_cell =
+      __atomic_load_n(&person->sampling_cell_, __ATOMIC_RELAXED);
+  while (true) {
+    uint32_t cell = GetCell(person);
+    if (old_cell == cell || old_cell == kRemoved) {
+      return;
+    }
+    if (__atomic_compare_exchange_n(&person->sampling_cell_, &old_cell, cell,
+                                    false, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      if (old_cell != kUncounted) {
+        delta[old_cell]--;
+      } else if (GetSamplingKey(person) < fractions_.back()) {
+        new_sampled_[tid].push_back(person->GetUid());
+      }
+      delta[cell]++;
+      old_cell = cell;
+    }
+  }
+}
+
+void SampledStatistics::Remove(Person* person) {
+  uint32_t old_cell =
+      __atomic_exchange_n(&person->sampling_cell_, kRemoved, __ATOMIC_RELAXED);
+  if (old_cell != kUncounted && old_cell != kRemoved) {
+    deltas_[ThreadInfo::GetInstance()->GetMyThreadId()][old_cell]--;
+  }
+}
+
+void SampledStatistics::Refresh() {
+  auto* sim = Simulation::GetActive();
+  auto* rm = sim->GetResourceManager();
+  uint64_t current_step = sim->GetScheduler()->GetSimulatedSteps();
+  if (step_ == current_step && simulation_name_ == sim->GetUniqueName()) {
+    return;
+  }
+  step_ = current_step;
+  simulation_name_ = sim->GetUniqueName();
+
+  using H = PopulationHistogram;
+  int year = static_cast<int>(start_year_ + current_step) + 1;
+  int nb_locations = no_locations_ - 1;
+  size_t no_strata = static_cast<size_t>(no_locations_) * H::kNoSexes;
+  size_t no_levels = fractions_.size();
+
+  // Merge the differences counted by the events. Counts wrap around, such
+  // that decrements of one thread may precede the increments of another one.
+  for (auto& delta : deltas_) {
+    for (size_t i = 0; i < delta.size(); i++) {
+      exact_counts_[i] += delta[i];
+    }
+    std::fill(delta.begin(), delta.end(), 0);
+  }
+  for (auto& uids : new_sampled_) {
+    sample_index_.insert(sample_index_.end(), uids.begin(), uids.end());
+    uids.clear();
+  }
+  // Persons that were created or restored without an event, e.g. the initial
+  // population, are counted by a sweep
+  uint64_t no_counted = std::accumulate(exact_counts_.begin(),
+                                        exact_counts_.end(), uint64_t{0});
+  if (resynchronize_ || no_counted != rm->GetNumAgents()) {
+    Resynchronize();
+  }
+  stratum_sizes_.assign(no_strata, 0);
+  for (size_t stratum = 0; stratum < no_strata; stratum++) {
+    for (int state = 0; state < H::kNoStates; state++) {
+      stratum_sizes_[stratum] += exact_counts_[ExactIndex(stratum, state)];
+    }
+  }
+
+  // Drop the removed persons from the index
+  size_t no_sampled = 0;
+  for (const auto& uid : sample_index_) {
+    auto* person = bdm_static_cast<Person*>(rm->GetAgent(uid));
+    if (person != nullptr && person->sampling_cell_ != kRemoved) {
+      sample_index_[no_sampled++] = uid;
+    }
+  }
+  sample_index_.resize(no_sampled);
+
+  // Each thread adds the persons of a part of the index to the sample of the
+  // smallest fraction that contains them
+  static std::vector<std::vector<PopulationHistogram>> thread_samples;
+  auto max_threads = ThreadInfo::GetInstance()->GetMaxThreads();
+  thread_samples.resize(max_threads);
+  for (int t = 0; t < max_threads; t++) {
+    thread_samples[t].resize(no_levels);
+    for (auto& sample : thread_samples[t]) {
+      sample.Clear(nb_locations);
+    }
+  }
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < sample_index_.size(); i++) {
+    auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+    auto* person = bdm_static_cast<Person*>(rm->GetAgent(sample_index_[i]));
+    size_t level = std::upper_bound(fractions_.begin(), fractions_.end(),
+                                    GetSamplingKey(person)) -
+                   fractions_.begin();
+    thread_samples[tid][level].Add(person, year);
+  }
+
+  for (size_t level = 0; level < no_levels; level++) {
+    samples_[level].Clear(nb_locations);
+    if (level > 0) {
+      samples_[level].Merge(samples_[level - 1]);
+    }
+    for (const auto& samples : thread_samples) {
+      samples_[level].Merge(samples[level]);
+    }
+    sample_sizes_[level].assign(no_strata, 0);
+    for (int location = 0; location < no_locations_; location++) {
+      for (int sex = 0; sex < H::kNoSexes; sex++) {
+        H::Selection stratum;
+        stratum.location = location;
+        stratum.sexes = H::Bin(sex);
+        sample_sizes_[level][Stratum(location, sex)] =
+            static_cast<uint64_t>(samples_[level].Count(stratum));
+      }
+    }
+  }
+}
+
+void SampledStatistics::Resynchronize() {
+  using H = PopulationHistogram;
+  size_t no_cells =
+      static_cast<size_t>(no_locations_) * H::kNoSexes * H::kNoStates;
+  static std::vector<std::vector<uint64_t>> thread_counts;
+  auto max_threads = ThreadInfo::GetInstance()->GetMaxThreads();
+  thread_counts.resize(max_threads);
+  for (int t = 0; t < max_threads; t++) {
+    thread_counts[t].assign(no_cells, 0);
+    new_sampled_[t].clear();
+  }
+  auto add_person = L2F([&](Agent* agent) {
+    auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+    auto* person = bdm_static_cast<Person*>(agent);
+    uint32_t cell = GetCell(person);
+    person->sampling_cell_ = cell;
+    thread_counts[tid][cell]++;
+    if (GetSamplingKey(person) < fractions_.back()) {
+      new_sampled_[tid].push_back(person->GetUid());
+    }
+  });
+  Simulation::GetActive()->GetResourceManager()->ForEachAgentParallel(
+      add_person);
+
+  exact_counts_.assign(no_cells, 0);
+  for (const auto& counts : thread_counts) {
+    for (size_t i = 0; i < counts.size(); i++) {
+      exact_counts_[i] += counts[i];
+    }
+  }
+  sample_index_.clear();
+  for (auto& uids : new_sampled_) {
+    sample_index_.insert(sample_index_.end(), uids.begin(), uids.end());
+    uids.clear();
+  }
+  resynchronize_ = false;
+}
+
+template <typename TSum, typename TSumSquared>
+Estimate SampledStatistics::Stratified(
+    const PopulationHistogram::Selection& selection, size_t level, TSum sum,
+    TSumSquared sum_squared) const {
+  using H = PopulationHistogram;
+  const auto& sample = samples_[level];
+  int first_location = selection.location >= 0 ? selection.location : 0;
+  int last_location =
+      selection.location >= 0 ? selection.location : no_locations_ - 1;
+  double value = 0;
+  double variance = 0;
+  for (int location = first_location; location <= last_location; location++) {
+    for (int sex = 0; sex < H::kNoSexes; sex++) {
+      size_t stratum = Stratum(location, sex);
+      double n = static_cast<double>(sample_sizes_[level][stratum]);
+      // Strata without sampled persons do not contribute
+      if (!(selection.sexes & H::Bin(sex)) || n == 0) {
+        continue;
+      }
+      double size = static_cast<double>(stratum_sizes_[stratum]);
+      auto stratum_selection = selection;
+      stratum_selection.location = location;
+      stratum_selection.sexes = H::Bin(sex);
+      double mean = sum(sample, stratum_selection) / n;
+      value += size * mean;
+      if (n > 1) {
+        double sample_variance =
+            (sum_squared(sample, stratum_selection) - n * mean * mean) /
+            (n - 1);
+        variance += size * size * (1 - n / size) * sample_variance / n;
+      }
+    }
+  }
+  return {value, 1.96 * std::sqrt(std::max(variance, 0.0))};
+}
+
+Estimate SampledStatistics::Count(
+    const PopulationHistogram::Selection& selection, double fraction) {
+  using H = PopulationHistogram;
+  Refresh();
+
+  // Selections by state, sex and location only are counted exactly
+  auto all = [](H::Bins bins, int no_bins) {
+    H::Bins mask = (H::Bins{1} << no_bins) - 1;
+    return (bins & mask) == mask;
+  };
+  if (all(selection.age_bands, H::kNoAgeBands) &&
+      all(selection.sociobehaviours, H::kNoSociobehaviours) &&
+      all(selection.transmission_types, H::kNoTransmissionTypes)) {
+    int first_location = selection.location >= 0 ? selection.location : 0;
+    int last_location =
+        selection.location >= 0 ? selection.location : no_locations_ - 1;
+    uint64_t count = 0;
+    for (int location = first_location; location <= last_location;
+         location++) {
+      for (int sex = 0; sex < H::kNoSexes; sex++) {
+        for (int state = 0; state < H::kNoStates; state++) {
+          if ((selection.sexes & H::Bin(sex)) &&
+              (selection.states & H::Bin(state))) {
+            count += exact_counts_[ExactIndex(Stratum(location, sex), state)];
+          }
+        }
+      }
+    }
+    return {static_cast<double>(count), 0};
+  }
+
+  // The count is the sum of an indicator, which equals its square
+  auto count = [](const H& sample, const H::Selection& selection) {
+    return sample.Count(selection);
+  };
+  return Stratified(selection, GetLevel(fraction), count, count);
+}
+
+Estimate SampledStatistics::SumCasualPartners(
+    const PopulationHistogram::Selection& selection, double fraction) {
+  using H = PopulationHistogram;
+  Refresh();
+  return Stratified(
+      selection, GetLevel(fraction),
+      [](const H& sample, const H::Selection& selection) {
+        return sample.SumCasualPartners(selection);
+      },
+      [](const H& sample, const H::Selection& selection) {
+        return sample.SumSquaredCasualPartners(selection);
+      });
+}
+
+Estimate SampledStatistics::CountAcuteByOrigin(int origin_state,
+                                               int origin_sb,
+                                               double fraction) {
+  Refresh();
+  size_t level = GetLevel(fraction);
+  double n = 0;
+  double size = 0;
+  for (size_t stratum = 0; stratum < stratum_sizes_.size(); stratum++) {
+    n += sample_sizes_[level][stratum];
+    size += stratum_sizes_[stratum];
+  }
+  if (n == 0) {
+    return {0, 0};
+  }
+  double p = samples_[level].CountAcuteByOrigin(origin_state, origin_sb) / n;
+  double variance = 0;
+  if (n > 1) {
+    variance = size * size * (1 - n / size) * p * (1 - p) / (n - 1);
+  }
+  return {size * p, 1.96 * std::sqrt(std::max(variance, 0.0))};
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
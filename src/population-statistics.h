@@ -0,0 +1,403 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef POPULATION_STATISTICS_H_
+#define POPULATION_STATISTICS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/agent/agent_uid.h"
+#include "datatypes.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+class Person;
+
+////////////////////////////////////////////////////////////////////////////////
+// Histogram of the population over GemsState x sex x age band x
+// sociobehaviour x location x transmission type, together with the number of
+// casual partners summed over the same bins, and the number of acute persons
+// by the GemsState and the sociobehaviour of the person who infected them. All
+// series of the TimeSeries can be derived from it, such that one sweep over
+// the population per iteration replaces one sweep per collector.
+//
+// Each dimension has a last bin for values out of range (e.g. attributes that
+// were never set), such that these persons are counted exactly as by the
+// predicates of Person: e.g. they are neither male nor female, but they are
+// infected if their state is not kHealthy.
+////////////////////////////////////////////////////////////////////////////////
+
+class PopulationHistogram {
+ public:
+  // Age bands of the collectors
+  enum AgeBand { kUnder15, k15To49, k50AndOlder, kNoAgeBands };
+
+  static constexpr int kNoStates = GemsState::kGemsLast + 1;
+  static constexpr int kNoSexes = 3;
+  static constexpr int kNoSociobehaviours = 3;
+  static constexpr int kNoTransmissionTypes =
+      TransmissionType::kTransmissionLast + 1;
+
+  // Set of bins of a dimension, one bit per bin
+  using Bins = uint32_t;
+  static constexpr Bins kAll = ~Bins{0};
+  static constexpr Bins Bin(int bin) { return Bins{1} << bin; }
+
+  // Bins selected in each dimension. location -1 selects all locations.
+  struct Selection {
+    Bins states = kAll;
+    Bins sexes = kAll;
+    Bins age_bands = kAll;
+    Bins sociobehaviours = kAll;
+    Bins transmission_types = kAll;
+    int location = -1;
+  };
+
+  explicit PopulationHistogram(int no_locations = 0);
+
+  // Removes all persons. Resizes the histogram if no_locations changed.
+  void Clear(int no_locations);
+
+  // Returns the age band of a person of the given age
+  static int GetAgeBand(int age) {
+    return age < 15 ? kUnder15 : (age < 50 ? k15To49 : k50AndOlder);
+  }
+
+  // Adds a person, whose age is evaluated in the given year
+  void Add(Person* person, int year);
+
+  // Returns the key of the bins in which a person, whose age is evaluated in
+  // the given year, is counted. Bits 8-63 hold the position in counts_ and
+  // casual_partners_, and bits 0-7 the position in acute_origins_ (or
+  // kNotAcute).
+  uint64_t GetKey(Person* person, int year) const;
+
+  // Adds (sign 1) or removes (sign -1) a person with the given key and number
+  // of casual partners. Counts wrap around, such that a histogram of
+  // differences can be merged.
+  void AddKey(uint64_t key, int sign, int casual_partners);
+
+  // Adds the change of the number of casual partners of a person with the
+  // given key from old_count to new_count
+  void AddCasualPartners(uint64_t key, int old_count, int new_count);
+
+  // Sets the sums of casual partners of all bins to zero, e.g. when the
+  // numbers of casual partners of all persons are reset
+  void ClearCasualPartners();
+
+  // Adds the persons of other, which must have the same number of locations
+  void Merge(const PopulationHistogram& other);
+
+  // Returns the number of persons in the selected bins
+  double Count(const Selection& selection) const;
+
+  // Returns the sum of no_casual_partners_ of the persons in the selected bins
+  double SumCasualPartners(const Selection& selection) const;
+
+  // Returns the sum of the squares of no_casual_partners_ of the persons in
+  // the selected bins
+  double SumSquaredCasualPartners(const Selection& selection) const;
+
+  // Returns the number of acute persons who were infected by a person in
+  // origin_state with sociobehaviour origin_sb (-1: any)
+  double CountAcuteByOrigin(int origin_state, int origin_sb) const;
+
+  // Returns the number of locations, without the bin for locations out of
+  // range
+  int GetNoLocations() const { return no_locations_ - 1; }
+
+ private:
+  // Sums values over the selected bins
+  double Sum(const std::vector<uint64_t>& values,
+             const Selection& selection) const;
+
+  // Position in acute_origins_ of persons who are not acute
+  static constexpr uint64_t kNotAcute = 0xff;
+
+  // Returns the position of a bin in counts_ and casual_partners_
+  size_t Index(int state, int sex, int age_band, int sociobehaviour,
+               int location, int transmission_type) const {
+    return ((((static_cast<size_t>(state) * kNoSexes + sex) * kNoAgeBands +
+              age_band) *
+                 kNoSociobehaviours +
+             sociobehaviour) *
+                no_locations_ +
+            location) *
+               kNoTransmissionTypes +
+           transmission_type;
+  }
+
+  // Number of location bins, including the bin for locations out of range
+  int no_locations_;
+  std::vector<uint64_t> counts_;
+  std::vector<uint64_t> casual_partners_;
+  std::vector<uint64_t> casual_partners_squared_;
+  // Acute persons by GemsState x sociobehaviour of their origin
+  std::vector<uint64_t> acute_origins_;
+};
+
+// Returns the histogram of the population of the active simulation, with the
+// ages of the year following the current iteration (see GetAgeAfterStep in
+// analyze.cc). It is computed by a single parallel sweep at the first call in
+// each iteration, and reused by the following calls.
+const PopulationHistogram& GetPopulationHistogram();
+
+////////////////////////////////////////////////////////////////////////////////
+// PopulationHistogram maintained from the events that change the bin of a
+// person, instead of a sweep over the population per iteration. Each person
+// stores the key of the bins it is counted in (Person::statistics_key_). At
+// each event, the new key is swapped in and the difference between the keys
+// is added to a histogram of the executing thread; the differences of all
+// threads are merged into the histogram once per iteration. Events are
+// infections, HIV state transitions, changes of the sociobehaviour, the
+// crossing of an age band, births, deaths, relocations, and the migration
+// between ranks, such that the cost scales with the number of events rather
+// than with the population.
+//
+// The numbers of casual partners are not part of the key. Each casual contact
+// adds its difference to the bin of the person, and the sums are cleared when
+// the numbers of casual partners are reset at the beginning of each
+// iteration. A contact that coincides with the move of the person to another
+// bin may be counted in the bin it left; the sums over all bins are exact.
+//
+// Persons that never went through an event (e.g. the initial population) are
+// not counted. If the number of counted persons differs from the number of
+// agents, the histogram is rebuilt by a sweep that also sets all keys.
+////////////////////////////////////////////////////////////////////////////////
+
+class IncrementalStatistics {
+ public:
+  // Keys of persons that are not counted yet, or removed from the simulation
+  static constexpr uint64_t kUncounted = ~uint64_t{0};
+  static constexpr uint64_t kRemoved = ~uint64_t{0} - 1;
+
+  static IncrementalStatistics* GetInstance() {
+    static IncrementalStatistics instance;
+    return &instance;
+  }
+
+  // Returns true if the events update the statistics
+  static bool IsEnabled() { return enabled_; }
+
+  // Enables or disables the updates, and forgets all persons counted so far,
+  // e.g. at the beginning of a simulation
+  void Reset(bool enabled);
+
+  // Moves person to the bins of its current attributes
+  void Update(Person* person);
+
+  // Removes person, which is ignored by later updates
+  void Remove(Person* person);
+
+  // Counts no_added new casual partners of person, whose number of casual
+  // partners was already incremented
+  void AddCasualPartners(Person* person, int no_added);
+
+  // Forgets the casual partners of all persons, whose numbers of casual
+  // partners were reset to zero
+  void ResetCasualPartners();
+
+  // Returns the histogram of the current iteration (see
+  // GetPopulationHistogram). The differences are merged at the first call in
+  // each iteration.
+  const PopulationHistogram& GetHistogram();
+
+ private:
+  IncrementalStatistics() {}
+
+  // Counts all persons again and sets their keys
+  void Resynchronize();
+
+  static bool enabled_;
+  int no_locations_ = 0;
+  int start_year_ = 0;
+  bool resynchronize_ = true;
+  // Iteration of the last call of GetHistogram
+  uint64_t step_ = 0;
+  PopulationHistogram histogram_;
+  // Differences since the last call of GetHistogram, per thread
+  std::vector<PopulationHistogram> deltas_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Estimates of the PopulationHistogram from a deterministic sample of the
+// persons, for populations where keying every person in each iteration is too
+// costly (see sampled_statistics). A person is in the sample of fraction f if
+// its sampling key, a hash of its uid, is below f; samples of smaller
+// fractions are thus contained in those of larger ones, and a person stays in
+// the sample across iterations.
+//
+// The number of persons by location, sex and GemsState is maintained from the
+// events that change these attributes (infections, HIV state transitions,
+// births, deaths, relocations and migrations between ranks): each person
+// stores the cell it is counted in (Person::sampling_cell_), and the events
+// add the differences to counters of the executing thread. The events also
+// append new sampled persons to an index of the sample. Once per iteration,
+// only the persons of the index are added to a histogram per sampling
+// fraction, such that the cost per iteration scales with the number of events
+// and the size of the sample. Persons that never went through an event (e.g.
+// the initial population) are counted by a sweep, as by IncrementalStatistics.
+//
+// The estimates are stratified by location and sex: the sampled counts of each
+// stratum are scaled to the number of persons in the stratum. Their errors are
+// the half-widths of normal 95% confidence intervals. Selections by GemsState,
+// sex and location only (e.g. infected_agents and healthy_agents) are counted
+// exactly.
+////////////////////////////////////////////////////////////////////////////////
+
+struct Estimate {
+  double value;
+  double error;
+};
+
+class SampledStatistics {
+ public:
+  // Cells of persons that are not counted yet, or removed from the simulation
+  static constexpr uint32_t kUncounted = ~uint32_t{0};
+  static constexpr uint32_t kRemoved = ~uint32_t{0} - 1;
+
+  static SampledStatistics* GetInstance() {
+    static SampledStatistics instance;
+    return &instance;
+  }
+
+  // Returns true if the collectors are estimated from samples
+  static bool IsEnabled() { return enabled_; }
+
+  // Returns the sampling key of a person in [0, 1)
+  static double GetSamplingKey(const Person* person);
+
+  // Enables or disables the sampling with the given sampling fractions, and
+  // forgets all persons counted so far, e.g. at the beginning of a simulation
+  void Reset(bool enabled, const std::vector<double>& fractions);
+
+  // Moves person to the cell of its current location, sex and GemsState, and
+  // adds it to the index of the sample when it is counted for the first time
+  void Update(Person* person);
+
+  // Removes person, which is ignored by later updates
+  void Remove(Person* person);
+
+  // Estimates the number of persons in the selection from the sample of the
+  // given fraction, which must be one of the fractions passed to Reset
+  Estimate Count(const PopulationHistogram::Selection& selection,
+                 double fraction);
+
+  // Estimates the sum of no_casual_partners_ of the persons in the selection
+  Estimate SumCasualPartners(const PopulationHistogram::Selection& selection,
+                             double fraction);
+
+  // Estimates the number of acute persons by the state and the sociobehaviour
+  // of their origin (-1: any). The estimate is not stratified.
+  Estimate CountAcuteByOrigin(int origin_state, int origin_sb,
+                              double fraction);
+
+ private:
+  SampledStatistics() {}
+
+  // Merges the counters of the threads and adds the sampled persons to the
+  // samples at the first call in each iteration
+  void Refresh();
+
+  // Counts all persons again, sets their cells and rebuilds the index
+  void Resynchronize();
+
+  // Returns the position of the cell of a person in exact_counts_
+  uint32_t GetCell(const Person* person) const;
+
+  // Returns the position of fraction in fractions_
+  size_t GetLevel(double fraction) const;
+
+  // Stratified estimate of the sum of a value over the selection; sum and
+  // sum_squared return the sums of the value and of its square over the
+  // sampled persons of a selection
+  template <typename TSum, typename TSumSquared>
+  Estimate Stratified(const PopulationHistogram::Selection& selection,
+                      size_t level, TSum sum, TSumSquared sum_squared) const;
+
+  // Returns the position of a stratum, and of a state in a stratum, in
+  // exact_counts_
+  size_t Stratum(int location, int sex) const {
+    return static_cast<size_t>(location) * PopulationHistogram::kNoSexes + sex;
+  }
+  size_t ExactIndex(size_t stratum, int state) const {
+    return stratum * PopulationHistogram::kNoStates + state;
+  }
+
+  static bool enabled_;
+  // Number of location bins, including the bin for locations out of range
+  int no_locations_ = 0;
+  int start_year_ = 0;
+  bool resynchronize_ = true;
+  // Iteration and simulation of the last call of Refresh
+  uint64_t step_ = 0;
+  std::string simulation_name_;
+  // Distinct sampling fractions in ascending order
+  std::vector<double> fractions_;
+  // Sampled persons of each fraction (including those of smaller fractions)
+  std::vector<PopulationHistogram> samples_;
+  // Number of sampled persons of each fraction per stratum
+  std::vector<std::vector<uint64_t>> sample_sizes_;
+  // Number of persons by stratum and GemsState
+  std::vector<uint64_t> exact_counts_;
+  // Number of persons per stratum
+  std::vector<uint64_t> stratum_sizes_;
+  // Differences of exact_counts_ since the last call of Refresh, per thread
+  std::vector<std::vector<uint64_t>> deltas_;
+  // Persons in the sample of the largest fraction, and those that were added
+  // by each thread since the last call of Refresh
+  std::vector<AgentUid> sample_index_;
+  std::vector<std::vector<AgentUid>> new_sampled_;
+};
+
+// Event hooks, which do nothing unless the incremental or the sampled
+// statistics are enabled
+inline void UpdateStatistics(Person* person) {
+  if (IncrementalStatistics::IsEnabled()) {
+    IncrementalStatistics::GetInstance()->Update(person);
+  }
+  if (SampledStatistics::IsEnabled()) {
+    SampledStatistics::GetInstance()->Update(person);
+  }
+}
+// Hook of changes of the sociobehaviour or the age band, which do not move a
+// person to another cell of SampledStatistics
+inline void UpdateIncrementalStatistics(Person* person) {
+  if (IncrementalStatistics::IsEnabled()) {
+    IncrementalStatistics::GetInstance()->Update(person);
+  }
+}
+inline void RemoveFromStatistics(Person* person) {
+  if (IncrementalStatistics::IsEnabled()) {
+    IncrementalStatistics::GetInstance()->Remove(person);
+  }
+  if (SampledStatistics::IsEnabled()) {
+    SampledStatistics::GetInstance()->Remove(person);
+  }
+}
+// Hook of casual contacts, called after the number of casual partners of
+// person was incremented by no_added. The samples of SampledStatistics read
+// the numbers of casual partners when they are refreshed.
+inline void AddCasualPartnersToStatistics(Person* person, int no_added) {
+  if (IncrementalStatistics::IsEnabled()) {
+    IncrementalStatistics::GetInstance()->AddCasualPartners(person, no_added);
+  }
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // POPULATION_STATISTICS_H_
@@ -13,6 +13,8 @@
 #ifndef SIM_PARAM_H_
 #define SIM_PARAM_H_
 
+#include <map>
+#include <string>
 #include <vector>
 #include "biodynamo.h"
 #include "datatypes.h"  //AM: Added to access GemState Enum
@@ -41,6 +43,191 @@ class SimParam : public ParamGroup {
   // Number of agents that are present at the first iteration of the simulation
   uint64_t initial_population_size = 53020;  // 3600000;//5302000;
 
+  // Reorder the agents in memory by compound category every
+  // sort_agents_frequency iterations (0: never). Keeps the potential mates of
+  // an agent close in memory, as births and deaths scatter them over time.
+  uint64_t sort_agents_frequency = 0;
+
+  // Run the behaviours with a cost-aware work-stealing schedule instead of
+  // BioDynaMo's default agent loop, and print the busy time of each thread at
+  // the end of the simulation.
+  bool cost_aware_scheduling = false;
+
+  // Run the behaviours district by district: each district (location) is
+  // executed by a single thread, without locking the relatives of the agents.
+  // Casual contacts with women of other districts and deaths of relatives in
+  // other districts are applied at the end of the behaviour pass; the HIV
+  // state of a woman of another district is taken from an index built at the
+  // beginning of the iteration. Takes precedence over cost_aware_scheduling,
+  // which is then ignored with a warning.
+  bool district_partitioned_execution = false;
+
+  // Draw the Bernoulli decisions of the behaviours (migration, partnerships,
+  // births, risk factors, HIV transitions and mortality) by comparing raw
+  // 32-bit integers of a thread-local buffer with thresholds precomputed from
+  // the probabilities, instead of calling Random::Uniform().
+  bool fast_bernoulli = false;
+
+  // Initialize the population by drawing the number of persons of each sex,
+  // age bin and location first and filling these cells in parallel (see
+  // InitializeStratifiedPopulation), instead of sampling each person
+  // independently. The marginal distributions then match the expected counts
+  // up to rounding. Always used by distributed simulations, where each rank
+  // only creates the persons of its own districts.
+  bool stratified_initialization = false;
+
+  // Derive all series of the TimeSeries from a histogram of the population
+  // filled by a single parallel sweep per iteration (see
+  // population-statistics.h), instead of one sweep per collector. The ids and
+  // the values of the series are unchanged.
+  bool fused_statistics = false;
+
+  // Maintain the histogram of fused_statistics from the events that change the
+  // attributes of persons (infections, casual contacts, births, deaths,
+  // ageing, migration), instead of a sweep over the population per iteration
+  // (see IncrementalStatistics). Implies fused_statistics.
+  bool incremental_statistics = false;
+
+  // Write the initial population, including the mother / child / partner
+  // links, to this binary snapshot file in the first iteration (empty: no
+  // snapshot). In distributed simulations, each rank writes its own file with
+  // the suffix ".rank_<rank>".
+  std::string save_population_snapshot = "";
+
+  // Load the initial population from this snapshot file instead of sampling
+  // it (empty: sample the population). The snapshot must have been written by
+  // a simulation with the same start_year and the same number of ranks.
+  std::string load_population_snapshot = "";
+
+  // Import the initial population from this synthetic population file (CSV
+  // or binary, see population-import.h) instead of sampling it (empty: sample
+  // the population). The ages are the ages in start_year.
+  std::string import_population = "";
+
+  // Write a checkpoint of the simulation to checkpoint_file every
+  // checkpoint_frequency iterations (0: never), see checkpoint.h. In
+  // distributed simulations, each rank writes its own file with the suffix
+  // ".rank_<rank>". checkpoint_frequency must be a multiple of
+  // sort_agents_frequency. Writing a checkpoint reseeds the random number
+  // generators from random_seed and the number of completed iterations, which
+  // the restarted simulation also does. A restarted simulation is therefore
+  // statistically equivalent to the uninterrupted one, and reproduces it
+  // exactly if both are executed with a single thread.
+  uint64_t checkpoint_frequency = 0;
+  std::string checkpoint_file = "checkpoint.bin";
+
+  // Count the persons by district, sex, 5-year age band and HIV state while
+  // the environment rebuilds its indexes, and append the counts of each
+  // iteration to <output directory>/district_pyramid.bin (see
+  // WriteDistrictPyramid).
+  bool district_pyramid = false;
+
+  // Log every HIV transmission (infected and infector, their attributes, the
+  // transmission type and the year) to <output directory>/transmissions.bin
+  // from a background thread (see transmission-log.h)
+  bool transmission_log = false;
+
+  // Estimate the fused statistics from a deterministic sample of the persons,
+  // stratified by location and sex, instead of counting all persons (see
+  // SampledStatistics). Each collector uses the sample of its fraction in
+  // collector_sampling_fractions, or of sampling_fraction. Counts by HIV
+  // state, sex and location only (e.g. infected_agents and healthy_agents)
+  // stay exact; they are maintained from the same events as
+  // incremental_statistics. data.json holds the 95% confidence intervals of
+  // the estimates as errors. If incremental_statistics is set as well, the
+  // collectors are still estimated from the samples.
+  bool sampled_statistics = false;
+  double sampling_fraction = 0.05;
+  std::map<std::string, double> collector_sampling_fractions;
+
+  // Evaluate the collectors of the time series only in the iterations whose
+  // year is in collection_years or, if it is empty, in every
+  // collection_interval-th iteration. Series derived from the collectors
+  // (e.g. prevalence) are computed when the time series are saved.
+  uint64_t collection_interval = 1;
+  std::vector<int> collection_years;
+
+  // Render the plots of the time series with ROOT at the end of the
+  // simulation. Batch runs (e.g. calibration sweeps) can disable it, write
+  // data.json only, and render the plots of selected runs later with
+  // hiv_malawi-plot.
+  bool plot_time_series = true;
+
+  // Append the values of the collectors of each iteration to
+  // <output directory>/timeseries.bin from a background thread, in blocks of
+  // stream_time_series_block iterations, and mirror them to timeseries.csv if
+  // stream_time_series_csv is set (see timeseries-stream.h). The stream can be
+  // converted to data.json with hiv_malawi-convert.
+  bool stream_time_series = false;
+  bool stream_time_series_csv = false;
+  uint64_t stream_time_series_block = 1;
+
+  // Resume the simulation from this checkpoint file instead of initializing
+  // the population (empty: start from start_year). The parameters must be
+  // those of the simulation that wrote the checkpoint.
+  std::string restart_from_checkpoint = "";
+
+  // Simulate the years before fork_year once (0: no fork), then simulate one
+  // branch per element of fork_scenarios from the state in fork_year, one
+  // after the other and with the same random numbers. Each scenario is a JSON
+  // patch of the parameters, e.g.
+  // {"bdm::hiv_malawi::SimParam": {"protect_mothers_at_birth": true}}, and
+  // writes its output to the directory scenario_<i> in the output directory.
+  // Derived parameters (e.g. hiv_transition_matrix) are not recomputed from
+  // patched values and must be patched themselves. The state in fork_year is
+  // also written to checkpoint_file, from which the scenarios can be
+  // simulated in parallel processes with restart_from_checkpoint.
+  int fork_year = 0;
+  std::vector<std::string> fork_scenarios;
+
+  // Simulate an ensemble of ensemble_size replicates (0: a single simulation)
+  // in this process, one after the other. Each replicate draws its random
+  // numbers from a seed derived from random_seed and writes its output to the
+  // directory replicate_<i> in the output directory. The mean of each series
+  // over the replicates is saved to ensemble.json in the output directory,
+  // with the central band of the values that covers the fraction
+  // ensemble_band as errors. If ensemble_share_population is set, all
+  // replicates start from the initial population of the first one instead of
+  // initializing their own. Cannot be combined with fork_year.
+  uint64_t ensemble_size = 0;
+  double ensemble_band = 0.9;
+  bool ensemble_share_population = false;
+
+  // Calibrate the parameters in calibration_parameters, which maps each name
+  // to its bounds {lower, upper} (see SetCalibrationParameter in
+  // calibration.h), against the targets in the CSV file calibration_targets
+  // (empty: no calibration). The method is "abc_rejection", "abc_smc",
+  // "nelder_mead" or "successive_halving". Each candidate parameter set is
+  // simulated in this process and writes its output to the directory
+  // calibration/run_<i> in the output directory; the parameters and results
+  // of all runs are written to calibration/runs.csv. A simulation is aborted
+  // as soon as its deviation from a target exceeds the band of the method:
+  // the tolerance of the target for abc_rejection, the shrinking band of the
+  // current round for abc_smc, and calibration_abort_band tolerances for
+  // nelder_mead and successive_halving. The years of the targets must be
+  // collection years (see collection_interval and collection_years).
+  std::string calibration_targets = "";
+  std::string calibration_method = "abc_rejection";
+  std::map<std::string, std::vector<double>> calibration_parameters;
+  // Number of simulations of abc_rejection and of each round of abc_smc, and
+  // maximal number of simulations of nelder_mead
+  uint64_t calibration_runs = 100;
+  // Number of rounds of abc_smc, whose band shrinks from
+  // calibration_initial_band tolerances in the first round to the tolerances
+  // in the last one
+  uint64_t calibration_rounds = 4;
+  double calibration_initial_band = 4;
+  double calibration_abort_band = 3;
+  // Initial population sizes of the levels of successive_halving, ascending.
+  // The calibration_runs candidates are simulated with the first size, and
+  // the fraction calibration_promotion_fraction with the smallest objectives
+  // of each level is simulated again with the next size. The counts of the
+  // smaller populations are scaled to the last size, to which the targets
+  // refer. The cost and the ranking agreement of the levels are written to
+  // calibration/levels.csv.
+  std::vector<uint64_t> calibration_population_sizes{53020, 530200, 3600000};
+  double calibration_promotion_fraction = 0.5;
+
   // Activate an additional safety mechanism: protect mothers from death in the
   // year in which they give birth
   bool protect_mothers_at_birth = false;
@@ -96,7 +283,7 @@ class SimParam : public ParamGroup {
   // distribution.
   // Gaussian distribution defining the number of casual partners per year
   // depending on year (see no_mates_year_transition) and socio-behaviour
-  const std::vector<std::vector<float>> no_mates_mean /*{{40.0,80.0},
+  std::vector<std::vector<float>> no_mates_mean /*{{40.0,80.0},
                                                       {30.0,60.0},
                                                       {20.0,40.0}};*/
       {{24, 95}, {22, 89}, {21, 83}, {20, 77}, {18, 71}, {16, 65}, {15, 59},
@@ -113,6 +300,26 @@ class SimParam : public ParamGroup {
   //{{8.0, 10.0}, {8.0, 10.0}, {8.0, 10.0}};
   //{{10.0, 10.0}, {10.0, 10.0}, {10.0, 10.0}};
 
+  // Only sample the casual contacts of healthy men with infected women, i.e.
+  // the contacts that could transmit HIV. The number of skipped contacts with
+  // healthy women between two sampled ones follows a geometric distribution.
+  // The skipped contacts are attributed to healthy women in bulk at the end of
+  // the iteration, at a cost bounded by the number of healthy women per
+  // compound category rather than by the number of contacts. The cost of the
+  // sampled contacts then scales with the prevalence instead of the population
+  // size. This is an approximation: the index of infected women is built at
+  // the beginning of the iteration, such that women infected during the
+  // iteration are skipped as healthy, and whether the contacts of a man
+  // infected during the iteration are thinned depends on whether his
+  // behaviours run before or after his infection.
+  bool skip_non_transmissive_casual_contacts = false;
+
+  // Allocate the casual partners of a man to the female compound categories
+  // with one multinomial draw (conditional binomials over locations, age and
+  // socio-behavioural categories), instead of one categorical draw per
+  // partner. The partners are then picked category by category.
+  bool bulk_casual_partner_allocation = false;
+
   // We sample the number of sex acts with each female sex partner per year
   // from a Gaussian distribution.
   const std::vector<std::vector<float>> no_acts_mean{
@@ -0,0 +1,208 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "timeseries-stream.h"
+#include <iomanip>
+#include <limits>
+#include <utility>
+
+#include "biodynamo.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+TimeSeriesStreamWriter::TimeSeriesStreamWriter(
+    const std::string& filename, const std::string& csv_filename,
+    const std::vector<std::string>& ids, uint64_t block_size)
+    : file_(filename, std::ios::binary | std::ios::trunc),
+      no_series_(ids.size()),
+      block_size_(block_size > 0 ? block_size : 1) {
+  if (!file_.is_open()) {
+    Log::Fatal("TimeSeriesStreamWriter()", "Cannot create ", filename);
+  }
+  TimeSeriesStreamHeader header;
+  header.magic = TimeSeriesStreamHeader::kMagic;
+  header.version = TimeSeriesStreamHeader::kVersion;
+  header.reserved = 0;
+  header.no_series = no_series_;
+  file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const auto& id : ids) {
+    uint64_t id_length = id.size();
+    file_.write(reinterpret_cast<const char*>(&id_length), sizeof(uint64_t));
+    file_.write(id.data(), id_length);
+  }
+  file_.flush();
+
+  if (!csv_filename.empty()) {
+    csv_file_.open(csv_filename, std::ios::trunc);
+    if (!csv_file_.is_open()) {
+      Log::Fatal("TimeSeriesStreamWriter()", "Cannot create ", csv_filename);
+    }
+    csv_file_ << "year";
+    for (const auto& id : ids) {
+      csv_file_ << "," << id;
+    }
+    csv_file_ << "\n";
+    csv_file_ << std::setprecision(std::numeric_limits<double>::max_digits10);
+    csv_file_.flush();
+  }
+
+  block_.y_values.resize(no_series_);
+  thread_ = std::thread([this]() { Run(); });
+}
+
+TimeSeriesStreamWriter::~TimeSeriesStreamWriter() { Close(); }
+
+void TimeSeriesStreamWriter::Append(double x,
+                                    const std::vector<double>& y_values) {
+  if (y_values.size() != no_series_) {
+    Log::Fatal("TimeSeriesStreamWriter::Append()", "Expected ", no_series_,
+               " values, got ", y_values.size());
+  }
+  block_.x_values.push_back(x);
+  for (uint64_t s = 0; s < no_series_; s++) {
+    block_.y_values[s].push_back(y_values[s]);
+  }
+  if (block_.x_values.size() >= block_size_) {
+    Submit();
+  }
+}
+
+void TimeSeriesStreamWriter::Submit() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(block_));
+  }
+  condition_.notify_one();
+  block_ = Block();
+  block_.y_values.resize(no_series_);
+}
+
+void TimeSeriesStreamWriter::Close() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  if (!block_.x_values.empty()) {
+    Submit();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  condition_.notify_one();
+  thread_.join();
+}
+
+void TimeSeriesStreamWriter::Run() {
+  while (true) {
+    Block block;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      block = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    Write(block);
+  }
+}
+
+void TimeSeriesStreamWriter::Write(const Block& block) {
+  uint64_t no_rows = block.x_values.size();
+  file_.write(reinterpret_cast<const char*>(&no_rows), sizeof(uint64_t));
+  file_.write(reinterpret_cast<const char*>(block.x_values.data()),
+              no_rows * sizeof(double));
+  for (const auto& column : block.y_values) {
+    file_.write(reinterpret_cast<const char*>(column.data()),
+                no_rows * sizeof(double));
+  }
+  file_.flush();
+
+  if (csv_file_.is_open()) {
+    for (uint64_t r = 0; r < no_rows; r++) {
+      csv_file_ << block.x_values[r];
+      for (const auto& column : block.y_values) {
+        csv_file_ << "," << column[r];
+      }
+      csv_file_ << "\n";
+    }
+    csv_file_.flush();
+  }
+}
+
+uint64_t ReadTimeSeriesStream(const std::string& filename,
+                              experimental::TimeSeries* ts) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    Log::Fatal("ReadTimeSeriesStream()", "Cannot open ", filename);
+  }
+  // Reads size bytes into value; returns false at the end of the file
+  auto read = [&](void* value, size_t size) {
+    file.read(static_cast<char*>(value), size);
+    return static_cast<size_t>(file.gcount()) == size;
+  };
+
+  TimeSeriesStreamHeader header;
+  if (!read(&header, sizeof(header)) ||
+      header.magic != TimeSeriesStreamHeader::kMagic ||
+      header.version != TimeSeriesStreamHeader::kVersion) {
+    Log::Fatal("ReadTimeSeriesStream()", filename,
+               " is not a time series stream of version ",
+               TimeSeriesStreamHeader::kVersion);
+  }
+  std::vector<std::string> ids(header.no_series);
+  for (auto& id : ids) {
+    uint64_t id_length;
+    if (!read(&id_length, sizeof(uint64_t))) {
+      Log::Fatal("ReadTimeSeriesStream()", "The ids in ", filename,
+                 " are truncated");
+    }
+    id.resize(id_length);
+    if (!read(&id[0], id_length)) {
+      Log::Fatal("ReadTimeSeriesStream()", "The ids in ", filename,
+                 " are truncated");
+    }
+  }
+
+  std::vector<double> x_values;
+  std::vector<std::vector<double>> y_values(header.no_series);
+  std::vector<double> block;
+  uint64_t no_rows;
+  while (read(&no_rows, sizeof(uint64_t))) {
+    block.resize(no_rows * (header.no_series + 1));
+    if (!read(block.data(), block.size() * sizeof(double))) {
+      break;
+    }
+    x_values.insert(x_values.end(), block.begin(), block.begin() + no_rows);
+    for (uint64_t s = 0; s < header.no_series; s++) {
+      auto begin = block.begin() + (s + 1) * no_rows;
+      y_values[s].insert(y_values[s].end(), begin, begin + no_rows);
+    }
+  }
+
+  for (uint64_t s = 0; s < header.no_series; s++) {
+    ts->Add(ids[s], x_values, y_values[s]);
+  }
+  return x_values.size();
+}
+
+void ConvertTimeSeriesStream(const std::string& filename,
+                             const std::string& json_filename) {
+  experimental::TimeSeries ts;
+  ReadTimeSeriesStream(filename, &ts);
+  ts.SaveJson(json_filename);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,120 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef TIMESERIES_STREAM_H_
+#define TIMESERIES_STREAM_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bdm {
+
+namespace experimental {
+class TimeSeries;
+}  // namespace experimental
+
+namespace hiv_malawi {
+
+////////////////////////////////////////////////////////////////////////////////
+// Stream of the values of the collectors, appended while the simulation runs
+// such that they survive a crash and can be read by other tools in the
+// meantime. The binary file is a TimeSeriesStreamHeader, followed by the ids of
+// the series (uint64_t length and characters), followed by blocks of
+// iterations. Each block stores the number of iterations (uint64_t), the
+// x-values of these iterations, and the y-values of each series in the order
+// of the ids, all as doubles. All series share the x-values (the year).
+//
+// A CSV mirror with a header line "year,<ids>" and one line per iteration can
+// be written as well. Both files are written and flushed by a background
+// thread after each block.
+////////////////////////////////////////////////////////////////////////////////
+
+struct TimeSeriesStreamHeader {
+  static constexpr uint64_t kMagic = 0x535245534d564948;  // "HIVMSERS"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t no_series;
+};
+
+class TimeSeriesStreamWriter {
+ public:
+  // Creates filename, and csv_filename unless it is empty, and starts the
+  // writer thread. Iterations are written in blocks of block_size.
+  TimeSeriesStreamWriter(const std::string& filename,
+                         const std::string& csv_filename,
+                         const std::vector<std::string>& ids,
+                         uint64_t block_size);
+
+  // Writes the remaining iterations (see Close)
+  ~TimeSeriesStreamWriter();
+
+  // Appends the values of an iteration, one y-value per id
+  void Append(double x, const std::vector<double>& y_values);
+
+  // Writes the iterations of the incomplete block, and waits until the writer
+  // thread has written everything
+  void Close();
+
+ private:
+  // Iterations of a block, column by column
+  struct Block {
+    std::vector<double> x_values;
+    std::vector<std::vector<double>> y_values;
+  };
+
+  // Loop of the writer thread
+  void Run();
+
+  // Writes block to the files and flushes them
+  void Write(const Block& block);
+
+  // Hands the current block over to the writer thread
+  void Submit();
+
+  std::ofstream file_;
+  std::ofstream csv_file_;
+  uint64_t no_series_;
+  uint64_t block_size_;
+  // Block filled by the simulation
+  Block block_;
+  // Blocks waiting for the writer thread
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::deque<Block> queue_;
+  bool closed_ = false;
+  std::thread thread_;
+};
+
+// Reads the complete blocks of a stream into ts, with one entry per id. An
+// incomplete block at the end, e.g. of a crashed simulation, is ignored.
+// Returns the number of iterations read.
+uint64_t ReadTimeSeriesStream(const std::string& filename,
+                              experimental::TimeSeries* ts);
+
+// Converts a stream to the JSON file that PlotAndSaveTimeseries writes for
+// the same iterations (data.json)
+void ConvertTimeSeriesStream(const std::string& filename,
+                             const std::string& json_filename);
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // TIMESERIES_STREAM_H_
@@ -0,0 +1,224 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include "transmission-log.h"
+#include <chrono>
+#include <fstream>
+
+#include "biodynamo.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Number of events after which the background thread writes a block
+static constexpr size_t kBlockSize = 1 << 16;
+
+// Appends value as a variable-length integer, 7 bits per byte
+static void EncodeVarint(uint64_t value, std::vector<char>* bytes) {
+  while (value >= 0x80) {
+    bytes->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  bytes->push_back(static_cast<char>(value));
+}
+
+// Appends a signed value, with small magnitudes encoded in few bytes
+static void EncodeSigned(int64_t value, std::vector<char>* bytes) {
+  EncodeVarint((static_cast<uint64_t>(value) << 1) ^
+                   static_cast<uint64_t>(value >> 63),
+               bytes);
+}
+
+// Decodes a variable-length integer at position and advances it. Returns
+// false if the integer exceeds end.
+static bool DecodeVarint(const char** position, const char* end,
+                         uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; *position < end && shift < 64; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*(*position)++);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool DecodeSigned(const char** position, const char* end,
+                         int64_t* value) {
+  uint64_t encoded;
+  if (!DecodeVarint(position, end, &encoded)) {
+    return false;
+  }
+  *value = static_cast<int64_t>(encoded >> 1) ^
+           -static_cast<int64_t>(encoded & 1);
+  return true;
+}
+
+std::atomic<bool> TransmissionLog::enabled_{false};
+
+void TransmissionLog::Open(const std::string& filename) {
+  Close();
+  {
+    // Closed before the background thread appends to the file
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      Log::Fatal("TransmissionLog::Open()", "Cannot create ", filename);
+    }
+    TransmissionLogHeader header;
+    header.magic = TransmissionLogHeader::kMagic;
+    header.version = TransmissionLogHeader::kVersion;
+    header.reserved = 0;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  filename_ = filename;
+  rings_.clear();
+  for (int i = 0; i < ThreadInfo::GetInstance()->GetMaxThreads(); i++) {
+    rings_.push_back(std::make_unique<Ring>());
+  }
+  stop_ = false;
+  enabled_ = true;
+  thread_ = std::thread([this]() { Run(); });
+}
+
+void TransmissionLog::Close() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  enabled_ = false;
+  stop_ = true;
+  thread_.join();
+}
+
+void TransmissionLog::Append(const TransmissionEvent& event) {
+  auto& ring = *rings_[ThreadInfo::GetInstance()->GetMyThreadId()];
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  while (head - ring.tail.load(std::memory_order_acquire) >= Ring::kSize) {
+    std::this_thread::yield();
+  }
+  ring.events[head % Ring::kSize] = event;
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+void TransmissionLog::Drain(std::vector<TransmissionEvent>* events) {
+  for (auto& ring : rings_) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    for (uint64_t i = tail; i < head; i++) {
+      events->push_back(ring->events[i % Ring::kSize]);
+    }
+    ring->tail.store(head, std::memory_order_release);
+  }
+}
+
+void TransmissionLog::Run() {
+  std::ofstream file(filename_, std::ios::binary | std::ios::app);
+  std::vector<TransmissionEvent> events;
+  auto write = [&]() {
+    auto block = EncodeBlock(events);
+    file.write(block.data(), block.size());
+    file.flush();
+    events.clear();
+  };
+  while (!stop_) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    Drain(&events);
+    if (events.size() >= kBlockSize) {
+      write();
+    }
+  }
+  // Appends that happened before Close are visible after the last drain
+  Drain(&events);
+  if (!events.empty()) {
+    write();
+  }
+}
+
+std::vector<char> TransmissionLog::EncodeBlock(
+    const std::vector<TransmissionEvent>& events) {
+  std::vector<char> bytes;
+  int64_t year = 0;
+  for (const auto& event : events) {
+    EncodeVarint(event.infected, &bytes);
+    // kUnknownInfector is encoded as 0
+    EncodeVarint(event.infector + 1, &bytes);
+    EncodeSigned(event.year - year, &bytes);
+    year = event.year;
+    EncodeSigned(event.location, &bytes);
+    EncodeSigned(event.sex, &bytes);
+    EncodeSigned(event.age, &bytes);
+    EncodeSigned(event.transmission_type, &bytes);
+    EncodeSigned(event.infector_state, &bytes);
+    EncodeSigned(event.infector_sb, &bytes);
+  }
+  uint32_t sizes[2] = {static_cast<uint32_t>(events.size()),
+                       static_cast<uint32_t>(bytes.size())};
+  bytes.insert(bytes.begin(), reinterpret_cast<const char*>(sizes),
+               reinterpret_cast<const char*>(sizes) + sizeof(sizes));
+  return bytes;
+}
+
+std::vector<TransmissionEvent> ReadTransmissionLog(
+    const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  TransmissionLogHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file.good() || header.magic != TransmissionLogHeader::kMagic ||
+      header.version != TransmissionLogHeader::kVersion) {
+    Log::Fatal("ReadTransmissionLog()", filename,
+               " is not a transmission log of version ",
+               TransmissionLogHeader::kVersion);
+  }
+
+  std::vector<TransmissionEvent> events;
+  std::vector<char> bytes;
+  uint32_t sizes[2];
+  while (file.read(reinterpret_cast<char*>(sizes), sizeof(sizes))) {
+    bytes.resize(sizes[1]);
+    if (!file.read(bytes.data(), bytes.size())) {
+      break;
+    }
+    const char* position = bytes.data();
+    const char* end = position + bytes.size();
+    int64_t year = 0;
+    for (uint32_t e = 0; e < sizes[0]; e++) {
+      uint64_t infected;
+      uint64_t infector;
+      int64_t values[7];
+      bool ok = DecodeVarint(&position, end, &infected) &&
+                DecodeVarint(&position, end, &infector);
+      for (int v = 0; v < 7; v++) {
+        ok = ok && DecodeSigned(&position, end, &values[v]);
+      }
+      if (!ok) {
+        Log::Fatal("ReadTransmissionLog()", "Corrupted block in ", filename);
+      }
+      year += values[0];
+      TransmissionEvent event;
+      event.infected = infected;
+      event.infector = infector - 1;
+      event.year = static_cast<int32_t>(year);
+      event.location = static_cast<int32_t>(values[1]);
+      event.sex = static_cast<int32_t>(values[2]);
+      event.age = static_cast<int32_t>(values[3]);
+      event.transmission_type = static_cast<int32_t>(values[4]);
+      event.infector_state = static_cast<int32_t>(values[5]);
+      event.infector_sb = static_cast<int32_t>(values[6]);
+      events.push_back(event);
+    }
+  }
+  return events;
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
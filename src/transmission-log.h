@@ -0,0 +1,161 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef TRANSMISSION_LOG_H_
+#define TRANSMISSION_LOG_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "person.h"
+#include "sim-param.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+////////////////////////////////////////////////////////////////////////////////
+// Log of all HIV transmissions (who infected whom), see transmission_log. The
+// transmission sites append events to a ring buffer of the executing thread
+// without locking; a background thread drains the buffers and writes the
+// events to a binary file. The file is a TransmissionLogHeader followed by
+// blocks; each block stores the number of events and of bytes (uint32_t), and
+// the events encoded as variable-length integers, the year relative to the
+// previous event of the block.
+////////////////////////////////////////////////////////////////////////////////
+
+// Infector of a transmission with a woman simulated by another rank
+constexpr uint64_t kUnknownInfector = ~uint64_t{0};
+
+struct TransmissionEvent {
+  // Uids of the infected person and of the infector (or kUnknownInfector)
+  uint64_t infected;
+  uint64_t infector;
+  int32_t year;
+  // Location, sex and age of the infected person
+  int32_t location;
+  int32_t sex;
+  int32_t age;
+  // TransmissionType, and GemsState and sociobehaviour of the infector
+  int32_t transmission_type;
+  int32_t infector_state;
+  int32_t infector_sb;
+};
+
+struct TransmissionLogHeader {
+  static constexpr uint64_t kMagic = 0x534e52544d564948;  // "HIVMTRNS"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+};
+
+class TransmissionLog {
+ public:
+  static TransmissionLog* GetInstance() {
+    static TransmissionLog instance;
+    return &instance;
+  }
+
+  // Returns true if transmissions are logged
+  static bool IsEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Creates filename and starts logging
+  void Open(const std::string& filename);
+
+  // Writes the remaining events and stops logging
+  void Close();
+
+  // Appends event to the buffer of the calling thread. Waits for the
+  // background thread if the buffer is full.
+  void Append(const TransmissionEvent& event);
+
+  // Encodes events as a block of the file
+  static std::vector<char> EncodeBlock(
+      const std::vector<TransmissionEvent>& events);
+
+ private:
+  // Events of a single thread, written by this thread and read by the
+  // background thread
+  struct Ring {
+    static constexpr uint64_t kSize = 1 << 14;
+
+    Ring() : events(kSize) {}
+
+    std::vector<TransmissionEvent> events;
+    // Number of events appended and drained so far
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+  };
+
+  TransmissionLog() {}
+
+  // Loop of the background thread
+  void Run();
+
+  // Moves the events of all rings to events
+  void Drain(std::vector<TransmissionEvent>* events);
+
+  // Read by the agents of all threads, written by Open and Close
+  static std::atomic<bool> enabled_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+  std::string filename_;
+};
+
+// Reads all complete blocks of a transmission log
+std::vector<TransmissionEvent> ReadTransmissionLog(const std::string& filename);
+
+// Logs the infection of infected by a person with the given uid, GemsState
+// and sociobehaviour, if transmissions are logged. The transmission type is
+// the one of infected.
+inline void LogTransmission(Person* infected, uint64_t infector,
+                            int infector_state, int infector_sb) {
+  if (!TransmissionLog::IsEnabled()) {
+    return;
+  }
+  auto* sim = Simulation::GetActive();
+  int year = static_cast<int>(
+      sim->GetParam()->Get<SimParam>()->start_year +
+      sim->GetScheduler()->GetSimulatedSteps());
+  TransmissionEvent event;
+  event.infected = infected->GetUid();
+  event.infector = infector;
+  event.year = year;
+  event.location = infected->location_;
+  event.sex = infected->sex_;
+  event.age = infected->GetAge(year);
+  event.transmission_type = infected->transmission_type_;
+  event.infector_state = infector_state;
+  event.infector_sb = infector_sb;
+  TransmissionLog::GetInstance()->Append(event);
+}
+
+// Logs the infection of infected by infector, which lives on this rank
+inline void LogTransmission(Person* infected, Person* infector) {
+  if (TransmissionLog::IsEnabled()) {
+    LogTransmission(infected, infector->GetUid(), infector->state_,
+                    infector->social_behaviour_factor_);
+  }
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // TRANSMISSION_LOG_H_
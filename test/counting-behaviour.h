@@ -0,0 +1,39 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef COUNTING_BEHAVIOUR_H_
+#define COUNTING_BEHAVIOUR_H_
+
+#include "biodynamo.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Behaviour that only counts how often it was run, for the tests of the
+// operations that execute the behaviours
+struct CountingBehaviour : public Behavior {
+  BDM_BEHAVIOR_HEADER(CountingBehaviour, Behavior, 1);
+
+  CountingBehaviour() {}
+
+  void Run(Agent* agent) override {
+#pragma omp atomic
+    no_runs_++;
+  }
+
+  int no_runs_ = 0;
+};
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // COUNTING_BEHAVIOUR_H_
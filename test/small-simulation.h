@@ -0,0 +1,93 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef SMALL_SIMULATION_H_
+#define SMALL_SIMULATION_H_
+
+#include <omp.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "analyze.h"
+#include "bdm-simulation.h"
+#include "biodynamo.h"
+#include "sim-param.h"
+
+namespace bdm {
+namespace hiv_malawi {
+
+////////////////////////////////////////////////////////////////////////////////
+// Complete simulations of a small population for the tests that compare the
+// results of several simulations
+////////////////////////////////////////////////////////////////////////////////
+
+// Values of the collectors of a simulation by id
+using CollectedSeries = std::map<std::string, std::vector<double>>;
+
+// Executes the simulations of its lifetime with a single thread, such that
+// their results only depend on their random seed
+class SingleThread {
+ public:
+  SingleThread() : max_threads_(omp_get_max_threads()) {
+    omp_set_num_threads(1);
+  }
+  ~SingleThread() { omp_set_num_threads(max_threads_); }
+
+ private:
+  int max_threads_;
+};
+
+// Parameters of the small simulations: 2000 persons and 10 iterations, without
+// plots
+inline void SetSmallSimulationParam(Param* param) {
+  param->random_seed = 4357;
+  param->statistics = false;
+  auto* sparam = param->Get<SimParam>();
+  sparam->initial_population_size = 2000;
+  sparam->number_of_iterations = 10;
+  sparam->plot_time_series = false;
+}
+
+// Returns the values of the collectors of the active simulation
+inline CollectedSeries GetCollectedSeries() {
+  auto* ts = Simulation::GetActive()->GetTimeSeries();
+  CollectedSeries series;
+  for (const auto& id : GetCollectorIds()) {
+    series[id] = ts->GetYValues(id);
+  }
+  return series;
+}
+
+// Sets up a simulation with SetSmallSimulationParam, followed by set_param,
+// and simulates no_steps iterations. The population is restored from
+// fork_state if it is not nullptr (see SetUpSimulation). Returns the values
+// of the collectors, including those restored from a checkpoint.
+inline CollectedSeries SimulateSmallPopulation(
+    const std::string& name, uint64_t no_steps,
+    const std::function<void(Param*)>& set_param = [](Param*) {},
+    const std::string* fork_state = nullptr) {
+  Simulation simulation(name, [&](Param* param) {
+    SetSmallSimulationParam(param);
+    set_param(param);
+  });
+  auto* cost_aware_behaviours = SetUpSimulation(&simulation, fork_state);
+  simulation.GetScheduler()->Simulate(no_steps);
+  FinishSimulation(cost_aware_behaviours);
+  return GetCollectedSeries();
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
+
+#endif  // SMALL_SIMULATION_H_
@@ -11,9 +11,15 @@
 // -----------------------------------------------------------------------------
 
 #include <gtest/gtest.h>
+#include "district-ranks.h"
 
 int main(int argc, char** argv) {
   ::testing::FLAGS_gtest_death_test_style = "threadsafe";
   ::testing::InitGoogleTest(&argc, argv);
-  return RUN_ALL_TESTS();
+  // Start MPI if the tests were launched with mpirun
+  auto* ranks = bdm::hiv_malawi::DistrictRanks::GetInstance();
+  ranks->Init();
+  int result = RUN_ALL_TESTS();
+  ranks->Finalize();
+  return result;
 }
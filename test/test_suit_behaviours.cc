@@ -0,0 +1,286 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2021 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <omp.h>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "bdm-simulation.h"
+#include "biodynamo.h"
+#include "counting-behaviour.h"
+#include "custom-operations.h"
+#include "person-behavior.h"
+#include "person.h"
+#include "sim-param.h"
+#include "small-simulation.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test that behaviours are only attached inside their sex and age windows
+TEST(BehaviourTest, ActivationWindows) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME);
+  const auto* sparam = simulation.GetParam()->Get<SimParam>();
+  int year = sparam->start_year;
+
+  // Boy: only RandomMigration and GetOlder
+  auto male = Person();
+  male.sex_ = Sex::kMale;
+  male.SetAge(10, year);
+  AttachBehaviours(&male, GetBehaviourWindows(&male, year, sparam));
+  EXPECT_EQ(male.active_behaviours_, 0);
+  EXPECT_EQ(male.GetAllBehaviors().size(), 2u);
+
+  // Adult man: all male behaviours
+  male.SetAge(20, year);
+  int windows = GetBehaviourWindows(&male, year, sparam);
+  EXPECT_EQ(windows, BehaviourWindow::kMatingWindow |
+                         BehaviourWindow::kRegularMatingWindow |
+                         BehaviourWindow::kRegularPartnershipWindow);
+  AttachBehaviours(&male, windows);
+  EXPECT_EQ(male.active_behaviours_, windows);
+  EXPECT_EQ(male.GetAllBehaviors().size(), 5u);
+
+  // Older man: only regular partnerships can still change
+  male.SetAge(sparam->max_age + 1, year);
+  windows = GetBehaviourWindows(&male, year, sparam);
+  EXPECT_EQ(windows, BehaviourWindow::kRegularPartnershipWindow);
+  AttachBehaviours(&male, windows);
+  EXPECT_EQ(male.GetAllBehaviors().size(), 3u);
+
+  // Woman: GiveBirth from min_age until max_age_birth (excluded)
+  auto female = Person();
+  female.sex_ = Sex::kFemale;
+  female.SetAge(sparam->min_age, year);
+  EXPECT_EQ(GetBehaviourWindows(&female, year, sparam),
+            BehaviourWindow::kGiveBirthWindow);
+  female.SetAge(sparam->max_age_birth, year);
+  EXPECT_EQ(GetBehaviourWindows(&female, year, sparam), 0);
+}
+
+// Test the sampling of skipped casual contacts and of multinomial allocations
+TEST(BehaviourTest, SkippedContacts) {
+  Simulation simulation(TEST_NAME);
+  auto* random = simulation.GetRandom();
+
+  MatingBehaviour mating;
+  // No infected women: all contacts are skipped
+  EXPECT_EQ(mating.SampleNoSkippedContacts(0.5, 0.0, 10), 10);
+  // Only infected women: no contact is skipped
+  EXPECT_EQ(mating.SampleNoSkippedContacts(0.5, 1.0, 10), 0);
+  // Geometric distribution: P(no_skipped >= k) = (1-p)^k
+  EXPECT_EQ(mating.SampleNoSkippedContacts(0.5, 0.5, 10), 1);
+  EXPECT_EQ(mating.SampleNoSkippedContacts(0.2, 0.5, 10), 2);
+  EXPECT_EQ(mating.SampleNoSkippedContacts(1e-9, 0.5, 10), 10);
+
+  // All draws are allocated, none to categories without weight
+  std::vector<float> weights{0.0, 0.3, 0.0, 0.7, 0.0};
+  std::vector<uint64_t> counts;
+  SampleMultinomial(random, 1000, weights, &counts);
+  EXPECT_EQ(counts.size(), weights.size());
+  EXPECT_EQ(counts[0] + counts[2] + counts[4], 0u);
+  EXPECT_EQ(counts[1] + counts[3], 1000u);
+}
+
+// Test that skipping the non-transmissive casual contacts does not change the
+// number of infected persons beyond the variation between replicates
+TEST(BehaviourTest, SkippedContactsInfections) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  const int no_replicates = 8;
+  double mean[2] = {0, 0};
+  double variance[2] = {0, 0};
+  for (int skip = 0; skip < 2; skip++) {
+    std::vector<double> infected;
+    for (int r = 0; r < no_replicates; r++) {
+      auto series = SimulateSmallPopulation(TEST_NAME, 10, [&](Param* param) {
+        param->random_seed = DeriveReplicateSeed(4357, r);
+        auto* sparam = param->Get<SimParam>();
+        sparam->initial_population_size = 5000;
+        sparam->initial_prevalence = 0.05;
+        sparam->SetInitialInfectionProbability();
+        sparam->skip_non_transmissive_casual_contacts = skip;
+      });
+      infected.push_back(series["infected_agents"].back());
+    }
+    for (double value : infected) {
+      mean[skip] += value / no_replicates;
+    }
+    for (double value : infected) {
+      variance[skip] +=
+          (value - mean[skip]) * (value - mean[skip]) / (no_replicates - 1);
+    }
+  }
+  EXPECT_GT(mean[0], 0);
+  // Difference of the means within 4 standard errors
+  double standard_error =
+      std::sqrt((variance[0] + variance[1]) / no_replicates);
+  EXPECT_NEAR(mean[1], mean[0], 4 * standard_error + 1);
+}
+
+// Test that district-partitioned execution, where the mates of other districts
+// are drawn from the index by HIV state, simulates all persons and infections
+TEST(BehaviourTest, DistrictPartitionedExecution) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  for (bool skip : {false, true}) {
+    auto series = SimulateSmallPopulation(TEST_NAME, 10, [&](Param* param) {
+      auto* sparam = param->Get<SimParam>();
+      sparam->district_partitioned_execution = true;
+      sparam->skip_non_transmissive_casual_contacts = skip;
+    });
+    ASSERT_EQ(series["infected_agents"].size(), 10u);
+    EXPECT_GT(series["infected_agents"].back(), 0);
+    EXPECT_GT(series["healthy_agents"].back(), 0);
+  }
+}
+
+// Test that the skipped casual contacts are all attributed to women, both with
+// one draw per contact and with one draw per woman
+TEST(BehaviourTest, DistributeSkippedContacts) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  Simulation simulation(TEST_NAME, [](Param* param) {
+    SetSmallSimulationParam(param);
+    param->Get<SimParam>()->skip_non_transmissive_casual_contacts = true;
+  });
+  SetUpSimulation(&simulation, nullptr);
+  simulation.GetScheduler()->Simulate(1);
+  auto* rm = simulation.GetResourceManager();
+  auto* env =
+      bdm_static_cast<CategoricalEnvironment*>(simulation.GetEnvironment());
+  size_t male_category = env->ComputeCompoundIndex(0, 1, 0);
+
+  // Fewer contacts than women per category, then more
+  for (uint64_t no_contacts : {5, 100000}) {
+    rm->ForEachAgent([](Agent* agent) {
+      bdm_static_cast<Person*>(agent)->ResetCasualPartners();
+    });
+    env->AddSkippedCasualContacts(male_category, no_contacts);
+    env->DistributeSkippedCasualContacts();
+    uint64_t no_female_partners = 0;
+    uint64_t no_male_partners = 0;
+    rm->ForEachAgent([&](Agent* agent) {
+      auto* person = bdm_static_cast<Person*>(agent);
+      if (person->IsFemale()) {
+        no_female_partners += person->no_casual_partners_;
+      } else {
+        no_male_partners += person->no_casual_partners_;
+      }
+    });
+    EXPECT_EQ(no_female_partners, no_contacts);
+    EXPECT_EQ(no_male_partners, 0u);
+  }
+}
+
+// Adds no_persons persons to the active simulation. Every 100th person has
+// 1000 behaviours, the last one has 50000, and all others have a single one,
+// such that a few agents dominate the cost of the iteration.
+static void AddSkewedPopulation(int no_persons) {
+  auto* rm = Simulation::GetActive()->GetResourceManager();
+  for (int i = 0; i < no_persons; i++) {
+    auto* person = new Person();
+    int no_behaviours = 1;
+    if (i == no_persons - 1) {
+      no_behaviours = 50000;
+    } else if (i % 100 == 0) {
+      no_behaviours = 1000;
+    }
+    for (int b = 0; b < no_behaviours; b++) {
+      person->AddBehavior(new CountingBehaviour());
+    }
+    rm->AddAgent(person);
+  }
+}
+
+// Test that the cost-aware execution runs each behaviour of each agent exactly
+// once per iteration, with one and with several threads, although the costs
+// of the agents are heavily skewed
+TEST(BehaviourTest, CostAwareExecution) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  int max_threads = omp_get_max_threads();
+  for (int no_threads : {1, 4}) {
+    omp_set_num_threads(no_threads);
+    Simulation simulation(TEST_NAME);
+    AddSkewedPopulation(10000);
+    auto* behaviour_op = simulation.GetScheduler()->GetOps("behavior")[0];
+    CostAwareBehaviourExecution execution(behaviour_op);
+    for (int iteration = 1; iteration <= 2; iteration++) {
+      execution();
+      uint64_t no_behaviours = 0;
+      uint64_t no_wrong_runs = 0;
+      simulation.GetResourceManager()->ForEachAgent([&](Agent* agent) {
+        for (auto* behaviour : agent->GetAllBehaviors()) {
+          no_behaviours++;
+          if (bdm_static_cast<CountingBehaviour*>(behaviour)->no_runs_ !=
+              iteration) {
+            no_wrong_runs++;
+          }
+        }
+      });
+      EXPECT_EQ(no_behaviours, 100u * 1000 + 9899u + 50000u);
+      EXPECT_EQ(no_wrong_runs, 0u);
+    }
+  }
+  omp_set_num_threads(max_threads);
+}
+
+// Test that the busy-time report has one line per thread, with a busy time
+// that does not exceed the total time of the operation
+TEST(BehaviourTest, BusyTimeReport) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  int max_threads = omp_get_max_threads();
+  const int no_threads = 3;
+  omp_set_num_threads(no_threads);
+  Simulation simulation(TEST_NAME);
+  AddSkewedPopulation(1000);
+  CostAwareBehaviourExecution execution(
+      simulation.GetScheduler()->GetOps("behavior")[0]);
+  execution();
+  execution();
+
+  std::ostringstream report;
+  auto* cout_buffer = std::cout.rdbuf(report.rdbuf());
+  execution.PrintBusyTimeReport();
+  std::cout.rdbuf(cout_buffer);
+  omp_set_num_threads(max_threads);
+
+  std::istringstream lines(report.str());
+  std::string line;
+  ASSERT_TRUE(static_cast<bool>(std::getline(lines, line)));
+  EXPECT_EQ(line.find("Busy time per thread"), 0u);
+  int no_thread_lines = 0;
+  while (std::getline(lines, line)) {
+    EXPECT_NE(line.find("thread"), std::string::npos);
+    // Share of the total time, between the parentheses
+    auto begin = line.find('(');
+    auto end = line.find("%)");
+    ASSERT_NE(begin, std::string::npos);
+    ASSERT_NE(end, std::string::npos);
+    double share = std::stod(line.substr(begin + 1, end - begin - 1));
+    EXPECT_GE(share, 0.0);
+    EXPECT_LE(share, 100.0);
+    no_thread_lines++;
+  }
+  EXPECT_EQ(no_thread_lines, no_threads);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
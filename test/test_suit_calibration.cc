@@ -0,0 +1,231 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "biodynamo.h"
+#include "calibration.h"
+#include "sim-param.h"
+#include "small-simulation.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Simulator whose trajectory reaches the value of parameter k in the year
+// 2000 + k, compared with the targets by the CalibrationMonitor
+static void SimulateParameters(const std::vector<CalibrationTarget>& targets,
+                               CalibrationRun* run) {
+  auto* monitor = CalibrationMonitor::GetInstance();
+  monitor->Reset(true, targets, run->band);
+  for (size_t k = 0; k < run->parameters.size() && !monitor->IsRejected();
+       k++) {
+    monitor->Check({"series"}, 2000 + k, {run->parameters[k]});
+    run->steps++;
+  }
+  run->objective = monitor->GetObjective();
+  run->max_deviation = monitor->GetMaxDeviation();
+  run->accepted = monitor->IsAccepted();
+  monitor->Reset(false, {}, 1);
+}
+
+TEST(CalibrationTest, ReadTargets) {
+  const std::string filename = "calibration_targets_test.csv";
+  {
+    std::ofstream file(filename);
+    file << "series,year,value,tolerance\n";
+    file << "prevalence,2004,0.118,0.01\n";
+    file << "\n";
+    file << "incidence,2010,0.006,0.002\n";
+  }
+  auto targets = ReadCalibrationTargets(filename);
+  ASSERT_EQ(2u, targets.size());
+  EXPECT_EQ("prevalence", targets[0].series);
+  EXPECT_EQ(2004, targets[0].year);
+  EXPECT_DOUBLE_EQ(0.118, targets[0].value);
+  EXPECT_DOUBLE_EQ(0.01, targets[0].tolerance);
+  EXPECT_EQ("incidence", targets[1].series);
+  EXPECT_EQ(2010, targets[1].year);
+  std::remove(filename.c_str());
+}
+
+// Test that the derived infection probabilities follow the coefficient
+TEST(CalibrationTest, SetParameter) {
+  SimParam sparam;
+  float acute_mf = sparam.infection_probability_acute_mf;
+  float failing_mm = sparam.infection_probability_failing_mm;
+  float coef = sparam.coef_infection_probability;
+  SetCalibrationParameter(&sparam, "coef_infection_probability", 2 * coef);
+  EXPECT_FLOAT_EQ(2 * coef, sparam.coef_infection_probability);
+  EXPECT_FLOAT_EQ(2 * acute_mf, sparam.infection_probability_acute_mf);
+  EXPECT_FLOAT_EQ(2 * failing_mm, sparam.infection_probability_failing_mm);
+
+  float mean = sparam.no_mates_mean[0][1];
+  SetCalibrationParameter(&sparam, "no_mates_mean_scale", 0.5);
+  EXPECT_FLOAT_EQ(0.5 * mean, sparam.no_mates_mean[0][1]);
+
+  SetCalibrationParameter(&sparam, "sociobehav_mixing_weight", 3);
+  for (const auto& row : sparam.sociobehav_mixing_matrix) {
+    EXPECT_FLOAT_EQ(3 * row[0], row[1]);
+  }
+}
+
+// Test that a trajectory is rejected at the first target outside of the band,
+// and that targets that were not reached count as deviations of band
+TEST(CalibrationTest, Monitor) {
+  std::vector<CalibrationTarget> targets = {{"series", 2000, 0.3, 0.1},
+                                            {"series", 2001, 0.6, 0.1}};
+  CalibrationRun run;
+  run.parameters = {0.35, 0.55};
+  run.band = 1;
+  SimulateParameters(targets, &run);
+  EXPECT_TRUE(run.accepted);
+  EXPECT_NEAR(0.5, run.max_deviation, 1e-9);
+  EXPECT_NEAR(0.5, run.objective, 1e-9);
+  EXPECT_EQ(2u, run.steps);
+
+  run = CalibrationRun();
+  run.parameters = {0.6, 0.6};
+  run.band = 2;
+  SimulateParameters(targets, &run);
+  EXPECT_FALSE(run.accepted);
+  EXPECT_EQ(1u, run.steps);
+  EXPECT_NEAR(3, run.max_deviation, 1e-9);
+  EXPECT_NEAR(9 + 4, run.objective, 1e-9);
+}
+
+// Test that the searches find the parameters of the targets
+TEST(CalibrationTest, Search) {
+  std::vector<CalibrationTarget> targets = {{"series", 2000, 0.3, 0.1},
+                                            {"series", 2001, 0.6, 0.1}};
+  auto simulate = [&](CalibrationRun* run) {
+    SimulateParameters(targets, run);
+  };
+  std::vector<double> lower = {0, 0}, upper = {1, 1};
+
+  auto check_accepted = [&](const CalibrationRun& run) {
+    EXPECT_NEAR(0.3, run.parameters[0], 0.1 * run.band + 1e-9);
+    EXPECT_NEAR(0.6, run.parameters[1], 0.1 * run.band + 1e-9);
+  };
+
+  auto runs = CalibrateAbcRejection(simulate, lower, upper, 500, 42);
+  ASSERT_EQ(500u, runs.size());
+  uint64_t no_accepted = 0;
+  for (const auto& run : runs) {
+    if (run.accepted) {
+      check_accepted(run);
+      no_accepted++;
+    }
+  }
+  // The band covers 4% of the parameter space
+  EXPECT_GT(no_accepted, 5u);
+  EXPECT_LT(no_accepted, 50u);
+
+  runs = CalibrateAbcSmc(simulate, lower, upper, 100, 3, 4, 42);
+  ASSERT_EQ(300u, runs.size());
+  uint64_t no_accepted_last_round = 0;
+  for (const auto& run : runs) {
+    if (run.accepted) {
+      check_accepted(run);
+      no_accepted_last_round += run.round == 2;
+    }
+  }
+  EXPECT_NEAR(1, runs.back().band, 1e-9);
+  // The last round proposes around the accepted parameters of the previous
+  // rounds, and accepts more often than sampling from the bounds
+  EXPECT_GT(no_accepted_last_round, 8u);
+
+  runs = CalibrateNelderMead(simulate, lower, upper, 200, 3);
+  EXPECT_LE(runs.size(), 200u);
+  double best = runs[0].objective;
+  for (const auto& run : runs) {
+    best = std::min(best, run.objective);
+  }
+  EXPECT_LT(best, 1e-2);
+}
+
+TEST(CalibrationTest, RankCorrelation) {
+  EXPECT_DOUBLE_EQ(1, RankCorrelation({1, 5, 2, 9}, {10, 30, 20, 1000}));
+  EXPECT_DOUBLE_EQ(-1, RankCorrelation({1, 2, 3}, {3, 2, 1}));
+  EXPECT_NEAR(0.8, RankCorrelation({1, 2, 3, 4}, {1, 3, 2, 4}), 1e-12);
+  EXPECT_TRUE(std::isnan(RankCorrelation({1, 1, 1}, {1, 2, 3})));
+}
+
+// Test that successive halving promotes the best half of each level to the
+// next population size and records the levels
+TEST(CalibrationTest, SuccessiveHalving) {
+  std::vector<CalibrationTarget> targets = {{"series", 2000, 0.3, 0.1},
+                                            {"series", 2001, 0.6, 0.1}};
+  std::vector<uint64_t> sizes;
+  auto simulate = [&](CalibrationRun* run) {
+    sizes.push_back(run->population_size);
+    SimulateParameters(targets, run);
+    run->runtime = 1e-6 * run->population_size;
+  };
+  std::vector<CalibrationLevel> levels;
+  auto runs = CalibrateSuccessiveHalving(simulate, {0, 0}, {1, 1}, 16,
+                                         {10, 100, 1000}, 0.5, 3, 42, &levels);
+  ASSERT_EQ(28u, runs.size());
+  ASSERT_EQ(3u, levels.size());
+  EXPECT_EQ(16u, levels[0].candidates);
+  EXPECT_EQ(8u, levels[0].promoted);
+  EXPECT_EQ(8u, levels[1].candidates);
+  EXPECT_EQ(4u, levels[1].promoted);
+  EXPECT_EQ(4u, levels[2].candidates);
+  EXPECT_EQ(0u, levels[2].promoted);
+  EXPECT_EQ(1000u, levels[2].population_size);
+  EXPECT_NEAR(4e-3, levels[2].runtime, 1e-12);
+  EXPECT_TRUE(std::isnan(levels[0].rank_correlation));
+  // The objectives do not depend on the population size in this test
+  EXPECT_DOUBLE_EQ(1, levels[1].rank_correlation);
+  EXPECT_EQ(10u, sizes.front());
+  EXPECT_EQ(1000u, sizes.back());
+
+  // The last level simulates the best candidates of the first one
+  double best = runs[0].objective;
+  for (size_t i = 0; i < 16; i++) {
+    best = std::min(best, runs[i].objective);
+  }
+  for (size_t i = 24; i < 28; i++) {
+    EXPECT_LE(best, runs[i].objective);
+  }
+  EXPECT_DOUBLE_EQ(best, std::min({runs[24].objective, runs[25].objective,
+                                   runs[26].objective, runs[27].objective}));
+}
+
+// Test that a candidate simulated after another one draws the same random
+// numbers as when it is simulated first (common random numbers)
+TEST(CalibrationTest, CommonRandomNumbers) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  SingleThread single_thread;
+  auto set_candidate = [](double coef) {
+    return [=](Param* param) {
+      auto* sparam = param->Get<SimParam>();
+      sparam->fast_bernoulli = true;
+      SetCalibrationParameter(sparam, "coef_infection_probability", coef);
+    };
+  };
+  auto first = SimulateSmallPopulation(TEST_NAME, 10, set_candidate(1));
+  SimulateSmallPopulation(TEST_NAME, 10, set_candidate(3));
+  auto again = SimulateSmallPopulation(TEST_NAME, 10, set_candidate(1));
+  EXPECT_EQ(first, again);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,237 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+#include "biodynamo.h"
+#include "calibration.h"
+#include "categorical-environment.h"
+#include "checkpoint.h"
+#include "person.h"
+#include "sim-param.h"
+#include "small-simulation.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test that a simulation restarted from a checkpoint continues in the next
+// year with the population of the checkpoint
+TEST(CheckpointTest, SaveAndLoad) {
+  const std::string filename = "checkpoint_test.bin";
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  int start_year;
+  uint64_t no_iterations;
+  {
+    Simulation simulation(TEST_NAME);
+    auto* rm = simulation.GetResourceManager();
+    const auto* sparam = simulation.GetParam()->Get<SimParam>();
+    start_year = sparam->start_year;
+    no_iterations = sparam->number_of_iterations;
+    simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+
+    auto* mother = new Person();
+    mother->sex_ = Sex::kFemale;
+    mother->SetAge(30, start_year);
+    mother->location_ = 0;
+    mother->state_ = GemsState::kTreated;
+    auto* child = new Person();
+    child->sex_ = Sex::kFemale;
+    child->SetAge(0, start_year + 1);
+    child->location_ = 0;
+    child->state_ = GemsState::kAcute;
+    child->transmission_type_ = TransmissionType::kMotherToChild;
+    rm->AddAgent(mother);
+    rm->AddAgent(child);
+    mother->AddChild(child->GetAgentPtr<Person>());
+    child->mother_ = mother->GetAgentPtr<Person>();
+
+    // Checkpoint at the end of the first iteration
+    ASSERT_TRUE(SaveCheckpoint(filename, 1));
+  }
+
+  Simulation simulation(TEST_NAME);
+  auto* rm = simulation.GetResourceManager();
+  const auto* sparam = simulation.GetParam()->Get<SimParam>();
+  simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+  EXPECT_EQ(LoadCheckpoint(filename), 1u);
+  std::remove(filename.c_str());
+
+  EXPECT_EQ(GetRestoredSteps(), 1u);
+  EXPECT_EQ(sparam->start_year, start_year + 1);
+  EXPECT_EQ(sparam->number_of_iterations, no_iterations - 1);
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  ASSERT_EQ(persons.size(), 2u);
+  EXPECT_EQ(persons[0]->GetAge(sparam->start_year), 31);
+  EXPECT_EQ(persons[0]->state_, GemsState::kTreated);
+  EXPECT_EQ(persons[1]->GetAge(sparam->start_year), 0);
+  EXPECT_EQ(persons[1]->transmission_type_, TransmissionType::kMotherToChild);
+  ASSERT_EQ(persons[0]->GetNumberOfChildren(), 1);
+  EXPECT_EQ(persons[0]->children_[0].Get(), persons[1]);
+  EXPECT_EQ(persons[1]->mother_.Get(), persons[0]);
+}
+
+// Test that several branches can be restored from the same in-memory state,
+// as the scenarios simulated from the state at the fork year
+TEST(CheckpointTest, ForkState) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  std::string fork_state;
+  int start_year;
+  {
+    Simulation simulation(TEST_NAME);
+    auto* rm = simulation.GetResourceManager();
+    start_year = simulation.GetParam()->Get<SimParam>()->start_year;
+    simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+    auto* man = new Person();
+    man->sex_ = Sex::kMale;
+    man->SetAge(25, start_year);
+    man->location_ = 1;
+    man->state_ = GemsState::kChronic;
+    auto* woman = new Person();
+    woman->sex_ = Sex::kFemale;
+    woman->SetAge(23, start_year);
+    woman->location_ = 1;
+    woman->state_ = GemsState::kHealthy;
+    rm->AddAgent(man);
+    rm->AddAgent(woman);
+    man->SetPartner(woman->GetAgentPtr<Person>());
+
+    std::ostringstream state;
+    WriteCheckpointData(&state, 3);
+    fork_state = state.str();
+  }
+
+  for (int branch = 0; branch < 2; branch++) {
+    Simulation simulation(TEST_NAME);
+    auto* rm = simulation.GetResourceManager();
+    const auto* sparam = simulation.GetParam()->Get<SimParam>();
+    simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+    EXPECT_EQ(RestoreCheckpointData(fork_state.data(), fork_state.size(),
+                                    "the fork state"),
+              3u);
+    EXPECT_EQ(sparam->start_year, start_year + 3);
+
+    std::vector<Person*> persons;
+    rm->ForEachAgent([&](Agent* agent) {
+      persons.push_back(bdm_static_cast<Person*>(agent));
+    });
+    ASSERT_EQ(persons.size(), 2u);
+    EXPECT_EQ(persons[0]->GetAge(sparam->start_year), 28);
+    EXPECT_EQ(persons[0]->state_, GemsState::kChronic);
+    EXPECT_EQ(persons[0]->partner_.Get(), persons[1]);
+    EXPECT_EQ(persons[1]->partner_.Get(), persons[0]);
+  }
+}
+
+// Test that a simulation restarted from a checkpoint collects the same time
+// series as the uninterrupted simulation, which writes the same checkpoint
+TEST(CheckpointTest, RestartReproducesUninterrupted) {
+  const std::string filename = "checkpoint_restart_test.bin";
+  const uint64_t no_steps = 7;
+  const uint64_t checkpoint_frequency = 4;
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  SingleThread single_thread;
+  auto set_param = [&](Param* param) {
+    auto* sparam = param->Get<SimParam>();
+    sparam->sort_agents_frequency = 2;
+    sparam->checkpoint_frequency = checkpoint_frequency;
+    sparam->checkpoint_file = filename;
+  };
+  auto uninterrupted = SimulateSmallPopulation(TEST_NAME, no_steps, set_param);
+
+  SimulateSmallPopulation(TEST_NAME, checkpoint_frequency, set_param);
+  auto restarted = SimulateSmallPopulation(
+      TEST_NAME, no_steps - checkpoint_frequency, [&](Param* param) {
+        set_param(param);
+        param->Get<SimParam>()->restart_from_checkpoint = filename;
+      });
+  std::remove(filename.c_str());
+
+  ASSERT_FALSE(uninterrupted.empty());
+  EXPECT_EQ(uninterrupted.begin()->second.size(), no_steps);
+  EXPECT_EQ(uninterrupted, restarted);
+}
+
+// Test that scenarios simulated from the same fork share the history before
+// the fork, and that they only diverge because of their parameter patches
+TEST(CheckpointTest, ForkScenarios) {
+  const uint64_t burn_in_steps = 4;
+  const uint64_t no_steps = 7;
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  SingleThread single_thread;
+  auto set_param = [](Param* param) {
+    auto* sparam = param->Get<SimParam>();
+    sparam->initial_prevalence = 0.05;
+    sparam->SetInitialInfectionProbability();
+  };
+
+  // Common history until the fork
+  std::string fork_state;
+  CollectedSeries history;
+  {
+    Simulation simulation(TEST_NAME, [&](Param* param) {
+      SetSmallSimulationParam(param);
+      set_param(param);
+    });
+    SetUpSimulation(&simulation, nullptr);
+    simulation.GetScheduler()->Simulate(burn_in_steps);
+    std::ostringstream state;
+    WriteCheckpointData(&state, burn_in_steps);
+    fork_state = state.str();
+    history = GetCollectedSeries();
+  }
+
+  // The same scenario twice, and one with a higher infection probability
+  auto simulate_scenario = [&](double coef_infection_probability) {
+    return SimulateSmallPopulation(
+        TEST_NAME, no_steps - burn_in_steps,
+        [&](Param* param) {
+          set_param(param);
+          auto* sparam = param->Get<SimParam>();
+          SetCalibrationParameter(
+              sparam, "coef_infection_probability",
+              coef_infection_probability * sparam->coef_infection_probability);
+        },
+        &fork_state);
+  };
+  auto scenario = simulate_scenario(1);
+  auto repeated = simulate_scenario(1);
+  auto patched = simulate_scenario(5);
+
+  ASSERT_FALSE(history.empty());
+  for (const auto& el : history) {
+    ASSERT_EQ(el.second.size(), burn_in_steps);
+    for (const auto* branch : {&scenario, &patched}) {
+      const auto& values = branch->at(el.first);
+      ASSERT_EQ(values.size(), no_steps);
+      EXPECT_EQ(std::vector<double>(values.begin(),
+                                    values.begin() + burn_in_steps),
+                el.second);
+    }
+  }
+  EXPECT_EQ(scenario, repeated);
+  EXPECT_NE(scenario.at("infected_agents"), patched.at("infected_agents"));
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -11,10 +11,15 @@
 // -----------------------------------------------------------------------------
 
 #include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <vector>
 #include "analyze.h"
 #include "biodynamo.h"
 #include "person.h"
+#include "population-statistics.h"
 #include "sim-param.h"
+#include "small-simulation.h"
 
 #define TEST_NAME typeid(*this).name()
 
@@ -175,7 +180,490 @@ TEST(CounterTest, Infected) {
  
 }
 
+// Create a population with pseudo-random attributes, identical for each call
+static void AddRandomPopulation(ResourceManager* rm, int year) {
+  std::mt19937 generator(7);
+  auto draw = [&](int n) {
+    return std::uniform_int_distribution<int>(0, n - 1)(generator);
+  };
+  for (int i = 0; i < 500; i++) {
+    auto* person = new Person();
+    person->state_ = draw(GemsState::kGemsLast);
+    person->sex_ = draw(2);
+    person->SetAge(draw(80), year);
+    person->location_ = draw(Location::kLocLast);
+    person->social_behaviour_factor_ = draw(2);
+    person->biomedical_factor_ = draw(2);
+    person->transmission_type_ = draw(TransmissionType::kTransmissionLast);
+    person->infection_origin_state_ = draw(GemsState::kGemsLast);
+    person->infection_origin_sb_ = draw(2);
+    person->no_casual_partners_ = draw(5);
+    rm->AddAgent(person);
+  }
+}
+
+// Test that the series derived from the population histogram are identical
+// to the series of the individual collectors
+TEST(CounterTest, FusedStatistics) {
+  Param::RegisterParamGroup(new SimParam());
+  std::vector<std::vector<double>> values[2];
+  for (int fused = 0; fused < 2; fused++) {
+    Simulation simulation(TEST_NAME, [&](Param* param) {
+      param->Get<SimParam>()->fused_statistics = fused;
+    });
+    int year = simulation.GetParam()->Get<SimParam>()->start_year;
+    AddRandomPopulation(simulation.GetResourceManager(), year);
+    simulation.SetEnvironment(new EmptyEnvironment());
+    DefineAndRegisterCollectors();
+
+    auto* scheduler = simulation.GetScheduler();
+    scheduler->UnscheduleOp(scheduler->GetOps("load balancing")[0]);
+    scheduler->Simulate(1);
+
+    auto* ts = simulation.GetTimeSeries();
+    AddDerivedSeries(ts);
+    for (const auto& id : GetCollectorIds()) {
+      values[fused].push_back(ts->GetYValues(id));
+    }
+    for (const auto& id : GetDerivedSeriesIds()) {
+      values[fused].push_back(ts->GetYValues(id));
+    }
+  }
+
+  ASSERT_EQ(values[0].size(), 96u);
+  ASSERT_EQ(values[1].size(), values[0].size());
+  for (size_t i = 0; i < values[0].size(); i++) {
+    ASSERT_EQ(values[1][i].size(), 1u);
+    ASSERT_EQ(values[0][i].size(), 1u);
+    if (std::isnan(values[0][i][0])) {
+      EXPECT_TRUE(std::isnan(values[1][i][0]));
+    } else {
+      EXPECT_EQ(values[1][i][0], values[0][i][0]);
+    }
+  }
+}
+
+// Test that the derived series are computed from the collected series
+TEST(CounterTest, DerivedSeries) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME);
+  int year = simulation.GetParam()->Get<SimParam>()->start_year;
+  AddRandomPopulation(simulation.GetResourceManager(), year);
+  simulation.SetEnvironment(new EmptyEnvironment());
+  DefineAndRegisterCollectors();
+  ASSERT_EQ(GetCollectorIds().size(), 69u);
+  ASSERT_EQ(GetDerivedSeriesIds().size(), 27u);
+
+  auto* scheduler = simulation.GetScheduler();
+  scheduler->UnscheduleOp(scheduler->GetOps("load balancing")[0]);
+  scheduler->Simulate(2);
+
+  auto* ts = simulation.GetTimeSeries();
+  AddDerivedSeries(ts);
+  const auto& x_values = ts->GetXValues("prevalence");
+  const auto& prevalence = ts->GetYValues("prevalence");
+  const auto& infected = ts->GetYValues("infected_agents");
+  const auto& healthy = ts->GetYValues("healthy_agents");
+  const auto& mean_nocas = ts->GetYValues("mean_nocas_men_low_sb");
+  const auto& total_nocas = ts->GetYValues("total_nocas_men_low_sb");
+  const auto& men = ts->GetYValues("adult_male_age_lt50_low_sb");
+  ASSERT_EQ(x_values.size(), 2u);
+  ASSERT_EQ(prevalence.size(), 2u);
+  ASSERT_EQ(mean_nocas.size(), 2u);
+  for (size_t i = 0; i < 2; i++) {
+    EXPECT_EQ(x_values[i], year + i);
+    EXPECT_EQ(infected[i] + healthy[i], 500);
+    EXPECT_EQ(prevalence[i], infected[i] / 500);
+    EXPECT_EQ(mean_nocas[i], total_nocas[i] / men[i]);
+  }
+}
 
+// Test the selection of the iterations in which the collectors are evaluated
+TEST(CounterTest, CollectionIterations) {
+  SimParam sparam;
+  EXPECT_TRUE(IsCollectionIteration(&sparam, 0, 1975));
+  EXPECT_TRUE(IsCollectionIteration(&sparam, 1, 1976));
+  sparam.collection_interval = 5;
+  EXPECT_TRUE(IsCollectionIteration(&sparam, 0, 1975));
+  EXPECT_FALSE(IsCollectionIteration(&sparam, 4, 1979));
+  EXPECT_TRUE(IsCollectionIteration(&sparam, 10, 1985));
+  // The years take precedence over the interval
+  sparam.collection_years = {1992, 2004, 2010};
+  EXPECT_FALSE(IsCollectionIteration(&sparam, 0, 1975));
+  EXPECT_TRUE(IsCollectionIteration(&sparam, 17, 1992));
+  EXPECT_FALSE(IsCollectionIteration(&sparam, 18, 1993));
+  EXPECT_TRUE(IsCollectionIteration(&sparam, 35, 2010));
+}
+
+// Test the mean and the band of the values of an ensemble
+TEST(CounterTest, EnsembleBand) {
+  double mean, low, high;
+  ComputeEnsembleBand({3, 1, 2, 5, 4}, 0.5, &mean, &low, &high);
+  EXPECT_DOUBLE_EQ(3, mean);
+  EXPECT_DOUBLE_EQ(2, low);
+  EXPECT_DOUBLE_EQ(4, high);
+  // Interpolated between values, and bounded by the extreme values
+  ComputeEnsembleBand({0, 10}, 0.9, &mean, &low, &high);
+  EXPECT_DOUBLE_EQ(5, mean);
+  EXPECT_DOUBLE_EQ(0.5, low);
+  EXPECT_DOUBLE_EQ(9.5, high);
+  ComputeEnsembleBand({7}, 0.9, &mean, &low, &high);
+  EXPECT_DOUBLE_EQ(7, low);
+  EXPECT_DOUBLE_EQ(7, high);
+  // Values that are not finite are ignored
+  ComputeEnsembleBand({1, std::nan(""), 3}, 1, &mean, &low, &high);
+  EXPECT_DOUBLE_EQ(2, mean);
+  EXPECT_DOUBLE_EQ(1, low);
+  EXPECT_DOUBLE_EQ(3, high);
+  ComputeEnsembleBand({std::nan("")}, 0.9, &mean, &low, &high);
+  EXPECT_TRUE(std::isnan(mean));
+}
+
+// Test that the sampled statistics are exact for a sampling fraction of 1 and
+// for selections by state, sex and location, and that the estimates of a
+// smaller fraction lie within their confidence intervals
+TEST(CounterTest, SampledStatistics) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME, [&](Param* param) {
+    auto* sparam = param->Get<SimParam>();
+    sparam->sampled_statistics = true;
+    sparam->sampling_fraction = 0.5;
+    sparam->collector_sampling_fractions["all_15_49"] = 1.0;
+  });
+  auto* rm = simulation.GetResourceManager();
+  const auto* sparam = simulation.GetParam()->Get<SimParam>();
+  AddRandomPopulation(rm, sparam->start_year);
+  simulation.SetEnvironment(new EmptyEnvironment());
+  DefineAndRegisterCollectors();
+  ASSERT_TRUE(SampledStatistics::IsEnabled());
+
+  auto* scheduler = simulation.GetScheduler();
+  scheduler->UnscheduleOp(scheduler->GetOps("load balancing")[0]);
+  scheduler->Simulate(1);
+  auto* ts = simulation.GetTimeSeries();
+  EXPECT_EQ(ts->GetYValues("infected_agents")[0] +
+                ts->GetYValues("healthy_agents")[0],
+            500);
+
+  int year = sparam->start_year + scheduler->GetSimulatedSteps() + 1;
+  PopulationHistogram expected(sparam->nb_locations);
+  rm->ForEachAgent([&](Agent* agent) {
+    expected.Add(bdm_static_cast<Person*>(agent), year);
+  });
+  using H = PopulationHistogram;
+  auto* sampled = SampledStatistics::GetInstance();
+
+  H::Selection infected_women;
+  infected_women.states = H::kAll & ~H::Bin(GemsState::kHealthy);
+  infected_women.sexes = H::Bin(Sex::kFemale);
+  auto exact = sampled->Count(infected_women, 0.5);
+  EXPECT_EQ(exact.value, expected.Count(infected_women));
+  EXPECT_EQ(exact.error, 0);
+
+  H::Selection adults;
+  adults.age_bands = H::Bin(H::k15To49);
+  auto full_sample = sampled->Count(adults, 1.0);
+  EXPECT_EQ(full_sample.value, expected.Count(adults));
+  EXPECT_EQ(full_sample.error, 0);
+  auto partners = sampled->SumCasualPartners(adults, 1.0);
+  EXPECT_EQ(partners.value, expected.SumCasualPartners(adults));
+
+  auto estimate = sampled->Count(adults, 0.5);
+  EXPECT_GT(estimate.error, 0);
+  EXPECT_NEAR(estimate.value, expected.Count(adults), 2 * estimate.error);
+  estimate = sampled->SumCasualPartners(adults, 0.5);
+  EXPECT_GT(estimate.error, 0);
+  EXPECT_NEAR(estimate.value, expected.SumCasualPartners(adults),
+              2 * estimate.error);
+  SampledStatistics::GetInstance()->Reset(false, {});
+}
+
+// Test that the exact counts and the sample maintained from events match a
+// sweep after persons were infected, removed and created, also if the
+// incremental statistics are maintained at the same time
+TEST(CounterTest, SampledStatisticsFromEvents) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME, [&](Param* param) {
+    auto* sparam = param->Get<SimParam>();
+    sparam->incremental_statistics = true;
+    sparam->sampled_statistics = true;
+    sparam->sampling_fraction = 1.0;
+  });
+  auto* rm = simulation.GetResourceManager();
+  const auto* sparam = simulation.GetParam()->Get<SimParam>();
+  AddRandomPopulation(rm, sparam->start_year);
+  simulation.SetEnvironment(new EmptyEnvironment());
+  DefineAndRegisterCollectors();
+  auto* scheduler = simulation.GetScheduler();
+  scheduler->UnscheduleOp(scheduler->GetOps("load balancing")[0]);
+  scheduler->Simulate(1);
+  ASSERT_TRUE(SampledStatistics::IsEnabled());
+  ASSERT_TRUE(IncrementalStatistics::IsEnabled());
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  int year = sparam->start_year + scheduler->GetSimulatedSteps() + 1;
+  for (size_t i = 0; i < persons.size(); i++) {
+    auto* person = persons[i];
+    if (i % 10 == 0) {
+      RemoveFromStatistics(person);
+      rm->RemoveAgent(person->GetUid());
+      continue;
+    }
+    if (i % 3 == 0 && person->IsHealthy()) {
+      person->state_ = GemsState::kAcute;
+    }
+    person->no_casual_partners_ = person->no_casual_partners_ + 1;
+    AddCasualPartnersToStatistics(person, 1);
+    UpdateStatistics(person);
+  }
+  for (int i = 0; i < 20; i++) {
+    auto* child = new Person();
+    child->state_ = GemsState::kHealthy;
+    child->sex_ = i % 2;
+    child->SetAge(0, year);
+    child->location_ = i % Location::kLocLast;
+    child->social_behaviour_factor_ = 0;
+    child->biomedical_factor_ = 0;
+    child->transmission_type_ = TransmissionType::kMotherToChild;
+    rm->AddAgent(child);
+    UpdateStatistics(child);
+  }
+
+  PopulationHistogram expected(sparam->nb_locations);
+  rm->ForEachAgent([&](Agent* agent) {
+    expected.Add(bdm_static_cast<Person*>(agent), year);
+  });
+  using H = PopulationHistogram;
+  auto* sampled = SampledStatistics::GetInstance();
+  H::Selection all;
+  EXPECT_EQ(sampled->Count(all, 1.0).value, 470);
+  H::Selection infected_men;
+  infected_men.states = H::kAll & ~H::Bin(GemsState::kHealthy);
+  infected_men.sexes = H::Bin(Sex::kMale);
+  EXPECT_EQ(sampled->Count(infected_men, 1.0).value,
+            expected.Count(infected_men));
+
+  // With fraction 1, the sample contains all persons
+  H::Selection adults;
+  adults.age_bands = H::Bin(H::k15To49);
+  auto estimate = sampled->Count(adults, 1.0);
+  EXPECT_DOUBLE_EQ(estimate.value, expected.Count(adults));
+  EXPECT_EQ(estimate.error, 0);
+  estimate = sampled->SumCasualPartners(adults, 1.0);
+  EXPECT_DOUBLE_EQ(estimate.value, expected.SumCasualPartners(adults));
+  SampledStatistics::GetInstance()->Reset(false, {});
+  IncrementalStatistics::GetInstance()->Reset(false);
+}
+
+// Test that the histogram maintained from events matches a sweep over the
+// population after persons were infected, removed and created
+TEST(CounterTest, IncrementalStatistics) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME, [&](Param* param) {
+    param->Get<SimParam>()->incremental_statistics = true;
+  });
+  auto* rm = simulation.GetResourceManager();
+  const auto* sparam = simulation.GetParam()->Get<SimParam>();
+  AddRandomPopulation(rm, sparam->start_year);
+  simulation.SetEnvironment(new EmptyEnvironment());
+  DefineAndRegisterCollectors();
+
+  // The initial population is counted by a sweep in the first iteration
+  auto* scheduler = simulation.GetScheduler();
+  scheduler->UnscheduleOp(scheduler->GetOps("load balancing")[0]);
+  scheduler->Simulate(1);
+  ASSERT_TRUE(IncrementalStatistics::IsEnabled());
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  ASSERT_EQ(persons.size(), 500u);
+  int year = sparam->start_year + scheduler->GetSimulatedSteps() + 1;
+  for (size_t i = 0; i < persons.size(); i++) {
+    auto* person = persons[i];
+    if (i % 10 == 0) {
+      RemoveFromStatistics(person);
+      // Later updates of a removed person are ignored
+      UpdateStatistics(person);
+      rm->RemoveAgent(person->GetUid());
+      continue;
+    }
+    if (i % 3 == 0 && person->IsHealthy()) {
+      person->state_ = GemsState::kAcute;
+      person->transmission_type_ = TransmissionType::kCasualPartner;
+      person->infection_origin_state_ = GemsState::kChronic;
+      person->infection_origin_sb_ = 1;
+      UpdateStatistics(person);
+    }
+    // A casual contact, which is counted in the bin of the person
+    person->no_casual_partners_ = person->no_casual_partners_ + 1;
+    AddCasualPartnersToStatistics(person, 1);
+    // Persons whose bins did not change are left unchanged by an update
+    if (i % 7 == 0) {
+      UpdateStatistics(person);
+    }
+  }
+  for (int i = 0; i < 20; i++) {
+    auto* child = new Person();
+    child->state_ = GemsState::kHealthy;
+    child->sex_ = i % 2;
+    child->SetAge(0, year);
+    child->location_ = i % Location::kLocLast;
+    child->social_behaviour_factor_ = 0;
+    child->biomedical_factor_ = 0;
+    child->transmission_type_ = TransmissionType::kMotherToChild;
+    rm->AddAgent(child);
+    UpdateStatistics(child);
+  }
+
+  PopulationHistogram expected(sparam->nb_locations);
+  rm->ForEachAgent([&](Agent* agent) {
+    expected.Add(bdm_static_cast<Person*>(agent), year);
+  });
+  const auto& histogram = GetPopulationHistogram();
+  using H = PopulationHistogram;
+  H::Selection all;
+  EXPECT_EQ(histogram.Count(all), 470);
+  EXPECT_EQ(histogram.Count(all), expected.Count(all));
+  EXPECT_EQ(histogram.SumCasualPartners(all), expected.SumCasualPartners(all));
+  EXPECT_EQ(histogram.CountAcuteByOrigin(-1, -1),
+            expected.CountAcuteByOrigin(-1, -1));
+  for (int state = 0; state < H::kNoStates; state++) {
+    for (int band = 0; band < H::kNoAgeBands; band++) {
+      for (int location = 0; location < sparam->nb_locations; location++) {
+        H::Selection selection;
+        selection.states = H::Bin(state);
+        selection.age_bands = H::Bin(band);
+        selection.location = location;
+        EXPECT_EQ(histogram.Count(selection), expected.Count(selection));
+        EXPECT_EQ(histogram.SumCasualPartners(selection),
+                  expected.SumCasualPartners(selection));
+      }
+    }
+  }
+
+  // The sums of casual partners restart at the beginning of each iteration
+  rm->ForEachAgent([&](Agent* agent) {
+    bdm_static_cast<Person*>(agent)->ResetCasualPartners();
+  });
+  IncrementalStatistics::GetInstance()->ResetCasualPartners();
+  EXPECT_EQ(histogram.SumCasualPartners(all), 0);
+  EXPECT_EQ(histogram.Count(all), 470);
+  IncrementalStatistics::GetInstance()->Reset(false);
+}
+
+// Test that the histogram matches a sweep after several threads updated the
+// same persons concurrently, as the relatives of persons in different threads
+TEST(CounterTest, IncrementalStatisticsParallel) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME, [&](Param* param) {
+    param->Get<SimParam>()->incremental_statistics = true;
+  });
+  auto* rm = simulation.GetResourceManager();
+  const auto* sparam = simulation.GetParam()->Get<SimParam>();
+  AddRandomPopulation(rm, sparam->start_year);
+  simulation.SetEnvironment(new EmptyEnvironment());
+  DefineAndRegisterCollectors();
+  auto* scheduler = simulation.GetScheduler();
+  scheduler->UnscheduleOp(scheduler->GetOps("load balancing")[0]);
+  scheduler->Simulate(1);
+  ASSERT_TRUE(IncrementalStatistics::IsEnabled());
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  // Each iteration changes and updates a person and its neighbours, which
+  // other threads change at the same time
+  const int no_updates = 200000;
+  int no_persons = static_cast<int>(persons.size());
+#pragma omp parallel for schedule(static, 1)
+  for (int i = 0; i < no_updates; i++) {
+    for (int j = 0; j < 3; j++) {
+      auto* person = persons[(i + j) % no_persons];
+      person->state_ =
+          (i / no_persons) % 2 == 0 ? GemsState::kAcute : GemsState::kHealthy;
+      UpdateStatistics(person);
+    }
+  }
+  // Casual contacts of the same persons in several threads at once
+#pragma omp parallel for schedule(static, 1)
+  for (int i = 0; i < no_updates; i++) {
+    for (int j = 0; j < 3; j++) {
+      auto* person = persons[(i + j) % no_persons];
+      __atomic_add_fetch(&person->no_casual_partners_, 1, __ATOMIC_RELAXED);
+      AddCasualPartnersToStatistics(person, 1);
+    }
+  }
+
+  int year = sparam->start_year + scheduler->GetSimulatedSteps() + 1;
+  PopulationHistogram expected(sparam->nb_locations);
+  rm->ForEachAgent([&](Agent* agent) {
+    expected.Add(bdm_static_cast<Person*>(agent), year);
+  });
+  const auto& histogram = GetPopulationHistogram();
+  using H = PopulationHistogram;
+  H::Selection all;
+  EXPECT_EQ(histogram.Count(all), expected.Count(all));
+  EXPECT_EQ(histogram.SumCasualPartners(all), expected.SumCasualPartners(all));
+  for (int state = 0; state < H::kNoStates; state++) {
+    H::Selection selection;
+    selection.states = H::Bin(state);
+    EXPECT_EQ(histogram.Count(selection), expected.Count(selection));
+    EXPECT_EQ(histogram.SumCasualPartners(selection),
+              expected.SumCasualPartners(selection));
+  }
+  IncrementalStatistics::GetInstance()->Reset(false);
+}
+
+// Test that the histogram maintained from the events of the behaviours yields
+// the same series as a sweep over the population in each iteration
+TEST(CounterTest, IncrementalStatisticsSimulation) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  SingleThread single_thread;
+  auto incremental = SimulateSmallPopulation(TEST_NAME, 10, [](Param* param) {
+    param->Get<SimParam>()->incremental_statistics = true;
+  });
+  // The second simulation disables the incremental statistics again
+  auto swept = SimulateSmallPopulation(TEST_NAME, 10, [](Param* param) {
+    param->Get<SimParam>()->fused_statistics = true;
+  });
+  ASSERT_EQ(swept.size(), incremental.size());
+  for (const auto& el : swept) {
+    EXPECT_EQ(el.second, incremental[el.first]);
+  }
+}
+
+// Test that the sampled statistics, whose cells are only updated by the events
+// that change the HIV state, the sex or the location, are exact with a
+// sampling fraction of 1
+TEST(CounterTest, SampledStatisticsSimulation) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  SingleThread single_thread;
+  auto sampled = SimulateSmallPopulation(TEST_NAME, 10, [](Param* param) {
+    auto* sparam = param->Get<SimParam>();
+    sparam->sampled_statistics = true;
+    sparam->sampling_fraction = 1.0;
+  });
+  // The second simulation disables the sampled statistics again
+  auto swept = SimulateSmallPopulation(TEST_NAME, 10, [](Param* param) {
+    param->Get<SimParam>()->fused_statistics = true;
+  });
+  ASSERT_EQ(swept.size(), sampled.size());
+  for (const auto& el : swept) {
+    const auto& values = sampled[el.first];
+    ASSERT_EQ(el.second.size(), values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      EXPECT_NEAR(values[i], el.second[i], 1e-9 * (1 + el.second[i]));
+    }
+  }
+}
 
 }  // namespace hiv_malawi
 }  // namespace bdm
@@ -0,0 +1,136 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+// These tests run with any number of processes, e.g.
+// mpirun -np 2 ./hiv_malawi-test --gtest_filter=DistributedTest.*
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "bdm-simulation.h"
+#include "district-ranks.h"
+#include "small-simulation.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test that the districts are split into contiguous blocks of similar weight
+TEST(DistributedTest, Partition) {
+  auto* ranks = DistrictRanks::GetInstance();
+  int no_ranks = ranks->GetNoRanks();
+  std::vector<float> weights(28, 1.0);
+  ranks->Partition(weights);
+
+  std::vector<int> no_locations(no_ranks, 0);
+  for (size_t l = 0; l < weights.size(); l++) {
+    int owner = ranks->GetOwner(l);
+    ASSERT_GE(owner, 0);
+    ASSERT_LT(owner, no_ranks);
+    if (l > 0) {
+      EXPECT_GE(owner, ranks->GetOwner(l - 1));
+    }
+    no_locations[owner]++;
+  }
+  for (int r = 0; r < no_ranks; r++) {
+    EXPECT_NEAR(no_locations[r], 28.0 / no_ranks, 1.0);
+  }
+
+  // A single heavy location forms its own block
+  weights.assign(4, 1.0);
+  weights[0] = 3.0;
+  ranks->Partition(weights);
+  EXPECT_EQ(ranks->GetOwner(0), 0);
+  if (no_ranks == 2) {
+    EXPECT_EQ(ranks->GetOwner(1), 1);
+  }
+}
+
+// Test that the counts are summed over all ranks
+TEST(DistributedTest, AllreduceSum) {
+  auto* ranks = DistrictRanks::GetInstance();
+  int no_ranks = ranks->GetNoRanks();
+  std::vector<uint64_t> values{1, static_cast<uint64_t>(ranks->GetRank())};
+  ranks->AllreduceSum(&values);
+  EXPECT_EQ(values[0], static_cast<uint64_t>(no_ranks));
+  EXPECT_EQ(values[1], static_cast<uint64_t>(no_ranks * (no_ranks - 1) / 2));
+}
+
+// Test that each rank receives the elements sent to it, in rank order
+TEST(DistributedTest, Exchange) {
+  auto* ranks = DistrictRanks::GetInstance();
+  int no_ranks = ranks->GetNoRanks();
+  int rank = ranks->GetRank();
+  std::vector<std::vector<int>> send(no_ranks);
+  for (int r = 0; r < no_ranks; r++) {
+    // Rank r receives r + 1 elements from each rank
+    send[r].assign(r + 1, 100 * rank + r);
+  }
+  std::vector<int> received;
+  ranks->Exchange(&send, &received);
+  for (const auto& el : send) {
+    EXPECT_TRUE(el.empty());
+  }
+  ASSERT_EQ(received.size(), static_cast<size_t>(no_ranks * (rank + 1)));
+  for (int r = 0; r < no_ranks; r++) {
+    for (int i = 0; i <= rank; i++) {
+      EXPECT_EQ(received[r * (rank + 1) + i], 100 * r + rank);
+    }
+  }
+}
+
+// Simulates the small population on all ranks, either distributed over the
+// ranks or on rank 0 only, and returns the global numbers of persons and of
+// infected persons at the end of the simulation
+static std::vector<uint64_t> SimulateTotals(const std::string& name,
+                                            bool distributed) {
+  auto* ranks = DistrictRanks::GetInstance();
+  SingleThread single_thread;
+  Simulation simulation(name, [&](Param* param) {
+    SetSmallSimulationParam(param);
+    param->output_dir += "/rank_" + std::to_string(ranks->GetRank());
+  });
+  const auto* sparam = simulation.GetParam()->Get<SimParam>();
+  if (distributed) {
+    PartitionDistricts(sparam);
+  } else {
+    ranks->AssignToFirstRank(sparam->location_distribution.size());
+  }
+  auto* cost_aware_behaviours = SetUpSimulation(&simulation, nullptr);
+  simulation.GetScheduler()->Simulate(sparam->number_of_iterations);
+  FinishSimulation(cost_aware_behaviours);
+  auto series = GetCollectedSeries();
+  auto healthy = static_cast<uint64_t>(series["healthy_agents"].back());
+  auto infected = static_cast<uint64_t>(series["infected_agents"].back());
+  std::vector<uint64_t> totals{healthy + infected, infected};
+  ranks->AllreduceSum(&totals);
+  return totals;
+}
+
+// Test that a distributed simulation has the same global population and
+// number of infected persons as a simulation on a single rank, within the
+// variation between two random realisations
+TEST(DistributedTest, SimulationTotals) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  auto single_rank = SimulateTotals(TEST_NAME, false);
+  auto distributed = SimulateTotals(TEST_NAME, true);
+  ASSERT_GT(single_rank[0], 0u);
+  ASSERT_GT(single_rank[1], 0u);
+  EXPECT_NEAR(distributed[0], single_rank[0], 0.1 * single_rank[0]);
+  EXPECT_NEAR(distributed[1], single_rank[1], 0.3 * single_rank[1]);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,257 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2021 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "bdm-simulation.h"
+#include "biodynamo.h"
+#include "categorical-environment.h"
+#include "custom-operations.h"
+#include "person.h"
+#include "sim-param.h"
+#include "small-simulation.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test that SortAgents orders the agents by location and keeps the partners
+// pointing at each other
+TEST(EnvironmentTest, SortAgents) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  Simulation simulation(TEST_NAME);
+  auto* rm = simulation.GetResourceManager();
+  int start_year = simulation.GetParam()->Get<SimParam>()->start_year;
+
+  auto* env = new CategoricalEnvironment(15, 40, 1, 4, 1);
+  simulation.SetEnvironment(env);
+
+  // Add couples in reverse location order
+  for (int loc = 3; loc >= 0; loc--) {
+    auto* male = new Person();
+    male->sex_ = Sex::kMale;
+    male->SetAge(20, start_year);
+    male->location_ = loc;
+    male->social_behaviour_factor_ = 0;
+    auto* female = new Person();
+    female->sex_ = Sex::kFemale;
+    female->SetAge(20, start_year);
+    female->location_ = loc;
+    female->social_behaviour_factor_ = 0;
+    rm->AddAgent(male);
+    rm->AddAgent(female);
+    male->SetPartner(female->GetAgentPtr<Person>());
+  }
+
+  SortAgents sort_agents;
+  sort_agents();
+
+  std::vector<int> locations;
+  rm->ForEachAgent([&](Agent* agent) {
+    auto* person = bdm_static_cast<Person*>(agent);
+    locations.push_back(person->location_);
+    ASSERT_TRUE(person->partner_ != nullptr);
+    EXPECT_EQ(person->partner_->partner_.Get(), person);
+    EXPECT_EQ(person->partner_->location_, person->location_);
+  });
+  EXPECT_EQ(locations.size(), 8u);
+  EXPECT_TRUE(std::is_sorted(locations.begin(), locations.end()));
+}
+
+// Test that the updates of agents of other districts are deferred until
+// ApplyRemoteDistrictUpdates in district-partitioned execution
+TEST(EnvironmentTest, RemoteDistrictUpdates) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME);
+  auto* rm = simulation.GetResourceManager();
+  int start_year = simulation.GetParam()->Get<SimParam>()->start_year;
+
+  auto* env = new CategoricalEnvironment(15, 40, 1, 2, 1);
+  simulation.SetEnvironment(env);
+
+  // A mother in district 0 with an adult child and a young child, and a woman
+  // in district 1
+  auto* mother = new Person();
+  mother->sex_ = Sex::kFemale;
+  mother->SetAge(50, start_year);
+  mother->location_ = 0;
+  auto* adult_child = new Person();
+  adult_child->sex_ = Sex::kMale;
+  adult_child->SetAge(20, start_year);
+  adult_child->location_ = 1;
+  auto* young_child = new Person();
+  young_child->sex_ = Sex::kMale;
+  young_child->SetAge(5, start_year);
+  young_child->location_ = 0;
+  auto* woman = new Person();
+  woman->sex_ = Sex::kFemale;
+  woman->SetAge(20, start_year);
+  woman->location_ = 1;
+  woman->state_ = GemsState::kHealthy;
+  for (auto* person : {mother, adult_child, young_child, woman}) {
+    rm->AddAgent(person);
+  }
+  for (auto* child : {adult_child, young_child}) {
+    mother->AddChild(child->GetAgentPtr<Person>());
+    child->mother_ = mother->GetAgentPtr<Person>();
+  }
+
+  // Outside of district-partitioned execution, nothing is deferred
+  EXPECT_FALSE(env->IsRemoteDistrict(1));
+  env->UnlinkRemoteRelatives(mother, start_year);
+  EXPECT_EQ(mother->GetNumberOfChildren(), 2);
+
+  env->SetExecutingDistrict(0);
+  EXPECT_FALSE(env->IsRemoteDistrict(0));
+  EXPECT_TRUE(env->IsRemoteDistrict(1));
+  env->AddRemoteCasualContact(woman->GetAgentPtr<Person>(), 1, true,
+                              GemsState::kAcute, 2);
+  env->UnlinkRemoteRelatives(mother, start_year);
+  env->ClearExecutingDistricts();
+  EXPECT_FALSE(env->IsRemoteDistrict(1));
+
+  // Only the adult child is unlinked on the side of the mother
+  ASSERT_EQ(mother->GetNumberOfChildren(), 1);
+  EXPECT_EQ(mother->children_[0].Get(), young_child);
+  EXPECT_EQ(adult_child->mother_.Get(), mother);
+  EXPECT_EQ(woman->no_casual_partners_, 0);
+  EXPECT_EQ(woman->state_, GemsState::kHealthy);
+
+  env->ApplyRemoteDistrictUpdates();
+  EXPECT_TRUE(adult_child->mother_ == nullptr);
+  EXPECT_EQ(woman->no_casual_partners_, 1);
+  EXPECT_EQ(woman->state_, GemsState::kAcute);
+  EXPECT_EQ(woman->transmission_type_, TransmissionType::kCasualPartner);
+  EXPECT_EQ(woman->infection_origin_state_, GemsState::kAcute);
+  EXPECT_EQ(woman->infection_origin_sb_, 2);
+}
+
+// Test that the district pyramid counts persons by location, sex, 5-year age
+// band and HIV state, and skips persons with attributes out of range
+TEST(EnvironmentTest, DistrictPyramid) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME);
+  auto* env = new CategoricalEnvironment(15, 40, 1, 3, 1);
+  simulation.SetEnvironment(env);
+
+  std::vector<Person*> persons(6);
+  for (auto*& person : persons) {
+    person = new Person();
+    person->sex_ = Sex::kFemale;
+    person->location_ = 2;
+    person->state_ = GemsState::kChronic;
+    simulation.GetResourceManager()->AddAgent(person);
+  }
+  persons[1]->sex_ = Sex::kMale;
+  persons[2]->state_ = GemsState::kHealthy;
+  persons[3]->location_ = 3;
+  persons[4]->state_ = GemsState::kGemsLast;
+  int ages[6] = {22, 22, 24, 22, 22, 97};
+
+  env->ClearDistrictPyramid();
+  for (size_t i = 0; i < persons.size(); i++) {
+    env->AddToDistrictPyramid(persons[i], ages[i]);
+  }
+  env->MergeDistrictPyramid();
+
+  const auto& pyramid = env->GetDistrictPyramid();
+  int no_age_bands = CategoricalEnvironment::kNoPyramidAgeBands;
+  ASSERT_EQ(pyramid.size(), 3u * 2 * no_age_bands * GemsState::kGemsLast);
+  uint64_t total = 0;
+  for (auto count : pyramid) {
+    total += count;
+  }
+  EXPECT_EQ(total, 4u);
+  EXPECT_EQ(pyramid[env->ComputePyramidIndex(2, Sex::kFemale, 4,
+                                             GemsState::kChronic)],
+            1u);
+  EXPECT_EQ(pyramid[env->ComputePyramidIndex(2, Sex::kMale, 4,
+                                             GemsState::kChronic)],
+            1u);
+  EXPECT_EQ(pyramid[env->ComputePyramidIndex(2, Sex::kFemale, 4,
+                                             GemsState::kHealthy)],
+            1u);
+  EXPECT_EQ(pyramid[env->ComputePyramidIndex(2, Sex::kFemale, no_age_bands - 1,
+                                             GemsState::kChronic)],
+            1u);
+}
+
+// Test that the bulk allocation of casual partners allocates all partners of a
+// man, and that the mean number of partners per female category matches the
+// probability of the category (see GetMateCompoundCategoryDistribution)
+TEST(EnvironmentTest, CasualPartnerCounts) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  Simulation simulation(TEST_NAME, [](Param* param) {
+    SetSmallSimulationParam(param);
+    param->Get<SimParam>()->bulk_casual_partner_allocation = true;
+  });
+  SetUpSimulation(&simulation, nullptr);
+  simulation.GetScheduler()->Simulate(1);
+  auto* env =
+      bdm_static_cast<CategoricalEnvironment*>(simulation.GetEnvironment());
+  const auto* sparam = simulation.GetParam()->Get<SimParam>();
+  int year = sparam->start_year + 1;
+
+  // Category of a man in the age range of the casual partnerships
+  Person* man = nullptr;
+  simulation.GetResourceManager()->ForEachAgent([&](Agent* agent) {
+    auto* person = bdm_static_cast<Person*>(agent);
+    int age = person->GetAge(year);
+    if (man == nullptr && person->IsMale() && age >= env->GetMinAge() &&
+        age < env->GetMaxAge()) {
+      man = person;
+    }
+  });
+  ASSERT_TRUE(man != nullptr);
+  size_t age_category = man->GetAgeCategory(year, env->GetMinAge(),
+                                            env->GetNoAgeCategories());
+  size_t male_category = env->ComputeCompoundIndex(
+      man->location_, age_category, man->social_behaviour_factor_);
+  const auto& distribution = env->GetMateCompoundCategoryDistribution(
+      man->location_, age_category, man->social_behaviour_factor_);
+
+  // Mean number of partners per female category over no_draws draws
+  const uint64_t no_mates = 1000;
+  const int no_draws = 2000;
+  std::vector<double> mean(distribution.size(), 0.0);
+  int no_wrong_totals = 0;
+  for (int d = 0; d < no_draws; d++) {
+    const auto& counts = env->SampleCasualPartnerCounts(
+        male_category, no_mates, simulation.GetRandom());
+    uint64_t total = 0;
+    for (const auto& el : counts) {
+      mean[el.first] += static_cast<double>(el.second) / no_draws;
+      total += el.second;
+    }
+    if (total != no_mates) {
+      no_wrong_totals++;
+    }
+  }
+  EXPECT_EQ(no_wrong_totals, 0);
+
+  // The counts of a category are binomial; allow 5 standard deviations of the
+  // mean, and the rounding of the float probabilities
+  for (size_t j = 0; j < distribution.size(); j++) {
+    double probability = distribution[j] - (j > 0 ? distribution[j - 1] : 0);
+    double sigma = std::sqrt(no_mates * probability * (1 - probability) /
+                             no_draws);
+    EXPECT_NEAR(mean[j], no_mates * probability, 5 * sigma + 0.01);
+  }
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,113 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include "biodynamo.h"
+#include "fast-bernoulli.h"
+#include "sim-param.h"
+#include "small-simulation.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test the conversion of probabilities to integer thresholds
+TEST(FastBernoulliTest, Thresholds) {
+  EXPECT_EQ(ToBernoulliThreshold(0.0), 0u);
+  EXPECT_EQ(ToBernoulliThreshold(-0.5), 0u);
+  EXPECT_EQ(ToBernoulliThreshold(1.0), BernoulliThreshold{1} << 32);
+  EXPECT_EQ(ToBernoulliThreshold(1.5), BernoulliThreshold{1} << 32);
+  for (double p : {1e-6, 0.188, 0.5, 0.95}) {
+    EXPECT_NEAR(static_cast<double>(ToBernoulliThreshold(p)),
+                p * 4294967296.0, 1.0);
+  }
+
+  // Probability 0 never fires and probability 1 always fires
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME);
+  auto* buffer = UniformBuffer::GetThreadLocal();
+  for (size_t i = 0; i < 3 * UniformBuffer::kSize; i++) {
+    ASSERT_FALSE(buffer->Bernoulli(ToBernoulliThreshold(0.0)));
+    ASSERT_TRUE(buffer->Bernoulli(ToBernoulliThreshold(1.0)));
+  }
+}
+
+// Test that the fast Bernoulli draws have the same distribution as the
+// comparisons with BioDynaMo's uniform random numbers
+TEST(FastBernoulliTest, Distribution) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME);
+  auto* random = simulation.GetRandom();
+  auto* buffer = UniformBuffer::GetThreadLocal();
+  const int no_draws = 1000000;
+
+  for (double p : {0.01, 0.188, 0.5, 0.95}) {
+    auto threshold = ToBernoulliThreshold(p);
+    int fast_successes = 0;
+    int uniform_successes = 0;
+    for (int i = 0; i < no_draws; i++) {
+      fast_successes += buffer->Bernoulli(threshold);
+      uniform_successes += random->Uniform() < p;
+    }
+    // Both frequencies are within 5 standard deviations of p, and the
+    // difference between them within 5 standard deviations of the difference
+    double sigma = std::sqrt(p * (1 - p) / no_draws);
+    double fast_frequency = static_cast<double>(fast_successes) / no_draws;
+    double uniform_frequency =
+        static_cast<double>(uniform_successes) / no_draws;
+    EXPECT_NEAR(fast_frequency, p, 5 * sigma);
+    EXPECT_NEAR(uniform_frequency, p, 5 * sigma);
+    EXPECT_NEAR(fast_frequency, uniform_frequency, 5 * std::sqrt(2) * sigma);
+  }
+
+  // Chi-square test of the independence of consecutive draws: the outcomes
+  // of four consecutive draws with p = 0.5 form 16 equally likely patterns
+  const int no_patterns = 16;
+  const int no_groups = no_draws / 4;
+  std::vector<int> counts(no_patterns, 0);
+  auto half = ToBernoulliThreshold(0.5);
+  for (int i = 0; i < no_groups; i++) {
+    int pattern = 0;
+    for (int j = 0; j < 4; j++) {
+      pattern = 2 * pattern + buffer->Bernoulli(half);
+    }
+    counts[pattern]++;
+  }
+  double expected = static_cast<double>(no_groups) / no_patterns;
+  double chi_square = 0;
+  for (int count : counts) {
+    chi_square += (count - expected) * (count - expected) / expected;
+  }
+  // Critical value of the chi-square distribution with 15 degrees of freedom
+  // at significance level 0.001
+  EXPECT_LT(chi_square, 37.70);
+}
+
+// Test that back-to-back simulations with the same seed draw the same fast
+// Bernoulli integers, instead of those left over from the previous simulation
+TEST(FastBernoulliTest, BackToBackSimulations) {
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  SingleThread single_thread;
+  auto set_param = [](Param* param) {
+    param->Get<SimParam>()->fast_bernoulli = true;
+  };
+  auto first = SimulateSmallPopulation(TEST_NAME, 10, set_param);
+  auto second = SimulateSmallPopulation(TEST_NAME, 10, set_param);
+  ASSERT_FALSE(first.empty());
+  EXPECT_EQ(first, second);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -0,0 +1,234 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include "biodynamo.h"
+#include "categorical-environment.h"
+#include "person.h"
+#include "population-import.h"
+#include "sim-param.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test the parsing of CSV lines with columns in any order and optional columns
+TEST(ImportTest, ParseCsvLine) {
+  auto columns = SyntheticPopulationReader::GetCsvColumns(
+      "location, age,id,sex,household,mother_id", "the test header");
+  SyntheticPerson person;
+  ASSERT_TRUE(SyntheticPopulationReader::ParseCsvLine("3,12,7,1,99,4",
+                                                      columns, &person));
+  EXPECT_EQ(person.id, 7);
+  EXPECT_EQ(person.sex, Sex::kFemale);
+  EXPECT_EQ(person.age, 12);
+  EXPECT_EQ(person.location, 3);
+  EXPECT_EQ(person.state, GemsState::kHealthy);
+  EXPECT_EQ(person.partner_id, -1);
+  EXPECT_EQ(person.mother_id, 4);
+
+  EXPECT_FALSE(SyntheticPopulationReader::ParseCsvLine("3,12,7,1,99",
+                                                       columns, &person));
+  EXPECT_FALSE(SyntheticPopulationReader::ParseCsvLine("3,12,x,1,99,4",
+                                                       columns, &person));
+}
+
+// Test that an imported population has the attributes and the partner /
+// mother / child links of the file
+TEST(ImportTest, ImportCsv) {
+  const std::string filename = "import_test.csv";
+  {
+    std::ofstream file(filename);
+    file << "id,sex,age,location,state,partner_id,mother_id\n"
+         << "10,0,30,1,2,11,-1\n"
+         << "11,1,28,1,0,-1,-1\n"
+         << "\n"
+         << "12,1,3,1,0,-1,11\n";
+  }
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  Simulation simulation(TEST_NAME);
+  auto* rm = simulation.GetResourceManager();
+  int year = simulation.GetParam()->Get<SimParam>()->start_year;
+  simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+  ImportSyntheticPopulation(filename, year);
+  std::remove(filename.c_str());
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  ASSERT_EQ(persons.size(), 3u);
+  auto* man = persons[0];
+  auto* woman = persons[1];
+  auto* child = persons[2];
+  EXPECT_EQ(man->sex_, Sex::kMale);
+  EXPECT_EQ(man->GetAge(year), 30);
+  EXPECT_EQ(man->location_, 1);
+  EXPECT_EQ(man->state_, GemsState::kChronic);
+  EXPECT_EQ(man->transmission_type_, TransmissionType::kCasualPartner);
+  // Only the man names his partner, the partnership is symmetric
+  EXPECT_EQ(man->partner_.Get(), woman);
+  EXPECT_EQ(woman->partner_.Get(), man);
+  EXPECT_EQ(child->mother_.Get(), woman);
+  ASSERT_EQ(woman->GetNumberOfChildren(), 1);
+  EXPECT_EQ(woman->children_[0].Get(), child);
+  EXPECT_EQ(man->GetNumberOfChildren(), 0);
+}
+
+// Test that partner links between persons who cannot be partners, and mother
+// links to persons who cannot be the mother, are dropped
+TEST(ImportTest, InvalidLinks) {
+  const std::string filename = "import_invalid_test.csv";
+  {
+    std::ofstream file(filename);
+    file << "id,sex,age,location,partner_id,mother_id\n"
+         // Two men
+         << "1,0,30,1,2,-1\n"
+         << "2,0,31,1,-1,-1\n"
+         // A woman and a boy
+         << "3,1,25,1,4,-1\n"
+         << "4,0,12,1,-1,3\n"
+         // A child whose mother is a man, and one older than its mother
+         << "5,0,2,1,-1,1\n"
+         << "6,1,40,1,-1,3\n";
+  }
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  Simulation simulation(TEST_NAME);
+  auto* rm = simulation.GetResourceManager();
+  int year = simulation.GetParam()->Get<SimParam>()->start_year;
+  simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+  ImportSyntheticPopulation(filename, year);
+  std::remove(filename.c_str());
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  ASSERT_EQ(persons.size(), 6u);
+  for (auto* person : persons) {
+    EXPECT_EQ(person->partner_.Get(), nullptr);
+  }
+  // Only the valid mother link of the boy is kept
+  EXPECT_EQ(persons[3]->mother_.Get(), persons[2]);
+  ASSERT_EQ(persons[2]->GetNumberOfChildren(), 1);
+  EXPECT_EQ(persons[2]->children_[0].Get(), persons[3]);
+  EXPECT_EQ(persons[4]->mother_.Get(), nullptr);
+  EXPECT_EQ(persons[5]->mother_.Get(), nullptr);
+  EXPECT_EQ(persons[0]->GetNumberOfChildren(), 0);
+}
+
+// Test that children under 15 are moved to the location of their mother, and
+// that adult children keep their own location
+TEST(ImportTest, ChildrenLiveWithMother) {
+  const std::string filename = "import_children_test.csv";
+  {
+    std::ofstream file(filename);
+    file << "id,sex,age,location,mother_id\n"
+         << "1,1,40,1,-1\n"
+         << "2,0,10,0,1\n"
+         << "3,1,20,0,1\n";
+  }
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  Simulation simulation(TEST_NAME);
+  auto* rm = simulation.GetResourceManager();
+  int year = simulation.GetParam()->Get<SimParam>()->start_year;
+  simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+  ImportSyntheticPopulation(filename, year);
+  std::remove(filename.c_str());
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  ASSERT_EQ(persons.size(), 3u);
+  EXPECT_EQ(persons[1]->mother_.Get(), persons[0]);
+  EXPECT_EQ(persons[1]->location_, 1);
+  EXPECT_EQ(persons[2]->mother_.Get(), persons[0]);
+  EXPECT_EQ(persons[2]->location_, 0);
+  EXPECT_EQ(persons[0]->GetNumberOfChildren(), 2);
+}
+
+// Test that the binary format reads the persons that were written, across
+// several chunks, and that their links are imported
+TEST(ImportTest, BinaryRoundTrip) {
+  const std::string filename = "import_test.bin";
+  std::vector<SyntheticPerson> written;
+  for (int i = 0; i < 5; i++) {
+    SyntheticPerson person;
+    person.id = 100 + i;
+    person.partner_id = -1;
+    person.mother_id = -1;
+    person.sex = i % 2 == 0 ? Sex::kMale : Sex::kFemale;
+    person.age = 20 + i;
+    person.location = i % 2;
+    person.state = i == 3 ? GemsState::kChronic : GemsState::kHealthy;
+    person.social_behaviour_factor = i % 2;
+    person.biomedical_factor = 1;
+    written.push_back(person);
+  }
+  written[0].partner_id = 101;
+  written[4].mother_id = 101;
+  written[4].age = 1;
+  ASSERT_TRUE(SaveSyntheticPopulation(written, filename));
+
+  std::vector<SyntheticPerson> read;
+  {
+    SyntheticPopulationReader reader(filename);
+    std::vector<SyntheticPerson> chunk;
+    while (reader.ReadChunk(&chunk, 2)) {
+      read.insert(read.end(), chunk.begin(), chunk.end());
+    }
+  }
+  ASSERT_EQ(read.size(), written.size());
+  for (size_t i = 0; i < read.size(); i++) {
+    EXPECT_EQ(read[i].id, written[i].id);
+    EXPECT_EQ(read[i].partner_id, written[i].partner_id);
+    EXPECT_EQ(read[i].mother_id, written[i].mother_id);
+    EXPECT_EQ(read[i].sex, written[i].sex);
+    EXPECT_EQ(read[i].age, written[i].age);
+    EXPECT_EQ(read[i].location, written[i].location);
+    EXPECT_EQ(read[i].state, written[i].state);
+    EXPECT_EQ(read[i].social_behaviour_factor,
+              written[i].social_behaviour_factor);
+    EXPECT_EQ(read[i].biomedical_factor, written[i].biomedical_factor);
+  }
+
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  Simulation simulation(TEST_NAME);
+  auto* rm = simulation.GetResourceManager();
+  int year = simulation.GetParam()->Get<SimParam>()->start_year;
+  simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+  ImportSyntheticPopulation(filename, year);
+  std::remove(filename.c_str());
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  ASSERT_EQ(persons.size(), 5u);
+  EXPECT_EQ(persons[3]->state_, GemsState::kChronic);
+  EXPECT_EQ(persons[3]->GetAge(year), 23);
+  EXPECT_EQ(persons[0]->partner_.Get(), persons[1]);
+  EXPECT_EQ(persons[1]->partner_.Get(), persons[0]);
+  EXPECT_EQ(persons[4]->mother_.Get(), persons[1]);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
@@ -65,6 +65,24 @@ TEST(InitializationTest, SampleSex) {
   EXPECT_LT(abs(probability_male - probability_male_measured), 0.01);
 }
 
+// Test that SampleCellCounts distributes exactly n persons and deviates from
+// the expected counts by less than one person per cell
+TEST(InitializationTest, SampleCellCounts) {
+  const uint64_t n = 100003;
+  const std::vector<double> probabilities{0.1, 0.25, 0.05, 0.3, 0.2, 0.1};
+  std::mt19937_64 generator(42);
+  for (int repetition = 0; repetition < 100; repetition++) {
+    auto counts = SampleCellCounts(n, probabilities, &generator);
+    ASSERT_EQ(counts.size(), probabilities.size());
+    EXPECT_EQ(std::accumulate(counts.begin(), counts.end(), uint64_t{0}), n);
+    for (size_t i = 0; i < counts.size(); i++) {
+      double expected = n * probabilities[i];
+      EXPECT_GE(counts[i], static_cast<uint64_t>(expected));
+      EXPECT_LT(counts[i] - expected, probabilities.size());
+    }
+  }
+}
+
 }  // namespace hiv_malawi
 
 }  // namespace bdm
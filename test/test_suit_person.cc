@@ -18,17 +18,24 @@
 namespace bdm {
 namespace hiv_malawi {
 
-// Test the person class for the age_ attribute
+// Test the person class for the birth_year_ attribute
 TEST(PersonTest, Age) {
   Simulation simulation(TEST_NAME);
   auto person = Person();
 
   // Age
-  person.age_ = 1;
-  EXPECT_DOUBLE_EQ(person.age_, 1);
-  EXPECT_FALSE(person.IsAdult());
-  person.age_ = 16;
-  EXPECT_TRUE(person.IsAdult());
+  person.SetAge(1, 2000);
+  EXPECT_EQ(person.birth_year_, 1999);
+  EXPECT_EQ(person.GetAge(2000), 1);
+  EXPECT_FALSE(person.IsAdult(2000));
+  // Age follows from the year, without updating the person
+  EXPECT_EQ(person.GetAge(2015), 16);
+  EXPECT_TRUE(person.IsAdult(2015));
+  // Age categories
+  EXPECT_EQ(person.GetAgeCategory(2015, 15, 12), 0);
+  EXPECT_EQ(person.GetAgeCategory(2021, 15, 12), 1);
+  EXPECT_EQ(person.GetAgeCategory(2024, 15, 12), 2);
+  EXPECT_EQ(person.GetAgeCategory(2100, 15, 12), 11);
 }
 
 // Test the person class for the sex_ attribute
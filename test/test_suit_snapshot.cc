@@ -0,0 +1,120 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <vector>
+#include "biodynamo.h"
+#include "categorical-environment.h"
+#include "person.h"
+#include "population-snapshot.h"
+#include "sim-param.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test that a population restored from a snapshot has the same attributes and
+// the same mother / child / partner links as the saved population
+TEST(SnapshotTest, SaveAndLoad) {
+  const std::string filename = "snapshot_test.bin";
+  Param::RegisterParamGroup(new SimParam());
+  gAgentPointerMode = AgentPointerMode::kDirect;
+  int start_year;
+  {
+    Simulation simulation(TEST_NAME);
+    auto* rm = simulation.GetResourceManager();
+    start_year = simulation.GetParam()->Get<SimParam>()->start_year;
+    simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+
+    // A couple with two children, and a single infected woman
+    auto* father = new Person();
+    father->sex_ = Sex::kMale;
+    father->SetAge(40, start_year);
+    father->location_ = 1;
+    father->state_ = GemsState::kHealthy;
+    auto* mother = new Person();
+    mother->sex_ = Sex::kFemale;
+    mother->SetAge(35, start_year);
+    mother->location_ = 1;
+    mother->state_ = GemsState::kChronic;
+    mother->social_behaviour_factor_ = 1;
+    auto* woman = new Person();
+    woman->sex_ = Sex::kFemale;
+    woman->SetAge(22, start_year);
+    woman->location_ = 0;
+    woman->state_ = GemsState::kAcute;
+    woman->transmission_type_ = TransmissionType::kCasualPartner;
+    woman->no_casual_partners_ = 3;
+    std::vector<Person*> children;
+    for (int age : {3, 10}) {
+      auto* child = new Person();
+      child->sex_ = Sex::kMale;
+      child->SetAge(age, start_year);
+      child->location_ = 1;
+      child->state_ = GemsState::kHealthy;
+      children.push_back(child);
+    }
+    for (auto* person : {father, mother, woman, children[0], children[1]}) {
+      rm->AddAgent(person);
+    }
+    father->SetPartner(mother->GetAgentPtr<Person>());
+    for (auto* child : children) {
+      mother->AddChild(child->GetAgentPtr<Person>());
+      child->mother_ = mother->GetAgentPtr<Person>();
+    }
+
+    ASSERT_TRUE(SavePopulationSnapshot(filename, start_year));
+  }
+
+  Simulation simulation(TEST_NAME);
+  auto* rm = simulation.GetResourceManager();
+  simulation.SetEnvironment(new CategoricalEnvironment(15, 40, 1, 2, 1));
+  LoadPopulationSnapshot(filename, start_year);
+  std::remove(filename.c_str());
+
+  std::vector<Person*> persons;
+  rm->ForEachAgent([&](Agent* agent) {
+    persons.push_back(bdm_static_cast<Person*>(agent));
+  });
+  ASSERT_EQ(persons.size(), 5u);
+  auto* father = persons[0];
+  auto* mother = persons[1];
+  auto* woman = persons[2];
+  EXPECT_EQ(father->GetAge(start_year), 40);
+  EXPECT_EQ(father->location_, 1);
+  EXPECT_EQ(mother->state_, GemsState::kChronic);
+  EXPECT_EQ(mother->social_behaviour_factor_, 1);
+  EXPECT_EQ(woman->state_, GemsState::kAcute);
+  EXPECT_EQ(woman->transmission_type_, TransmissionType::kCasualPartner);
+  EXPECT_EQ(woman->no_casual_partners_, 3);
+  EXPECT_EQ(woman->location_, 0);
+
+  EXPECT_EQ(father->partner_.Get(), mother);
+  EXPECT_EQ(mother->partner_.Get(), father);
+  EXPECT_FALSE(woman->hasPartner());
+  EXPECT_TRUE(woman->mother_ == nullptr);
+  ASSERT_EQ(mother->GetNumberOfChildren(), 2);
+  EXPECT_EQ(mother->children_[0].Get(), persons[3]);
+  EXPECT_EQ(mother->children_[1].Get(), persons[4]);
+  EXPECT_EQ(persons[3]->GetAge(start_year), 3);
+  EXPECT_EQ(persons[4]->GetAge(start_year), 10);
+  for (size_t i = 3; i < 5; i++) {
+    EXPECT_EQ(persons[i]->mother_.Get(), mother);
+  }
+  // Persons restored from a snapshot have their behaviours
+  EXPECT_GT(father->GetAllBehaviors().size(), 0u);
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
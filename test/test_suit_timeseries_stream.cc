@@ -0,0 +1,74 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "biodynamo.h"
+#include "timeseries-stream.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test that the streamed values are read back in blocks, that an incomplete
+// block at the end is ignored, and that the CSV mirror has one line per
+// iteration
+TEST(TimeSeriesStreamTest, WriteAndRead) {
+  const std::string filename = "timeseries_stream_test.bin";
+  const std::string csv_filename = "timeseries_stream_test.csv";
+  {
+    TimeSeriesStreamWriter writer(filename, csv_filename, {"a", "bb"}, 2);
+    for (int i = 0; i < 5; i++) {
+      writer.Append(1990 + i, {1.0 * i, 0.5 - i});
+    }
+  }
+  {
+    // Block of a crashed simulation: number of iterations only
+    std::ofstream file(filename, std::ios::binary | std::ios::app);
+    uint64_t no_rows = 2;
+    file.write(reinterpret_cast<const char*>(&no_rows), sizeof(uint64_t));
+  }
+
+  experimental::TimeSeries ts;
+  ASSERT_EQ(ReadTimeSeriesStream(filename, &ts), 5u);
+  const auto& x_values = ts.GetXValues("bb");
+  const auto& a_values = ts.GetYValues("a");
+  const auto& b_values = ts.GetYValues("bb");
+  ASSERT_EQ(x_values.size(), 5u);
+  ASSERT_EQ(a_values.size(), 5u);
+  ASSERT_EQ(b_values.size(), 5u);
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(x_values[i], 1990 + i);
+    EXPECT_EQ(a_values[i], 1.0 * i);
+    EXPECT_EQ(b_values[i], 0.5 - i);
+  }
+
+  std::ifstream csv_file(csv_filename);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(csv_file, line)) {
+    lines.push_back(line);
+  }
+  ASSERT_EQ(lines.size(), 6u);
+  EXPECT_EQ(lines[0], "year,a,bb");
+  EXPECT_EQ(lines[1], "1990,0,0.5");
+
+  std::remove(filename.c_str());
+  std::remove(csv_filename.c_str());
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
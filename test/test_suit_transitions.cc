@@ -38,12 +38,13 @@ TEST(TransitionTest, FemaleToMale) {
   // Create simulation object
   Simulation simulation(TEST_NAME, set_param);
   auto* rm = simulation.GetResourceManager();
+  int start_year = simulation.GetParam()->Get<SimParam>()->start_year;
 
   // Add a healthy male to the simulation
   auto male = new Person();
   male->state_ = GemsState::kHealthy;
   male->sex_ = Sex::kMale;
-  male->age_ = 20;
+  male->SetAge(20, start_year);
   male->location_ = 0;
   male->biomedical_factor_ = 0;
   male->social_behaviour_factor_ = 0;
@@ -55,7 +56,7 @@ TEST(TransitionTest, FemaleToMale) {
   auto female = new Person();
   female->state_ = GemsState::kAcute;
   female->sex_ = Sex::kFemale;
-  female->age_ = 20;
+  female->SetAge(20, start_year);
   female->location_ = 0;
   female->biomedical_factor_ = 0;
   female->social_behaviour_factor_ = 0;
@@ -90,12 +91,13 @@ TEST(TransitionTest, MaleToFemale) {
   // Create simulation object
   Simulation simulation(TEST_NAME, set_param);
   auto* rm = simulation.GetResourceManager();
+  int start_year = simulation.GetParam()->Get<SimParam>()->start_year;
 
   // Add a healthy female to the simulation
   auto female = new Person();
   female->state_ = GemsState::kHealthy;
   female->sex_ = Sex::kFemale;
-  female->age_ = 20;
+  female->SetAge(20, start_year);
   female->location_ = 0;
   female->biomedical_factor_ = 0;
   female->social_behaviour_factor_ = 0;
@@ -107,7 +109,7 @@ TEST(TransitionTest, MaleToFemale) {
   auto male = new Person();
   male->state_ = GemsState::kAcute;
   male->sex_ = Sex::kMale;
-  male->age_ = 20;
+  male->SetAge(20, start_year);
   male->location_ = 0;
   male->biomedical_factor_ = 0;
   male->social_behaviour_factor_ = 0;
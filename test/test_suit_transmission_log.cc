@@ -0,0 +1,105 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "biodynamo.h"
+#include "transmission-log.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+namespace hiv_malawi {
+
+// Test that the events appended by several threads, more than fit in the
+// buffers, are read back unchanged, including unknown infectors and years
+// that decrease within a block
+TEST(TransmissionLogTest, WriteAndRead) {
+  Simulation simulation(TEST_NAME);
+  const std::string filename = "transmission_log_test.bin";
+  const uint64_t no_events = 100000;
+
+  auto make_event = [](uint64_t i) {
+    TransmissionEvent event;
+    event.infected = i;
+    event.infector = i % 7 == 0 ? kUnknownInfector : i * 1000003;
+    event.year = 1975 + static_cast<int32_t>(i % 60);
+    event.location = static_cast<int32_t>(i % 28);
+    event.sex = static_cast<int32_t>(i % 2);
+    event.age = static_cast<int32_t>(i % 120);
+    event.transmission_type = static_cast<int32_t>(i % 5);
+    event.infector_state = i % 7 == 0 ? -1 : static_cast<int32_t>(i % 6);
+    event.infector_sb = static_cast<int32_t>(i % 2);
+    return event;
+  };
+
+  auto* log = TransmissionLog::GetInstance();
+  log->Open(filename);
+  EXPECT_TRUE(TransmissionLog::IsEnabled());
+#pragma omp parallel for
+  for (uint64_t i = 0; i < no_events; i++) {
+    log->Append(make_event(i));
+  }
+  log->Close();
+  EXPECT_FALSE(TransmissionLog::IsEnabled());
+
+  auto events = ReadTransmissionLog(filename);
+  ASSERT_EQ(events.size(), no_events);
+  std::sort(events.begin(), events.end(),
+            [](const TransmissionEvent& a, const TransmissionEvent& b) {
+              return a.infected < b.infected;
+            });
+  for (uint64_t i = 0; i < no_events; i++) {
+    auto expected = make_event(i);
+    const auto& event = events[i];
+    ASSERT_EQ(event.infected, expected.infected);
+    EXPECT_EQ(event.infector, expected.infector);
+    EXPECT_EQ(event.year, expected.year);
+    EXPECT_EQ(event.location, expected.location);
+    EXPECT_EQ(event.sex, expected.sex);
+    EXPECT_EQ(event.age, expected.age);
+    EXPECT_EQ(event.transmission_type, expected.transmission_type);
+    EXPECT_EQ(event.infector_state, expected.infector_state);
+    EXPECT_EQ(event.infector_sb, expected.infector_sb);
+  }
+  std::remove(filename.c_str());
+}
+
+// Test that an incomplete block at the end of the log is ignored
+TEST(TransmissionLogTest, TruncatedBlock) {
+  Simulation simulation(TEST_NAME);
+  const std::string filename = "transmission_log_truncated.bin";
+  auto* log = TransmissionLog::GetInstance();
+  log->Open(filename);
+  TransmissionEvent event = {1, 2, 1990, 3, 0, 25, 0, 1, 1};
+  log->Append(event);
+  log->Close();
+  {
+    auto block = TransmissionLog::EncodeBlock({event, event});
+    std::ofstream file(filename, std::ios::binary | std::ios::app);
+    file.write(block.data(), block.size() - 1);
+  }
+
+  auto events = ReadTransmissionLog(filename);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].infected, 1u);
+  EXPECT_EQ(events[0].infector, 2u);
+  EXPECT_EQ(events[0].age, 25);
+  std::remove(filename.c_str());
+}
+
+}  // namespace hiv_malawi
+}  // namespace bdm
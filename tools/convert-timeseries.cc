@@ -0,0 +1,29 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+// Converts a time series stream written with stream_time_series to the JSON
+// file written at the end of the simulation:
+//   hiv_malawi-convert <output dir>/timeseries.bin <output dir>/data.json
+
+#include <iostream>
+
+#include "timeseries-stream.h"
+
+int main(int argc, const char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <timeseries.bin> <data.json>"
+              << std::endl;
+    return 1;
+  }
+  bdm::hiv_malawi::ConvertTimeSeriesStream(argv[1], argv[2]);
+  return 0;
+}
@@ -0,0 +1,54 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2022 CERN and the University of Geneva for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+//
+// -----------------------------------------------------------------------------
+
+// Renders the plots of a simulation from its data.json, or from its time
+// series stream (see stream_time_series), e.g. of a batch run with
+// plot_time_series disabled:
+//   hiv_malawi-plot <output dir>/data.json <output dir>
+// Several runs can be rendered in parallel by running one process per run.
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "TBufferJSON.h"
+
+#include "biodynamo.h"
+#include "plot-timeseries.h"
+#include "timeseries-stream.h"
+
+int main(int argc, const char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <data.json> <output dir>"
+              << std::endl;
+    return 1;
+  }
+  std::string filename = argv[1];
+  auto ts = std::make_unique<bdm::experimental::TimeSeries>();
+  if (filename.size() >= 5 &&
+      filename.compare(filename.size() - 5, 5, ".json") == 0) {
+    // data.json is the ROOT JSON representation of the TimeSeries
+    std::ifstream file(filename);
+    std::stringstream json;
+    json << file.rdbuf();
+    if (!file.is_open() || !TBufferJSON::FromJSON(ts, json.str().c_str())) {
+      std::cerr << "Cannot read the time series in " << filename << std::endl;
+      return 1;
+    }
+  } else {
+    bdm::hiv_malawi::ReadTimeSeriesStream(filename, ts.get());
+  }
+  bdm::hiv_malawi::PlotTimeseries(ts.get(), argv[2]);
+  return 0;
+}